@@ -4,5 +4,21 @@
 
 #include "../src/protocol_agent.hpp"
 #include "../src/session.hpp"
+#include "../src/packet_buffer.hpp"
 #include "../src/radio_interface.hpp"
+#include "../src/timer_wheel.hpp"
+#include "../src/gateway.hpp"
 #include "../src/lora_interface.hpp"
+#include "../src/message_store.hpp"
+#include "../src/chat_history.hpp"
+#include "../src/load_test.hpp"
+#include "../src/metrics.hpp"
+#include "../src/hot_restart.hpp"
+#include "../src/frame_sizer.hpp"
+#include "../src/link_planner.hpp"
+#include "../src/header_compression.hpp"
+#include "../src/ip_tunnel.hpp"
+#include "../src/bulk_transfer.hpp"
+#include "../src/tdma.hpp"
+#include "../src/power_control.hpp"
+#include "../src/guard_times.hpp"
@@ -0,0 +1,200 @@
+#include "protocol_agent.hpp"
+#include "session.hpp"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "radio_interface.hpp"
+#include "sx1276/sx1276.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+// Every allocation in the process, including those made from inside libbcp and
+// libstdc++'s operator new, goes through these. They forward to glibc's own
+// allocator and, while armed, count what they see.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+
+std::atomic<bool> kCountAllocations{false};
+std::atomic<size_t> kAllocationCount{0};
+std::atomic<size_t> kLastAllocationSize{0};
+
+void NoteAllocation(size_t size) {
+  if (!kCountAllocations.load(std::memory_order_relaxed)) return;
+  kAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  kLastAllocationSize.store(size, std::memory_order_relaxed);
+}
+
+} // namespace
+
+extern "C" {
+void *malloc(size_t size) {
+  NoteAllocation(size);
+  return __libc_malloc(size);
+}
+void *calloc(size_t count, size_t size) {
+  NoteAllocation(count * size);
+  return __libc_calloc(count, size);
+}
+void *realloc(void *ptr, size_t size) {
+  NoteAllocation(size);
+  return __libc_realloc(ptr, size);
+}
+void *aligned_alloc(size_t alignment, size_t size) {
+  NoteAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+int posix_memalign(void **out, size_t alignment, size_t size) {
+  NoteAllocation(size);
+  *out = __libc_memalign(alignment, size);
+  return *out ? 0 : ENOMEM;
+}
+void free(void *ptr) { __libc_free(ptr); }
+}
+
+namespace {
+
+using namespace lora_chat::testutils;
+
+constexpr static TextTag kPingTag = {"PING"};
+constexpr static TextTag kPongTag = {"PONG"};
+constexpr static TextTag kPingerTag = {"Pinger"};
+constexpr static TextTag kPongerTag = {"Ponger"};
+
+/// Counts allocations from any thread between construction and Stop()
+class AllocationCounter {
+public:
+  AllocationCounter() {
+    kAllocationCount = 0;
+    kLastAllocationSize = 0;
+    kCountAllocations = true;
+  }
+  ~AllocationCounter() { Stop(); }
+
+  size_t Stop() {
+    kCountAllocations = false;
+    return kAllocationCount;
+  }
+
+  size_t LastSize() const { return kLastAllocationSize; }
+};
+
+TEST(Allocations, InterposerSeesAllocations) {
+  // Stored through a volatile so the compiler can't elide the pairs
+  static void *volatile sink;
+  AllocationCounter counter{};
+  sink = malloc(24);
+  free(sink);
+  sink = new int[4];
+  delete[] static_cast<int *>(sink);
+  EXPECT_EQ(counter.Stop(), 2u);
+}
+
+TEST(Allocations, SpiBursts) {
+  // Not a spidev, so every ioctl fails -- but the wrappers run the same code
+  // they would against a radio
+  int fd = open("/dev/null", O_RDWR);
+  ASSERT_GE(fd, 0);
+  std::array<uint8_t, SX127x_FIFO_CAPACITY> buffer{};
+
+  AllocationCounter counter{};
+  spi_write_burst(fd, sx1276::RegAddr::kFifo, buffer.data(), buffer.size());
+  spi_read_burst(fd, sx1276::RegAddr::kFifo, buffer.data(), buffer.size());
+  spi_write_byte(fd, sx1276::RegAddr::kOpMode, 0x89);
+  spi_read_byte(fd, sx1276::RegAddr::kOpMode);
+  EXPECT_EQ(counter.Stop(), 0u) << "last allocation was "
+                                << counter.LastSize() << " bytes";
+  close(fd);
+}
+
+TEST(Allocations, SessionSteadyState) {
+  using MessagePipe = lora_chat::MessagePipe;
+  using Session = lora_chat::Session;
+
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, ConsumeMessage<kPingerTag>};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, ConsumeMessage<kPongerTag>};
+  LocalRadio radio(std::chrono::milliseconds(8));
+
+  constexpr int kWarmupPeriods{2};
+  constexpr int kPeriods{8};
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+
+  std::thread ponger_thread([&]() {
+    std::this_thread::sleep_until(start_time);
+    for (int i = 0; i < 2 * (kWarmupPeriods + kPeriods); i++)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+
+  // Both sides run off the same clock, so the ponger is through its warm-up
+  // by the time the pinger is
+  std::this_thread::sleep_until(start_time);
+  for (int i = 0; i < 2 * kWarmupPeriods; i++)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+
+  AllocationCounter counter{};
+  for (int i = 0; i < 2 * kPeriods; i++)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  ponger_thread.join();
+  EXPECT_EQ(counter.Stop(), 0u) << "last allocation was "
+                                << counter.LastSize() << " bytes";
+}
+
+TEST(Allocations, ProtocolAgentSteadyState) {
+  using ProtocolAgent = lora_chat::ProtocolAgent;
+  using Goal = ProtocolAgent::ConnectionGoal;
+  using MessagePipe = lora_chat::MessagePipe;
+
+  LocalRadio radio{std::chrono::milliseconds(50)};
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, ConsumeMessage<kPingerTag>};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, ConsumeMessage<kPongerTag>};
+  ProtocolAgent agent_a{0, radio, ping_pipe};
+  ProtocolAgent agent_b{1, radio, pong_pipe};
+
+  agent_a.SetGoal(Goal::kAdvertiseConnection);
+  agent_b.SetGoal(Goal::kSeekConnection);
+
+  // Handshake (which logs, and so allocates), then the first session actions
+  // to warm up
+  constexpr int kWarmupActions{10};
+  constexpr int kActions{3};
+
+  std::thread seeker_thread([&]() {
+    for (int i = 0; i < kWarmupActions + kActions; i++)
+      agent_b.ExecuteAgentAction();
+  });
+  for (int i = 0; i < kWarmupActions; i++)
+    agent_a.ExecuteAgentAction();
+  EXPECT_TRUE(agent_a.InSession());
+
+  AllocationCounter counter{};
+  for (int i = 0; i < kActions; i++)
+    agent_a.ExecuteAgentAction();
+  seeker_thread.join();
+  EXPECT_EQ(counter.Stop(), 0u) << "last allocation was "
+                                << counter.LastSize() << " bytes";
+  EXPECT_TRUE(agent_a.InSession());
+  EXPECT_TRUE(agent_b.InSession());
+}
+
+} // namespace
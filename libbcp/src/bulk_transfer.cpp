@@ -0,0 +1,423 @@
+#include "bulk_transfer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lora_chat {
+
+namespace {
+
+using bulk::Kind;
+
+// Manifest flags
+constexpr uint8_t kEndOfPass = 0x01;
+
+uint16_t Get16(uint8_t const *p) { return (p[0] << 8) | p[1]; }
+void Put16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+uint32_t Get32(uint8_t const *p) { return (Get16(p) << 16) | Get16(p + 2); }
+void Put32(uint8_t *p, uint32_t v) {
+  Put16(p, v >> 16);
+  Put16(p + 2, v & 0xffff);
+}
+
+size_t BlocksFor(size_t size) {
+  return (size + bulk::kBlockBytes - 1) / bulk::kBlockBytes;
+}
+
+// A manifest, or anything else that names the file by its size and checksum
+void WriteFileId(std::span<uint8_t, kSessionPacketPayloadBytes> out, Kind kind,
+                 uint32_t size, uint32_t checksum) {
+  std::fill(out.begin(), out.end(), 0);
+  out[0] = static_cast<uint8_t>(kind);
+  Put32(&out[1], size);
+  Put32(&out[5], checksum);
+}
+
+bool NamesFile(std::span<const uint8_t, kSessionPacketPayloadBytes> message,
+               uint32_t size, uint32_t checksum) {
+  return Get32(&message[1]) == size && Get32(&message[5]) == checksum;
+}
+
+} // namespace
+
+uint32_t bulk::Checksum(std::span<const uint8_t> bytes) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t b : bytes)
+    hash = (hash ^ b) * 16777619u;
+  return hash;
+}
+
+BulkSender::~BulkSender() { Close(); }
+
+void BulkSender::Close() {
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+  data_ = nullptr;
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+}
+
+BulkSender::Status BulkSender::Open(const char *path) {
+  Close();
+  fd_ = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    perror("BulkSender: failed to open file");
+    return Status::kIoError;
+  }
+  struct stat st {};
+  if (fstat(fd_, &st) < 0) {
+    perror("BulkSender: failed to stat file");
+    Close();
+    return Status::kIoError;
+  }
+  if (static_cast<size_t>(st.st_size) > bulk::kMaxFileBytes) {
+    Close();
+    return Status::kTooLarge;
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+      perror("BulkSender: failed to map file");
+      Close();
+      return Status::kIoError;
+    }
+    data_ = static_cast<uint8_t const *>(mapping);
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+  }
+
+  blocks_ = BlocksFor(size_);
+  checksum_ = bulk::Checksum({data_, size_});
+  delivered_.assign((blocks_ + 63) / 64, 0);
+  next_block_ = 0;
+  blocks_sent_ = 0;
+  phase_ = Phase::kAnnouncing;
+  return Status::kSuccess;
+}
+
+bool BulkSender::NextMessage(std::span<uint8_t, kSessionPacketPayloadBytes> out) {
+  switch (phase_) {
+  case Phase::kAnnouncing:
+    WriteFileId(out, Kind::kManifest, size_, checksum_);
+    phase_ = Phase::kSending;
+    return true;
+  case Phase::kSending:
+    break;
+  case Phase::kAwaitingReport:
+  case Phase::kComplete:
+    return false;
+  }
+
+  // Whole words at a time past what's been delivered, which on a resumed
+  // transfer is most of the file
+  size_t block = next_block_;
+  while (block < blocks_) {
+    if (delivered_[block / 64] == ~uint64_t{0}) {
+      block = (block / 64 + 1) * 64;
+      continue;
+    }
+    if (!Delivered(block))
+      break;
+    block++;
+  }
+  if (block >= blocks_) {
+    WriteFileId(out, Kind::kManifest, size_, checksum_);
+    out[9] = kEndOfPass;
+    phase_ = Phase::kAwaitingReport;
+    return true;
+  }
+
+  const size_t offset = block * bulk::kBlockBytes;
+  const size_t n = std::min(bulk::kBlockBytes, size_ - offset);
+  out[0] = static_cast<uint8_t>(Kind::kBlock);
+  Put16(&out[1], block);
+  std::memcpy(&out[3], data_ + offset, n);
+  std::fill(out.begin() + 3 + n, out.end(), 0);
+  // The session sees it there, or we hear otherwise in the next report
+  delivered_[block / 64] |= uint64_t{1} << (block % 64);
+  next_block_ = block + 1;
+  blocks_sent_++;
+  return true;
+}
+
+void BulkSender::Receive(
+    std::span<const uint8_t, kSessionPacketPayloadBytes> message) {
+  switch (static_cast<Kind>(message[0])) {
+  case Kind::kHave: {
+    // Mid-pass, we may have sent more since the report was made, so it can
+    // only add to what we know; at the end of a pass, it's the last word
+    const bool exact = (phase_ == Phase::kAwaitingReport);
+    const size_t first = Get16(&message[1]);
+    for (size_t i = 0; i < bulk::kBlocksPerReport && first + i < blocks_; i++) {
+      const size_t block = first + i;
+      const bool have = message[3 + i / 8] >> (i % 8) & 1;
+      const uint64_t bit = uint64_t{1} << (block % 64);
+      if (have)
+        delivered_[block / 64] |= bit;
+      else if (exact)
+        delivered_[block / 64] &= ~bit;
+    }
+    break;
+  }
+  case Kind::kReportEnd:
+    if (phase_ == Phase::kAwaitingReport &&
+        NamesFile(message, size_, checksum_)) {
+      next_block_ = 0;
+      phase_ = Phase::kSending;
+    }
+    break;
+  case Kind::kComplete:
+    if (NamesFile(message, size_, checksum_))
+      phase_ = Phase::kComplete;
+    break;
+  default:
+    break;
+  }
+}
+
+void BulkSender::Restart() {
+  if (phase_ != Phase::kComplete)
+    phase_ = Phase::kAnnouncing;
+}
+
+BulkReceiver::~BulkReceiver() { Close(); }
+
+void BulkReceiver::Close() {
+  if (!open_)
+    return;
+  Sync();
+  if (data_)
+    munmap(data_, size_);
+  if (progress_)
+    munmap(progress_, progress_size_);
+  if (fd_ >= 0)
+    close(fd_);
+  if (progress_fd_ >= 0)
+    close(progress_fd_);
+  data_ = progress_ = nullptr;
+  fd_ = progress_fd_ = -1;
+  open_ = false;
+}
+
+BulkReceiver::Status BulkReceiver::Begin(uint32_t size, uint32_t checksum) {
+  Close();
+  size_ = size;
+  checksum_ = checksum;
+  blocks_ = BlocksFor(size);
+  blocks_received_ = 0;
+  have_.assign((blocks_ + 7) / 8, 0);
+  unsynced_ = 0;
+  complete_ = false;
+  report_ = Report::kNone;
+  report_end_pending_ = complete_pending_ = false;
+  if (size > bulk::kMaxFileBytes)
+    return status_ = Status::kTooLarge;
+
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st {};
+  if (fd_ < 0 || fstat(fd_, &st) < 0) {
+    perror("BulkReceiver: failed to open file");
+    Close();
+    return status_ = Status::kIoError;
+  }
+  if (static_cast<size_t>(st.st_size) != size_ && ftruncate(fd_, size_) < 0) {
+    perror("BulkReceiver: failed to size file");
+    close(fd_);
+    fd_ = -1;
+    return status_ = Status::kIoError;
+  }
+  if (size_ > 0) {
+    void *mapping =
+        mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+      perror("BulkReceiver: failed to map file");
+      close(fd_);
+      fd_ = -1;
+      return status_ = Status::kIoError;
+    }
+    data_ = static_cast<uint8_t *>(mapping);
+  }
+  open_ = true;
+
+  // Picking up where we left off, if the progress there is for this file
+  const std::string progress_path = path_ + ".progress";
+  progress_size_ = sizeof(ProgressHeader) + have_.size();
+  progress_fd_ = open(progress_path.c_str(), O_RDWR | O_CLOEXEC);
+  bool resumed = false;
+  if (progress_fd_ >= 0 && fstat(progress_fd_, &st) == 0 &&
+      static_cast<size_t>(st.st_size) == progress_size_) {
+    void *mapping = mmap(nullptr, progress_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, progress_fd_, 0);
+    if (mapping != MAP_FAILED) {
+      progress_ = static_cast<uint8_t *>(mapping);
+      ProgressHeader header{};
+      std::memcpy(&header, progress_, sizeof(header));
+      resumed = header.magic == kProgressMagic &&
+                header.version == kProgressVersion && header.size == size_ &&
+                header.checksum == checksum_;
+    }
+  }
+  if (resumed) {
+    std::memcpy(have_.data(), progress_ + sizeof(ProgressHeader), have_.size());
+    for (size_t block = 0; block < blocks_; block++)
+      blocks_received_ += Have(block);
+    return status_ = Status::kSuccess;
+  }
+  if (progress_fd_ < 0 && st.st_size == static_cast<off_t>(size_) &&
+      bulk::Checksum({data_, size_}) == checksum_) {
+    // Finished last time, after which the progress went
+    complete_ = true;
+    blocks_received_ = blocks_;
+    std::fill(have_.begin(), have_.end(), 0xff);
+    return status_ = Status::kSuccess;
+  }
+
+  // Starting afresh
+  if (progress_)
+    munmap(progress_, progress_size_);
+  progress_ = nullptr;
+  if (progress_fd_ >= 0)
+    close(progress_fd_);
+  progress_fd_ = open(progress_path.c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  void *mapping = MAP_FAILED;
+  if (progress_fd_ >= 0 && ftruncate(progress_fd_, progress_size_) == 0)
+    mapping = mmap(nullptr, progress_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   progress_fd_, 0);
+  if (mapping == MAP_FAILED) {
+    perror("BulkReceiver: failed to create progress file");
+    Close();
+    return status_ = Status::kIoError;
+  }
+  progress_ = static_cast<uint8_t *>(mapping);
+  const ProgressHeader header{.magic = kProgressMagic,
+                              .version = kProgressVersion,
+                              .size = size,
+                              .checksum = checksum};
+  std::memcpy(progress_, &header, sizeof(header));
+  Sync();
+  return status_ = Status::kSuccess;
+}
+
+void BulkReceiver::Sync() {
+  if (!progress_)
+    return;
+  if (data_ && msync(data_, size_, MS_SYNC) < 0)
+    perror("BulkReceiver: failed to sync file");
+  std::memcpy(progress_ + sizeof(ProgressHeader), have_.data(), have_.size());
+  if (msync(progress_, progress_size_, MS_SYNC) < 0)
+    perror("BulkReceiver: failed to sync progress");
+  unsynced_ = 0;
+}
+
+void BulkReceiver::FinishPass() {
+  Sync();
+  report_ = Report::kMissing;
+  report_next_ = 0;
+  report_end_pending_ = true;
+  if (blocks_received_ < blocks_)
+    return;
+
+  if (bulk::Checksum({data_, size_}) != checksum_) {
+    printf("BulkReceiver: %s doesn't match its checksum; starting over\n",
+           path_.c_str());
+    std::fill(have_.begin(), have_.end(), 0);
+    blocks_received_ = 0;
+    Sync();
+    return;
+  }
+  complete_ = true;
+  complete_pending_ = true;
+  report_ = Report::kNone;
+  report_end_pending_ = false;
+  // The file itself says it's done from here on
+  munmap(progress_, progress_size_);
+  progress_ = nullptr;
+  close(progress_fd_);
+  progress_fd_ = -1;
+  unlink((path_ + ".progress").c_str());
+}
+
+void BulkReceiver::Receive(
+    std::span<const uint8_t, kSessionPacketPayloadBytes> message) {
+  switch (static_cast<Kind>(message[0])) {
+  case Kind::kManifest: {
+    const uint32_t size = Get32(&message[1]);
+    const uint32_t checksum = Get32(&message[5]);
+    if ((!open_ || size != size_ || checksum != checksum_) &&
+        Begin(size, checksum) != Status::kSuccess)
+      return;
+    if (complete_) {
+      complete_pending_ = true;
+    } else if (message[9] & kEndOfPass) {
+      FinishPass();
+    } else {
+      report_ = Report::kHave;
+      report_next_ = 0;
+      report_end_pending_ = false;
+    }
+    break;
+  }
+  case Kind::kBlock: {
+    const size_t block = Get16(&message[1]);
+    if (!open_ || complete_ || block >= blocks_ || Have(block))
+      break;
+    const size_t offset = block * bulk::kBlockBytes;
+    std::memcpy(data_ + offset, &message[3],
+                std::min(bulk::kBlockBytes, size_ - offset));
+    have_[block / 8] |= 1 << (block % 8);
+    blocks_received_++;
+    if (++unsynced_ >= kSyncInterval)
+      Sync();
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+bool BulkReceiver::NextMessage(
+    std::span<uint8_t, kSessionPacketPayloadBytes> out) {
+  if (complete_pending_) {
+    WriteFileId(out, Kind::kComplete, size_, checksum_);
+    complete_pending_ = false;
+    return true;
+  }
+  while (report_ != Report::kNone && report_next_ < blocks_) {
+    const size_t first = report_next_;
+    const size_t count = std::min(bulk::kBlocksPerReport, blocks_ - first);
+    report_next_ += bulk::kBlocksPerReport;
+    std::fill(out.begin(), out.end(), 0);
+    size_t have = 0;
+    for (size_t i = 0; i < count; i++)
+      if (Have(first + i)) {
+        out[3 + i / 8] |= 1 << (i % 8);
+        have++;
+      }
+    if ((report_ == Report::kHave && have > 0) ||
+        (report_ == Report::kMissing && have < count)) {
+      out[0] = static_cast<uint8_t>(Kind::kHave);
+      Put16(&out[1], first);
+      return true;
+    }
+  }
+  report_ = Report::kNone;
+  if (report_end_pending_) {
+    WriteFileId(out, Kind::kReportEnd, size_, checksum_);
+    report_end_pending_ = false;
+    return true;
+  }
+  return false;
+}
+
+} // namespace lora_chat
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace lora_chat {
+
+/// What BulkSender and BulkReceiver share: the messages they exchange, each
+/// starting with a byte giving its kind (none of them zero, so that the
+/// empty message each session starts with is ignored).
+namespace bulk {
+
+enum class Status {
+  kSuccess,
+  kIoError,
+  kTooLarge,
+};
+
+/// File bytes per block message, after its kind and index
+constexpr size_t kBlockBytes = kSessionPacketPayloadBytes - 3;
+/// Blocks are indexed by uint16_t
+constexpr size_t kMaxFileBytes = kBlockBytes * UINT16_MAX;
+/// Blocks covered by each report message, after its kind and first block
+constexpr size_t kBlocksPerReport = 8 * (kSessionPacketPayloadBytes - 3);
+
+enum class Kind : uint8_t {
+  // Sender to receiver
+  kManifest = 0xb1,
+  kBlock = 0xb2,
+  // Receiver to sender
+  kHave = 0xb3,
+  kReportEnd = 0xb4,
+  kComplete = 0xb5,
+};
+
+/// FNV-1a, over the whole file: what the receiver checks its copy against
+/// once it has every block
+uint32_t Checksum(std::span<const uint8_t> bytes);
+
+} // namespace bulk
+
+/// Moves a file across a session, a block per message, for payloads too
+/// big for chat messages (map tiles, config bundles).
+///
+/// The sender announces the file with a manifest (its size and checksum),
+/// then streams every block the receiver doesn't have straight out of a
+/// mapping of the file, filling every slot the session gives it. The
+/// session already delivers in order and retransmits lost frames, so a pass
+/// through the file normally gets every block there; what it can't cover is
+/// the block in flight when a session ends. So the receiver keeps a bitmap
+/// of the blocks it has, persisted next to the file, and reports it back:
+/// after each manifest, the blocks it already has (so a resumed transfer
+/// skips them), and at the end of each pass, the blocks still missing (so
+/// only those go again). Reports travel in the receiver's own slots, which
+/// a one-way transfer leaves idle anyway.
+///
+/// Neither end is thread-safe.
+class BulkSender {
+public:
+  using Status = bulk::Status;
+
+  BulkSender() = default;
+  ~BulkSender();
+  BulkSender(const BulkSender &) = delete;
+  BulkSender &operator=(const BulkSender &) = delete;
+
+  /// Maps the file at `path` to be sent, and checksums it
+  Status Open(const char *path);
+
+  /// Writes the next message to send into `out`. Returns false if there's
+  /// nothing to send: waiting on the receiver's report, or done.
+  bool NextMessage(std::span<uint8_t, kSessionPacketPayloadBytes> out);
+  /// Takes a message from the receiver
+  void Receive(std::span<const uint8_t, kSessionPacketPayloadBytes> message);
+  /// Announces the file again, e.g. for a new session, so that the receiver
+  /// reports what it has
+  void Restart();
+
+  bool Complete() const { return phase_ == Phase::kComplete; }
+  size_t Blocks() const { return blocks_; }
+  /// Including any sent again
+  uint64_t BlocksSent() const { return blocks_sent_; }
+
+private:
+  enum class Phase {
+    kAnnouncing,
+    kSending,
+    // Told the receiver we're through the file; waiting for what it's missing
+    kAwaitingReport,
+    kComplete,
+  };
+
+  void Close();
+  bool Delivered(size_t block) const {
+    return delivered_[block / 64] >> (block % 64) & 1;
+  }
+
+  int fd_{-1};
+  uint8_t const *data_{nullptr};
+  size_t size_{0};
+  size_t blocks_{0};
+  uint32_t checksum_{0};
+
+  Phase phase_{Phase::kAnnouncing};
+  // The blocks we believe the receiver has
+  std::vector<uint64_t> delivered_{};
+  size_t next_block_{0};
+  uint64_t blocks_sent_{0};
+};
+
+/// The receiving end of a BulkSender.
+class BulkReceiver {
+public:
+  using Status = bulk::Status;
+
+  /// Blocks received between syncs of the file and its progress
+  static constexpr size_t kSyncInterval = 64;
+
+  BulkReceiver() = default;
+  ~BulkReceiver();
+  BulkReceiver(const BulkReceiver &) = delete;
+  BulkReceiver &operator=(const BulkReceiver &) = delete;
+
+  /// Directs the transfer into `path`, with its progress kept in
+  /// `path`.progress. Nothing is opened until the sender's manifest arrives:
+  /// if the progress there is for the same file, the transfer resumes.
+  void Open(std::string path) { path_ = std::move(path); }
+
+  /// Takes a message from the sender
+  void Receive(std::span<const uint8_t, kSessionPacketPayloadBytes> message);
+  /// Writes the next report to send into `out`. Returns false if there's
+  /// nothing to report.
+  bool NextMessage(std::span<uint8_t, kSessionPacketPayloadBytes> out);
+
+  /// Whether the file is all here, and matches its checksum
+  bool Complete() const { return complete_; }
+  size_t Blocks() const { return blocks_; }
+  size_t BlocksReceived() const { return blocks_received_; }
+  /// Any trouble with the files themselves
+  Status LastStatus() const { return status_; }
+
+private:
+  struct ProgressHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t checksum;
+  };
+
+  enum class Report {
+    kNone,
+    // Ranges with any block we have, for the sender to skip
+    kHave,
+    // Ranges with any block we're missing, for the sender to resend
+    kMissing,
+  };
+
+  static constexpr uint32_t kProgressMagic = 0x42435054; // "BCPT"
+  static constexpr uint32_t kProgressVersion = 1;
+
+  Status Begin(uint32_t size, uint32_t checksum);
+  void Close();
+  /// Makes every block received so far durable, the blocks before the
+  /// bitmap that says they're here
+  void Sync();
+  void FinishPass();
+  bool Have(size_t block) const { return have_[block / 8] >> (block % 8) & 1; }
+
+  std::string path_{};
+  Status status_{Status::kSuccess};
+  int fd_{-1};
+  int progress_fd_{-1};
+  uint8_t *data_{nullptr};
+  uint8_t *progress_{nullptr};
+  size_t size_{0};
+  size_t progress_size_{0};
+  uint32_t checksum_{0};
+  bool open_{false};
+
+  size_t blocks_{0};
+  size_t blocks_received_{0};
+  // Ahead of the persisted bitmap by whatever's arrived since the last sync
+  std::vector<uint8_t> have_{};
+  size_t unsynced_{0};
+  bool complete_{false};
+
+  Report report_{Report::kNone};
+  size_t report_next_{0};
+  bool report_end_pending_{false};
+  bool complete_pending_{false};
+};
+
+} // namespace lora_chat
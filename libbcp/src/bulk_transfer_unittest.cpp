@@ -0,0 +1,188 @@
+#include "bulk_transfer.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::BulkReceiver;
+using lora_chat::BulkSender;
+using lora_chat::SessionPacketPayload;
+using lora_chat::testutils::TempDir;
+namespace bulk = lora_chat::bulk;
+
+std::vector<uint8_t> Contents(size_t size, uint8_t seed) {
+  std::vector<uint8_t> d(size);
+  for (size_t i = 0; i < size; i++)
+    d[i] = seed + i * 13 + i / 251;
+  return d;
+}
+
+void WriteFile(std::string const &path, std::vector<uint8_t> const &d) {
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(d.data()), d.size());
+}
+
+std::vector<uint8_t> ReadFile(std::string const &path) {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// Alternates a message each way, as a session's slots do, until neither end
+// has anything to say or `budget` messages from the sender have gone;
+// returns how many did
+size_t Pump(BulkSender &sender, BulkReceiver &receiver,
+            size_t budget = SIZE_MAX) {
+  size_t sent = 0;
+  while (true) {
+    SessionPacketPayload message{};
+    bool any = false;
+    if (sent < budget && sender.NextMessage(message)) {
+      receiver.Receive(message);
+      sent++;
+      any = true;
+    }
+    if (receiver.NextMessage(message)) {
+      sender.Receive(message);
+      any = true;
+    }
+    if (!any)
+      return sent;
+  }
+}
+
+TEST(BulkTransfer, SendsAFile) {
+  TempDir dir{"bcp-bulk"};
+  for (size_t size : {0ul, 1ul, bulk::kBlockBytes, bulk::kBlockBytes + 1,
+                      10'000ul}) {
+    const std::string from = dir.path() + "/from";
+    const std::string to = dir.path() + "/to" + std::to_string(size);
+    auto contents = Contents(size, size);
+    WriteFile(from, contents);
+
+    BulkSender sender{};
+    BulkReceiver receiver{};
+    ASSERT_EQ(sender.Open(from.c_str()), bulk::Status::kSuccess);
+    receiver.Open(to);
+    const size_t sent = Pump(sender, receiver);
+    EXPECT_TRUE(sender.Complete()) << size;
+    EXPECT_TRUE(receiver.Complete()) << size;
+    EXPECT_EQ(ReadFile(to), contents) << size;
+    // Each block once, plus the manifests at either end of the pass (an
+    // empty file is there as soon as it's announced)
+    EXPECT_EQ(sender.BlocksSent(), sender.Blocks());
+    EXPECT_EQ(sent, size ? sender.Blocks() + 2 : 1);
+    EXPECT_FALSE(std::filesystem::exists(to + ".progress"));
+  }
+}
+
+TEST(BulkTransfer, ResendsBlocksLostInFlight) {
+  TempDir dir{"bcp-bulk"};
+  const std::string from = dir.path() + "/from";
+  const std::string to = dir.path() + "/to";
+  auto contents = Contents(5000, 7);
+  WriteFile(from, contents);
+
+  BulkSender sender{};
+  BulkReceiver receiver{};
+  ASSERT_EQ(sender.Open(from.c_str()), bulk::Status::kSuccess);
+  receiver.Open(to);
+  // The session drops out with a couple of blocks in flight
+  Pump(sender, receiver, 40);
+  SessionPacketPayload lost{};
+  ASSERT_TRUE(sender.NextMessage(lost));
+  ASSERT_TRUE(sender.NextMessage(lost));
+  sender.Restart();
+
+  Pump(sender, receiver);
+  EXPECT_TRUE(sender.Complete());
+  EXPECT_TRUE(receiver.Complete());
+  EXPECT_EQ(ReadFile(to), contents);
+  EXPECT_EQ(sender.BlocksSent(), sender.Blocks() + 2);
+}
+
+TEST(BulkTransfer, ResumesAfterTheReceiverStops) {
+  TempDir dir{"bcp-bulk"};
+  const std::string from = dir.path() + "/from";
+  const std::string to = dir.path() + "/to";
+  auto contents = Contents(20'000, 3);
+  WriteFile(from, contents);
+
+  BulkSender sender{};
+  ASSERT_EQ(sender.Open(from.c_str()), bulk::Status::kSuccess);
+  const size_t first_pass = 3 * BulkReceiver::kSyncInterval + 10;
+  {
+    BulkReceiver receiver{};
+    receiver.Open(to);
+    Pump(sender, receiver, first_pass);
+    EXPECT_FALSE(receiver.Complete());
+    // Going away syncs what it has
+  }
+  EXPECT_TRUE(std::filesystem::exists(to + ".progress"));
+
+  // A new receiver, and a new sender that knows nothing of the first
+  BulkSender resumed{};
+  ASSERT_EQ(resumed.Open(from.c_str()), bulk::Status::kSuccess);
+  BulkReceiver receiver{};
+  receiver.Open(to);
+  Pump(resumed, receiver);
+  EXPECT_TRUE(resumed.Complete());
+  EXPECT_TRUE(receiver.Complete());
+  EXPECT_EQ(ReadFile(to), contents);
+  // The first pass's manifest went along with its blocks
+  EXPECT_EQ(resumed.BlocksSent(), resumed.Blocks() - (first_pass - 1));
+
+  // Once it's all there, announcing it again finishes straight away
+  BulkSender again{};
+  ASSERT_EQ(again.Open(from.c_str()), bulk::Status::kSuccess);
+  BulkReceiver done{};
+  done.Open(to);
+  Pump(again, done);
+  EXPECT_TRUE(again.Complete());
+  EXPECT_EQ(again.BlocksSent(), 0u);
+}
+
+TEST(BulkTransfer, StartsOverOnADifferentFile) {
+  TempDir dir{"bcp-bulk"};
+  const std::string from = dir.path() + "/from";
+  const std::string to = dir.path() + "/to";
+  WriteFile(from, Contents(3000, 1));
+  {
+    BulkSender sender{};
+    BulkReceiver receiver{};
+    ASSERT_EQ(sender.Open(from.c_str()), bulk::Status::kSuccess);
+    receiver.Open(to);
+    Pump(sender, receiver, 50);
+  }
+
+  auto contents = Contents(3000, 2);
+  WriteFile(from, contents);
+  BulkSender sender{};
+  BulkReceiver receiver{};
+  ASSERT_EQ(sender.Open(from.c_str()), bulk::Status::kSuccess);
+  receiver.Open(to);
+  Pump(sender, receiver);
+  EXPECT_TRUE(receiver.Complete());
+  EXPECT_EQ(ReadFile(to), contents);
+  EXPECT_EQ(sender.BlocksSent(), sender.Blocks());
+}
+
+TEST(BulkTransfer, RefusesFilesTooBigToIndex) {
+  TempDir dir{"bcp-bulk"};
+  const std::string from = dir.path() + "/from";
+  std::ofstream{from};
+  std::filesystem::resize_file(from, bulk::kMaxFileBytes + 1);
+  BulkSender sender{};
+  EXPECT_EQ(sender.Open(from.c_str()), bulk::Status::kTooLarge);
+  EXPECT_EQ(sender.Open((dir.path() + "/missing").c_str()),
+            bulk::Status::kIoError);
+}
+
+} // namespace
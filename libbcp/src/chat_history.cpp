@@ -0,0 +1,253 @@
+#include "chat_history.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+namespace lora_chat {
+
+namespace {
+
+// The direction goes in the record's flags
+constexpr uint8_t kSentFlag = 1 << 0;
+
+bool Contains(std::vector<uint32_t> const &postings, uint32_t ordinal) {
+  return std::binary_search(postings.begin(), postings.end(), ordinal);
+}
+
+} // namespace
+
+template <typename Visitor>
+void ChatHistory::ForEachKeyword(std::string_view text, Visitor &&visit) {
+  constexpr size_t kMaximumKeywordLength = 32;
+  std::array<char, kMaximumKeywordLength> keyword{};
+  size_t length = 0;
+  size_t run = 0;
+
+  auto flush = [&]() {
+    if (run >= kMinimumKeywordLength)
+      visit(std::string_view{keyword.data(), length});
+    length = 0;
+    run = 0;
+  };
+  for (char c : text) {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      // Overlong keywords are indexed by their prefix
+      if (length < keyword.size())
+        keyword[length++] = std::tolower(static_cast<unsigned char>(c));
+      run++;
+    } else {
+      flush();
+    }
+  }
+  flush();
+}
+
+uint32_t ChatHistory::HashKeyword(std::string_view keyword) {
+  uint32_t hash = 2166136261u;
+  for (char c : keyword) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint64_t ChatHistory::TimestampCount(WireTimePoint t) {
+  return FlipBitsIfBigEndian(t);
+}
+
+bool ChatHistory::ContainsKeyword(std::string_view text,
+                                  std::string_view keyword) {
+  bool found = false;
+  ForEachKeyword(text, [&](std::string_view k) { found |= (k == keyword); });
+  return found;
+}
+
+ChatHistory::Status ChatHistory::Open(std::string directory,
+                                      MessageLog::Options options) {
+  std::scoped_lock lock(lock_);
+  log_.Close();
+  records_.clear();
+  time_index_.clear();
+  keyword_postings_.clear();
+  peer_postings_.clear();
+  latest_timestamp_ = 0;
+
+  if (auto status = log_.Open(std::move(directory), options);
+      status != Status::kSuccess)
+    return status;
+  log_.ForEach([&](MessageLog::Record const &r) {
+    if (r.kind == MessageLog::RecordKind::kMessage)
+      Index(r);
+  });
+  return Status::kSuccess;
+}
+
+void ChatHistory::Close() {
+  std::scoped_lock lock(lock_);
+  log_.Close();
+}
+
+ChatHistory::Status ChatHistory::Record(WireAddress peer, Direction direction,
+                                        std::span<const uint8_t> text) {
+  return Record(peer, direction, WireTimeClock::now(), text);
+}
+
+ChatHistory::Status ChatHistory::Record(WireAddress peer, Direction direction,
+                                        Timestamp timestamp,
+                                        std::span<const uint8_t> text) {
+  std::scoped_lock lock(lock_);
+  if (!log_.IsOpen())
+    return Status::kNotOpen;
+
+  uint64_t count =
+      std::chrono::duration_cast<WireTimeUnit>(timestamp.time_since_epoch())
+          .count();
+  count = std::max(count, latest_timestamp_);
+
+  auto id = log_.Append(
+      MessageLog::RecordKind::kMessage, peer, records_.size(),
+      FlipBitsIfBigEndian(count), 0, text,
+      (direction == Direction::kSent) ? kSentFlag : 0);
+  if (!id)
+    return Status::kIoError;
+
+  auto record = log_.Read(*id);
+  assert(record.has_value());
+  Index(*record);
+  return Status::kSuccess;
+}
+
+void ChatHistory::Index(MessageLog::Record const &record) {
+  const Ordinal ordinal = records_.size();
+  const uint64_t timestamp =
+      std::max(TimestampCount(record.timestamp), latest_timestamp_);
+
+  records_.push_back(record.id);
+  if (ordinal % kTimeIndexStride == 0)
+    time_index_.push_back(timestamp);
+  latest_timestamp_ = timestamp;
+
+  peer_postings_[record.peer].push_back(ordinal);
+
+  std::string_view text{reinterpret_cast<const char *>(record.payload.data()),
+                        record.payload.size()};
+  ForEachKeyword(text, [&](std::string_view keyword) {
+    auto &postings = keyword_postings_[HashKeyword(keyword)];
+    // Repeated keywords within a message only need one posting
+    if (postings.empty() || postings.back() != ordinal)
+      postings.push_back(ordinal);
+  });
+}
+
+std::optional<ChatHistory::Entry> ChatHistory::EntryAt(Ordinal ordinal) const {
+  auto record = log_.Read(records_[ordinal]);
+  if (!record)
+    return {};
+  return Entry{
+      .peer = record->peer,
+      .direction = (record->flags & kSentFlag) ? Direction::kSent
+                                               : Direction::kReceived,
+      .timestamp = Timestamp(std::chrono::duration_cast<Timestamp::duration>(
+          WireTimeUnit(TimestampCount(record->timestamp)))),
+      .text = {reinterpret_cast<const char *>(record->payload.data()),
+               record->payload.size()},
+  };
+}
+
+uint64_t ChatHistory::TimestampAt(Ordinal ordinal) const {
+  auto record = log_.Read(records_[ordinal]);
+  assert(record.has_value());
+  return TimestampCount(record->timestamp);
+}
+
+ChatHistory::Ordinal ChatHistory::LowerBound(uint64_t t) const {
+  // Find the last stride whose first timestamp is < t, then scan within it
+  auto it = std::lower_bound(time_index_.begin(), time_index_.end(), t);
+  if (it == time_index_.begin())
+    return 0;
+  Ordinal ordinal = (std::distance(time_index_.begin(), it) - 1) *
+                    kTimeIndexStride;
+  const Ordinal end = std::min<size_t>(ordinal + kTimeIndexStride,
+                                       records_.size());
+  while (ordinal < end && TimestampAt(ordinal) < t)
+    ordinal++;
+  return ordinal;
+}
+
+std::vector<ChatHistory::Entry> ChatHistory::Search(Query const &query) const {
+  std::scoped_lock lock(lock_);
+  std::vector<Entry> results{};
+  if (records_.empty() || query.limit == 0)
+    return results;
+
+  auto to_count = [](Timestamp t) -> uint64_t {
+    return std::chrono::duration_cast<WireTimeUnit>(t.time_since_epoch())
+        .count();
+  };
+  const Ordinal lo = query.since ? LowerBound(to_count(*query.since)) : 0;
+  const Ordinal hi = query.until ? LowerBound(to_count(*query.until) + 1)
+                                 : records_.size();
+  if (lo >= hi)
+    return results;
+
+  // Gather every postings list the results have to appear in
+  std::vector<std::string> keywords{};
+  ForEachKeyword(query.keywords,
+                 [&](std::string_view k) { keywords.emplace_back(k); });
+  std::vector<Postings const *> lists{};
+  for (auto const &keyword : keywords) {
+    auto it = keyword_postings_.find(HashKeyword(keyword));
+    if (it == keyword_postings_.end())
+      return results;
+    lists.push_back(&it->second);
+  }
+  if (query.peer) {
+    auto it = peer_postings_.find(*query.peer);
+    if (it == peer_postings_.end())
+      return results;
+    lists.push_back(&it->second);
+  }
+  std::sort(lists.begin(), lists.end(),
+            [](auto *a, auto *b) { return a->size() < b->size(); });
+
+  auto accept = [&](Ordinal ordinal) {
+    for (size_t i = 1; i < lists.size(); i++)
+      if (!Contains(*lists[i], ordinal))
+        return;
+    auto entry = EntryAt(ordinal);
+    if (!entry)
+      return;
+    // Weed out hash collisions
+    for (auto const &keyword : keywords)
+      if (!ContainsKeyword(entry->text, keyword))
+        return;
+    results.push_back(*entry);
+  };
+
+  if (lists.empty()) {
+    for (Ordinal o = hi; o > lo && results.size() < query.limit; o--)
+      accept(o - 1);
+    return results;
+  }
+
+  // Walk the shortest list newest-first, probing the others
+  auto const &driver = *lists.front();
+  auto begin = std::lower_bound(driver.begin(), driver.end(), lo);
+  auto end = std::lower_bound(begin, driver.end(), hi);
+  for (auto it = end; it != begin && results.size() < query.limit; --it)
+    accept(*(it - 1));
+  return results;
+}
+
+size_t ChatHistory::size() const {
+  std::scoped_lock lock(lock_);
+  return records_.size();
+}
+
+ChatHistory::Status ChatHistory::Sync() {
+  std::scoped_lock lock(lock_);
+  return log_.Sync();
+}
+
+} // namespace lora_chat
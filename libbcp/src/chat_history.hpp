@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "message_log.hpp"
+#include "packet.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// A searchable record of every message we've sent or received.
+///
+/// Messages are appended to a MessageLog, so their text is only ever read
+/// back out of the memory-mapped segments. On top of that we keep two
+/// compact, incrementally-maintained indices:
+///  - a sparse time index holding the timestamp of every
+///    `kTimeIndexStride`th message, which narrows a time range down to a
+///    handful of records that then get checked directly, and
+///  - an inverted index from (hashed) keyword and from peer to the ordinals of
+///    the messages containing/involving them.
+/// The indices are rebuilt with a single pass over the log on Open(). Opened
+/// `read_only`, the history can be searched while another process records to
+/// it, though it only sees what was there on Open().
+///
+/// All methods are thread-safe.
+class ChatHistory {
+public:
+  using Status = MessageLog::Status;
+  using Timestamp = WireTimeClock::time_point;
+
+  enum class Direction : uint8_t {
+    kReceived = 0,
+    kSent = 1,
+  };
+
+  struct Entry {
+    WireAddress peer;
+    Direction direction;
+    Timestamp timestamp;
+    // Points into the log's mapping
+    std::string_view text;
+  };
+
+  struct Query {
+    std::optional<WireAddress> peer{};
+    std::optional<Timestamp> since{};
+    std::optional<Timestamp> until{};
+    // Whitespace-separated; every keyword must match (case-insensitively)
+    std::string keywords{};
+    size_t limit{20};
+  };
+
+  ChatHistory() = default;
+
+  Status Open(std::string directory, MessageLog::Options options);
+  Status Open(std::string directory) { return Open(std::move(directory), {}); }
+  void Close();
+
+  Status Record(WireAddress peer, Direction direction,
+                std::span<const uint8_t> text);
+  Status Record(WireAddress peer, Direction direction, Timestamp timestamp,
+                std::span<const uint8_t> text);
+
+  /// Returns the messages matching `query`, newest first.
+  std::vector<Entry> Search(Query const &query) const;
+
+  size_t size() const;
+  Status Sync();
+
+private:
+  using Ordinal = uint32_t;
+  using Postings = std::vector<Ordinal>;
+
+  static constexpr size_t kTimeIndexStride = 64;
+  static constexpr size_t kMinimumKeywordLength = 2;
+
+  template <typename Visitor>
+  static void ForEachKeyword(std::string_view text, Visitor &&visit);
+  static uint32_t HashKeyword(std::string_view keyword);
+  static uint64_t TimestampCount(WireTimePoint t);
+  static bool ContainsKeyword(std::string_view text, std::string_view keyword);
+
+  void Index(MessageLog::Record const &record);
+  std::optional<Entry> EntryAt(Ordinal ordinal) const;
+  uint64_t TimestampAt(Ordinal ordinal) const;
+  /// The first ordinal whose timestamp is >= `t`
+  Ordinal LowerBound(uint64_t t) const;
+
+  mutable std::mutex lock_{};
+  MessageLog log_{};
+
+  std::vector<MessageLog::RecordId> records_{};
+  std::vector<uint64_t> time_index_{};
+  // Timestamps are clamped to be non-decreasing on ingest so that the time
+  // index stays sorted even if the wall clock steps backwards
+  uint64_t latest_timestamp_{0};
+  std::unordered_map<uint32_t, Postings> keyword_postings_{};
+  std::unordered_map<WireAddress, Postings> peer_postings_{};
+};
+
+} // namespace lora_chat
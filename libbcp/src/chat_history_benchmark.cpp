@@ -0,0 +1,103 @@
+#include "chat_history.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+
+namespace {
+
+using lora_chat::ChatHistory;
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMessages = 300000;
+constexpr int kPeers = 16;
+constexpr int kQueryRepetitions = 100;
+
+const char *kVocabulary[] = {
+    "north",  "south",   "ridge", "camp",   "battery", "low",   "ok",
+    "copy",   "weather", "storm", "wind",   "water",   "route", "blocked",
+    "arrive", "depart",  "relay", "signal", "status",  "check", "medic",
+    "supply", "drop",    "zone",  "alpha",  "bravo",   "delta", "echo",
+};
+constexpr size_t kVocabularySize = sizeof(kVocabulary) / sizeof(kVocabulary[0]);
+
+double MicrosecondsSince(Clock::time_point start, int n = 1) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+             .count() / n;
+}
+
+template <typename F> void TimeQuery(const char *name, F &&query) {
+  size_t results = 0;
+  auto start = Clock::now();
+  for (int i = 0; i < kQueryRepetitions; i++)
+    results += query().size();
+  printf("  %-36s %9.1f us/query (%zu results)\n", name,
+         MicrosecondsSince(start, kQueryRepetitions),
+         results / kQueryRepetitions);
+}
+
+} // namespace
+
+int main() {
+  char templ[] = "/tmp/bcp-history-bench-XXXXXX";
+  std::string dir = mkdtemp(templ);
+
+  std::mt19937 rng{1234};
+  const auto epoch = ChatHistory::Timestamp(std::chrono::hours(24 * 365 * 50));
+
+  {
+    ChatHistory history{};
+    history.Open(dir);
+    auto start = Clock::now();
+    std::string text{};
+    for (int i = 0; i < kMessages; i++) {
+      text.clear();
+      int words = 2 + rng() % 5;
+      for (int w = 0; w < words; w++) {
+        text += kVocabulary[rng() % kVocabularySize];
+        text += ' ';
+      }
+      text += std::to_string(i);
+      history.Record(rng() % kPeers, ChatHistory::Direction::kReceived,
+                     epoch + std::chrono::seconds(i),
+                     {reinterpret_cast<const uint8_t *>(text.data()),
+                      text.size()});
+    }
+    history.Sync();
+    printf("ingest: %d messages, %.2f us/message\n", kMessages,
+           MicrosecondsSince(start, kMessages));
+  }
+
+  auto start = Clock::now();
+  ChatHistory history{};
+  history.Open(dir);
+  printf("reopen + index rebuild: %.1f ms\n", MicrosecondsSince(start) / 1000);
+
+  printf("queries over %zu messages:\n", history.size());
+  TimeQuery("latest 20", [&] { return history.Search({}); });
+  TimeQuery("keyword (common)",
+            [&] { return history.Search({.keywords = "storm"}); });
+  TimeQuery("keyword (unique)",
+            [&] { return history.Search({.keywords = "123456"}); });
+  TimeQuery("two keywords", [&] {
+    return history.Search({.keywords = "medic blocked", .limit = 100});
+  });
+  TimeQuery("peer", [&] { return history.Search({.peer = 3}); });
+  TimeQuery("time window (1h)", [&] {
+    return history.Search({.since = epoch + std::chrono::seconds(150000),
+                           .until = epoch + std::chrono::seconds(153600),
+                           .limit = 10000});
+  });
+  TimeQuery("peer + keyword + window", [&] {
+    return history.Search({.peer = 5,
+                           .since = epoch + std::chrono::seconds(100000),
+                           .until = epoch + std::chrono::seconds(200000),
+                           .keywords = "relay signal"});
+  });
+
+  std::filesystem::remove_all(dir);
+  return 0;
+}
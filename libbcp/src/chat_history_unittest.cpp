@@ -0,0 +1,133 @@
+#include "chat_history.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::ChatHistory;
+using Direction = ChatHistory::Direction;
+using Status = ChatHistory::Status;
+using lora_chat::testutils::TempDir;
+
+std::span<const uint8_t> Bytes(std::string const &str) {
+  return {reinterpret_cast<const uint8_t *>(str.data()), str.size()};
+}
+
+const ChatHistory::Timestamp kEpoch{std::chrono::hours(24 * 365 * 50)};
+
+ChatHistory::Timestamp At(int seconds) {
+  return kEpoch + std::chrono::seconds(seconds);
+}
+
+TEST(ChatHistory, KeywordSearch) {
+  TempDir dir{"bcp-history"};
+  ChatHistory history{};
+  ASSERT_EQ(history.Open(dir.path()), Status::kSuccess);
+
+  history.Record(1, Direction::kSent, At(0), Bytes("Meet at the north ridge"));
+  history.Record(2, Direction::kReceived, At(1), Bytes("battery low, RIDGE camp"));
+  history.Record(1, Direction::kReceived, At(2), Bytes("ok see you there"));
+
+  auto results = history.Search({.keywords = "ridge"});
+  ASSERT_EQ(results.size(), 2u);
+  // Newest first
+  EXPECT_EQ(results[0].peer, 2u);
+  EXPECT_EQ(results[0].direction, Direction::kReceived);
+  EXPECT_EQ(results[1].text, "Meet at the north ridge");
+  EXPECT_EQ(results[1].direction, Direction::kSent);
+  EXPECT_EQ(results[1].timestamp, At(0));
+
+  EXPECT_EQ(history.Search({.keywords = "north RIDGE"}).size(), 1u);
+  EXPECT_EQ(history.Search({.keywords = "ridge missing"}).size(), 0u);
+  // Keywords match whole words only
+  EXPECT_EQ(history.Search({.keywords = "rid"}).size(), 0u);
+}
+
+TEST(ChatHistory, PeerAndTimeFilters) {
+  TempDir dir{"bcp-history"};
+  ChatHistory history{};
+  ASSERT_EQ(history.Open(dir.path()), Status::kSuccess);
+
+  for (int i = 0; i < 1000; i++) {
+    auto text = "status report " + std::to_string(i);
+    history.Record(i % 4, Direction::kReceived, At(i), Bytes(text));
+  }
+
+  auto by_peer = history.Search({.peer = 3, .limit = 1000});
+  ASSERT_EQ(by_peer.size(), 250u);
+  for (auto const &e : by_peer)
+    EXPECT_EQ(e.peer, 3u);
+
+  auto in_window = history.Search({.since = At(100), .until = At(199),
+                                   .limit = 1000});
+  ASSERT_EQ(in_window.size(), 100u);
+  EXPECT_EQ(in_window.front().timestamp, At(199));
+  EXPECT_EQ(in_window.back().timestamp, At(100));
+
+  auto combined = history.Search({.peer = 1, .since = At(500),
+                                  .keywords = "report", .limit = 3});
+  ASSERT_EQ(combined.size(), 3u);
+  EXPECT_EQ(combined[0].text, "status report 997");
+  EXPECT_EQ(combined[2].text, "status report 989");
+
+  EXPECT_EQ(history.Search({.keywords = "report 42"}).size(), 1u);
+  EXPECT_EQ(history.Search({.since = At(2000)}).size(), 0u);
+}
+
+TEST(ChatHistory, ClampsBackwardsClockSteps) {
+  TempDir dir{"bcp-history"};
+  ChatHistory history{};
+  ASSERT_EQ(history.Open(dir.path()), Status::kSuccess);
+
+  history.Record(1, Direction::kSent, At(100), Bytes("first"));
+  history.Record(1, Direction::kSent, At(50), Bytes("second"));
+  auto results = history.Search({.since = At(100)});
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[0].timestamp, At(100));
+}
+
+TEST(ChatHistory, RebuildsIndicesOnOpen) {
+  TempDir dir{"bcp-history"};
+  {
+    ChatHistory history{};
+    ASSERT_EQ(history.Open(dir.path()), Status::kSuccess);
+    for (int i = 0; i < 300; i++) {
+      auto text = (i % 10) ? "chatter" : "checkpoint alpha";
+      history.Record(7, Direction::kSent, At(i), Bytes(text));
+    }
+  }
+
+  ChatHistory history{};
+  ASSERT_EQ(history.Open(dir.path()), Status::kSuccess);
+  EXPECT_EQ(history.size(), 300u);
+  auto results = history.Search({.since = At(150), .keywords = "alpha",
+                                 .limit = 100});
+  ASSERT_EQ(results.size(), 15u);
+  EXPECT_EQ(results.back().timestamp, At(150));
+}
+
+TEST(ChatHistory, SearchableReadOnly) {
+  TempDir dir{"bcp-history"};
+  ChatHistory writer{};
+  ASSERT_EQ(writer.Open(dir.path()), Status::kSuccess);
+  writer.Record(1, Direction::kSent, At(0), Bytes("outbound ping"));
+  writer.Record(1, Direction::kReceived, At(1), Bytes("inbound pong"));
+  ASSERT_EQ(writer.Sync(), Status::kSuccess);
+
+  // Alongside the writer, as bcp-history runs alongside the agent
+  ChatHistory reader{};
+  ASSERT_EQ(reader.Open(dir.path(), {.read_only = true}), Status::kSuccess);
+  auto results = reader.Search({});
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[0].direction, Direction::kReceived);
+  EXPECT_EQ(results[1].direction, Direction::kSent);
+  EXPECT_NE(reader.Record(1, Direction::kSent, At(2), Bytes("refused")),
+            Status::kSuccess);
+}
+
+} // namespace
@@ -4,6 +4,7 @@
 #include <chrono>
 
 #include "time.hpp"
+#include "timer_wheel.hpp"
 
 namespace lora_chat {
 
@@ -40,6 +41,12 @@ public:
     return TimeOfNextActionImpl(t);
   }
 
+  /// Schedules `timer` for TimeOfNextAction(), for callers which wait on a
+  /// TimerWheel rather than sleeping a thread per deadline.
+  void ScheduleNextAction(TimerWheel &wheel, TimerWheel::Timer &timer) const {
+    wheel.Schedule(timer, TimeOfNextAction());
+  }
+
   TimePoint start_time() const { return start_time_; }
 
 private:
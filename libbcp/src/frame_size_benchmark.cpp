@@ -0,0 +1,100 @@
+#include "frame_sizer.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "packet_buffer.hpp"
+
+namespace {
+
+using lora_chat::FrameSizer;
+using Clock = std::chrono::steady_clock;
+
+// Packet error rates of a full frame, from a clean link to a barely usable one
+constexpr double kFullFrameLossRates[] = {0.0,  0.05, 0.1,  0.25, 0.5,
+                                          0.75, 0.9,  0.95, 0.99};
+// Slots simulated per link: a busy session's worth of hours
+constexpr int kSlots = 50000;
+
+constexpr size_t FrameBytes(size_t payload_bytes) {
+  return lora_chat::kSessionPayloadOffset + payload_bytes;
+}
+
+/// A link's chance of losing a frame of a given length
+struct Link {
+  // Per bit, independently...
+  double bit_error_rate;
+  // ...and per frame, whatever its length
+  double frame_loss_rate;
+
+  double Survival(size_t payload_bytes) const {
+    return (1 - frame_loss_rate) *
+           std::pow(1 - bit_error_rate, 8.0 * FrameBytes(payload_bytes));
+  }
+};
+
+/// Payload bytes delivered per slot, sending every frame at `payload_bytes`
+double FixedGoodput(Link const &link, size_t payload_bytes) {
+  return payload_bytes * link.Survival(payload_bytes);
+}
+
+struct AdaptiveResult {
+  double goodput;
+  double mean_payload_bytes;
+  double ns_per_record;
+};
+
+/// Payload bytes delivered per slot, letting a FrameSizer choose
+AdaptiveResult AdaptiveGoodput(Link const &link, uint32_t seed) {
+  std::mt19937 rng{seed};
+  FrameSizer sizer{};
+  double delivered = 0;
+  double payload = 0;
+  Clock::duration in_sizer{};
+  for (int slot = 0; slot < kSlots; slot++) {
+    const size_t length = sizer.NextPayloadBytes();
+    const bool ok = std::bernoulli_distribution(link.Survival(length))(rng);
+    if (ok)
+      delivered += length;
+    payload += length;
+    const auto start = Clock::now();
+    sizer.Record(length, ok);
+    in_sizer += Clock::now() - start;
+  }
+  return {delivered / kSlots, payload / kSlots,
+          std::chrono::duration<double, std::nano>(in_sizer).count() / kSlots};
+}
+
+void Run(const char *title, bool bit_errors) {
+  printf("%s\n", title);
+  printf("%8s %10s %10s %10s %10s %10s %8s %10s\n", "full PER", "fixed 4",
+         "fixed 8", "fixed 16", "fixed 32", "adaptive", "avg len",
+         "ns/record");
+  for (double per : kFullFrameLossRates) {
+    Link link{};
+    if (bit_errors)
+      link.bit_error_rate =
+          1 - std::pow(1 - per, 1.0 / (8.0 * FrameBytes(FrameSizer::kPayloadSizes.back())));
+    else
+      link.frame_loss_rate = per;
+
+    printf("%7.0f%%", 100 * per);
+    for (size_t size : FrameSizer::kPayloadSizes)
+      printf(" %10.2f", FixedGoodput(link, size));
+    auto adaptive = AdaptiveGoodput(link, static_cast<uint32_t>(per * 1000));
+    printf(" %10.2f %8.1f %10.0f\n", adaptive.goodput,
+           adaptive.mean_payload_bytes, adaptive.ns_per_record);
+  }
+  printf("\n");
+}
+
+} // namespace
+
+int main() {
+  printf("goodput in payload bytes per slot, over %d slots\n\n", kSlots);
+  Run("bit errors (longer frames lose more)", true);
+  Run("frame losses (every length loses alike)", false);
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "frame_sizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace lora_chat {
+
+namespace {
+
+double FrameBits(size_t payload_bytes, size_t overhead_bytes) {
+  return 8.0 * (overhead_bytes + payload_bytes);
+}
+
+} // namespace
+
+size_t FrameSizer::NextPayloadBytes() {
+  if (lengths_fitted_ <= 1 && current_ + 1 < kPayloadSizes.size() &&
+      ++frames_since_probe_ >= kProbeInterval) {
+    frames_since_probe_ = 0;
+    return kPayloadSizes[current_ + 1];
+  }
+  return PayloadBytes();
+}
+
+void FrameSizer::Record(size_t payload_bytes, bool delivered) {
+  payload_bytes = std::min(payload_bytes, kSessionPacketPayloadBytes);
+  // Including the shorter frames that end messages, which a lossy enough
+  // link could otherwise keep failing at the current size forever
+  if (payload_bytes > 0 && payload_bytes <= PayloadBytes()) {
+    if (delivered)
+      unexpected_losses_in_a_row_ = 0;
+    else if (LossRate(payload_bytes) < kUnexpectedLossRate)
+      unexpected_losses_in_a_row_++;
+  }
+  for (size_t i = 0; i < attempts_.size(); i++) {
+    attempts_[i] *= kDecay;
+    losses_[i] *= kDecay;
+  }
+  attempts_[payload_bytes] += 1;
+  if (!delivered)
+    losses_[payload_bytes] += 1;
+  Refit();
+  Choose();
+}
+
+double FrameSizer::ExpectedGoodput(size_t payload_bytes) const {
+  return payload_bytes * (1.0 - LossRate(payload_bytes));
+}
+
+double FrameSizer::LossRate(size_t payload_bytes) const {
+  return -std::expm1(std::min(0.0, log_survival_ -
+                                        bit_loss_rate_ *
+                                            FrameBits(payload_bytes,
+                                                      kOverheadBytes)));
+}
+
+void FrameSizer::Refit() {
+  std::array<size_t, kSessionPacketPayloadBytes + 1> lengths{};
+  size_t num_lengths = 0;
+  for (size_t i = 0; i < attempts_.size(); i++)
+    if (attempts_[i] >= kMinAttempts)
+      lengths[num_lengths++] = i;
+  lengths_fitted_ = num_lengths;
+  if (num_lengths == 0)
+    return; // Nothing to go on yet: keep what we had
+
+  // Maximum likelihood, over a grid: it's only a handful of lengths, and
+  // unlike a fit to observed loss rates it copes with lengths that have
+  // seen nothing but losses
+  double best_log_likelihood = -std::numeric_limits<double>::infinity();
+  for (int f = 0; f < kLengthIndependentLossSteps + kKneeSteps; f++) {
+    const double log_survival =
+        (f < kLengthIndependentLossSteps)
+            ? std::log1p(-static_cast<double>(f) / kLengthIndependentLossSteps)
+            : kMinKnee * (1 << (f - kLengthIndependentLossSteps));
+    for (int b = 0; b <= kBitLossRateSteps; b++) {
+      const double bit_loss_rate =
+          b ? kMinBitLossRate * std::pow(10.0, (b - 1.0) / kBitLossRateStepsPerDecade)
+            : 0.0;
+      // Between explanations that fit equally well (as they all do, given a
+      // single length), blaming bit errors alone errs towards shorter frames,
+      // which is the safer mistake while losing frames
+      double log_likelihood = -kNonBitErrorPenalty * std::abs(log_survival);
+      for (size_t k = 0; k < num_lengths; k++) {
+        const size_t i = lengths[k];
+        // Nothing is ever quite certain to get through, so that a stray
+        // loss among short frames doesn't rule out every model in which
+        // they get through
+        const double log_s = std::min(
+            std::log1p(-kStrayLossRate),
+            log_survival - bit_loss_rate * FrameBits(i, kOverheadBytes));
+        log_likelihood += (attempts_[i] - losses_[i]) * log_s +
+                          losses_[i] * std::log(-std::expm1(log_s));
+      }
+      if (log_likelihood > best_log_likelihood) {
+        best_log_likelihood = log_likelihood;
+        log_survival_ = log_survival;
+        bit_loss_rate_ = bit_loss_rate;
+      }
+    }
+  }
+}
+
+void FrameSizer::Choose() {
+  if (unexpected_losses_in_a_row_ >= kBackOffAfterLosses && current_ > 0) {
+    current_--;
+    unexpected_losses_in_a_row_ = 0;
+    return;
+  }
+  size_t best = current_;
+  for (size_t i = 0; i < kPayloadSizes.size(); i++)
+    if (ExpectedGoodput(kPayloadSizes[i]) > ExpectedGoodput(kPayloadSizes[best]))
+      best = i;
+  if (ExpectedGoodput(kPayloadSizes[best]) >
+      kHysteresis * ExpectedGoodput(kPayloadSizes[current_]))
+    // Down as far as it takes, but up only a size at a time: what the model
+    // says about lengths it has no recent outcomes for is a guess
+    current_ = std::min(best, current_ + 1);
+}
+
+} // namespace lora_chat
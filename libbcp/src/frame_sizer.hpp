@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "packet.hpp"
+
+namespace lora_chat {
+
+/// Picks how much payload to put in each session frame, from how often frames
+/// of each length have been getting through.
+///
+/// Every frame costs a slot however long it is, but longer frames are more
+/// likely to be hit: on a clean link the most goodput comes from full frames,
+/// on a noisy one from frames short enough to usually survive. Survival is
+/// modelled as min(1, exp(a - lambda * bits)): a per-bit loss rate lambda,
+/// with a < 0 for losses that hit frames of any length (collisions, fades),
+/// or a > 0 for links where frames up to some length always get through.
+/// It's fitted to the recent outcomes of each length by maximum likelihood,
+/// and the payload size chosen is the one with the largest payload *
+/// survival.
+///
+/// Trivially copyable, so that it can travel in a Session::State.
+class FrameSizer {
+public:
+  /// The payload sizes frames are cut to. Messages are chunked across frames,
+  /// so these needn't divide kSessionPacketPayloadBytes.
+  static constexpr std::array<uint8_t, 4> kPayloadSizes{4, 8, 16, 32};
+  static_assert(kPayloadSizes.back() == kSessionPacketPayloadBytes);
+
+  /// The payload size to cut the next frame carrying data to. While the model
+  /// has only one length to go on, which can't show how losses depend on
+  /// length, this now and then probes the size above the current one.
+  size_t NextPayloadBytes();
+  /// The payload size currently chosen, not counting probes
+  size_t PayloadBytes() const { return kPayloadSizes[current_]; }
+
+  /// Records whether a frame carrying `payload_bytes` got through, and
+  /// re-evaluates the choice of size
+  void Record(size_t payload_bytes, bool delivered);
+
+  /// Expected delivered payload bytes per frame of `payload_bytes`, under the
+  /// current model
+  double ExpectedGoodput(size_t payload_bytes) const;
+  /// The fitted chance that a frame carrying `payload_bytes` is lost
+  double LossRate(size_t payload_bytes) const;
+
+private:
+  // Header bytes sent with every frame, which are as exposed to bit errors as
+  // the payload
+  static constexpr size_t kOverheadBytes = 9;
+  // Outcomes are forgotten at this rate per frame, so that the model follows
+  // the link as it changes: roughly the last 50 frames count
+  static constexpr float kDecay = 0.98f;
+  // The grid the model is fitted over: a = log(1 - f) for f in steps of 0.1
+  // up to 0.9, or a knee in steps of doubling a from 0.5 to 32, and
+  // lambda from 1e-5 per bit (a 41-byte frame lost 0.3% of the time) up to
+  // 2e-1, in sixths of a decade, plus zero. The top of both is for links
+  // where frames up to some length always get through and longer ones never
+  // do, which takes a steep lambda and a knee far enough out to match.
+  // Coarse, but the choice between four sizes doesn't need it any finer, and
+  // refitting stays cheap enough to do for every frame.
+  static constexpr int kLengthIndependentLossSteps = 10;
+  static constexpr int kKneeSteps = 7;
+  static constexpr double kMinKnee = 0.5;
+  static constexpr double kMinBitLossRate = 1e-5;
+  static constexpr int kBitLossRateStepsPerDecade = 6;
+  static constexpr int kBitLossRateSteps = 27;
+  // Likelihood given up per unit of |a|, so that the fit only strays from
+  // plain bit errors when the outcomes at different lengths say so
+  static constexpr double kNonBitErrorPenalty = 0.1;
+  // The least chance of loss any frame is fitted with: collisions and the
+  // like take out the odd frame however short
+  static constexpr double kStrayLossRate = 0.02;
+  // One frame in this many probes, while probing
+  static constexpr uint32_t kProbeInterval = 16;
+  // How many (decayed) outcomes a length needs to stay part of the fit: a
+  // single one counts for about the last 50 frames, so that one lost probe
+  // keeps us from climbing straight back to where it was lost
+  static constexpr float kMinAttempts = 0.35f;
+  // Sessions give up after a few NACKs in a row, sooner than the model can be
+  // sure of anything, so this many losses in a row at up to the current size
+  // step down to the next size whatever the model says. Only losses the model
+  // gave less than even odds count: ones it expected, it's already
+  // accounted for in choosing the size.
+  static constexpr int kBackOffAfterLosses = 2;
+  static constexpr double kUnexpectedLossRate = 0.5;
+  // A better size has to beat the current one by this much before we switch,
+  // so that noise in the estimate doesn't flip us back and forth
+  static constexpr double kHysteresis = 1.1;
+
+  void Refit();
+  void Choose();
+
+  // Decayed counts, indexed by payload length
+  std::array<float, kSessionPacketPayloadBytes + 1> attempts_{};
+  std::array<float, kSessionPacketPayloadBytes + 1> losses_{};
+
+  // The fitted model: survival = min(1, exp(log_survival_ - bit_loss_rate_ *
+  // bits))
+  double log_survival_{0};
+  double bit_loss_rate_{0};
+
+  // Index into kPayloadSizes; full frames until we learn otherwise
+  size_t current_{kPayloadSizes.size() - 1};
+  int unexpected_losses_in_a_row_{0};
+  size_t lengths_fitted_{0};
+  uint32_t frames_since_probe_{0};
+};
+
+} // namespace lora_chat
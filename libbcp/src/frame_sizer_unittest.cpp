@@ -0,0 +1,180 @@
+#include "frame_sizer.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet_buffer.hpp"
+#include "session.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::FrameSizer;
+using lora_chat::kSessionPacketPayloadBytes;
+using lora_chat::SessionPacketPayload;
+using namespace lora_chat::testutils;
+
+// Each bit is flipped with probability `ber`; any flip loses the frame
+bool SurvivesBitErrors(std::mt19937 &rng, double ber, size_t payload_bytes) {
+  const double bits = 8.0 * (lora_chat::kSessionPayloadOffset + payload_bytes);
+  return std::bernoulli_distribution(std::pow(1 - ber, bits))(rng);
+}
+
+TEST(FrameSizer, FullFramesOnACleanLink) {
+  FrameSizer sizer{};
+  EXPECT_EQ(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+  for (int i = 0; i < 200; i++) sizer.Record(sizer.NextPayloadBytes(), true);
+  EXPECT_EQ(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+  EXPECT_LT(sizer.LossRate(kSessionPacketPayloadBytes), 0.05);
+}
+
+TEST(FrameSizer, ShortFramesWhenBitsAreLost) {
+  std::mt19937 rng{1};
+  // Enough that nine full frames in ten are lost
+  constexpr double kBer = 7e-3;
+  FrameSizer sizer{};
+  for (int i = 0; i < 500; i++) {
+    const size_t length = sizer.NextPayloadBytes();
+    sizer.Record(length, SurvivesBitErrors(rng, kBer, length));
+  }
+  EXPECT_LT(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+  EXPECT_GT(sizer.ExpectedGoodput(sizer.PayloadBytes()),
+            sizer.ExpectedGoodput(kSessionPacketPayloadBytes));
+}
+
+TEST(FrameSizer, FullFramesWhenLossesDontDependOnLength) {
+  std::mt19937 rng{2};
+  std::bernoulli_distribution delivered{0.5};
+  FrameSizer sizer{};
+  // Empty frames, as a session sends when there's nothing queued, see the
+  // same losses as full ones
+  for (int i = 0; i < 500; i++)
+    sizer.Record(i % 2 ? sizer.NextPayloadBytes() : 0, delivered(rng));
+  EXPECT_EQ(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+}
+
+TEST(FrameSizer, RecoversWhenTheLinkDoes) {
+  std::mt19937 rng{3};
+  FrameSizer sizer{};
+  for (int i = 0; i < 200; i++) {
+    const size_t length = sizer.NextPayloadBytes();
+    sizer.Record(length, SurvivesBitErrors(rng, 7e-3, length));
+  }
+  ASSERT_LT(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+  for (int i = 0; i < 500; i++) {
+    const size_t length = sizer.NextPayloadBytes();
+    sizer.Record(length, SurvivesBitErrors(rng, 1e-5, length));
+  }
+  EXPECT_EQ(sizer.PayloadBytes(), kSessionPacketPayloadBytes);
+}
+
+TEST(FrameSizer, SettlesUnderAHardThreshold) {
+  // As on a link which loses every frame longer than 16 bytes of payload,
+  // and nothing else
+  FrameSizer sizer{};
+  for (int i = 0; i < 200; i++) {
+    const size_t length = sizer.NextPayloadBytes();
+    sizer.Record(length, length <= 16);
+  }
+  // Once settled, a longer size is only tried again once its loss has been
+  // all but forgotten, and is given up on as soon as it's lost
+  int lost = 0;
+  bool was_over = false;
+  for (int i = 0; i < 200; i++) {
+    const size_t length = sizer.NextPayloadBytes();
+    sizer.Record(length, length <= 16);
+    lost += length > 16;
+    const bool over = sizer.PayloadBytes() > 16;
+    EXPECT_FALSE(over && was_over) << i;
+    was_over = over;
+  }
+  EXPECT_LE(lost, 200 / 50);
+  EXPECT_EQ(sizer.PayloadBytes(), 16u);
+}
+
+// Loses every frame longer than `max_payload_bytes` on air
+class ShortFramesOnlyRadio : public lora_chat::RadioInterface {
+public:
+  ShortFramesOnlyRadio(std::chrono::milliseconds timeout,
+                       size_t max_payload_bytes)
+      : radio_{timeout}, timeout_(timeout),
+        max_frame_bytes_(lora_chat::kSessionPayloadOffset + max_payload_bytes) {}
+
+  Status Transmit(std::span<uint8_t const> buffer) {
+    if (buffer.size() > max_frame_bytes_) {
+      std::this_thread::sleep_for(timeout_);
+      return Status::kSuccess;
+    }
+    return radio_.Transmit(buffer);
+  }
+  Status Receive(std::span<uint8_t> buffer_out) {
+    return radio_.Receive(buffer_out);
+  }
+  size_t MaximumMessageLength() const { return radio_.MaximumMessageLength(); }
+
+private:
+  LocalRadio radio_;
+  std::chrono::milliseconds timeout_;
+  size_t max_frame_bytes_;
+};
+
+std::vector<std::string> received_messages{};
+void KeepMessage(SessionPacketPayload &&msg) {
+  if (msg[0])
+    received_messages.emplace_back(reinterpret_cast<const char *>(msg.data()),
+                                   strnlen(reinterpret_cast<const char *>(
+                                               msg.data()),
+                                           msg.size()));
+}
+std::optional<SessionPacketPayload> NothingToSend() { return {}; }
+constexpr TextTag kChunkedTag{"sent in chunks, number"};
+
+TEST(FrameSizer, SessionsChunkMessagesToFit) {
+  constexpr int kPeriods = 60;
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+
+  ShortFramesOnlyRadio radio(std::chrono::milliseconds(8), 16);
+  lora_chat::MessagePipe sender_pipe{MakeMessage<kChunkedTag>};
+  lora_chat::MessagePipe receiver_pipe{NothingToSend, KeepMessage};
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  lora_chat::Session sender(start_time, 9, kTransmitTime, kGapTime, true);
+  lora_chat::Session receiver(start_time, 9, kTransmitTime, kGapTime, false);
+  std::thread receiver_thread([&]() {
+    receiver.SleepUntilStartTime();
+    for (int i = 0; i < 2 * kPeriods; i++)
+      receiver.ExecuteCurrentAction(radio, receiver_pipe);
+  });
+  sender.SleepUntilStartTime();
+  // Once it's had a chance to learn, the sender should mostly be cutting
+  // frames short enough, trying longer ones only now and then
+  int settled_actions = 0;
+  int short_enough = 0;
+  for (int i = 0; i < 2 * kPeriods; i++) {
+    sender.ExecuteCurrentAction(radio, sender_pipe);
+    if (i >= kPeriods) {
+      settled_actions++;
+      short_enough += sender.frame_sizer().PayloadBytes() <= 16;
+    }
+  }
+  receiver_thread.join();
+
+  EXPECT_GE(short_enough, settled_actions * 3 / 4);
+  // Each message takes a few frames, but arrives whole and in order
+  ASSERT_GE(received_messages.size(), 5u);
+  for (size_t i = 0; i < received_messages.size(); i++) {
+    char expected[64];
+    std::snprintf(expected, sizeof(expected), "%s %zu", kChunkedTag.str, i);
+    EXPECT_EQ(received_messages[i], expected);
+  }
+}
+
+} // namespace
@@ -0,0 +1,273 @@
+#include "gateway.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace lora_chat {
+
+namespace {
+
+// MessagePipe's callbacks carry no context, so the peer being served is
+// passed to them through here for the duration of each Session call
+struct Serving {
+  const GatewayPipe *pipe;
+  WireAddress peer;
+};
+thread_local Serving serving{};
+
+std::optional<SessionPacketPayload> GetMessageForServedPeer() {
+  return serving.pipe->GetNextMessageToSend(serving.peer);
+}
+
+void ReceiveMessageFromServedPeer(SessionPacketPayload &&message) {
+  serving.pipe->DepositReceivedMessage(serving.peer, std::move(message));
+}
+
+// Enough to drain every lane in one go on any gateway we're likely to build
+constexpr int kMaxEventsPerWait = 16;
+
+} // namespace
+
+Gateway::Entry::Entry() : timer(OnTimer, this) {}
+
+Gateway::Gateway(Duration transmission_duration, Duration gap_duration,
+                 GatewayPipe pipe, size_t max_peers)
+    : transmission_duration_(transmission_duration),
+      gap_duration_(gap_duration),
+      slots_per_lane_(1 + gap_duration / transmission_duration),
+      epoch_(Now()), pipe_(pipe),
+      session_pipe_(GetMessageForServedPeer, ReceiveMessageFromServedPeer),
+      pool_(2 * max_peers + kSpareFrames),
+      entries_(std::make_unique<Entry[]>(max_peers)),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  assert(transmission_duration > Duration::zero());
+  assert(max_peers < kFreeSlot && "peer table is indexed by uint16_t");
+
+  addresses_.reserve(max_peers);
+  entry_of_.reserve(max_peers);
+  free_entries_.reserve(max_peers);
+  // Handed out lowest index first
+  for (size_t i = max_peers; i-- > 0;) {
+    entries_[i].gateway = this;
+    free_entries_.push_back(i);
+  }
+
+  if (epoll_fd_ < 0) {
+    perror("Gateway: epoll_create1 failed");
+    return;
+  }
+  epoll_event ev{.events = EPOLLIN, .data = {.u64 = kWheelEvent}};
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wheel_.Fd(), &ev) < 0)
+    perror("Gateway: couldn't watch the timer wheel");
+}
+
+Gateway::~Gateway() {
+  // The radios outlive us, so nothing may be left to complete into our lanes
+  for (Lane &lane : lanes_) {
+    if (lane.in_flight &&
+        !lane.radio->WaitForCompletion(Now() + 2 * (transmission_duration_ +
+                                                    gap_duration_)))
+      printf("Gateway: lane %zu never completed its last operation\n",
+             static_cast<size_t>(&lane - &lanes_.front()));
+  }
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+size_t Gateway::AddRadio(RadioInterface &radio) {
+  const size_t index = lanes_.size();
+  Lane &lane = lanes_.emplace_back();
+  lane.radio = &radio;
+  lane.gateway = this;
+  lane.slots.assign(slots_per_lane_, kFreeSlot);
+
+  epoll_event ev{.events = EPOLLIN, .data = {.u64 = index}};
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, radio.CompletionFd(), &ev) < 0)
+    perror("Gateway: couldn't watch the radio's completions");
+  return index;
+}
+
+ptrdiff_t Gateway::Find(Address peer) const {
+  for (size_t i = 0; i < addresses_.size(); i++)
+    if (addresses_[i] == peer) return i;
+  return -1;
+}
+
+TimePoint Gateway::SlotStartAtOrAfter(size_t slot, TimePoint t) const {
+  const Duration period = 2 * (transmission_duration_ + gap_duration_);
+  const TimePoint first = epoch_ + slot * transmission_duration_;
+  if (t <= first) return first;
+  const auto periods = (t - first + period - Duration(1)) / period;
+  return first + periods * period;
+}
+
+std::optional<Gateway::Assignment> Gateway::Admit(Address peer,
+                                                  Duration lead_time) {
+  if (free_entries_.empty() || Find(peer) >= 0) return {};
+
+  Lane *lane = nullptr;
+  for (Lane &candidate : lanes_) {
+    if (candidate.load == slots_per_lane_) continue;
+    if (!lane || candidate.load < lane->load) lane = &candidate;
+  }
+  if (!lane) return {};
+
+  size_t slot = 0;
+  while (lane->slots[slot] != kFreeSlot) slot++;
+
+  const uint16_t index = free_entries_.back();
+  free_entries_.pop_back();
+  Entry &entry = entries_[index];
+  const TimePoint start = SlotStartAtOrAfter(slot, Now() + lead_time);
+  const Session::Id id = next_session_id_++;
+  entry.session.emplace(start, id, transmission_duration_, gap_duration_,
+                        true, pool_);
+  entry.peer = peer;
+  entry.lane = lane - &lanes_.front();
+  entry.slot = slot;
+
+  lane->slots[slot] = index;
+  lane->load++;
+  addresses_.push_back(peer);
+  entry_of_.push_back(index);
+  wheel_.Schedule(entry.timer, start);
+
+  return Assignment{.lane = entry.lane,
+                    .slot = slot,
+                    .session_id = id,
+                    .start_time = start,
+                    .transmission_duration = transmission_duration_,
+                    .gap_duration = gap_duration_};
+}
+
+bool Gateway::Remove(Address peer) {
+  auto i = Find(peer);
+  if (i < 0) return false;
+  EndSession(i);
+  return true;
+}
+
+void Gateway::EndSession(size_t i) {
+  const uint16_t index = entry_of_[i];
+  Entry &entry = entries_[index];
+  Lane &lane = lanes_[entry.lane];
+
+  wheel_.Cancel(entry.timer);
+  // A receive of theirs may still be in flight; it'll complete to no one
+  if (lane.receiver == &entry) lane.receiver = nullptr;
+  lane.slots[entry.slot] = kFreeSlot;
+  lane.load--;
+  entry.session.reset();
+  free_entries_.push_back(index);
+
+  addresses_[i] = addresses_.back();
+  addresses_.pop_back();
+  entry_of_[i] = entry_of_.back();
+  entry_of_.pop_back();
+}
+
+void Gateway::OnTimer(void *ctx) {
+  auto &entry = *static_cast<Entry *>(ctx);
+  entry.gateway->Serve(entry);
+}
+
+void Gateway::OnCompletion(void *ctx, RadioInterface::Status status) {
+  auto &lane = *static_cast<Lane *>(ctx);
+  lane.in_flight = false;
+  Entry *receiver = lane.receiver;
+  PacketRef frame = std::move(lane.frame);
+  if (!receiver) return; // A transmission, or the peer has since gone
+  lane.receiver = nullptr;
+
+  serving = {&lane.gateway->pipe_, receiver->peer};
+  receiver->session->CompleteReceive(status, std::move(frame),
+                                     lane.gateway->session_pipe_);
+}
+
+void Gateway::Serve(Entry &entry) {
+  Lane &lane = lanes_[entry.lane];
+  // The previous slot's completion may be due at this very instant, and not
+  // yet have been dispatched
+  if (lane.in_flight) lane.radio->DispatchCompletions();
+
+  serving = {&pipe_, entry.peer};
+  PacketRef frame{};
+  auto action = entry.session->PrepareCurrentAction(session_pipe_, frame);
+  const TimePoint deadline = entry.session->EndOfCurrentAction();
+  const RadioInterface::Completion done{OnCompletion, &lane};
+
+  bool submitted = false;
+  switch (action) {
+  case AgentAction::kReceive:
+    if (!lane.in_flight) frame = pool_.Acquire();
+    // Cleared, so that stale bytes can't pass for a received packet
+    if (frame) frame->bytes = {};
+    submitted = frame && lane.radio->SubmitReceive(frame->bytes.span(),
+                                                   deadline, done);
+    if (submitted) {
+      lane.in_flight = true;
+      lane.frame = std::move(frame);
+      lane.receiver = &entry;
+    } else {
+      entry.session->CompleteReceive(RadioInterface::Status::kTimeout, {},
+                                     session_pipe_);
+    }
+    break;
+  case AgentAction::kTransmitNextMessage:
+  case AgentAction::kTransmitNack:
+  case AgentAction::kRetransmitMessage:
+    // Otherwise, as far as the session is concerned, the frame was lost
+    submitted = !lane.in_flight &&
+                lane.radio->SubmitTransmitStaged(frame->StagedSessionFrame(),
+                                                 deadline, done);
+    if (submitted) {
+      lane.in_flight = true;
+      lane.frame = std::move(frame);
+    }
+    break;
+  case AgentAction::kTerminateSession:
+  case AgentAction::kSessionComplete: {
+    const Address peer = entry.peer;
+    EndSession(Find(peer));
+    pipe_.NotifySessionEnded(peer);
+    return;
+  }
+  case AgentAction::kSleepUntilNextAction:
+    submitted = true;
+    break;
+  }
+
+  if (!submitted) missed_actions_++;
+  entry.session->ScheduleNextAction(wheel_, entry.timer);
+}
+
+size_t Gateway::RunOnce(Duration timeout) {
+  epoll_event events[kMaxEventsPerWait];
+  const auto timeout_ms =
+      std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  int n = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, timeout_ms);
+  if (n < 0) {
+    if (errno != EINTR) perror("Gateway: epoll_wait failed");
+    return 0;
+  }
+
+  size_t dispatched = 0;
+  for (int i = 0; i < n; i++) {
+    const uint64_t source = events[i].data.u64;
+    if (source == kWheelEvent)
+      dispatched += wheel_.Dispatch();
+    else
+      dispatched += lanes_[source].radio->DispatchCompletions();
+  }
+  return dispatched;
+}
+
+void Gateway::Run() {
+  while (!stopping_)
+    RunOnce(kStopCheckInterval);
+}
+
+} // namespace lora_chat
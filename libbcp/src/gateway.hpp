@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "packet.hpp"
+#include "packet_buffer.hpp"
+#include "radio_interface.hpp"
+#include "session.hpp"
+#include "time.hpp"
+#include "timer_wheel.hpp"
+#include "wire_packet.hpp"
+
+namespace lora_chat {
+
+/// The gateway's counterpart to MessagePipe: the same callbacks, told which
+/// peer each message is to or from.
+class GatewayPipe {
+public:
+  using GetMessageFunc = std::optional<SessionPacketPayload> (*)(WireAddress peer);
+  using ReceiveMessageFunc = void (*)(WireAddress peer,
+                                      SessionPacketPayload &&message);
+  using SessionEndedFunc = void (*)(WireAddress peer);
+
+  GatewayPipe() = default;
+  GatewayPipe(GetMessageFunc get_msg, ReceiveMessageFunc recv_msg)
+      : get_msg_(get_msg), recv_msg_(recv_msg) {}
+  GatewayPipe(GetMessageFunc get_msg, ReceiveMessageFunc recv_msg,
+              SessionEndedFunc session_ended)
+      : get_msg_(get_msg), recv_msg_(recv_msg),
+        session_ended_(session_ended) {}
+
+  std::optional<SessionPacketPayload> GetNextMessageToSend(WireAddress peer) const {
+    return get_msg_(peer);
+  }
+  void DepositReceivedMessage(WireAddress peer,
+                              SessionPacketPayload &&message) const {
+    recv_msg_(peer, std::move(message));
+  }
+  void NotifySessionEnded(WireAddress peer) const { session_ended_(peer); }
+
+private:
+  GetMessageFunc get_msg_{DontSendAMessage};
+  ReceiveMessageFunc recv_msg_{DropMessage};
+  SessionEndedFunc session_ended_{IgnoreSessionEnded};
+
+  static std::optional<SessionPacketPayload> DontSendAMessage(WireAddress) {
+    return {};
+  }
+  static void DropMessage(WireAddress, SessionPacketPayload &&) { return; }
+  static void IgnoreSessionEnded(WireAddress) { return; }
+};
+
+/// Serves many peers at once from a pool of radios ("lanes"), each of which
+/// may be on its own channel and spreading factor.
+///
+/// Every session the gateway runs shares one transmission/gap duration, and
+/// the gateway initiates all of them, so a lane's period 2(T+G) divides into
+/// 1 + G/T slots: slot k transmits at offset kT and receives at T+G+kT, and
+/// a lane is never asked to do two things at once. Peers are assigned to the
+/// least-loaded lane.
+///
+/// Everything runs from a single thread: one epoll set waits on a TimerWheel
+/// holding every session's next deadline, plus every radio's completion fd.
+/// Nothing allocates once the gateway has been constructed and its radios
+/// added; peers live in a table sized up front, and frames come from the
+/// gateway's own PacketBufferPool.
+///
+/// Not thread-safe, save for Stop(): admit and remove peers from the thread
+/// running the loop (e.g. from a pipe callback), or while it isn't running.
+class Gateway {
+public:
+  using Address = WireAddress;
+
+  /// Where and when a peer's session takes place. The peer runs it as a
+  /// follower, tuned to the lane's radio settings.
+  struct Assignment {
+    size_t lane;
+    size_t slot;
+    Session::Id session_id;
+    TimePoint start_time;
+    Duration transmission_duration;
+    Duration gap_duration;
+  };
+
+  static constexpr size_t kDefaultMaxPeers = 512;
+  static constexpr Duration kDefaultAdmissionLeadTime{
+      std::chrono::milliseconds(100)};
+
+  Gateway(Duration transmission_duration, Duration gap_duration,
+          GatewayPipe pipe, size_t max_peers = kDefaultMaxPeers);
+  ~Gateway();
+  Gateway(const Gateway &) = delete;
+  Gateway &operator=(const Gateway &) = delete;
+
+  /// Adds a lane driven by `radio`, which must outlive the gateway.
+  /// Returns its index.
+  size_t AddRadio(RadioInterface &radio);
+
+  /// Starts a session with `peer` in a free slot on the least-loaded lane,
+  /// beginning no sooner than `lead_time` from now. Returns nullopt if every
+  /// slot (or the peer table) is full, or `peer` already has a session.
+  std::optional<Assignment>
+  Admit(Address peer, Duration lead_time = kDefaultAdmissionLeadTime);
+  /// Ends `peer`'s session, if it has one.
+  bool Remove(Address peer);
+
+  size_t Lanes() const { return lanes_.size(); }
+  size_t SlotsPerLane() const { return slots_per_lane_; }
+  size_t LaneLoad(size_t lane) const { return lanes_[lane].load; }
+  size_t Peers() const { return addresses_.size(); }
+  /// Slots which went by without their action, because the lane's radio was
+  /// still busy with the one before
+  uint64_t MissedActions() const { return missed_actions_; }
+
+  /// Waits up to `timeout` for something to do, and does it.
+  /// Returns the number of timers and completions dispatched.
+  size_t RunOnce(Duration timeout);
+  /// Runs the loop until Stop() is called (from any thread, at any time:
+  /// once stopped, Run returns straight away).
+  void Run();
+  void Stop() { stopping_ = true; }
+
+private:
+  struct Entry;
+
+  struct Lane {
+    RadioInterface *radio;
+    Gateway *gateway;
+    // Entry index per slot, or kFreeSlot
+    std::vector<uint16_t> slots{};
+    size_t load{0};
+    bool in_flight{false};
+    // The frame in flight, and whose receive it is, if it's a receive
+    PacketRef frame{};
+    Entry *receiver{nullptr};
+  };
+
+  struct Entry {
+    Entry();
+
+    std::optional<Session> session{};
+    TimerWheel::Timer timer;
+    Gateway *gateway{nullptr};
+    Address peer{0};
+    uint16_t lane{0};
+    uint16_t slot{0};
+  };
+
+  static constexpr uint16_t kFreeSlot = UINT16_MAX;
+  // Every session holds on to its last frame sent and received; these are
+  // for frames in flight, and messages the application hangs on to
+  static constexpr size_t kSpareFrames = 64;
+  static constexpr uint64_t kWheelEvent = UINT64_MAX;
+  // How long Run() waits between checks for Stop()
+  static constexpr Duration kStopCheckInterval{std::chrono::milliseconds(100)};
+
+  static void OnTimer(void *ctx);
+  static void OnCompletion(void *ctx, RadioInterface::Status status);
+
+  void Serve(Entry &entry);
+  void EndSession(size_t index);
+  /// Index into addresses_/entry_of_, or -1
+  ptrdiff_t Find(Address peer) const;
+  TimePoint SlotStartAtOrAfter(size_t slot, TimePoint t) const;
+
+  Duration transmission_duration_;
+  Duration gap_duration_;
+  size_t slots_per_lane_;
+  // Every slot's schedule is measured from here
+  TimePoint epoch_;
+  GatewayPipe pipe_;
+  // Bridges Session's context-free MessagePipe callbacks over to pipe_
+  MessagePipe session_pipe_;
+
+  // Declared ahead of everything holding frames, so that it's destroyed last
+  PacketBufferPool pool_;
+
+  // The session table, split so that admission's lookups scan a few dense
+  // cache lines rather than the (much larger) entries themselves
+  std::vector<Address> addresses_;
+  std::vector<uint16_t> entry_of_;
+  std::unique_ptr<Entry[]> entries_;
+  std::vector<uint16_t> free_entries_;
+
+  // A deque so that lanes stay put as more are added: completions point at them
+  std::deque<Lane> lanes_{};
+  TimerWheel wheel_{};
+  int epoll_fd_;
+  uint64_t missed_actions_{0};
+  Session::Id next_session_id_{1};
+  std::atomic<bool> stopping_{false};
+};
+
+} // namespace lora_chat
@@ -0,0 +1,161 @@
+#include "gateway.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::Gateway;
+using lora_chat::GatewayPipe;
+using lora_chat::MessagePipe;
+using lora_chat::SessionPacketPayload;
+using lora_chat::WireAddress;
+using namespace lora_chat::testutils;
+using std::chrono::milliseconds;
+
+constexpr WireAddress kFirstPeer = 100;
+constexpr int kPeers = 4;
+
+std::array<std::atomic<int>, kPeers> gateway_received{};
+std::array<std::atomic<int>, kPeers> peer_received{};
+std::atomic<int> sessions_ended{0};
+
+std::optional<SessionPacketPayload> MessageForPeer(WireAddress peer) {
+  SessionPacketPayload p{0};
+  std::snprintf(reinterpret_cast<char *>(&p), p.size(), "to %u", peer);
+  return p;
+}
+
+void MessageFromPeer(WireAddress peer, SessionPacketPayload &&) {
+  gateway_received[peer - kFirstPeer]++;
+}
+
+void SessionEnded(WireAddress) { sessions_ended++; }
+
+template <int Peer>
+void PeerReceived(SessionPacketPayload &&msg) {
+  char expected[16] = {};
+  std::snprintf(expected, sizeof(expected), "to %u", kFirstPeer + Peer);
+  // The first message out of a session is the empty one it starts off with
+  if (msg[0]) {
+    EXPECT_STREQ(reinterpret_cast<char *>(msg.data()), expected);
+  }
+  peer_received[Peer]++;
+}
+
+constexpr TextTag kPeerTag{"peer"};
+constexpr MessagePipe::ReceiveMessageFunc kPeerReceivers[kPeers] = {
+    PeerReceived<0>, PeerReceived<1>, PeerReceived<2>, PeerReceived<3>};
+
+TEST(Gateway, AssignsSlotsByLoad) {
+  CountingRadio a{};
+  CountingRadio b{};
+  constexpr auto kTransmitTime = milliseconds(10);
+  constexpr auto kGapTime = milliseconds(25);
+  Gateway gateway{kTransmitTime, kGapTime, GatewayPipe{}};
+  gateway.AddRadio(a);
+  gateway.AddRadio(b);
+  ASSERT_EQ(gateway.SlotsPerLane(), 3u);
+
+  const auto admitted_after = lora_chat::Now();
+  std::vector<Gateway::Assignment> assignments{};
+  for (WireAddress peer = kFirstPeer; peer < kFirstPeer + 6; peer++) {
+    auto assignment = gateway.Admit(peer);
+    ASSERT_TRUE(assignment);
+    EXPECT_GE(assignment->start_time,
+              admitted_after + Gateway::kDefaultAdmissionLeadTime);
+    assignments.push_back(*assignment);
+  }
+  // Alternating between the lanes as they fill up
+  EXPECT_EQ(gateway.LaneLoad(0), 3u);
+  EXPECT_EQ(gateway.LaneLoad(1), 3u);
+  EXPECT_EQ(assignments[0].lane, 0u);
+  EXPECT_EQ(assignments[1].lane, 1u);
+
+  // Slots on a lane are staggered by exactly one transmission time
+  const auto period = 2 * (kTransmitTime + kGapTime);
+  auto modulo_period = [&](lora_chat::Duration d) {
+    return ((d % period) + period) % period;
+  };
+  for (auto const &x : assignments) {
+    for (auto const &y : assignments) {
+      if (x.lane != y.lane) continue;
+      const int slots_apart =
+          static_cast<int>(x.slot) - static_cast<int>(y.slot);
+      EXPECT_EQ(modulo_period(x.start_time - y.start_time),
+                modulo_period(slots_apart * kTransmitTime));
+    }
+  }
+
+  EXPECT_FALSE(gateway.Admit(kFirstPeer + 6)) << "every slot is taken";
+  EXPECT_TRUE(gateway.Remove(kFirstPeer + 3));
+  EXPECT_FALSE(gateway.Remove(kFirstPeer + 3));
+  EXPECT_FALSE(gateway.Admit(kFirstPeer)) << "already has a session";
+  auto reused = gateway.Admit(kFirstPeer + 6);
+  ASSERT_TRUE(reused);
+  EXPECT_EQ(reused->lane, assignments[3].lane);
+  EXPECT_EQ(reused->slot, assignments[3].slot);
+  EXPECT_NE(reused->session_id, assignments[3].session_id);
+  EXPECT_EQ(gateway.Peers(), 6u);
+}
+
+TEST(Gateway, ServesPeersOnEveryLane) {
+  constexpr auto kTransmitTime = milliseconds(30);
+  constexpr auto kGapTime = milliseconds(65);
+  constexpr auto kRadioTimeout = milliseconds(20);
+  constexpr auto kPeerRunTime = milliseconds(1500);
+  // Each lane is a medium of its own, as if on different channels
+  std::array<LocalRadio, 2> lanes{LocalRadio{kRadioTimeout},
+                                  LocalRadio{kRadioTimeout}};
+
+  Gateway gateway{kTransmitTime, kGapTime,
+                  GatewayPipe{MessageForPeer, MessageFromPeer, SessionEnded}};
+  for (auto &lane : lanes) gateway.AddRadio(lane);
+
+  std::vector<Gateway::Assignment> assignments{};
+  for (int i = 0; i < kPeers; i++)
+    assignments.push_back(*gateway.Admit(kFirstPeer + i));
+
+  std::thread loop([&]() { gateway.Run(); });
+  std::vector<std::thread> peers{};
+  for (int i = 0; i < kPeers; i++) {
+    peers.emplace_back([&, i]() {
+      auto const &a = assignments[i];
+      lora_chat::Session session{a.start_time, a.session_id,
+                                 a.transmission_duration, a.gap_duration,
+                                 false};
+      MessagePipe pipe{MakeMessage<kPeerTag>, kPeerReceivers[i]};
+      session.SleepUntilStartTime();
+      const auto stop_at = a.start_time + kPeerRunTime;
+      while (lora_chat::Now() < stop_at)
+        session.ExecuteCurrentAction(lanes[a.lane], pipe);
+    });
+  }
+  for (auto &peer : peers) peer.join();
+
+  // With its peers gone quiet, the gateway times each session out
+  const auto give_up_at = lora_chat::Now() + std::chrono::seconds(3);
+  while (sessions_ended < kPeers && lora_chat::Now() < give_up_at)
+    std::this_thread::sleep_for(milliseconds(10));
+  gateway.Stop();
+  loop.join();
+
+  EXPECT_EQ(sessions_ended, kPeers);
+  EXPECT_EQ(gateway.Peers(), 0u);
+  EXPECT_EQ(gateway.LaneLoad(0), 0u);
+  EXPECT_EQ(gateway.LaneLoad(1), 0u);
+  for (int i = 0; i < kPeers; i++) {
+    EXPECT_GE(gateway_received[i], 5) << "from peer " << i;
+    EXPECT_GE(peer_received[i], 5) << "to peer " << i;
+  }
+}
+
+} // namespace
@@ -0,0 +1,89 @@
+#include "guard_times.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lora_chat {
+
+namespace {
+
+using Micros = std::chrono::duration<double, std::micro>;
+
+} // namespace
+
+void GuardTimeCalibrator::Histogram::Record(Duration latency) {
+  const double us = std::max(Micros(latency).count(), 1.0);
+  const size_t bucket = std::min<size_t>(
+      static_cast<size_t>(std::log2(us) * kBucketsPerOctave), kBuckets - 1);
+  weights_[bucket] += next_weight_;
+  total_ += next_weight_;
+  next_weight_ /= kDecay;
+  samples_++;
+
+  if (next_weight_ > kRescaleAbove) {
+    for (double &w : weights_)
+      w /= next_weight_;
+    total_ /= next_weight_;
+    next_weight_ = 1;
+  }
+}
+
+Duration GuardTimeCalibrator::Histogram::Quantile(double q) const {
+  if (total_ <= 0)
+    return Duration::zero();
+  const double wanted = q * total_;
+  double seen = 0;
+  size_t bucket = 0;
+  for (; bucket < kBuckets - 1; bucket++) {
+    seen += weights_[bucket];
+    if (seen >= wanted)
+      break;
+  }
+  const double upper_us =
+      std::exp2(static_cast<double>(bucket + 1) / kBucketsPerOctave);
+  return std::chrono::ceil<Duration>(Micros(upper_us));
+}
+
+void GuardTimeCalibrator::Record(Switch kind, Duration latency) {
+  For(kind).Record(latency);
+}
+
+void GuardTimeCalibrator::RecordOverrun(Switch kind, Duration overrun) {
+  OverrunsOf(kind).Record(std::max(overrun, Duration::zero()));
+}
+
+Duration GuardTimeCalibrator::Percentile(Switch kind, double q) const {
+  return For(kind).Quantile(q);
+}
+
+Duration GuardTimeCalibrator::OverrunPercentile(Switch kind, double q) const {
+  return OverrunsOf(kind).Quantile(q);
+}
+
+uint64_t GuardTimeCalibrator::Samples(Switch kind) const {
+  return For(kind).samples();
+}
+
+uint64_t GuardTimeCalibrator::OverrunSamples(Switch kind) const {
+  return OverrunsOf(kind).samples();
+}
+
+std::optional<Duration> GuardTimeCalibrator::SafeGap() const {
+  if (to_receive_.samples() < kMinSamples ||
+      to_transmit_.samples() < kMinSamples ||
+      receive_overruns_.samples() < kMinSamples ||
+      transmit_overruns_.samples() < kMinSamples)
+    return {};
+  const Duration to_receive = to_receive_.Quantile(kPercentile);
+  const Duration to_transmit = to_transmit_.Quantile(kPercentile);
+  // Late going live stands in for running late, unless running late has
+  // been seen to take longer
+  const Duration needed = std::max(
+      {to_receive + to_transmit,
+       receive_overruns_.Quantile(kPercentile) + to_transmit,
+       transmit_overruns_.Quantile(kPercentile) + to_receive});
+  return std::max(std::chrono::ceil<Duration>(needed * kSafetyFactor),
+                  kMinGap);
+}
+
+} // namespace lora_chat
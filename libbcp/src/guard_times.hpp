@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// Learns how long this host really takes to turn the radio around, from
+/// sessions as they run, and the guard times that follow from it.
+///
+/// Each time a session starts a transmission or a receive, it records how
+/// long after the window opened the radio was actually live (see
+/// RadioInterface::LastOperationLive): the scheduler's wake-up, the SPI
+/// writes that set the operation up, and the chip's own mode switch, all in
+/// one. Switching to receive is the TX-to-RX turnaround, switching to
+/// transmit the RX-to-TX.
+///
+/// An operation that goes live late also runs late, into the gap after its
+/// window, and the next one must still be live when its window opens, so
+/// the gap has to cover one turnaround of each kind. Operations can run over
+/// for other reasons too (a blocking receive waits out its own timeout,
+/// whatever the window), so sessions also record how far past the end of its
+/// window each one actually finished, and the gap has to cover that and the
+/// turnaround into the next. Each comes from a high percentile of what's
+/// been seen, with a safety factor on top.
+class GuardTimeCalibrator {
+public:
+  enum class Switch {
+    kToReceive,
+    kToTransmit,
+  };
+
+  static constexpr double kPercentile = 0.999;
+  static constexpr double kSafetyFactor = 1.5;
+  /// Samples of each kind, at least, before there's anything to go on
+  static constexpr size_t kMinSamples = 200;
+  /// However quick the turnarounds, a gap no shorter than this
+  static constexpr Duration kMinGap{std::chrono::milliseconds(2)};
+
+  void Record(Switch kind, Duration latency);
+  /// Records that the operation `kind` switched to (a receive for
+  /// kToReceive) finished `overrun` after its window closed; zero if it
+  /// finished in time
+  void RecordOverrun(Switch kind, Duration overrun);
+
+  /// The `q`th quantile of the recent latencies of `kind`, rounded up to its
+  /// bucket's upper edge; zero if there are none
+  Duration Percentile(Switch kind, double q) const;
+  /// Likewise for the recent overruns of the operation `kind` switched to
+  Duration OverrunPercentile(Switch kind, double q) const;
+  /// How many samples of `kind` have been recorded, all told
+  uint64_t Samples(Switch kind) const;
+  /// Likewise for overruns of the operation `kind` switched to
+  uint64_t OverrunSamples(Switch kind) const;
+
+  /// The least gap between windows which leaves room for an operation's
+  /// overrun and the turnaround into the next, or nullopt until there are
+  /// kMinSamples of each latency and each overrun
+  std::optional<Duration> SafeGap() const;
+
+private:
+  /// Latencies from a microsecond up to about a second, on a log scale: an
+  /// eighth of an octave (9%) per bucket. Older samples count for less and
+  /// less, kDecay per sample, so that the percentiles follow the host's load.
+  class Histogram {
+  public:
+    void Record(Duration latency);
+    Duration Quantile(double q) const;
+    uint64_t samples() const { return samples_; }
+
+  private:
+    static constexpr int kBucketsPerOctave = 8;
+    static constexpr size_t kBuckets = 20 * kBucketsPerOctave;
+    // Roughly the last few thousand samples count
+    static constexpr double kDecay = 0.9995;
+    // Rather than shrinking every bucket each sample, each sample counts for
+    // more than the one before, and everything is scaled back down now and
+    // then
+    static constexpr double kRescaleAbove = 1e100;
+
+    std::array<double, kBuckets> weights_{};
+    double total_{0};
+    double next_weight_{1};
+    uint64_t samples_{0};
+  };
+
+  Histogram &For(Switch kind) {
+    return kind == Switch::kToReceive ? to_receive_ : to_transmit_;
+  }
+  Histogram const &For(Switch kind) const {
+    return kind == Switch::kToReceive ? to_receive_ : to_transmit_;
+  }
+
+  Histogram &OverrunsOf(Switch kind) {
+    return kind == Switch::kToReceive ? receive_overruns_
+                                      : transmit_overruns_;
+  }
+  Histogram const &OverrunsOf(Switch kind) const {
+    return kind == Switch::kToReceive ? receive_overruns_
+                                      : transmit_overruns_;
+  }
+
+  Histogram to_receive_{};
+  Histogram to_transmit_{};
+  Histogram receive_overruns_{};
+  Histogram transmit_overruns_{};
+};
+
+} // namespace lora_chat
@@ -0,0 +1,126 @@
+#include "guard_times.hpp"
+
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::GuardTimeCalibrator;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using Switch = GuardTimeCalibrator::Switch;
+
+TEST(GuardTimeCalibrator, NothingToGoOnUntilThereAreEnoughOfEach) {
+  GuardTimeCalibrator calibrator{};
+  EXPECT_EQ(calibrator.Percentile(Switch::kToReceive, 0.5),
+            lora_chat::Duration::zero());
+  for (size_t i = 0; i < GuardTimeCalibrator::kMinSamples; i++) {
+    calibrator.RecordOverrun(Switch::kToReceive, lora_chat::Duration::zero());
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+  for (size_t i = 0; i < GuardTimeCalibrator::kMinSamples; i++)
+    calibrator.Record(Switch::kToReceive, milliseconds(1));
+  for (size_t i = 1; i < GuardTimeCalibrator::kMinSamples; i++)
+    calibrator.Record(Switch::kToTransmit, milliseconds(1));
+  EXPECT_FALSE(calibrator.SafeGap().has_value());
+
+  calibrator.Record(Switch::kToTransmit, milliseconds(1));
+  EXPECT_EQ(calibrator.Samples(Switch::kToTransmit),
+            GuardTimeCalibrator::kMinSamples);
+  EXPECT_TRUE(calibrator.SafeGap().has_value());
+}
+
+TEST(GuardTimeCalibrator, NothingToGoOnWithoutOverruns) {
+  GuardTimeCalibrator calibrator{};
+  for (size_t i = 0; i < GuardTimeCalibrator::kMinSamples; i++) {
+    calibrator.Record(Switch::kToReceive, milliseconds(1));
+    calibrator.Record(Switch::kToTransmit, milliseconds(1));
+  }
+  EXPECT_FALSE(calibrator.SafeGap().has_value());
+}
+
+TEST(GuardTimeCalibrator, GapCoversTheSlowTailOfBoth) {
+  GuardTimeCalibrator calibrator{};
+  // Mostly quick, with one in a hundred held up by the scheduler
+  for (int i = 0; i < 10000; i++) {
+    const bool late = (i % 100) == 0;
+    calibrator.Record(Switch::kToReceive,
+                      late ? milliseconds(8) : microseconds(400));
+    calibrator.Record(Switch::kToTransmit,
+                      late ? milliseconds(4) : microseconds(250));
+    calibrator.RecordOverrun(Switch::kToReceive, lora_chat::Duration::zero());
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+
+  // Within a bucket (9%) of the truth, and never under it
+  const auto rx_median = calibrator.Percentile(Switch::kToReceive, 0.5);
+  EXPECT_GE(rx_median, microseconds(400));
+  EXPECT_LE(rx_median, microseconds(440));
+  const auto rx_tail =
+      calibrator.Percentile(Switch::kToReceive, GuardTimeCalibrator::kPercentile);
+  const auto tx_tail = calibrator.Percentile(Switch::kToTransmit,
+                                             GuardTimeCalibrator::kPercentile);
+  EXPECT_GE(rx_tail, milliseconds(8));
+  EXPECT_LE(rx_tail, microseconds(8800));
+  EXPECT_GE(tx_tail, milliseconds(4));
+  EXPECT_LE(tx_tail, microseconds(4400));
+
+  auto gap = calibrator.SafeGap();
+  ASSERT_TRUE(gap.has_value());
+  EXPECT_GE(*gap, (rx_tail + tx_tail) * GuardTimeCalibrator::kSafetyFactor);
+  EXPECT_LT(*gap, milliseconds(20));
+}
+
+TEST(GuardTimeCalibrator, NeverUnderTheFloor) {
+  GuardTimeCalibrator calibrator{};
+  for (size_t i = 0; i < GuardTimeCalibrator::kMinSamples; i++) {
+    calibrator.Record(Switch::kToReceive, microseconds(10));
+    calibrator.Record(Switch::kToTransmit, microseconds(10));
+    calibrator.RecordOverrun(Switch::kToReceive, lora_chat::Duration::zero());
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+  EXPECT_EQ(calibrator.SafeGap(), GuardTimeCalibrator::kMinGap);
+}
+
+TEST(GuardTimeCalibrator, FollowsTheLoadAsItChanges) {
+  GuardTimeCalibrator calibrator{};
+  for (int i = 0; i < 5000; i++) {
+    calibrator.Record(Switch::kToReceive, milliseconds(30));
+    calibrator.Record(Switch::kToTransmit, milliseconds(30));
+    calibrator.RecordOverrun(Switch::kToReceive, lora_chat::Duration::zero());
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+  const auto loaded = calibrator.SafeGap();
+  ASSERT_TRUE(loaded.has_value());
+  EXPECT_GE(*loaded, milliseconds(90));
+
+  // The host quietens down; long enough after, the old samples no longer
+  // hold the gap open
+  for (int i = 0; i < 50000; i++) {
+    calibrator.Record(Switch::kToReceive, milliseconds(1));
+    calibrator.Record(Switch::kToTransmit, milliseconds(1));
+    calibrator.RecordOverrun(Switch::kToReceive, lora_chat::Duration::zero());
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+  const auto quiet = calibrator.SafeGap();
+  ASSERT_TRUE(quiet.has_value());
+  EXPECT_LT(*quiet, milliseconds(5));
+}
+
+TEST(GuardTimeCalibrator, GapCoversAReceiveThatRunsOver) {
+  GuardTimeCalibrator calibrator{};
+  // Quick to go live, but each receive waits out a timeout well past its
+  // window
+  for (size_t i = 0; i < GuardTimeCalibrator::kMinSamples; i++) {
+    calibrator.Record(Switch::kToReceive, microseconds(100));
+    calibrator.Record(Switch::kToTransmit, microseconds(100));
+    calibrator.RecordOverrun(Switch::kToReceive, milliseconds(40));
+    calibrator.RecordOverrun(Switch::kToTransmit, lora_chat::Duration::zero());
+  }
+  const auto gap = calibrator.SafeGap();
+  ASSERT_TRUE(gap.has_value());
+  EXPECT_GE(*gap, milliseconds(40) + microseconds(100));
+}
+
+} // namespace
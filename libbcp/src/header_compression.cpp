@@ -0,0 +1,221 @@
+#include "header_compression.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace lora_chat {
+
+namespace {
+
+// The first byte of every compressed datagram. Compressed ones name their
+// context in the low four bits, and say which of the fields that can't be
+// worked out from it follow.
+constexpr uint8_t kCompressedMask = 0xc0;
+constexpr uint8_t kCompressed = 0x00;
+constexpr uint8_t kIpIdFollows = 0x20;
+constexpr uint8_t kChecksumFollows = 0x10;
+constexpr uint8_t kContextMask = 0x0f;
+// The header in full, establishing (or refreshing) the context named in the
+// low four bits
+constexpr uint8_t kIrMask = 0xf0;
+constexpr uint8_t kIr = 0x40;
+constexpr uint8_t kUncompressed = 0x50;
+
+constexpr size_t kIpv4UdpHeaderBytes = 28;
+constexpr size_t kIpv6UdpHeaderBytes = 48;
+constexpr uint8_t kUdp = 17;
+
+enum class Layout { kUnsupported, kIpv4Udp, kIpv6Udp };
+
+uint16_t Get16(uint8_t const *p) { return (p[0] << 8) | p[1]; }
+void Put16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+// Only plain headers, whose lengths all agree with the datagram's: anything
+// else would need fields we don't carry to be restored
+Layout Classify(std::span<const uint8_t> d) {
+  if (d.size() >= kIpv4UdpHeaderBytes && d[0] == 0x45 &&
+      Get16(&d[2]) == d.size() && (Get16(&d[6]) & 0x3fff) == 0 &&
+      d[9] == kUdp && Get16(&d[24]) == d.size() - 20)
+    return Layout::kIpv4Udp;
+  if (d.size() >= kIpv6UdpHeaderBytes && (d[0] >> 4) == 6 &&
+      Get16(&d[4]) == d.size() - 40 && d[6] == kUdp &&
+      Get16(&d[44]) == d.size() - 40)
+    return Layout::kIpv6Udp;
+  return Layout::kUnsupported;
+}
+
+size_t HeaderBytes(Layout layout) {
+  return layout == Layout::kIpv4Udp ? kIpv4UdpHeaderBytes
+                                    : kIpv6UdpHeaderBytes;
+}
+
+// Whether everything but the lengths, checksums and IPv4 ID matches, i.e.
+// whether `b` can go compressed against `a`'s context
+bool SameFlow(Layout layout, uint8_t const *a, uint8_t const *b) {
+  if (layout == Layout::kIpv4Udp)
+    // Version through TOS; flags through protocol; addresses and ports
+    return !std::memcmp(a, b, 2) && !std::memcmp(a + 6, b + 6, 4) &&
+           !std::memcmp(a + 12, b + 12, 12);
+  // Version through flow label; next header through ports
+  return !std::memcmp(a, b, 4) && !std::memcmp(a + 6, b + 6, 38);
+}
+
+uint16_t Ipv4HeaderChecksum(uint8_t const *header) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < 20; i += 2)
+    sum += Get16(header + i);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+} // namespace
+
+size_t HeaderCompressor::Compress(std::span<const uint8_t> datagram,
+                                  std::span<uint8_t> out) {
+  if (out.size() < datagram.size() + kMaxExpansion)
+    return 0;
+  datagrams_++;
+
+  const Layout layout = Classify(datagram);
+  if (layout == Layout::kUnsupported) {
+    out[0] = kUncompressed;
+    std::memcpy(&out[1], datagram.data(), datagram.size());
+    bytes_saved_--;
+    return datagram.size() + 1;
+  }
+  const size_t header_bytes = HeaderBytes(layout);
+
+  auto context = std::find_if(
+      contexts_.begin(), contexts_.end(), [&](Context const &c) {
+        return c.in_use && c.header_bytes == header_bytes &&
+               SameFlow(layout, c.header.data(), datagram.data());
+      });
+  // IPv4 IDs usually count up by one per datagram, but a host sending on
+  // several flows interleaves them, so it's worth a byte to allow for that
+  const uint16_t ip_id_delta =
+      (layout == Layout::kIpv4Udp && context != contexts_.end())
+          ? static_cast<uint16_t>(Get16(&datagram[4]) -
+                                  Get16(&context->header[4]))
+          : 0;
+
+  if (context == contexts_.end() || context->since_refresh >= kRefreshInterval ||
+      ip_id_delta > 0xff) {
+    if (context == contexts_.end())
+      // The least recently used, which is one never used, if there are any
+      context = std::min_element(
+          contexts_.begin(), contexts_.end(),
+          [](Context const &a, Context const &b) {
+            return std::pair(a.in_use, a.last_used) <
+                   std::pair(b.in_use, b.last_used);
+          });
+    context->in_use = true;
+    context->header_bytes = header_bytes;
+    std::memcpy(context->header.data(), datagram.data(), header_bytes);
+    context->since_refresh = 0;
+    context->last_used = datagrams_;
+    out[0] = kIr | (context - contexts_.begin());
+    std::memcpy(&out[1], datagram.data(), datagram.size());
+    bytes_saved_--;
+    return datagram.size() + 1;
+  }
+
+  uint8_t type = kCompressed | (context - contexts_.begin());
+  size_t written = 1;
+  if (ip_id_delta) {
+    type |= kIpIdFollows;
+    out[written++] = datagram[5];
+  }
+  // Zero means there isn't one, which IPv6 doesn't allow for UDP
+  const uint16_t checksum = Get16(&datagram[header_bytes - 2]);
+  if (layout == Layout::kIpv6Udp || checksum) {
+    type |= kChecksumFollows;
+    Put16(&out[written], checksum);
+    written += 2;
+  }
+  out[0] = type;
+  std::memcpy(&out[written], &datagram[header_bytes],
+              datagram.size() - header_bytes);
+
+  std::memcpy(context->header.data(), datagram.data(), header_bytes);
+  context->since_refresh++;
+  context->last_used = datagrams_;
+  bytes_saved_ += header_bytes - written;
+  return written + datagram.size() - header_bytes;
+}
+
+void HeaderCompressor::Reset() { contexts_ = {}; }
+
+std::optional<size_t>
+HeaderDecompressor::Decompress(std::span<const uint8_t> compressed,
+                               std::span<uint8_t> out) {
+  if (compressed.empty())
+    return {};
+  const uint8_t type = compressed[0];
+  const auto body = compressed.subspan(1);
+
+  if (type == kUncompressed || (type & kIrMask) == kIr) {
+    if (body.size() > out.size())
+      return {};
+    if (type != kUncompressed) {
+      const Layout layout = Classify(body);
+      if (layout == Layout::kUnsupported)
+        return {};
+      auto &context = contexts_[type & kContextMask];
+      context.in_use = true;
+      context.header_bytes = HeaderBytes(layout);
+      std::memcpy(context.header.data(), body.data(), context.header_bytes);
+    }
+    std::memcpy(out.data(), body.data(), body.size());
+    return body.size();
+  }
+
+  if ((type & kCompressedMask) != kCompressed)
+    return {};
+  auto &context = contexts_[type & kContextMask];
+  if (!context.in_use)
+    return {};
+  const size_t header_bytes = context.header_bytes;
+  if (header_bytes != kIpv4UdpHeaderBytes && (type & kIpIdFollows))
+    return {};
+  const size_t fields = ((type & kIpIdFollows) ? 1 : 0) +
+                        ((type & kChecksumFollows) ? 2 : 0);
+  if (body.size() < fields)
+    return {};
+  const auto payload = body.subspan(fields);
+  const size_t length = header_bytes + payload.size();
+  if (length > out.size() || length > UINT16_MAX)
+    return {};
+
+  uint8_t *header = out.data();
+  std::memcpy(header, context.header.data(), header_bytes);
+  size_t read = 0;
+  if (header_bytes == kIpv4UdpHeaderBytes) {
+    if (type & kIpIdFollows) {
+      // The ID moved on by 1 to 255 from the last, and this is its low byte
+      const uint16_t last = Get16(&header[4]);
+      Put16(&header[4], last + static_cast<uint8_t>(body[read++] - last));
+    }
+    Put16(&header[2], length);
+    Put16(&header[24], length - 20);
+    Put16(&header[10], 0);
+    Put16(&header[10], Ipv4HeaderChecksum(header));
+  } else {
+    Put16(&header[4], length - 40);
+    Put16(&header[44], length - 40);
+  }
+  Put16(&header[header_bytes - 2],
+        (type & kChecksumFollows) ? Get16(&body[read]) : 0);
+  std::memcpy(out.data() + header_bytes, payload.data(), payload.size());
+
+  std::memcpy(context.header.data(), header, header_bytes);
+  return length;
+}
+
+void HeaderDecompressor::Reset() { contexts_ = {}; }
+
+} // namespace lora_chat
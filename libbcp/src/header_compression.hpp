@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace lora_chat {
+
+/// Stateful compression of IPv4/IPv6 + UDP headers, along the lines of ROHC
+/// (RFC 3095), for datagrams carried over a session.
+///
+/// Both ends keep a context per flow, holding the header last sent on it.
+/// The first datagram of a flow goes with its header in full (an IR packet),
+/// after which each one sends only what can't be worked out from the
+/// context: a type byte naming the context, the low byte of the IPv4 ID if
+/// it moved on, and the UDP checksum if there is one. Lengths come from the
+/// datagram's own length and the IPv4 header checksum is recomputed, so a
+/// 28-byte IPv4+UDP header goes in 2 to 4 bytes, and a 48-byte IPv6+UDP
+/// header in 3.
+///
+/// Unlike ROHC there's no CRC over the restored header, and no feedback:
+/// sessions deliver in order and retransmit what's lost, so the contexts
+/// only part ways when one end starts over. Both ends Reset() at the start
+/// of each session, and every context is refreshed with an IR now and then
+/// in case only one of them did. Anything else (other protocols, IPv4
+/// options or fragments, extension headers) passes through uncompressed.
+///
+/// Not thread-safe.
+class HeaderCompressor {
+public:
+  /// Compressed datagrams are never more than this much longer than the
+  /// originals
+  static constexpr size_t kMaxExpansion = 1;
+
+  /// Writes `datagram`, its header compressed, to `out`. Returns the bytes
+  /// written, or 0 if `out` is too small.
+  size_t Compress(std::span<const uint8_t> datagram, std::span<uint8_t> out);
+  /// Forgets every context, so that each flow starts over with an IR
+  void Reset();
+
+  /// The header bytes saved so far, net of the type byte every datagram
+  /// carries
+  int64_t BytesSaved() const { return bytes_saved_; }
+
+  // Every context is refreshed after this many compressed datagrams
+  static constexpr uint32_t kRefreshInterval = 64;
+  static constexpr size_t kContexts = 16;
+  // IPv6 + UDP
+  static constexpr size_t kMaxHeaderBytes = 48;
+
+  struct Context {
+    std::array<uint8_t, kMaxHeaderBytes> header{};
+    uint8_t header_bytes{0};
+    bool in_use{false};
+    uint32_t since_refresh{0};
+    uint64_t last_used{0};
+  };
+
+private:
+  std::array<Context, kContexts> contexts_{};
+  uint64_t datagrams_{0};
+  int64_t bytes_saved_{0};
+};
+
+/// The receiving end of a HeaderCompressor. Not thread-safe.
+class HeaderDecompressor {
+public:
+  /// Restores the datagram `compressed` was made from into `out`. Returns
+  /// its length, or nothing if it can't be restored: it's malformed, names a
+  /// context we don't have (e.g. after a restart, until the next IR), or
+  /// doesn't fit in `out`.
+  std::optional<size_t> Decompress(std::span<const uint8_t> compressed,
+                                   std::span<uint8_t> out);
+  void Reset();
+
+private:
+  std::array<HeaderCompressor::Context, HeaderCompressor::kContexts>
+      contexts_{};
+};
+
+} // namespace lora_chat
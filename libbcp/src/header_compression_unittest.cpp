@@ -0,0 +1,167 @@
+#include "header_compression.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::HeaderCompressor;
+using lora_chat::HeaderDecompressor;
+
+void Put16(std::vector<uint8_t> &d, size_t at, uint16_t v) {
+  d[at] = v >> 8;
+  d[at + 1] = v & 0xff;
+}
+
+std::vector<uint8_t> Ipv4Udp(uint16_t id, uint16_t checksum,
+                             size_t payload_bytes, uint16_t src_port = 5000,
+                             uint8_t protocol = 17) {
+  std::vector<uint8_t> d(28 + payload_bytes);
+  d[0] = 0x45;
+  Put16(d, 2, d.size());
+  Put16(d, 4, id);
+  d[6] = 0x40; // DF
+  d[8] = 64;
+  d[9] = protocol;
+  const uint8_t addresses[] = {10, 0, 0, 1, 10, 0, 0, 2};
+  std::copy(std::begin(addresses), std::end(addresses), &d[12]);
+  uint32_t sum = 0;
+  for (size_t i = 0; i < 20; i += 2)
+    sum += (d[i] << 8) | d[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  Put16(d, 10, ~sum);
+  Put16(d, 20, src_port);
+  Put16(d, 22, 6000);
+  Put16(d, 24, d.size() - 20);
+  Put16(d, 26, checksum);
+  for (size_t i = 28; i < d.size(); i++)
+    d[i] = i * 7;
+  return d;
+}
+
+std::vector<uint8_t> Ipv6Udp(uint16_t checksum, size_t payload_bytes) {
+  std::vector<uint8_t> d(48 + payload_bytes);
+  d[0] = 0x60;
+  d[3] = 0x42; // Flow label
+  Put16(d, 4, d.size() - 40);
+  d[6] = 17;
+  d[7] = 64;
+  d[8] = 0xfd;
+  d[23] = 1;
+  d[24] = 0xfd;
+  d[39] = 2;
+  Put16(d, 40, 5000);
+  Put16(d, 42, 6000);
+  Put16(d, 44, d.size() - 40);
+  Put16(d, 46, checksum);
+  for (size_t i = 48; i < d.size(); i++)
+    d[i] = i * 3;
+  return d;
+}
+
+// Compresses `datagram`, checks it comes back intact, and returns how much
+// longer or shorter it went
+ptrdiff_t RoundTrip(HeaderCompressor &compressor,
+                    HeaderDecompressor &decompressor,
+                    std::vector<uint8_t> const &datagram) {
+  std::vector<uint8_t> compressed(datagram.size() + 1);
+  const size_t n = compressor.Compress(datagram, compressed);
+  EXPECT_GT(n, 0u);
+  compressed.resize(n);
+  std::vector<uint8_t> restored(1500);
+  auto length = decompressor.Decompress(compressed, restored);
+  EXPECT_TRUE(length.has_value());
+  restored.resize(length.value_or(0));
+  EXPECT_EQ(restored, datagram);
+  return static_cast<ptrdiff_t>(n) - static_cast<ptrdiff_t>(datagram.size());
+}
+
+TEST(HeaderCompression, Ipv4UdpHeadersShrinkToAFewBytes) {
+  HeaderCompressor compressor{};
+  HeaderDecompressor decompressor{};
+  // The first goes in full, to set up the context
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(100, 0xbeef, 10)), 1);
+  // ID moving on, with a checksum: type, ID byte and checksum
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(101, 0x1234, 10)),
+            4 - 28);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(110, 0x4321, 50)),
+            4 - 28);
+  // ID wrapping around
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(0xfffe, 0x1, 3)), 1);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(0x0003, 0x1, 3)),
+            4 - 28);
+  // Same ID, no checksum: the type byte is all
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(0x0003, 0, 0)), 1 - 28);
+  EXPECT_GT(compressor.BytesSaved(), 3 * 24);
+}
+
+TEST(HeaderCompression, Ipv6UdpHeadersShrinkToThreeBytes) {
+  HeaderCompressor compressor{};
+  HeaderDecompressor decompressor{};
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv6Udp(0xabcd, 20)), 1);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv6Udp(0x1111, 5)), 3 - 48);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv6Udp(0x2222, 0)), 3 - 48);
+}
+
+TEST(HeaderCompression, FlowsKeepContextsOfTheirOwn) {
+  HeaderCompressor compressor{};
+  HeaderDecompressor decompressor{};
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(1, 1, 8, 5000)), 1);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(2, 1, 8, 5001)), 1);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv6Udp(1, 8)), 1);
+  for (uint16_t id = 3; id < 20; id += 2) {
+    EXPECT_LT(RoundTrip(compressor, decompressor, Ipv4Udp(id, 1, 8, 5000)), 0);
+    EXPECT_LT(RoundTrip(compressor, decompressor, Ipv4Udp(id + 1, 1, 8, 5001)),
+              0);
+    EXPECT_LT(RoundTrip(compressor, decompressor, Ipv6Udp(id, 8)), 0);
+  }
+  // An ID jump too far for a byte sends the header again
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(1000, 1, 8, 5000)), 1);
+  // More flows than contexts: the least recently used go
+  for (uint16_t port = 7000; port < 7000 + 2 * HeaderCompressor::kContexts;
+       port++)
+    EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(1, 1, 8, port)), 1);
+}
+
+TEST(HeaderCompression, AnythingElsePassesThrough) {
+  HeaderCompressor compressor{};
+  HeaderDecompressor decompressor{};
+  // TCP
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(1, 1, 20, 5000, 6)), 1);
+  EXPECT_EQ(RoundTrip(compressor, decompressor, Ipv4Udp(2, 1, 20, 5000, 6)), 1);
+  // A fragment
+  auto fragment = Ipv4Udp(3, 1, 20);
+  fragment[6] = 0x20; // MF
+  EXPECT_EQ(RoundTrip(compressor, decompressor, fragment), 1);
+  // Not IP at all
+  EXPECT_EQ(RoundTrip(compressor, decompressor, {1, 2, 3}), 1);
+}
+
+TEST(HeaderCompression, DecompressorCatchesUpAtTheNextRefresh) {
+  HeaderCompressor compressor{};
+  HeaderDecompressor decompressor{};
+  RoundTrip(compressor, decompressor, Ipv4Udp(0, 1, 8));
+  decompressor.Reset();
+
+  std::vector<uint8_t> compressed(64);
+  std::vector<uint8_t> restored(64);
+  uint32_t lost = 0;
+  for (uint16_t id = 1;; id++) {
+    auto datagram = Ipv4Udp(id, 1, 8);
+    const size_t n = compressor.Compress(datagram, compressed);
+    auto length = decompressor.Decompress({compressed.data(), n}, restored);
+    if (length) {
+      restored.resize(*length);
+      EXPECT_EQ(restored, datagram);
+      break;
+    }
+    lost++;
+    ASSERT_LE(lost, HeaderCompressor::kRefreshInterval);
+  }
+  EXPECT_EQ(lost, HeaderCompressor::kRefreshInterval);
+}
+
+} // namespace
@@ -0,0 +1,270 @@
+#include "hot_restart.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace lora_chat {
+
+namespace {
+
+constexpr uint32_t kImageMagic = 0x42435048; // "BCPH"
+// Bump whenever Handoff (or anything in it, like Session::State) changes:
+// both ends of a handoff must be built from the same layout
+constexpr uint32_t kImageVersion = 4;
+constexpr char kHandoffByte = 'H';
+constexpr char kConfirmByte = 'K';
+// Sent by an old agent that gave up waiting for the confirmation, and is
+// carrying on with the radio itself
+constexpr char kAbortByte = 'A';
+
+/// What goes in the memfd
+struct Image {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t bytes;
+  HotRestart::Handoff handoff;
+};
+static_assert(std::is_trivially_copyable_v<Image>);
+
+bool MakeAddress(const char *path, sockaddr_un &addr) {
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("HotRestart: socket path too long: %s\n", path);
+    return false;
+  }
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+bool WaitReadable(int fd, Duration timeout) {
+  const auto deadline = Now() + timeout;
+  pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+  while (true) {
+    auto remaining =
+        std::chrono::ceil<std::chrono::milliseconds>(deadline - Now()).count();
+    if (remaining <= 0)
+      return false;
+    int ready = poll(&pfd, 1, remaining);
+    if (ready > 0)
+      return true;
+    if (ready < 0 && errno != EINTR) {
+      perror("HotRestart: poll failed");
+      return false;
+    }
+  }
+}
+
+/// A sealed memfd holding `handoff`, or -1
+int WriteImage(HotRestart::Handoff const &handoff) {
+  int fd = memfd_create("bcp-handoff", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    perror("HotRestart: memfd_create failed");
+    return -1;
+  }
+  Image image{.magic = kImageMagic,
+              .version = kImageVersion,
+              .bytes = sizeof(Image),
+              .handoff = handoff};
+  if (write(fd, &image, sizeof(image)) != sizeof(image) ||
+      fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+    perror("HotRestart: failed to write handoff");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+std::optional<HotRestart::Handoff> ReadImage(int fd) {
+  Image image{};
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size != sizeof(Image) ||
+      pread(fd, &image, sizeof(image), 0) != sizeof(image)) {
+    printf("HotRestart: handoff is the wrong size\n");
+    return {};
+  }
+  if (image.magic != kImageMagic || image.version != kImageVersion ||
+      image.bytes != sizeof(Image)) {
+    printf("HotRestart: handoff is from an incompatible build "
+           "(version %u, expected %u)\n",
+           image.version, kImageVersion);
+    return {};
+  }
+  return image.handoff;
+}
+
+} // namespace
+
+HotRestart::~HotRestart() {
+  if (successor_fd_ >= 0)
+    close(successor_fd_);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+}
+
+bool HotRestart::Listen(const char *path) {
+  sockaddr_un addr;
+  if (!MakeAddress(path, addr))
+    return false;
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    perror("HotRestart: socket failed");
+    return false;
+  }
+  unlink(path);
+  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd_, 1) < 0) {
+    perror("HotRestart: failed to listen");
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  path_ = path;
+  return true;
+}
+
+bool HotRestart::SuccessorWaiting() {
+  if (successor_fd_ >= 0)
+    return true;
+  if (listen_fd_ < 0)
+    return false;
+  successor_fd_ = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  return successor_fd_ >= 0;
+}
+
+bool HotRestart::HandOff(Handoff const &handoff, int radio_fd) {
+  if (!SuccessorWaiting())
+    return false;
+
+  bool confirmed = false;
+  int image_fd = WriteImage(handoff);
+  if (image_fd >= 0) {
+    int fds[2] = {image_fd, radio_fd};
+    char byte = kHandoffByte;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(successor_fd_, &msg, MSG_NOSIGNAL) != 1) {
+      perror("HotRestart: failed to send handoff");
+    } else if (WaitReadable(successor_fd_, kConfirmTimeout)) {
+      confirmed = (read(successor_fd_, &byte, 1) == 1 && byte == kConfirmByte);
+    }
+    close(image_fd);
+  }
+
+  if (!confirmed) {
+    // A confirmation on its way in as we gave up is answered by this, so the
+    // successor can't go ahead with the radio we're keeping. Done with it
+    // then; a failed one can always try again
+    const char abort = kAbortByte;
+    send(successor_fd_, &abort, 1, MSG_NOSIGNAL);
+    close(successor_fd_);
+    successor_fd_ = -1;
+    return false;
+  }
+  // The successor owns the socket path now, and learns that we're gone when
+  // the connection closes as we exit
+  close(listen_fd_);
+  listen_fd_ = -1;
+  return true;
+}
+
+std::optional<HotRestart::Takeover> HotRestart::TakeOver(const char *path,
+                                                         Duration timeout) {
+  sockaddr_un addr;
+  if (!MakeAddress(path, addr))
+    return {};
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    perror("HotRestart: socket failed");
+    return {};
+  }
+  if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    // Nobody to take over from
+    close(sock);
+    return {};
+  }
+
+  std::optional<Takeover> takeover{};
+  int fds[2] = {-1, -1};
+  if (WaitReadable(sock, timeout)) {
+    char byte = 0;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = nullptr;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == 1 && byte == kHandoffByte &&
+        (cmsg = CMSG_FIRSTHDR(&msg)) && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+      std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      if (auto handoff = ReadImage(fds[0]))
+        takeover = Takeover{.handoff = *handoff, .radio_fd = fds[1]};
+    } else {
+      printf("HotRestart: malformed handoff\n");
+    }
+  } else {
+    printf("HotRestart: timed out waiting for a handoff\n");
+  }
+
+  if (fds[0] >= 0)
+    close(fds[0]);
+  if (takeover) {
+    const char confirm = kConfirmByte;
+    // Not SIGPIPE, should the old agent have given up and gone already
+    if (send(sock, &confirm, 1, MSG_NOSIGNAL) != 1) {
+      // The old agent will carry on with the radio, so we mustn't
+      perror("HotRestart: failed to confirm handoff");
+      takeover.reset();
+    }
+  }
+  // Only once the old agent has exited is everything it had open (the radio,
+  // message stores) ours alone. If it gave up on us instead, or is still
+  // there, the radio is still its to drive
+  if (takeover) {
+    char byte = 0;
+    const ssize_t n = WaitReadable(sock, timeout) ? read(sock, &byte, 1) : -1;
+    if (n != 0) {
+      if (n == 1 && byte == kAbortByte)
+        printf("HotRestart: the old agent carried on without us\n");
+      else
+        printf("HotRestart: the old agent never exited\n");
+      takeover.reset();
+    }
+  }
+  if (!takeover && fds[1] >= 0)
+    close(fds[1]);
+  close(sock);
+  return takeover;
+}
+
+} // namespace lora_chat
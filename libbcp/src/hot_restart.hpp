@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include "packet.hpp"
+#include "session.hpp"
+#include "sx1276/sx1276.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// Hands a live session, and the radio it runs on, from one agent process to
+/// its replacement, so that upgrading or restarting an agent doesn't drop
+/// the link.
+///
+/// The running agent listens on a unix socket. Its successor connects and
+/// waits; between actions, the running agent notices, writes its state into
+/// a sealed memfd, and passes that along with the radio's SPI fd over the
+/// socket (SCM_RIGHTS). Once the successor confirms it has both, the old
+/// agent exits without touching the radio again, and the successor resumes
+/// the session from the next slot boundary. The peer misses at most the one
+/// slot during which the handoff took place.
+///
+/// Only one of the two ever drives the radio: an old agent which gives up
+/// waiting for the confirmation says so before carrying on, and the
+/// successor only goes ahead once the old agent has exited, giving up if it
+/// doesn't.
+class HotRestart {
+public:
+  /// Everything the successor needs besides the radio itself
+  struct Handoff {
+    sx1276::ChannelConfig channel;
+    sx1276::PacketConfig packet;
+    bool in_session;
+    // Only meaningful if in_session
+    WireAddress peer;
+    Session::State session;
+  };
+
+  struct Takeover {
+    Handoff handoff;
+    // The radio, already set up on handoff.channel: adopt, don't initialize
+    int radio_fd;
+  };
+
+  static constexpr Duration kDefaultTakeoverTimeout{std::chrono::seconds(10)};
+
+  HotRestart() = default;
+  ~HotRestart();
+  HotRestart(const HotRestart &) = delete;
+  HotRestart &operator=(const HotRestart &) = delete;
+
+  /// Starts listening for a successor at `path`, replacing any socket left
+  /// behind there
+  bool Listen(const char *path);
+  /// Whether a successor is waiting to take over. Never blocks, so it's
+  /// cheap enough to check between every action.
+  bool SuccessorWaiting();
+  /// Passes `handoff` and `radio_fd` to the waiting successor. Returns true
+  /// once the successor has confirmed it took them, after which the caller
+  /// must leave the radio alone and exit (promptly: the successor waits for
+  /// it to). On false, carry on as before.
+  bool HandOff(Handoff const &handoff, int radio_fd);
+
+  /// Asks the agent listening at `path` to hand over, and waits up to
+  /// `timeout` for it to, then for it to exit. Returns nullopt straight away
+  /// if no agent is listening there, and also if the agent carried on
+  /// instead or didn't exit in time, in which case the radio is still its.
+  static std::optional<Takeover>
+  TakeOver(const char *path, Duration timeout = kDefaultTakeoverTimeout);
+
+private:
+  // How long the old agent waits for the successor to confirm
+  static constexpr Duration kConfirmTimeout{std::chrono::seconds(1)};
+
+  std::string path_{};
+  int listen_fd_{-1};
+  int successor_fd_{-1};
+};
+
+} // namespace lora_chat
@@ -0,0 +1,197 @@
+#include "hot_restart.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "session.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::HotRestart;
+using lora_chat::MessagePipe;
+using lora_chat::Session;
+using lora_chat::SessionPacketPayload;
+using namespace lora_chat::testutils;
+using std::chrono::milliseconds;
+
+std::string SocketPath() {
+  return "/tmp/bcp-handoff-test-" + std::to_string(getpid());
+}
+
+TEST(HotRestart, NobodyToTakeOverFrom) {
+  auto start = lora_chat::Now();
+  EXPECT_FALSE(HotRestart::TakeOver(SocketPath().c_str()));
+  EXPECT_LT(lora_chat::Now() - start, milliseconds(100));
+}
+
+TEST(HotRestart, HandsOverStateAndRadio) {
+  const auto path = SocketPath();
+  std::optional<HotRestart> old_agent{std::in_place};
+  ASSERT_TRUE(old_agent->Listen(path.c_str()));
+  EXPECT_FALSE(old_agent->SuccessorWaiting());
+
+  std::optional<HotRestart::Takeover> takeover{};
+  std::thread successor(
+      [&]() { takeover = HotRestart::TakeOver(path.c_str(), milliseconds(2000)); });
+
+  // A pipe stands in for the radio: whatever comes out of the far end of the
+  // handoff should go into this one
+  int radio[2];
+  ASSERT_EQ(pipe(radio), 0);
+
+  HotRestart::Handoff handoff{};
+  handoff.channel.sf = sx1276::SpreadingFactor::kSF10;
+  handoff.packet.preamble_symbols = 12;
+  handoff.in_session = true;
+  handoff.peer = 0x1234;
+  handoff.session.id = 77;
+  handoff.session.has_last_sent_frame = true;
+  handoff.session.last_sent_frame.buffer[5] = 0xab;
+
+  while (!old_agent->SuccessorWaiting())
+    std::this_thread::sleep_for(milliseconds(1));
+  ASSERT_TRUE(old_agent->HandOff(handoff, radio[1]));
+  // The successor only returns once we've gone
+  old_agent.reset();
+  successor.join();
+
+  ASSERT_TRUE(takeover);
+  auto const &got = takeover->handoff;
+  EXPECT_EQ(got.channel.sf, sx1276::SpreadingFactor::kSF10);
+  EXPECT_EQ(got.packet.preamble_symbols, 12);
+  EXPECT_TRUE(got.in_session);
+  EXPECT_EQ(got.peer, 0x1234u);
+  EXPECT_EQ(got.session.id, 77u);
+  EXPECT_EQ(got.session.last_sent_frame.buffer[5], 0xab);
+
+  // A fresh descriptor, for the same pipe
+  EXPECT_NE(takeover->radio_fd, radio[1]);
+  const char kMessage[] = "over";
+  ASSERT_EQ(write(takeover->radio_fd, kMessage, sizeof(kMessage)),
+            static_cast<ssize_t>(sizeof(kMessage)));
+  char received[sizeof(kMessage)] = {};
+  ASSERT_EQ(read(radio[0], received, sizeof(received)),
+            static_cast<ssize_t>(sizeof(received)));
+  EXPECT_STREQ(received, kMessage);
+
+  close(takeover->radio_fd);
+  close(radio[0]);
+  close(radio[1]);
+  // Left for the successor to listen on in turn
+  EXPECT_EQ(access(path.c_str(), F_OK), 0);
+  unlink(path.c_str());
+}
+
+TEST(HotRestart, NoTakeoverWhileTheOldAgentIsStillThere) {
+  const auto path = SocketPath();
+  HotRestart old_agent{};
+  ASSERT_TRUE(old_agent.Listen(path.c_str()));
+
+  std::optional<HotRestart::Takeover> takeover{};
+  std::thread successor(
+      [&]() { takeover = HotRestart::TakeOver(path.c_str(), milliseconds(300)); });
+  int radio[2];
+  ASSERT_EQ(pipe(radio), 0);
+  while (!old_agent.SuccessorWaiting())
+    std::this_thread::sleep_for(milliseconds(1));
+  ASSERT_TRUE(old_agent.HandOff(HotRestart::Handoff{}, radio[1]));
+  // ...but doesn't exit, so the successor mustn't go ahead
+  successor.join();
+  EXPECT_FALSE(takeover);
+
+  close(radio[0]);
+  close(radio[1]);
+}
+
+TEST(HotRestart, ALateSuccessorIsToldTheOldAgentCarriedOn) {
+  const auto path = SocketPath();
+  HotRestart old_agent{};
+  ASSERT_TRUE(old_agent.Listen(path.c_str()));
+
+  // Slower to confirm than the old agent waits for
+  char first = 0, second = 0;
+  std::thread successor([&]() {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{.sun_family = AF_UNIX, .sun_path = {}};
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    ASSERT_EQ(connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)),
+              0);
+    std::this_thread::sleep_for(milliseconds(1500));
+    // Whatever fds came with the handoff are dropped along with it
+    ASSERT_EQ(read(sock, &first, 1), 1);
+    const char confirm = 'K';
+    send(sock, &confirm, 1, MSG_NOSIGNAL);
+    ASSERT_EQ(read(sock, &second, 1), 1);
+    close(sock);
+  });
+  int radio[2];
+  ASSERT_EQ(pipe(radio), 0);
+  while (!old_agent.SuccessorWaiting())
+    std::this_thread::sleep_for(milliseconds(1));
+  EXPECT_FALSE(old_agent.HandOff(HotRestart::Handoff{}, radio[1]));
+  successor.join();
+  EXPECT_EQ(first, 'H');
+  EXPECT_EQ(second, 'A');
+
+  close(radio[0]);
+  close(radio[1]);
+}
+
+std::atomic<int> pinger_received{0};
+void CountForPinger(SessionPacketPayload &&msg) {
+  if (msg[0]) pinger_received++;
+}
+constexpr TextTag kPongerTag{"pong"};
+constexpr TextTag kPingerTag{"ping"};
+
+TEST(HotRestart, RestoredSessionPicksUpWhereItLeftOff) {
+  constexpr int kPeriodsBefore = 4;
+  constexpr int kPeriodsAfter = 8;
+  constexpr auto kTransmitTime = milliseconds(10);
+  constexpr auto kGapTime = milliseconds(10);
+
+  LocalRadio radio(milliseconds(8));
+  MessagePipe ponger_pipe{MakeMessage<kPongerTag>, ConsumeMessage<kPongerTag>};
+  MessagePipe pinger_pipe{MakeMessage<kPingerTag>, CountForPinger};
+  auto start_time = lora_chat::Now() + milliseconds(10);
+
+  int received_before_restart = 0;
+  std::thread ponger_thread([&]() {
+    std::optional<Session> ponger{std::in_place, start_time, 5, kTransmitTime,
+                                  kGapTime, false};
+    ponger->SleepUntilStartTime();
+    for (int i = 0; i < 2 * kPeriodsBefore; i++)
+      ponger->ExecuteCurrentAction(radio, ponger_pipe);
+
+    // As a new process would, with nothing but the saved state
+    auto state = ponger->SaveState();
+    received_before_restart = pinger_received;
+    // emplace drops the old session before the new one's built from state
+    ponger.emplace(state);
+    ponger->SleepUntilNextSlot();
+    for (int i = 0; i < 2 * kPeriodsAfter; i++)
+      ponger->ExecuteCurrentAction(radio, ponger_pipe);
+  });
+
+  Session pinger{start_time, 5, kTransmitTime, kGapTime, true};
+  pinger.SleepUntilStartTime();
+  for (int i = 0; i < 2 * (kPeriodsBefore + kPeriodsAfter + 1); i++)
+    pinger.ExecuteCurrentAction(radio, pinger_pipe);
+  ponger_thread.join();
+
+  // Losing at most the slot the restart happened in
+  EXPECT_GE(received_before_restart, kPeriodsBefore - 1);
+  EXPECT_GE(pinger_received - received_before_restart, kPeriodsAfter - 1);
+}
+
+} // namespace
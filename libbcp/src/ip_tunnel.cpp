@@ -0,0 +1,136 @@
+#include "ip_tunnel.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace lora_chat {
+
+bool IpTunnel::Send(std::span<const uint8_t> datagram) {
+  std::lock_guard lock{queue_mutex_};
+  if (datagram.empty() || datagram.size() > kMtu ||
+      queue_length_ == kMaxQueuedDatagrams) {
+    datagrams_dropped_++;
+    return false;
+  }
+  auto &slot = queue_[(queue_head_ + queue_length_) % kMaxQueuedDatagrams];
+  std::memcpy(slot.bytes.data(), datagram.data(), datagram.size());
+  slot.length = datagram.size();
+  queue_length_++;
+  return true;
+}
+
+bool IpTunnel::StartNextDatagram() {
+  std::lock_guard lock{queue_mutex_};
+  if (queue_length_ == 0)
+    return false;
+  auto const &next = queue_[queue_head_];
+  // Compressed only now, as it goes, so that a Reset() in between doesn't
+  // leave it compressed against contexts the peer no longer has
+  outgoing_length_ =
+      compressor_.Compress({next.bytes.data(), next.length}, outgoing_);
+  outgoing_offset_ = 0;
+  outgoing_number_ = (outgoing_number_ + 1) & kDatagramNumberMask;
+  queue_head_ = (queue_head_ + 1) % kMaxQueuedDatagrams;
+  queue_length_--;
+  outgoing_in_progress_ = outgoing_length_ > 0;
+  return outgoing_in_progress_;
+}
+
+std::optional<SessionPacketPayload> IpTunnel::NextMessage() {
+  if (!outgoing_in_progress_ && !StartNextDatagram())
+    return {};
+
+  SessionPacketPayload message{};
+  const size_t remaining = outgoing_length_ - outgoing_offset_;
+  uint8_t header = kFragment | outgoing_number_;
+  if (outgoing_offset_ == 0)
+    header |= kFirstFragment;
+  size_t data_offset = 1;
+  size_t data_bytes = kFragmentDataBytes;
+  // A last fragment gives its length, so it takes one byte less data: a
+  // datagram which would just fill its last fragment takes one more
+  if (remaining < kFragmentDataBytes) {
+    header |= kLastFragment;
+    outgoing_in_progress_ = false;
+    message[data_offset++] = remaining;
+    data_bytes = remaining;
+  }
+  message[0] = header;
+  std::memcpy(&message[data_offset], &outgoing_[outgoing_offset_], data_bytes);
+  outgoing_offset_ += data_bytes;
+  fragments_sent_++;
+  if (header & kLastFragment)
+    datagrams_sent_++;
+  return message;
+}
+
+std::optional<size_t> IpTunnel::Receive(SessionPacketPayload const &message,
+                                        std::span<uint8_t> out) {
+  const uint8_t header = message[0];
+  // Empty messages (which every session starts with) aren't fragments
+  if (!(header & kFragment))
+    return {};
+  const uint8_t number = header & kDatagramNumberMask;
+
+  if (header & kFirstFragment) {
+    if (incoming_number_)
+      datagrams_lost_++;
+    incoming_number_ = number;
+    incoming_length_ = 0;
+  } else if (incoming_number_ != number) {
+    // The rest of a datagram whose start we never got, counted once, at its
+    // end. Any we were partway through is lost too.
+    if (incoming_number_)
+      datagrams_lost_++;
+    if (header & kLastFragment)
+      datagrams_lost_++;
+    incoming_number_.reset();
+    return {};
+  }
+
+  size_t data_offset = 1;
+  size_t data_bytes = kFragmentDataBytes;
+  if (header & kLastFragment) {
+    data_bytes = std::min<size_t>(message[data_offset++], kFragmentDataBytes - 1);
+  }
+  if (incoming_length_ + data_bytes > incoming_.size()) {
+    datagrams_lost_++;
+    incoming_number_.reset();
+    return {};
+  }
+  std::memcpy(&incoming_[incoming_length_], &message[data_offset], data_bytes);
+  incoming_length_ += data_bytes;
+  if (!(header & kLastFragment))
+    return {};
+
+  incoming_number_.reset();
+  auto length =
+      decompressor_.Decompress({incoming_.data(), incoming_length_}, out);
+  if (!length) {
+    datagrams_lost_++;
+    return {};
+  }
+  datagrams_received_++;
+  return length;
+}
+
+void IpTunnel::Reset() {
+  compressor_.Reset();
+  decompressor_.Reset();
+  outgoing_in_progress_ = false;
+  incoming_number_.reset();
+}
+
+IpTunnel::Stats IpTunnel::GetStats() const {
+  std::lock_guard lock{queue_mutex_};
+  return {
+      .datagrams_sent = datagrams_sent_.load(),
+      .datagrams_received = datagrams_received_.load(),
+      .datagrams_dropped = datagrams_dropped_,
+      .datagrams_lost = datagrams_lost_.load(),
+      .fragments_sent = fragments_sent_.load(),
+      .header_bytes_saved = compressor_.BytesSaved(),
+  };
+}
+
+} // namespace lora_chat
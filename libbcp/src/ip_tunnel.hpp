@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+
+#include "header_compression.hpp"
+#include "packet.hpp"
+
+namespace lora_chat {
+
+/// Carries IP datagrams over a session: headers compressed with a
+/// HeaderCompressor, and each datagram fragmented across as many session
+/// messages as it takes.
+///
+/// Every fragment starts with a byte holding kFragment, whether it's the
+/// first and/or last of its datagram, and the datagram's number (mod 32),
+/// so that a datagram cut short by a session ending is dropped rather than
+/// spliced onto the next. The last fragment then gives how many of its bytes
+/// are data; the others are full. Sessions deliver messages in order, so
+/// reassembly needs nothing more.
+///
+/// Send() is thread-safe, so that datagrams can be read from a TUN device on
+/// their own thread. Everything else is for the thread running the session,
+/// e.g. from its MessagePipe callbacks.
+class IpTunnel {
+public:
+  /// The largest datagram carried: IPv6's minimum MTU
+  static constexpr size_t kMtu = 1280;
+  /// Datagrams waiting to go, beyond which Send() drops them
+  static constexpr size_t kMaxQueuedDatagrams = 16;
+  /// Data bytes in every fragment but the last
+  static constexpr size_t kFragmentDataBytes = kSessionPacketPayloadBytes - 1;
+
+  static constexpr uint8_t kFragment = 0x80;
+  static constexpr uint8_t kFirstFragment = 0x40;
+  static constexpr uint8_t kLastFragment = 0x20;
+  static constexpr uint8_t kDatagramNumberMask = 0x1f;
+
+  struct Stats {
+    uint64_t datagrams_sent;
+    uint64_t datagrams_received;
+    // Queue full, or too long to carry
+    uint64_t datagrams_dropped;
+    // Cut short, or not restorable
+    uint64_t datagrams_lost;
+    uint64_t fragments_sent;
+    int64_t header_bytes_saved;
+  };
+
+  /// Queues `datagram` to be sent. Returns false, dropping it, if it's
+  /// longer than kMtu or the queue is full.
+  bool Send(std::span<const uint8_t> datagram);
+
+  /// The next fragment to send, if there's anything to send
+  std::optional<SessionPacketPayload> NextMessage();
+  /// Takes a received message. Once it completes a datagram, writes the
+  /// datagram to `out` (which should hold kMtu bytes) and returns its length.
+  std::optional<size_t> Receive(SessionPacketPayload const &message,
+                                std::span<uint8_t> out);
+
+  /// Starts afresh for a new session, with both ends' compression contexts
+  /// and any part-sent or part-received datagram forgotten. Datagrams still
+  /// queued are kept.
+  void Reset();
+
+  Stats GetStats() const;
+
+private:
+  struct Queued {
+    std::array<uint8_t, kMtu> bytes;
+    size_t length;
+  };
+
+  /// Takes the next queued datagram and compresses it into outgoing_
+  bool StartNextDatagram();
+
+  mutable std::mutex queue_mutex_{};
+  std::array<Queued, kMaxQueuedDatagrams> queue_{};
+  size_t queue_head_{0};
+  size_t queue_length_{0};
+  uint64_t datagrams_dropped_{0};
+
+  HeaderCompressor compressor_{};
+  std::array<uint8_t, kMtu + HeaderCompressor::kMaxExpansion> outgoing_{};
+  size_t outgoing_length_{0};
+  size_t outgoing_offset_{0};
+  uint8_t outgoing_number_{0};
+  bool outgoing_in_progress_{false};
+
+  HeaderDecompressor decompressor_{};
+  std::array<uint8_t, kMtu + HeaderCompressor::kMaxExpansion> incoming_{};
+  size_t incoming_length_{0};
+  std::optional<uint8_t> incoming_number_{};
+
+  // Counted outside queue_mutex_, by the session's thread, but read by
+  // GetStats from any
+  std::atomic<uint64_t> datagrams_sent_{0};
+  std::atomic<uint64_t> datagrams_received_{0};
+  std::atomic<uint64_t> datagrams_lost_{0};
+  std::atomic<uint64_t> fragments_sent_{0};
+};
+
+} // namespace lora_chat
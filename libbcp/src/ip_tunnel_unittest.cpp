@@ -0,0 +1,103 @@
+#include "ip_tunnel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::IpTunnel;
+using lora_chat::SessionPacketPayload;
+
+std::vector<uint8_t> Datagram(size_t length, uint8_t seed) {
+  std::vector<uint8_t> d(length);
+  for (size_t i = 0; i < length; i++)
+    d[i] = seed + i;
+  return d;
+}
+
+// Passes every message `from` has to send over to `to`, returning the
+// datagrams that come out and how many messages it took
+std::vector<std::vector<uint8_t>> Pump(IpTunnel &from, IpTunnel &to,
+                                       size_t *messages = nullptr) {
+  std::vector<std::vector<uint8_t>> received{};
+  std::vector<uint8_t> out(IpTunnel::kMtu);
+  size_t n = 0;
+  while (auto message = from.NextMessage()) {
+    n++;
+    if (auto length = to.Receive(*message, out))
+      received.emplace_back(out.begin(), out.begin() + *length);
+  }
+  if (messages)
+    *messages = n;
+  return received;
+}
+
+TEST(IpTunnel, FragmentsAndReassembles) {
+  IpTunnel a{}, b{};
+  // Around each fragment boundary, with the compressor's type byte on top
+  const size_t lengths[] = {1,  28, 29, 30, 31, 32, 60, 61,
+                            62, 63, 93, 500, IpTunnel::kMtu};
+  for (size_t length : lengths) {
+    auto datagram = Datagram(length, length);
+    ASSERT_TRUE(a.Send(datagram));
+    size_t messages = 0;
+    auto received = Pump(a, b, &messages);
+    ASSERT_EQ(received.size(), 1u) << length;
+    EXPECT_EQ(received[0], datagram);
+    // Full fragments, plus a last one that has a byte to spare
+    EXPECT_EQ(messages, (length + 1) / IpTunnel::kFragmentDataBytes + 1)
+        << length;
+  }
+  auto stats = b.GetStats();
+  EXPECT_EQ(stats.datagrams_received, std::size(lengths));
+  EXPECT_EQ(stats.datagrams_lost, 0u);
+  EXPECT_EQ(a.GetStats().datagrams_sent, std::size(lengths));
+}
+
+TEST(IpTunnel, EmptyMessagesAreNotFragments) {
+  IpTunnel b{};
+  std::vector<uint8_t> out(IpTunnel::kMtu);
+  EXPECT_FALSE(b.Receive(SessionPacketPayload{}, out));
+  EXPECT_EQ(b.GetStats().datagrams_lost, 0u);
+}
+
+TEST(IpTunnel, DatagramsCutShortAreDropped) {
+  IpTunnel a{}, b{};
+  std::vector<uint8_t> out(IpTunnel::kMtu);
+  auto first = Datagram(100, 1);
+  auto second = Datagram(100, 2);
+  ASSERT_TRUE(a.Send(first));
+  ASSERT_TRUE(a.Send(second));
+
+  // The session ends partway through the first; both ends start over
+  b.Receive(*a.NextMessage(), out);
+  a.Reset();
+  b.Reset();
+  auto received = Pump(a, b);
+  ASSERT_EQ(received.size(), 1u);
+  EXPECT_EQ(received[0], second);
+
+  // Just the middle of one, which can't be pieced together
+  ASSERT_TRUE(a.Send(first));
+  a.NextMessage();
+  EXPECT_TRUE(Pump(a, b).empty());
+  EXPECT_EQ(b.GetStats().datagrams_lost, 1u);
+}
+
+TEST(IpTunnel, QueueIsBounded) {
+  IpTunnel a{}, b{};
+  for (size_t i = 0; i < IpTunnel::kMaxQueuedDatagrams; i++)
+    EXPECT_TRUE(a.Send(Datagram(10, i)));
+  EXPECT_FALSE(a.Send(Datagram(10, 0)));
+  EXPECT_FALSE(a.Send(Datagram(IpTunnel::kMtu + 1, 0)));
+  EXPECT_EQ(a.GetStats().datagrams_dropped, 2u);
+
+  auto received = Pump(a, b);
+  ASSERT_EQ(received.size(), IpTunnel::kMaxQueuedDatagrams);
+  for (size_t i = 0; i < received.size(); i++)
+    EXPECT_EQ(received[i], Datagram(10, i));
+}
+
+} // namespace
@@ -0,0 +1,229 @@
+#include "link_planner.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "frame_sizer.hpp"
+#include "packet_buffer.hpp"
+
+namespace lora_chat {
+
+namespace {
+
+// The bit error rate right at the SNR floor, and how many dB above it buy
+// each tenfold drop. LoRa's waterfall is steep: a few dB take a frame from
+// coin-flip to near-certain.
+constexpr double kBitErrorRateAtFloor = 1e-3;
+constexpr double kDbPerDecadeOfBitErrors = 1.5;
+// What each step of coding rate beyond 4/5 is worth
+constexpr double kCodingGainDbPerStep = 0.4;
+
+// Shadowing is integrated over this many standard deviations either side of
+// the mean, in this many steps
+constexpr double kFadingSpanSigmas = 4.0;
+constexpr int kFadingSteps = 81;
+
+// Supply currents from the SX1276 datasheet (table 6), at 3.3V
+constexpr double kSupplyVolts = 3.3;
+constexpr double kReceiveMilliamps = 11.5;
+// Between windows the radio waits in standby
+constexpr double kIdleMilliamps = 1.6;
+struct TransmitCurrent {
+  float dbm;
+  double milliamps;
+};
+constexpr TransmitCurrent kTransmitCurrents[] = {
+    {7, 20}, {13, 29}, {17, 87}, {20, 120}};
+
+double TransmitMilliamps(float dbm) {
+  auto const *above = std::find_if(std::begin(kTransmitCurrents),
+                                   std::end(kTransmitCurrents),
+                                   [&](auto const &c) { return c.dbm >= dbm; });
+  if (above == std::begin(kTransmitCurrents))
+    return above->milliamps;
+  if (above == std::end(kTransmitCurrents))
+    return std::prev(above)->milliamps;
+  auto const *below = std::prev(above);
+  return below->milliamps + (above->milliamps - below->milliamps) *
+                                (dbm - below->dbm) / (above->dbm - below->dbm);
+}
+
+double Seconds(Duration d) { return std::chrono::duration<double>(d).count(); }
+
+size_t FrameBytes(size_t payload_bytes) {
+  return kSessionPayloadOffset + payload_bytes;
+}
+
+} // namespace
+
+LinkSettings LinkPlanner::SettingsFor(sx1276::ChannelConfig const &channel,
+                                      sx1276::PacketConfig const &packet,
+                                      size_t payload_bytes,
+                                      Duration gap_duration) const {
+  // The frame sizer may grow frames back to full size at any point, so the
+  // window has to fit one whatever the payload size settled on
+  const auto airtime_ms = sx1276::compute_time_on_air_ms(
+      FrameBytes(kSessionPacketPayloadBytes), channel, packet);
+  return {
+      .channel = channel,
+      .packet = packet,
+      .payload_bytes = payload_bytes,
+      .transmission_duration = std::chrono::milliseconds(airtime_ms),
+      .gap_duration = gap_duration,
+  };
+}
+
+double LinkPlanner::FrameSurvival(sx1276::ChannelConfig const &channel,
+                                  size_t frame_bytes) const {
+  const double mean_margin = conditions_.tx_power_dbm -
+                             conditions_.path_loss_db -
+                             sx1276::sensitivity_dbm(channel);
+  const double coding_gain = kCodingGainDbPerStep * (channel.cr - 1);
+  const double bits = 8.0 * frame_bytes;
+
+  // Averaged over the shadowing, which is slow enough to hold for a frame
+  double survival = 0;
+  double total_weight = 0;
+  for (int i = 0; i < kFadingSteps; i++) {
+    const double x =
+        -kFadingSpanSigmas + 2 * kFadingSpanSigmas * i / (kFadingSteps - 1);
+    const double weight = std::exp(-x * x / 2);
+    total_weight += weight;
+    const double margin = mean_margin + conditions_.fading_db * x;
+    if (margin < 0)
+      continue;
+    const double ber = kBitErrorRateAtFloor *
+                       std::pow(10.0, -(margin + coding_gain) /
+                                          kDbPerDecadeOfBitErrors);
+    survival += weight * std::exp(bits * std::log1p(-ber));
+  }
+  return survival / total_weight;
+}
+
+LinkPrediction LinkPlanner::Predict(LinkSettings const &settings) const {
+  const size_t frame_bytes = FrameBytes(settings.payload_bytes);
+  const double airtime_s = sx1276::time_on_air_s(
+      static_cast<int>(frame_bytes), settings.channel, settings.packet);
+  const double window_s = Seconds(settings.transmission_duration);
+  const double period_s =
+      2 * (window_s + Seconds(settings.gap_duration));
+
+  const double survival = FrameSurvival(settings.channel, frame_bytes);
+  // A chunk moves on once it, and the acknowledgement riding on the peer's
+  // frame back, both get through
+  const double advance = survival * survival;
+  const double chunks_per_message = std::ceil(
+      static_cast<double>(kSessionPacketPayloadBytes) / settings.payload_bytes);
+  const double periods_per_message =
+      advance > 0 ? chunks_per_message / advance : INFINITY;
+
+  // Every period, each end transmits once and listens through the other's
+  // window, idling through the gaps
+  const double energy_per_period_mj =
+      kSupplyVolts *
+      (TransmitMilliamps(conditions_.tx_power_dbm) * airtime_s +
+       kReceiveMilliamps * window_s +
+       kIdleMilliamps * (period_s - airtime_s - window_s));
+
+  return {
+      .margin_db = conditions_.tx_power_dbm - conditions_.path_loss_db -
+                   sx1276::sensitivity_dbm(settings.channel),
+      .frame_loss_rate = 1 - survival,
+      .goodput_bps = 8.0 * settings.payload_bytes * advance / period_s,
+      // Queued on average half a period before the next window, then however
+      // many periods it takes, the last ending once the frame's on air
+      .latency_s = period_s / 2 + period_s * (periods_per_message - 1) +
+                   airtime_s,
+      .duty_cycle = airtime_s / period_s,
+      .energy_per_message_mj = energy_per_period_mj * periods_per_message,
+  };
+}
+
+std::vector<LinkPlan> LinkPlanner::Sweep(unsigned threads) const {
+  constexpr sx1276::SpreadingFactor kSpreadingFactors[] = {
+      sx1276::kSF7,  sx1276::kSF8,  sx1276::kSF9,
+      sx1276::kSF10, sx1276::kSF11, sx1276::kSF12};
+  constexpr sx1276::CodingRate kCodingRates[] = {
+      sx1276::k4_5, sx1276::k4_6, sx1276::k4_7, sx1276::k4_8};
+  constexpr size_t kBandwidths = sx1276::k500kHz + 1;
+
+  // Every point gets a fixed slot, so the result doesn't depend on which
+  // thread got to it first
+  std::vector<LinkSettings> points{};
+  for (auto sf : kSpreadingFactors)
+    for (size_t bw = 0; bw < kBandwidths; bw++)
+      for (auto cr : kCodingRates) {
+        const sx1276::ChannelConfig channel{
+            conditions_.freq, static_cast<sx1276::Bandwidth>(bw), cr, sf};
+        for (size_t payload : FrameSizer::kPayloadSizes) {
+          for (int gap_ms : kGapDurationsMs)
+            points.push_back(SettingsFor(channel, sx1276::kDefaultPacketConfig,
+                                         payload,
+                                         std::chrono::milliseconds(gap_ms)));
+          // Plus the shortest gap that keeps within the duty cycle limit,
+          // which for slow settings can be far longer than any of those
+          auto settings = points.back();
+          const double airtime_s = sx1276::time_on_air_s(
+              static_cast<int>(FrameBytes(payload)), channel,
+              sx1276::kDefaultPacketConfig);
+          const double gap_s = airtime_s / conditions_.max_duty_cycle / 2 -
+                               Seconds(settings.transmission_duration);
+          if (gap_s * 1000 > kGapDurationsMs[std::size(kGapDurationsMs) - 1]) {
+            settings.gap_duration = std::chrono::milliseconds(
+                static_cast<int64_t>(std::ceil(gap_s * 1000)));
+            points.push_back(settings);
+          }
+        }
+      }
+
+  std::vector<LinkPrediction> predictions(points.size());
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers{};
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back([&, t]() {
+      for (size_t i = t; i < points.size(); i += threads)
+        predictions[i] = Predict(points[i]);
+    });
+  for (auto &worker : workers)
+    worker.join();
+
+  std::vector<LinkPlan> plans{};
+  for (size_t i = 0; i < points.size(); i++) {
+    auto const &p = predictions[i];
+    if (p.margin_db < conditions_.required_margin_db ||
+        p.duty_cycle > conditions_.max_duty_cycle || !(p.goodput_bps > 0))
+      continue;
+    plans.push_back({points[i], p});
+  }
+  return plans;
+}
+
+bool LinkPlanner::Dominates(LinkPrediction const &a, LinkPrediction const &b) {
+  const bool no_worse = a.goodput_bps >= b.goodput_bps &&
+                        a.latency_s <= b.latency_s &&
+                        a.duty_cycle <= b.duty_cycle &&
+                        a.energy_per_message_mj <= b.energy_per_message_mj;
+  const bool better = a.goodput_bps > b.goodput_bps ||
+                      a.latency_s < b.latency_s ||
+                      a.duty_cycle < b.duty_cycle ||
+                      a.energy_per_message_mj < b.energy_per_message_mj;
+  return no_worse && better;
+}
+
+std::vector<LinkPlan>
+LinkPlanner::ParetoFront(std::vector<LinkPlan> const &plans) {
+  std::vector<LinkPlan> front{};
+  for (auto const &plan : plans)
+    if (std::none_of(plans.begin(), plans.end(), [&](auto const &other) {
+          return Dominates(other.prediction, plan.prediction);
+        }))
+      front.push_back(plan);
+  std::stable_sort(front.begin(), front.end(), [](auto const &a, auto const &b) {
+    return a.prediction.goodput_bps > b.prediction.goodput_bps;
+  });
+  return front;
+}
+
+} // namespace lora_chat
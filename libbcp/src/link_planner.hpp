@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "sx1276/sx1276.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// What a site has to work with, as far as choosing radio settings goes.
+struct LinkConditions {
+  float tx_power_dbm{17};
+  // Mean loss between the two ends, e.g. from sx1276::path_loss_db
+  float path_loss_db{120};
+  // Standard deviation of the slow fading/shadowing about that mean
+  float fading_db{4};
+  // Settings which don't clear the receiver's sensitivity by this much, on
+  // average, aren't considered
+  float required_margin_db{5};
+  // The largest fraction of time a node may spend transmitting, e.g. 0.01 in
+  // much of the EU's 868MHz band
+  double max_duty_cycle{1.0};
+  sx1276::Frequency freq{0xe4c000}; // 915MHz
+};
+
+/// One point in the space of settings: the modem, how much payload each
+/// session frame carries, and the session's slot timing.
+struct LinkSettings {
+  sx1276::ChannelConfig channel;
+  sx1276::PacketConfig packet;
+  size_t payload_bytes;
+  Duration transmission_duration;
+  Duration gap_duration;
+};
+
+/// What a session running with some LinkSettings should see, in each
+/// direction, with both ends always having something to send.
+struct LinkPrediction {
+  float margin_db;
+  // Chance that any one frame is lost
+  double frame_loss_rate;
+  // Message bytes delivered per second
+  double goodput_bps;
+  // Mean time from a message being queued to its last byte arriving
+  double latency_s;
+  // Fraction of time spent transmitting
+  double duty_cycle;
+  // Radio energy (transmit, receive and idle) spent per message delivered
+  double energy_per_message_mj;
+};
+
+struct LinkPlan {
+  LinkSettings settings;
+  LinkPrediction prediction;
+};
+
+/// Predicts how sessions would fare under a set of LinkConditions, and sweeps
+/// the settings to find the ones worth choosing between.
+///
+/// Airtime comes from the datasheet's formula, and a session's transmission
+/// window is sized the way sessions need it: long enough for a full frame,
+/// padded as compute_time_on_air_ms pads it. Each period carries one frame
+/// each way, and a chunk of a message only moves on once both it and the
+/// peer's acknowledgement get through.
+///
+/// Losses are modelled from the link margin: the margin wanders about its
+/// mean with log-normal shadowing, frames are lost outright below the
+/// demodulator's SNR floor, and above it bit errors fall away steeply with
+/// every dB to spare. The constants behind that are rough; the planner is
+/// for ranking settings against each other, not for promising numbers.
+class LinkPlanner {
+public:
+  explicit LinkPlanner(LinkConditions const &conditions)
+      : conditions_(conditions) {}
+
+  /// Settings for a session using `channel`, with the transmission window
+  /// sized for a full frame and the given gap
+  LinkSettings SettingsFor(sx1276::ChannelConfig const &channel,
+                           sx1276::PacketConfig const &packet,
+                           size_t payload_bytes, Duration gap_duration) const;
+
+  LinkPrediction Predict(LinkSettings const &settings) const;
+
+  /// The chance that a frame of `frame_bytes` gets through on `channel`
+  double FrameSurvival(sx1276::ChannelConfig const &channel,
+                       size_t frame_bytes) const;
+
+  /// Predicts every combination of spreading factor, bandwidth, coding rate,
+  /// payload size and gap (kGapDurationsMs, and the shortest gap within the
+  /// duty cycle limit), spread over `threads` threads (0 for one per core),
+  /// and returns the ones which meet the conditions, in sweep order.
+  std::vector<LinkPlan> Sweep(unsigned threads = 0) const;
+
+  /// The plans which no other plan beats on goodput, latency, duty cycle and
+  /// energy all at once, fastest first
+  static std::vector<LinkPlan> ParetoFront(std::vector<LinkPlan> const &plans);
+  /// Whether `a` is at least as good as `b` in every respect, and better in
+  /// at least one
+  static bool Dominates(LinkPrediction const &a, LinkPrediction const &b);
+
+  /// The gaps between windows the sweep tries
+  static constexpr int kGapDurationsMs[] = {10, 25, 50, 100, 200, 500, 1000};
+
+private:
+  LinkConditions conditions_;
+};
+
+} // namespace lora_chat
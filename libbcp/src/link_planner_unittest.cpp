@@ -0,0 +1,109 @@
+#include "link_planner.hpp"
+
+#include <chrono>
+
+#include "packet_buffer.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::LinkConditions;
+using lora_chat::LinkPlanner;
+using lora_chat::LinkPrediction;
+using std::chrono::milliseconds;
+using namespace sx1276;
+
+constexpr ChannelConfig kSF9{0xe4c000, Bandwidth::k125kHz, CodingRate::k4_7,
+                             SpreadingFactor::kSF9};
+
+TEST(LinkPlanner, MarginAndLengthDecideLosses) {
+  LinkConditions strong{};
+  strong.path_loss_db = 100;
+  LinkConditions weak = strong;
+  weak.path_loss_db = 147; // 2dB above SF9's floor, on average
+
+  EXPECT_GT(LinkPlanner(strong).FrameSurvival(kSF9, 41), 0.999);
+  const double weak_short = LinkPlanner(weak).FrameSurvival(kSF9, 13);
+  const double weak_long = LinkPlanner(weak).FrameSurvival(kSF9, 41);
+  EXPECT_LT(weak_long, 0.9);
+  EXPECT_GT(weak_short, weak_long);
+
+  // A slower spreading factor buys back the margin
+  ChannelConfig sf12 = kSF9;
+  sf12.sf = SpreadingFactor::kSF12;
+  EXPECT_GT(LinkPlanner(weak).FrameSurvival(sf12, 41), 0.95);
+}
+
+TEST(LinkPlanner, SessionSlotsFitAFullFrame) {
+  LinkPlanner planner{LinkConditions{}};
+  auto settings =
+      planner.SettingsFor(kSF9, kDefaultPacketConfig, 4, milliseconds(100));
+  EXPECT_GE(settings.transmission_duration,
+            std::chrono::duration<float>(time_on_air_s(
+                lora_chat::kSessionPayloadOffset +
+                    lora_chat::kSessionPacketPayloadBytes,
+                kSF9)));
+
+  LinkConditions clean{};
+  clean.path_loss_db = 90;
+  auto p = LinkPlanner(clean).Predict(
+      planner.SettingsFor(kSF9, kDefaultPacketConfig, 32, milliseconds(100)));
+  // Nothing lost: a message every period, each way
+  const double period_s =
+      2 * (std::chrono::duration<double>(settings.transmission_duration).count() +
+           0.1);
+  EXPECT_NEAR(p.goodput_bps, 8 * 32 / period_s, 0.01 * p.goodput_bps);
+  EXPECT_LT(p.latency_s, period_s);
+  EXPECT_LT(p.duty_cycle, 0.5);
+  EXPECT_GT(p.energy_per_message_mj, 0);
+
+  // Longer gaps trade throughput for duty cycle
+  auto gappy = LinkPlanner(clean).Predict(
+      planner.SettingsFor(kSF9, kDefaultPacketConfig, 32, milliseconds(1000)));
+  EXPECT_LT(gappy.goodput_bps, p.goodput_bps);
+  EXPECT_LT(gappy.duty_cycle, p.duty_cycle);
+}
+
+TEST(LinkPlanner, ParetoFrontKeepsOnlyTradeOffs) {
+  const LinkPrediction fast{0, 0, 100, 1, 0.5, 10};
+  const LinkPrediction frugal{0, 0, 10, 5, 0.05, 2};
+  const LinkPrediction worse{0, 0, 10, 5, 0.5, 10};
+  EXPECT_TRUE(LinkPlanner::Dominates(fast, worse));
+  EXPECT_TRUE(LinkPlanner::Dominates(frugal, worse));
+  EXPECT_FALSE(LinkPlanner::Dominates(fast, frugal));
+  EXPECT_FALSE(LinkPlanner::Dominates(frugal, fast));
+  EXPECT_FALSE(LinkPlanner::Dominates(fast, fast));
+
+  auto front = LinkPlanner::ParetoFront(
+      {{{}, worse}, {{}, frugal}, {{}, fast}});
+  ASSERT_EQ(front.size(), 2u);
+  EXPECT_EQ(front[0].prediction.goodput_bps, 100);
+  EXPECT_EQ(front[1].prediction.goodput_bps, 10);
+}
+
+TEST(LinkPlanner, SweepMeetsConditionsWhateverTheThreads) {
+  LinkConditions conditions{};
+  conditions.path_loss_db = 135;
+  conditions.max_duty_cycle = 0.1;
+  LinkPlanner planner{conditions};
+  auto plans = planner.Sweep(4);
+  ASSERT_FALSE(plans.empty());
+  for (auto const &plan : plans) {
+    EXPECT_GE(plan.prediction.margin_db, conditions.required_margin_db);
+    EXPECT_LE(plan.prediction.duty_cycle, conditions.max_duty_cycle);
+  }
+
+  auto serial = planner.Sweep(1);
+  ASSERT_EQ(serial.size(), plans.size());
+  for (size_t i = 0; i < plans.size(); i++)
+    EXPECT_EQ(serial[i].prediction.goodput_bps, plans[i].prediction.goodput_bps);
+
+  // Nothing on the front is beaten outright by anything in the sweep
+  auto front = LinkPlanner::ParetoFront(plans);
+  ASSERT_FALSE(front.empty());
+  for (auto const &chosen : front)
+    for (auto const &plan : plans)
+      EXPECT_FALSE(LinkPlanner::Dominates(plan.prediction, chosen.prediction));
+}
+
+} // namespace
@@ -0,0 +1,192 @@
+#include "load_test.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace lora_chat {
+
+namespace {
+
+WireTimePoint ToWireTime(WireTimeClock::time_point t) {
+  return FlipBitsIfBigEndian<WireTimePoint>(
+      std::chrono::duration_cast<WireTimeUnit>(t.time_since_epoch()).count());
+}
+
+WireTimeClock::time_point FromWireTime(WireTimePoint t) {
+  return WireTimeClock::time_point(
+      std::chrono::duration_cast<WireTimeClock::duration>(
+          WireTimeUnit(FlipBitsIfBigEndian(t))));
+}
+
+double Seconds(Duration d) { return std::chrono::duration<double>(d).count(); }
+
+// A frame may start up to 1/kLateToleranceDivisor of a period past its
+// scheduled time, to allow for wakeup jitter, before it's counted as late
+constexpr int kLateToleranceDivisor = 10;
+
+} // namespace
+
+TrafficGenerator::Report TrafficGenerator::Run() {
+  std::vector<uint8_t> frame(
+      std::clamp(options_.frame_bytes, kLoadTestFrameHeaderBytes,
+                 radio_.MaximumMessageLength()));
+  // Fill with something other than zeroes so the filler can't be mistaken for
+  // padding on the receiving end
+  for (size_t i = kLoadTestFrameHeaderBytes; i < frame.size(); i++)
+    frame[i] = static_cast<uint8_t>(i);
+
+  const Duration period =
+      (options_.rate_hz > 0)
+          ? std::chrono::duration_cast<Duration>(
+                std::chrono::duration<double>(1.0 / options_.rate_hz))
+          : Duration::zero();
+
+  Report report{};
+  const TimePoint start = Now();
+  for (uint32_t i = 0; i < options_.count; i++) {
+    // Schedule against the start time rather than the previous frame, so
+    // that jitter doesn't accumulate into a lower rate
+    const TimePoint scheduled = start + i * period;
+    // Back-to-back, there's no schedule to fall behind
+    if (period > Duration::zero() &&
+        Now() > scheduled + period / kLateToleranceDivisor)
+      report.late++;
+    std::this_thread::sleep_until(scheduled);
+
+    LoadTestFrameHeader header{
+        .magic = FlipBitsIfBigEndian(LoadTestFrameHeader::kMagic),
+        .run_id = FlipBitsIfBigEndian(options_.run_id),
+        .sequence = FlipBitsIfBigEndian(i),
+        .count = FlipBitsIfBigEndian(options_.count),
+        .frame_bytes = FlipBitsIfBigEndian<uint32_t>(frame.size()),
+        .sent_at = ToWireTime(WireTimeClock::now()),
+    };
+    std::memcpy(frame.data(), &header, sizeof(header));
+
+    if (radio_.Transmit(frame) == RadioInterface::kSuccess)
+      report.sent++;
+    else
+      report.failed++;
+  }
+  report.elapsed = Now() - start;
+  return report;
+}
+
+bool LoadTestStats::Observe(std::span<uint8_t const> frame,
+                            WireTimeClock::time_point arrival) {
+  LoadTestFrameHeader header{};
+  if (frame.size() < sizeof(header)) {
+    ignored_++;
+    return false;
+  }
+  std::memcpy(&header, frame.data(), sizeof(header));
+  const uint32_t magic = FlipBitsIfBigEndian(header.magic);
+  const uint32_t run_id = FlipBitsIfBigEndian(header.run_id);
+  const uint32_t sequence = FlipBitsIfBigEndian(header.sequence);
+  const uint32_t count = FlipBitsIfBigEndian(header.count);
+
+  if (magic != LoadTestFrameHeader::kMagic || sequence >= count ||
+      count > kMaxRunFrames ||
+      (run_id_ && (*run_id_ != run_id || count_ != count))) {
+    ignored_++;
+    return false;
+  }
+  if (!run_id_) {
+    run_id_ = run_id;
+    count_ = count;
+    seen_.assign(count, false);
+    latencies_.reserve(count);
+    first_arrival_ = arrival;
+  }
+
+  if (seen_[sequence]) {
+    duplicates_++;
+    return true;
+  }
+  seen_[sequence] = true;
+  received_++;
+  bytes_ += std::min<size_t>(FlipBitsIfBigEndian(header.frame_bytes),
+                             frame.size());
+  last_arrival_ = arrival;
+
+  if (highest_sequence_ && sequence < *highest_sequence_)
+    reordered_++;
+  else
+    highest_sequence_ = sequence;
+
+  latencies_.push_back(std::chrono::duration_cast<Duration>(
+      arrival - FromWireTime(header.sent_at)));
+  return true;
+}
+
+bool LoadTestStats::Complete() const {
+  return run_id_ && received_ == count_;
+}
+
+LoadTestReport LoadTestStats::Report() const {
+  LoadTestReport report{
+      .expected = count_,
+      .received = received_,
+      .lost = count_ - received_,
+      .duplicates = duplicates_,
+      .reordered = reordered_,
+      .ignored = ignored_,
+      .elapsed = std::chrono::duration_cast<Duration>(last_arrival_ -
+                                                      first_arrival_),
+  };
+
+  // With a single frame there's no interval to measure a rate over
+  if (received_ > 1 && report.elapsed > Duration::zero()) {
+    const double seconds = Seconds(report.elapsed);
+    // The first frame's arrival starts the clock, so it doesn't count
+    report.frames_per_second = (received_ - 1) / seconds;
+    report.bits_per_second =
+        8.0 * bytes_ * (received_ - 1) / received_ / seconds;
+  }
+
+  if (!latencies_.empty()) {
+    auto sorted = latencies_;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+      size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+      return sorted[rank];
+    };
+    report.latency_p50 = percentile(0.50);
+    report.latency_p90 = percentile(0.90);
+    report.latency_p99 = percentile(0.99);
+    report.latency_max = sorted.back();
+  }
+  return report;
+}
+
+LoadTestReport TrafficReceiver::Run() {
+  std::vector<uint8_t> buffer(radio_.MaximumMessageLength());
+  LoadTestStats stats{};
+  uint32_t arrivals = 0;
+
+  TimePoint last_activity = Now();
+  while (!stats.Complete() &&
+         !(options_.expected && arrivals >= options_.expected) &&
+         Now() - last_activity < options_.idle_timeout) {
+    auto status = radio_.Receive(buffer);
+    // Stamp before doing anything else so parsing isn't counted as latency
+    auto arrival = WireTimeClock::now();
+    if (status != RadioInterface::kSuccess)
+      continue;
+    last_activity = Now();
+    if (stats.Observe(buffer, arrival))
+      arrivals++;
+  }
+
+  auto report = stats.Report();
+  // If we never heard from the sender, at least report what we were told to
+  // expect as lost
+  if (!report.expected && options_.expected) {
+    report.expected = options_.expected;
+    report.lost = options_.expected;
+  }
+  return report;
+}
+
+} // namespace lora_chat
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "radio_interface.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// The header carried at the front of every load-test frame. Everything after
+/// it is filler, so that the frame size can be varied independently.
+///
+/// Fields are little-endian on the wire (see FlipBitsIfBigEndian).
+struct __attribute__((packed)) LoadTestFrameHeader {
+  static constexpr uint32_t kMagic = 0x696f7461; // "iota"
+
+  uint32_t magic;
+  // Distinguishes back-to-back runs, so stragglers from an earlier run don't
+  // get counted against the current one
+  uint32_t run_id;
+  uint32_t sequence;
+  uint32_t count;
+  // Radios may hand back the frame with trailing padding, so carry the size
+  // that was actually sent
+  uint32_t frame_bytes;
+  WireTimePoint sent_at;
+};
+constexpr size_t kLoadTestFrameHeaderBytes = sizeof(LoadTestFrameHeader);
+
+/// Sends a run of sequenced, timestamped frames over a radio, either at a
+/// fixed rate or as fast as the radio will accept them.
+class TrafficGenerator {
+public:
+  struct Options {
+    // At most LoadTestStats::kMaxRunFrames, or the receiver won't count it
+    uint32_t count{100};
+    // Frames per second; 0 sends back-to-back
+    double rate_hz{0};
+    // Total frame size, including the header
+    size_t frame_bytes{kLoadTestFrameHeaderBytes};
+    uint32_t run_id{0};
+  };
+
+  struct Report {
+    uint32_t sent{0};
+    uint32_t failed{0};
+    Duration elapsed{};
+    // Frames whose scheduled send time had already passed by the time the
+    // radio was free; nonzero means the requested rate was unattainable.
+    // Always zero when sending back-to-back.
+    uint32_t late{0};
+  };
+
+  TrafficGenerator(RadioInterface &radio, Options options)
+      : radio_(radio), options_(options) {}
+
+  Report Run();
+
+private:
+  RadioInterface &radio_;
+  Options options_;
+};
+
+/// The summary of a received load-test run.
+struct LoadTestReport {
+  uint32_t expected{0};
+  uint32_t received{0};
+  uint32_t lost{0};
+  uint32_t duplicates{0};
+  // Frames that arrived after a frame with a higher sequence number
+  uint32_t reordered{0};
+  // Frames which weren't part of the run being measured
+  uint32_t ignored{0};
+
+  // Measured from the first to the last frame received
+  Duration elapsed{};
+  double frames_per_second{0};
+  double bits_per_second{0};
+
+  // One-way latency, which relies on sender and receiver wall clocks being
+  // synchronized in the same way that the handshake already does
+  std::optional<Duration> latency_p50{};
+  std::optional<Duration> latency_p90{};
+  std::optional<Duration> latency_p99{};
+  std::optional<Duration> latency_max{};
+};
+
+/// Accumulates statistics over the frames of a single load-test run.
+///
+/// The first valid frame observed selects the run; frames from any other run
+/// are ignored.
+class LoadTestStats {
+public:
+  /// The longest run that's counted. The count comes off the air, and the
+  /// bookkeeping is sized by it, so frames claiming more are ignored.
+  static constexpr uint32_t kMaxRunFrames = 1 << 20;
+
+  LoadTestStats() = default;
+
+  /// Returns whether `frame` was counted towards the current run.
+  bool Observe(std::span<uint8_t const> frame, WireTimeClock::time_point arrival);
+
+  /// True once every frame of the run has arrived at least once.
+  bool Complete() const;
+
+  LoadTestReport Report() const;
+
+private:
+  std::optional<uint32_t> run_id_{};
+  uint32_t count_{0};
+  uint32_t received_{0};
+  uint32_t duplicates_{0};
+  uint32_t reordered_{0};
+  uint32_t ignored_{0};
+  std::optional<uint32_t> highest_sequence_{};
+  std::vector<bool> seen_{};
+  std::vector<Duration> latencies_{};
+  size_t bytes_{0};
+  WireTimeClock::time_point first_arrival_{};
+  WireTimeClock::time_point last_arrival_{};
+};
+
+/// Receives a load-test run from a radio, stopping once every frame has been
+/// seen, `expected` frames have arrived (if nonzero), or nothing has been
+/// received for `idle_timeout`.
+class TrafficReceiver {
+public:
+  struct Options {
+    uint32_t expected{0};
+    std::chrono::milliseconds idle_timeout{5000};
+  };
+
+  TrafficReceiver(RadioInterface &radio, Options options)
+      : radio_(radio), options_(options) {}
+
+  LoadTestReport Run();
+
+private:
+  RadioInterface &radio_;
+  Options options_;
+};
+
+} // namespace lora_chat
@@ -0,0 +1,157 @@
+#include "load_test.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::LoadTestFrameHeader;
+using lora_chat::LoadTestStats;
+using lora_chat::TrafficGenerator;
+using lora_chat::TrafficReceiver;
+using lora_chat::WireTimeClock;
+using namespace lora_chat::testutils;
+using namespace std::chrono_literals;
+
+std::vector<uint8_t> Frame(uint32_t run_id, uint32_t sequence, uint32_t count,
+                           WireTimeClock::time_point sent_at) {
+  LoadTestFrameHeader header{
+      .magic = LoadTestFrameHeader::kMagic,
+      .run_id = run_id,
+      .sequence = sequence,
+      .count = count,
+      .frame_bytes = 64,
+      .sent_at = static_cast<lora_chat::WireTimePoint>(
+          std::chrono::duration_cast<lora_chat::WireTimeUnit>(
+              sent_at.time_since_epoch())
+              .count()),
+  };
+  std::vector<uint8_t> frame(64);
+  std::memcpy(frame.data(), &header, sizeof(header));
+  return frame;
+}
+
+TEST(LoadTestStats, LossReorderingAndDuplicates) {
+  const auto t0 = WireTimeClock::now();
+  LoadTestStats stats{};
+
+  // 0 1 3 2 3 5 [4 lost] [6..9 lost], each 10ms late and 100ms apart
+  for (uint32_t seq : {0, 1, 3, 2, 3, 5}) {
+    auto sent = t0 + seq * 100ms;
+    EXPECT_TRUE(stats.Observe(Frame(7, seq, 10, sent), sent + 10ms));
+  }
+  // A straggler from another run, and something that isn't a frame at all
+  EXPECT_FALSE(stats.Observe(Frame(8, 1, 10, t0), t0));
+  std::vector<uint8_t> noise(64, 0xab);
+  EXPECT_FALSE(stats.Observe(noise, t0));
+
+  EXPECT_FALSE(stats.Complete());
+  auto report = stats.Report();
+  EXPECT_EQ(report.expected, 10u);
+  EXPECT_EQ(report.received, 5u);
+  EXPECT_EQ(report.lost, 5u);
+  EXPECT_EQ(report.duplicates, 1u);
+  EXPECT_EQ(report.reordered, 1u);
+  EXPECT_EQ(report.ignored, 2u);
+  EXPECT_EQ(report.elapsed, 500ms);
+  EXPECT_DOUBLE_EQ(report.frames_per_second, 8.0);
+  EXPECT_DOUBLE_EQ(report.bits_per_second, 8.0 * 64 * 8);
+  ASSERT_TRUE(report.latency_p50.has_value());
+  EXPECT_EQ(*report.latency_p50, 10ms);
+  EXPECT_EQ(*report.latency_max, 10ms);
+}
+
+TEST(LoadTestStats, IgnoresRunsTooLongToTrack) {
+  const auto t0 = WireTimeClock::now();
+  LoadTestStats stats{};
+  // A corrupt count mustn't size anything, or select the run
+  EXPECT_FALSE(
+      stats.Observe(Frame(1, 0, LoadTestStats::kMaxRunFrames + 1, t0), t0));
+  EXPECT_FALSE(stats.Observe(Frame(1, 0, UINT32_MAX, t0), t0));
+  EXPECT_TRUE(stats.Observe(Frame(2, 0, 1, t0), t0));
+  EXPECT_TRUE(stats.Complete());
+  EXPECT_EQ(stats.Report().ignored, 2u);
+}
+
+TEST(LoadTestStats, LatencyPercentiles) {
+  const auto t0 = WireTimeClock::now();
+  LoadTestStats stats{};
+  for (uint32_t seq = 0; seq < 100; seq++)
+    stats.Observe(Frame(1, seq, 100, t0), t0 + (seq + 1) * 1ms);
+
+  EXPECT_TRUE(stats.Complete());
+  auto report = stats.Report();
+  EXPECT_EQ(report.lost, 0u);
+  EXPECT_EQ(report.reordered, 0u);
+  EXPECT_EQ(*report.latency_p50, 51ms);
+  EXPECT_EQ(*report.latency_p90, 90ms);
+  EXPECT_EQ(*report.latency_p99, 99ms);
+  EXPECT_EQ(*report.latency_max, 100ms);
+}
+
+TEST(LoadTest, OverLocalRadio) {
+  constexpr uint32_t kCount = 50;
+  LocalRadio radio{5ms};
+
+  auto received = std::async(std::launch::async, [&] {
+    return TrafficReceiver{radio, {.idle_timeout = 500ms}}.Run();
+  });
+  // Give the receiver a moment to start listening
+  std::this_thread::sleep_for(20ms);
+  auto sent = TrafficGenerator{radio, {.count = kCount, .frame_bytes = 48,
+                                       .run_id = 3}}
+                  .Run();
+  auto report = received.get();
+
+  EXPECT_EQ(sent.sent, kCount);
+  EXPECT_EQ(sent.failed, 0u);
+  // Back-to-back, nothing's ever behind schedule
+  EXPECT_EQ(sent.late, 0u);
+  EXPECT_EQ(report.expected, kCount);
+  EXPECT_EQ(report.received, kCount);
+  EXPECT_EQ(report.lost, 0u);
+  EXPECT_EQ(report.duplicates, 0u);
+  EXPECT_GT(report.frames_per_second, 0);
+  ASSERT_TRUE(report.latency_p50.has_value());
+  EXPECT_GE(*report.latency_p50, lora_chat::Duration::zero());
+}
+
+TEST(LoadTest, PacedAndLossy) {
+  constexpr uint32_t kCount = 40;
+  // Drop every 4th transmission
+  FallibleLocalRadio radio{5ms, 4, 0};
+
+  auto received = std::async(std::launch::async, [&] {
+    return TrafficReceiver{radio, {.idle_timeout = 500ms}}.Run();
+  });
+  std::this_thread::sleep_for(20ms);
+  auto sent = TrafficGenerator{radio, {.count = kCount, .rate_hz = 50}}.Run();
+  auto report = received.get();
+
+  EXPECT_EQ(sent.sent, 30u);
+  EXPECT_EQ(sent.failed, 10u);
+  // 40 frames at 50Hz
+  EXPECT_GE(sent.elapsed, 780ms);
+  EXPECT_EQ(report.expected, kCount);
+  EXPECT_EQ(report.received, 30u);
+  EXPECT_EQ(report.lost, 10u);
+}
+
+TEST(LoadTest, CountsFramesBehindSchedule) {
+  constexpr uint32_t kCount = 10;
+  // Each transmission holds the radio for 5ms, against a 4ms schedule, so
+  // every frame after the first starts a little further behind
+  LocalRadio radio{5ms};
+
+  auto sent = TrafficGenerator{radio, {.count = kCount, .rate_hz = 250}}.Run();
+
+  EXPECT_EQ(sent.sent, kCount);
+  EXPECT_EQ(sent.late, kCount - 1);
+}
+
+} // namespace
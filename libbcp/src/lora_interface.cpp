@@ -1,4 +1,14 @@
 #include "lora_interface.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
 #include "sx1276/sx1276.hpp"
 
 namespace lora_chat {
@@ -10,31 +20,295 @@ constexpr sx1276::ChannelConfig kHardcodedLoraChannelConfig {
   .sf = sx1276::SpreadingFactor::kSF9,
 };
 
+// The headroom is exactly where the FIFO address byte goes
+static_assert(kFrameHeadroomBytes == 1);
+
+namespace {
+void RecordTransmit(TimePoint begun, uint32_t airtime_us) {
+  auto &metrics = Metrics::Default();
+  metrics.Count(Counter::kTransmitNs, Now() - begun);
+  metrics.Count(Counter::kAirtimeNs, std::chrono::microseconds(airtime_us));
+}
+
+void RecordReceive(TimePoint begun) {
+  Metrics::Default().Count(Counter::kReceiveNs, Now() - begun);
+}
+
+RadioInterface::Status ReceiveStatus(sx1276::ReceiveResult result) {
+  switch (result) {
+  case sx1276::ReceiveResult::kReceived:
+    return RadioInterface::Status::kSuccess;
+  case sx1276::ReceiveResult::kNoFrame:
+    return RadioInterface::Status::kTimeout;
+  case sx1276::ReceiveResult::kCrcError:
+    return RadioInterface::Status::kBadMessage;
+  case sx1276::ReceiveResult::kReadFailed:
+    break;
+  }
+  return RadioInterface::Status::kUnspecifiedError;
+}
+} // namespace
+
 RadioInterface::Status LoraInterface::Transmit(std::span<uint8_t const> buffer) {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
   if (fd_ < 0) return Status::kInitializationFailed;
   if (!buffer.size_bytes() || buffer.size_bytes() > SX127x_FIFO_CAPACITY)
     return Status::kBadBufferSize;
 
-  sx1276::lora_transmit(fd_, &buffer[0], buffer.size_bytes());
+  const auto begun = Now();
+  const uint32_t airtime_us =
+      sx1276::lora_transmit_begin(fd_, &buffer[0], buffer.size_bytes());
+  live_at_ = Now() + std::chrono::microseconds(sx1276::kStandbyToTransmitUs);
+  usleep(airtime_us);
+  sx1276::lora_transmit_end(fd_);
+  RecordTransmit(begun, airtime_us);
+  return Status::kSuccess;
+}
+
+RadioInterface::Status LoraInterface::TransmitStaged(std::span<uint8_t> staged) {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
+  if (fd_ < 0) return Status::kInitializationFailed;
+  const size_t length = staged.size_bytes() - kFrameHeadroomBytes;
+  if (staged.size_bytes() <= kFrameHeadroomBytes || length > SX127x_FIFO_CAPACITY)
+    return Status::kBadBufferSize;
+
+  const auto begun = Now();
+  const uint32_t airtime_us =
+      sx1276::lora_transmit_begin_staged(fd_, &staged[0], length);
+  live_at_ = Now() + std::chrono::microseconds(sx1276::kStandbyToTransmitUs);
+  usleep(airtime_us);
+  sx1276::lora_transmit_end(fd_);
+  RecordTransmit(begun, airtime_us);
   return Status::kSuccess;
 }
 
 RadioInterface::Status LoraInterface::Receive(std::span<uint8_t> buffer_out) {
+  return ReceiveWithin(buffer_out, Duration::max());
+}
+
+RadioInterface::Status
+LoraInterface::ReceiveWithin(std::span<uint8_t> buffer_out, Duration window) {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
   if (fd_ < 0) return Status::kInitializationFailed;
   if (buffer_out.size_bytes() < SX127x_FIFO_CAPACITY)
     return Status::kBadBufferSize;
 
-  bool success = sx1276::lora_receive_continuous(fd_, &buffer_out[0], SX127x_FIFO_CAPACITY);
-  // TODO should actually check for whether we got a timeout or something else
-  return success ? Status::kSuccess : Status::kTimeout;
+  const auto begun = Now();
+  // As lora_receive_continuous does, with a note of when the radio's listening
+  const uint32_t window_us =
+      sx1276::lora_receive_continuous_begin(fd_, SX127x_FIFO_CAPACITY);
+  live_at_ = Now() + std::chrono::microseconds(sx1276::kStandbyToReceiveUs);
+  if (!window_us) {
+    RecordReceive(begun);
+    return Status::kUnspecifiedError;
+  }
+  // At least a moment, so that a window already over still goes through the
+  // same motions as any other
+  const auto window_cap =
+      std::chrono::ceil<std::chrono::microseconds>(window).count();
+  usleep(std::clamp<int64_t>(window_cap, 1, window_us));
+  const auto result = sx1276::lora_receive_continuous_end(
+      fd_, &buffer_out[0], SX127x_FIFO_CAPACITY);
+  RecordReceive(begun);
+  return ReceiveStatus(result);
 }
 
 size_t LoraInterface::MaximumMessageLength() const {
   return SX127x_FIFO_CAPACITY;
 }
 
-LoraInterface::LoraInterface() : fd_{spi_init()} {
-  sx1276::init_lora(fd_, kHardcodedLoraChannelConfig);
+std::optional<Duration> LoraInterface::TimeOnAir(size_t frame_bytes) const {
+  sx1276::ChannelConfig channel{};
+  sx1276::PacketConfig packet{};
+  if (!sx1276::get_channel_config(fd_, &channel) ||
+      !sx1276::get_packet_config(fd_, &packet))
+    return {};
+  return std::chrono::duration_cast<Duration>(std::chrono::duration<float>(
+      sx1276::time_on_air_s(frame_bytes, channel, packet)));
+}
+
+bool LoraInterface::SetWakeUpInterval(Duration interval) {
+  sx1276::ChannelConfig channel{};
+  if (fd_ < 0 || !sx1276::get_channel_config(fd_, &channel))
+    return false;
+  sx1276::set_preamble_symbols(
+      fd_, interval > Duration::zero()
+               ? sx1276::wake_up_preamble_symbols(
+                     std::chrono::duration<float>(interval).count(), channel)
+               : usual_preamble_symbols_);
+  return true;
+}
+
+void LoraInterface::Sleep() {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
+  if (fd_ >= 0) sx1276::lora_sleep(fd_);
+}
+
+RadioInterface::Status LoraInterface::DetectActivity() {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
+  if (fd_ < 0) return Status::kInitializationFailed;
+  return sx1276::lora_channel_activity(fd_) ? Status::kSuccess
+                                            : Status::kTimeout;
+}
+
+std::optional<int8_t> LoraInterface::SetTransmitPower(int8_t dbm) {
+  if (fd_ < 0) return {};
+  return sx1276::set_tx_power(fd_, dbm);
+}
+
+std::optional<float> LoraInterface::LastLinkMarginDb() const {
+  sx1276::ChannelConfig channel{};
+  if (fd_ < 0 || !sx1276::get_channel_config(fd_, &channel))
+    return {};
+  return sx1276::lora_last_packet_snr_db(fd_) -
+         sx1276::snr_limit_db(channel.sf);
+}
+
+std::optional<TimePoint> LoraInterface::LastOperationLive() const {
+  return live_at_;
+}
+
+std::optional<Duration> LoraInterface::WakeUpTime() const {
+  if (fd_ < 0) return {};
+  // The oscillator's start-up can't be seen from here: RegOpMode reads back
+  // standby as soon as it's written. What can be measured, the SPI write and
+  // the thread's own lateness, IdleUntil does, after Wake returns.
+  return std::chrono::microseconds(sx1276::kSleepToStandbyUs);
+}
+
+void LoraInterface::Wake() {
+  assert(pending_ == Pending::kNothing && "async operation in flight");
+  if (fd_ >= 0) sx1276::lora_wake(fd_);
+}
+
+bool LoraInterface::SubmitTransmit(std::span<uint8_t const> buffer,
+                                   TimePoint deadline, Completion done) {
+  if (pending_ != Pending::kNothing) return false;
+  done_ = done;
+  if (fd_ < 0) return CompleteImmediately(Status::kInitializationFailed);
+  if (!buffer.size_bytes() || buffer.size_bytes() > SX127x_FIFO_CAPACITY)
+    return CompleteImmediately(Status::kBadBufferSize);
+  if (Now() >= deadline) return CompleteImmediately(Status::kTimeout);
+
+  pending_ = Pending::kTransmit;
+  began_at_ = Now();
+  airtime_us_ = sx1276::lora_transmit_begin(fd_, &buffer[0], buffer.size_bytes());
+  ArmTimer(airtime_us_);
+  return true;
+}
+
+bool LoraInterface::SubmitTransmitStaged(std::span<uint8_t> staged,
+                                         TimePoint deadline, Completion done) {
+  if (pending_ != Pending::kNothing) return false;
+  done_ = done;
+  if (fd_ < 0) return CompleteImmediately(Status::kInitializationFailed);
+  const size_t length = staged.size_bytes() - kFrameHeadroomBytes;
+  if (staged.size_bytes() <= kFrameHeadroomBytes || length > SX127x_FIFO_CAPACITY)
+    return CompleteImmediately(Status::kBadBufferSize);
+  if (Now() >= deadline) return CompleteImmediately(Status::kTimeout);
+
+  pending_ = Pending::kTransmit;
+  began_at_ = Now();
+  airtime_us_ = sx1276::lora_transmit_begin_staged(fd_, &staged[0], length);
+  ArmTimer(airtime_us_);
+  return true;
+}
+
+bool LoraInterface::SubmitReceive(std::span<uint8_t> buffer_out,
+                                  TimePoint deadline, Completion done) {
+  if (pending_ != Pending::kNothing) return false;
+  done_ = done;
+  if (fd_ < 0) return CompleteImmediately(Status::kInitializationFailed);
+  if (buffer_out.size_bytes() < SX127x_FIFO_CAPACITY)
+    return CompleteImmediately(Status::kBadBufferSize);
+  auto window = std::chrono::ceil<std::chrono::microseconds>(deadline - Now());
+  if (window.count() <= 0) return CompleteImmediately(Status::kTimeout);
+
+  began_at_ = Now();
+  uint32_t wait_us =
+      sx1276::lora_receive_continuous_begin(fd_, SX127x_FIFO_CAPACITY);
+  if (!wait_us) return CompleteImmediately(Status::kUnspecifiedError);
+
+  pending_ = Pending::kReceive;
+  rx_buffer_ = buffer_out;
+  ArmTimer(std::min<int64_t>(wait_us, window.count()));
+  return true;
+}
+
+int LoraInterface::CompletionFd() { return timer_fd_; }
+
+size_t LoraInterface::DispatchCompletions() {
+  if (pending_ == Pending::kNothing) return 0;
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return 0; // Still in the air
+
+  Status status{status_};
+  switch (pending_) {
+  case Pending::kTransmit:
+    sx1276::lora_transmit_end(fd_);
+    RecordTransmit(began_at_, airtime_us_);
+    status = Status::kSuccess;
+    break;
+  case Pending::kReceive:
+    status = ReceiveStatus(sx1276::lora_receive_continuous_end(
+        fd_, rx_buffer_.data(), SX127x_FIFO_CAPACITY));
+    RecordReceive(began_at_);
+    break;
+  case Pending::kStatus:
+  case Pending::kNothing:
+    break;
+  }
+
+  // Cleared before the callback runs, so that it may submit again
+  pending_ = Pending::kNothing;
+  done_.func(done_.ctx, status);
+  return 1;
+}
+
+bool LoraInterface::CompleteImmediately(Status status) {
+  // Still goes through the timer, so that completions are always dispatched
+  // the same way
+  pending_ = Pending::kStatus;
+  status_ = status;
+  ArmTimer(0);
+  return true;
+}
+
+void LoraInterface::ArmTimer(uint32_t wait_us) {
+  itimerspec spec{};
+  spec.it_value.tv_sec = wait_us / 1000000;
+  spec.it_value.tv_nsec = (wait_us % 1000000) * 1000;
+  // An all-zero it_value would disarm the timer instead
+  if (!wait_us) spec.it_value.tv_nsec = 1;
+  if (timerfd_settime(timer_fd_, 0, &spec, nullptr) < 0)
+    perror("LoraInterface: timerfd_settime failed");
+}
+
+LoraInterface::LoraInterface()
+    : LoraInterface(kSpiDefaultDevice, kHardcodedLoraChannelConfig) {}
+
+LoraInterface::LoraInterface(const char *device, sx1276::ChannelConfig channel,
+                             sx1276::PacketConfig packet)
+    : fd_{spi_init(device)},
+      timer_fd_{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)},
+      usual_preamble_symbols_{packet.preamble_symbols} {
+  sx1276::init_lora(fd_, channel, packet);
+  if (timer_fd_ < 0) perror("LoraInterface: timerfd_create failed");
+}
+
+LoraInterface::LoraInterface(int spi_fd, sx1276::ChannelConfig channel,
+                             sx1276::PacketConfig packet)
+    : fd_{spi_fd},
+      timer_fd_{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)},
+      usual_preamble_symbols_{packet.preamble_symbols} {
+  sx1276::adopt_lora(fd_, channel, packet);
+  if (timer_fd_ < 0) perror("LoraInterface: timerfd_create failed");
+}
+
+LoraInterface::~LoraInterface() {
+  if (timer_fd_ >= 0) close(timer_fd_);
+  if (fd_ >= 0) close(fd_);
 }
 
 } // namespace lora_chat
@@ -5,6 +5,7 @@
 #include <cstdint>
 
 #include "radio_interface.hpp"
+#include "sx1276/sx1276.hpp"
 
 namespace lora_chat {
 
@@ -15,20 +16,93 @@ public:
   LoraInterface(LoraInterface &&) = delete;
   LoraInterface &operator=(LoraInterface &&) = delete;
 
+  /// The radio on the default spidev, on lora-chat's usual channel
   static LoraInterface &instance() {
     static LoraInterface instance;
     return instance;
   }
 
+  /// A radio on `device`, e.g. one of several on a gateway, each on its own
+  /// channel and/or spreading factor
+  LoraInterface(const char *device, sx1276::ChannelConfig channel,
+                sx1276::PacketConfig packet = sx1276::kDefaultPacketConfig);
+  /// Takes over `spi_fd`, a radio already set up on `channel` by another
+  /// process (see HotRestart), without reinitializing it
+  LoraInterface(int spi_fd, sx1276::ChannelConfig channel,
+                sx1276::PacketConfig packet = sx1276::kDefaultPacketConfig);
+  ~LoraInterface();
+
+  /// For handing the radio over to another process. -1 if it failed to open.
+  int SpiFd() const { return fd_; }
+  /// The preamble the radio was set up with, which low-power listening
+  /// (SetWakeUpInterval) stretches for as long as it's on
+  uint16_t UsualPreambleSymbols() const { return usual_preamble_symbols_; }
+
   virtual Status Transmit(std::span<uint8_t const> buffer);
   virtual Status Receive(std::span<uint8_t> buffer_out);
+  // Cuts short the wait for a frame as long as the FIFO holds
+  virtual Status ReceiveWithin(std::span<uint8_t> buffer_out, Duration window);
+  // The headroom takes the FIFO address, so the frame goes over SPI as is
+  virtual Status TransmitStaged(std::span<uint8_t> staged);
 
   virtual size_t MaximumMessageLength() const;
+  /// Per the datasheet, for the channel and packet settings the radio is on
+  virtual std::optional<Duration> TimeOnAir(size_t frame_bytes) const;
+
+  // Channel activity detection, and a preamble of as many symbols as it takes
+  virtual bool SetWakeUpInterval(Duration interval);
+  virtual void Sleep();
+  virtual Status DetectActivity();
+
+  // Per the PA's datasheet limits; see sx1276::set_tx_power
+  virtual std::optional<int8_t> SetTransmitPower(int8_t dbm);
+  virtual std::optional<float> LastLinkMarginDb() const;
+  virtual std::optional<TimePoint> LastOperationLive() const;
+
+  // Settings are kept through sleep; see sx1276::lora_wake
+  virtual std::optional<Duration> WakeUpTime() const;
+  virtual void Wake();
+
+  // Native async operations: the radio is programmed right away and a timerfd
+  // is armed for the airtime, so no thread sleeps while the frame is in the
+  // air. The timerfd is the completion fd.
+  virtual bool SubmitTransmit(std::span<uint8_t const> buffer,
+                              TimePoint deadline, Completion done);
+  virtual bool SubmitTransmitStaged(std::span<uint8_t> staged,
+                                    TimePoint deadline, Completion done);
+  virtual bool SubmitReceive(std::span<uint8_t> buffer_out, TimePoint deadline,
+                             Completion done);
+  virtual int CompletionFd();
+  virtual size_t DispatchCompletions();
 
 private:
   LoraInterface();
 
+  enum class Pending {
+    kNothing,
+    kTransmit,
+    kReceive,
+    // Finished (or failed) before reaching the radio; just report the status
+    kStatus,
+  };
+
+  bool CompleteImmediately(Status status);
+  void ArmTimer(uint32_t wait_us);
+
   int fd_;
+  int timer_fd_;
+  // What the preamble goes back to when low-power listening stops
+  uint16_t usual_preamble_symbols_;
+  // See LastOperationLive; blocking operations only
+  std::optional<TimePoint> live_at_{};
+
+  Pending pending_{Pending::kNothing};
+  std::span<uint8_t> rx_buffer_{};
+  Completion done_{};
+  Status status_{kSuccess};
+  // For the metrics: when the operation in flight began, and its airtime
+  TimePoint began_at_{};
+  uint32_t airtime_us_{0};
 };
 
 } // namespace lora_chat
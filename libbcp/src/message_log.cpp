@@ -0,0 +1,392 @@
+#include "message_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace lora_chat {
+
+namespace {
+
+constexpr const char *kSegmentNameFormat = "segment-%08u.log";
+
+size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+// FNV-1a: we only need to catch torn or garbage writes, not adversaries
+uint32_t Fnv1a(uint32_t hash, std::span<const uint8_t> bytes) {
+  for (auto b : bytes) {
+    hash ^= b;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+MessageLog::~MessageLog() { Close(); }
+
+uint32_t MessageLog::Checksum(RecordHeader const &header,
+                              std::span<const uint8_t> payload) {
+  RecordHeader copy = header;
+  copy.checksum = 0;
+  uint32_t hash = Fnv1a(2166136261u, {reinterpret_cast<uint8_t const *>(&copy),
+                                      sizeof(copy)});
+  return Fnv1a(hash, payload);
+}
+
+std::string MessageLog::SegmentPath(uint32_t index) const {
+  char name[32];
+  snprintf(name, sizeof(name), kSegmentNameFormat, index);
+  return directory_ + "/" + name;
+}
+
+MessageLog::Status MessageLog::Open(std::string directory, Options options) {
+  Close();
+  directory_ = std::move(directory);
+  options_ = options;
+  assert(options_.segment_bytes > kSegmentHeaderBytes + sizeof(RecordHeader));
+
+  if (!options_.read_only && mkdir(directory_.c_str(), 0755) < 0 &&
+      errno != EEXIST) {
+    perror("MessageLog: mkdir failed");
+    return Status::kIoError;
+  }
+
+  DIR *dir = opendir(directory_.c_str());
+  if (!dir) {
+    perror("MessageLog: opendir failed");
+    return Status::kIoError;
+  }
+  std::vector<uint32_t> indices{};
+  while (auto *entry = readdir(dir)) {
+    unsigned index = 0;
+    char trailing = 0;
+    if (sscanf(entry->d_name, "segment-%08u.lo%c", &index, &trailing) == 2 &&
+        trailing == 'g')
+      indices.push_back(index);
+  }
+  closedir(dir);
+  std::sort(indices.begin(), indices.end());
+
+  for (auto index : indices) {
+    auto status = MapSegment(index, false);
+    if (status != Status::kSuccess) {
+      Close();
+      return status;
+    }
+  }
+  if (segments_.empty())
+    return options_.read_only ? Status::kNotOpen : CreateNextSegment();
+  return Status::kSuccess;
+}
+
+void MessageLog::Close() {
+  if (segments_.empty())
+    return;
+  Sync();
+  for (auto &segment : segments_)
+    UnmapSegment(segment);
+  segments_.clear();
+  unsynced_records_ = 0;
+}
+
+MessageLog::Status MessageLog::MapSegment(uint32_t index, bool create) {
+  assert(!(create && options_.read_only));
+  auto path = SegmentPath(index);
+  int fd = open(path.c_str(),
+                (options_.read_only ? O_RDONLY : O_RDWR) |
+                    (create ? (O_CREAT | O_EXCL) : 0),
+                0644);
+  if (fd < 0) {
+    perror("MessageLog: failed to open segment");
+    return Status::kIoError;
+  }
+
+  size_t size = options_.segment_bytes;
+  if (create) {
+    if (ftruncate(fd, size) < 0) {
+      perror("MessageLog: failed to size segment");
+      close(fd);
+      return Status::kIoError;
+    }
+  } else {
+    struct stat st {};
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < kSegmentHeaderBytes) {
+      printf("MessageLog: segment %s is truncated\n", path.c_str());
+      close(fd);
+      return Status::kIoError;
+    }
+    size = st.st_size;
+  }
+
+  void *mapping =
+      mmap(nullptr, size, PROT_READ | (options_.read_only ? 0 : PROT_WRITE),
+           MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    perror("MessageLog: failed to map segment");
+    close(fd);
+    return Status::kIoError;
+  }
+
+  Segment segment{
+      .index = index,
+      .fd = fd,
+      .base = static_cast<uint8_t *>(mapping),
+      .size = size,
+      .tail = kSegmentHeaderBytes,
+      .synced = kSegmentHeaderBytes,
+  };
+
+  SegmentHeader header{};
+  if (!create)
+    std::memcpy(&header, segment.base, sizeof(header));
+  // The header is first synced along with the segment's first records, so
+  // if we went down before that, there's nothing behind it either
+  const SegmentHeader never_written{};
+  if (!create && options_.read_only &&
+      std::memcmp(&header, &never_written, sizeof(header)) == 0) {
+    // Nothing in it yet, and it isn't ours to start
+  } else if (create ||
+             std::memcmp(&header, &never_written, sizeof(header)) == 0) {
+    header = {.magic = kSegmentMagic, .version = kSegmentVersion,
+              .index = index, .reserved = 0};
+    std::memcpy(segment.base, &header, sizeof(header));
+    segment.synced = 0;
+  } else {
+    if (header.magic != kSegmentMagic || header.version != kSegmentVersion ||
+        header.index != index) {
+      printf("MessageLog: segment %s has a bad header\n", path.c_str());
+      UnmapSegment(segment);
+      return Status::kIoError;
+    }
+    segment.tail = ValidTail(segment);
+    segment.synced = segment.tail;
+  }
+
+  segments_.push_back(segment);
+  return Status::kSuccess;
+}
+
+size_t MessageLog::ValidTail(Segment const &segment) const {
+  size_t offset = kSegmentHeaderBytes;
+  while (auto record = ReadAt(segment, offset, true))
+    offset += RecordFootprint(record->payload.size());
+  return offset;
+}
+
+MessageLog::Status MessageLog::CreateNextSegment() {
+  uint32_t index = segments_.empty() ? 0 : segments_.back().index + 1;
+  return MapSegment(index, true);
+}
+
+void MessageLog::UnmapSegment(Segment &segment) {
+  munmap(segment.base, segment.size);
+  close(segment.fd);
+}
+
+std::optional<MessageLog::RecordId>
+MessageLog::Append(RecordKind kind, WireAddress peer, uint32_t sequence,
+                   WireTimePoint timestamp, RecordId reference,
+                   std::span<const uint8_t> payload, uint8_t flags) {
+  if (segments_.empty() || options_.read_only)
+    return {};
+
+  const size_t footprint = RecordFootprint(payload.size());
+  if (footprint > options_.segment_bytes - kSegmentHeaderBytes)
+    return {};
+
+  if (segments_.back().tail + footprint > segments_.back().size) {
+    // Without commit_on_append the full segment waits for the caller's next
+    // sync along with everything else
+    if ((options_.commit_on_append &&
+         SyncSegment(segments_.back()) != Status::kSuccess) ||
+        CreateNextSegment() != Status::kSuccess)
+      return {};
+  }
+  Segment &segment = segments_.back();
+
+  RecordHeader header{
+      .length = static_cast<uint32_t>(payload.size()),
+      .checksum = 0,
+      .reference = reference,
+      .timestamp = timestamp,
+      .peer = peer,
+      .sequence = sequence,
+      .kind = kind,
+      .flags = flags,
+      .reserved = {},
+  };
+  header.checksum = Checksum(header, payload);
+
+  uint8_t *dst = segment.base + segment.tail;
+  if (!payload.empty())
+    std::memcpy(dst + sizeof(header), payload.data(), payload.size());
+  std::memset(dst + sizeof(header) + payload.size(), 0,
+              footprint - sizeof(header) - payload.size());
+  std::memcpy(dst, &header, sizeof(header));
+
+  RecordId id = (static_cast<RecordId>(segment.index) << 32) | segment.tail;
+  segment.tail += footprint;
+
+  if (unsynced_records_++ == 0)
+    oldest_unsynced_append_ = Now();
+  if (options_.commit_on_append &&
+      (unsynced_records_ >= options_.group_commit_records ||
+       Now() - oldest_unsynced_append_ >= options_.group_commit_interval))
+    Sync();
+
+  return id;
+}
+
+MessageLog::Status MessageLog::SyncSegment(Segment &segment) {
+  if (segment.synced >= segment.tail)
+    return Status::kSuccess;
+  size_t begin = segment.synced & ~(PageSize() - 1);
+  if (msync(segment.base + begin, segment.tail - begin, MS_SYNC) < 0) {
+    perror("MessageLog: msync failed");
+    return Status::kIoError;
+  }
+  segment.synced = segment.tail;
+  return Status::kSuccess;
+}
+
+MessageLog::Status MessageLog::Sync() {
+  if (segments_.empty())
+    return Status::kNotOpen;
+  for (auto &segment : segments_) {
+    auto status = SyncSegment(segment);
+    if (status != Status::kSuccess)
+      return status;
+  }
+  unsynced_records_ = 0;
+  return Status::kSuccess;
+}
+
+std::vector<MessageLog::UnsyncedRange> MessageLog::UnsyncedRanges() const {
+  std::vector<UnsyncedRange> ranges{};
+  for (auto const &segment : segments_) {
+    if (segment.synced >= segment.tail)
+      continue;
+    size_t begin = segment.synced & ~(PageSize() - 1);
+    ranges.push_back({.segment = segment.index,
+                      .begin = segment.base + begin,
+                      .length = segment.tail - begin,
+                      .tail = segment.tail});
+  }
+  return ranges;
+}
+
+MessageLog::Status
+MessageLog::SyncRanges(std::span<const UnsyncedRange> ranges) {
+  for (auto const &range : ranges) {
+    if (msync(range.begin, range.length, MS_SYNC) < 0) {
+      perror("MessageLog: msync failed");
+      return Status::kIoError;
+    }
+  }
+  return Status::kSuccess;
+}
+
+void MessageLog::MarkSynced(std::span<const UnsyncedRange> ranges) {
+  for (auto const &range : ranges) {
+    auto it = std::lower_bound(
+        segments_.begin(), segments_.end(), range.segment,
+        [](Segment const &s, uint32_t i) { return s.index < i; });
+    if (it != segments_.end() && it->index == range.segment)
+      it->synced = std::max(it->synced, range.tail);
+  }
+  // Records appended in the meantime keep the count from going back to zero
+  if (std::all_of(segments_.begin(), segments_.end(),
+                  [](Segment const &s) { return s.synced >= s.tail; }))
+    unsynced_records_ = 0;
+}
+
+MessageLog::Segment const *MessageLog::FindSegment(uint32_t index) const {
+  auto it = std::lower_bound(
+      segments_.begin(), segments_.end(), index,
+      [](Segment const &s, uint32_t i) { return s.index < i; });
+  if (it == segments_.end() || it->index != index)
+    return nullptr;
+  return &*it;
+}
+
+std::optional<MessageLog::Record> MessageLog::Read(RecordId id) const {
+  auto const *segment = FindSegment(SegmentOf(id));
+  if (!segment)
+    return {};
+  size_t offset = id & 0xffffffff;
+  if (offset < kSegmentHeaderBytes || offset >= segment->tail)
+    return {};
+  return ReadAt(*segment, offset);
+}
+
+std::optional<MessageLog::Record>
+MessageLog::ReadAt(Segment const &segment, size_t offset, bool verify) const {
+  if (offset + sizeof(RecordHeader) > segment.size)
+    return {};
+  RecordHeader header{};
+  std::memcpy(&header, segment.base + offset, sizeof(header));
+  if (header.kind != RecordKind::kMessage &&
+      header.kind != RecordKind::kTombstone &&
+      header.kind != RecordKind::kSequenceMark)
+    return {};
+  if (header.length > segment.size - offset - sizeof(header))
+    return {};
+
+  std::span<const uint8_t> payload{segment.base + offset + sizeof(header),
+                                   header.length};
+  if (verify && Checksum(header, payload) != header.checksum)
+    return {};
+
+  return Record{
+      .id = (static_cast<RecordId>(segment.index) << 32) | offset,
+      .kind = header.kind,
+      .peer = header.peer,
+      .sequence = header.sequence,
+      .timestamp = header.timestamp,
+      .reference = header.reference,
+      .flags = header.flags,
+      .payload = payload,
+  };
+}
+
+std::optional<uint32_t> MessageLog::OldestSegment() const {
+  if (segments_.empty())
+    return {};
+  return segments_.front().index;
+}
+
+std::optional<uint32_t> MessageLog::NewestSegment() const {
+  if (segments_.empty())
+    return {};
+  return segments_.back().index;
+}
+
+MessageLog::Status MessageLog::DropOldestSegment() {
+  if (options_.read_only)
+    return Status::kIoError;
+  if (segments_.size() < 2)
+    return Status::kSuccess;
+  auto &segment = segments_.front();
+  UnmapSegment(segment);
+  if (unlink(SegmentPath(segment.index).c_str()) < 0) {
+    perror("MessageLog: failed to delete segment");
+    segments_.erase(segments_.begin());
+    return Status::kIoError;
+  }
+  segments_.erase(segments_.begin());
+  return Status::kSuccess;
+}
+
+} // namespace lora_chat
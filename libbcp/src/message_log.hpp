@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "packet.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// An append-only log of messages, stored as a series of fixed-size segment
+/// files within a single directory. Each segment is memory-mapped in full, so
+/// appends are a memcpy into the mapping and reads hand out spans which point
+/// straight into it.
+///
+/// Durability is batched ("group commit"): appended records are only
+/// guaranteed to survive a crash once Sync() has returned, which happens
+/// automatically every `group_commit_records` appends or once the oldest
+/// unsynced record is older than `group_commit_interval`. Callers which
+/// can't afford an msync on the thread doing the appending can turn that off
+/// (`commit_on_append`) and flush from elsewhere with the UnsyncedRanges()
+/// trio instead.
+///
+/// A log opened `read_only` can be read while another process appends to
+/// it: nothing is created or written, and Append fails.
+///
+/// Not thread-safe; callers must serialize access.
+class MessageLog {
+public:
+  /// Identifies a record within the log. The upper 32 bits are the index of
+  /// the segment holding the record, the lower 32 its offset in that segment.
+  using RecordId = uint64_t;
+
+  enum class Status {
+    kSuccess,
+    kIoError,
+    kNotOpen,
+  };
+
+  enum class RecordKind : uint8_t {
+    kMessage = 1,
+    // Marks the message named by `reference` as consumed
+    kTombstone = 2,
+    // Holds the next sequence number for `peer`, so that it outlives the
+    // segments holding the records which got it there
+    kSequenceMark = 3,
+  };
+
+  struct Options {
+    size_t segment_bytes{4 << 20};
+    size_t group_commit_records{64};
+    Duration group_commit_interval{std::chrono::milliseconds(50)};
+    // Otherwise nothing is synced until the caller asks
+    bool commit_on_append{true};
+    bool read_only{false};
+  };
+
+  /// Appended bytes which have yet to be flushed, from the start of the page
+  /// holding the first of them
+  struct UnsyncedRange {
+    uint32_t segment;
+    uint8_t *begin;
+    size_t length;
+    // Where the segment's tail was when the range was taken
+    size_t tail;
+  };
+
+  struct Record {
+    RecordId id;
+    RecordKind kind;
+    WireAddress peer;
+    uint32_t sequence;
+    WireTimePoint timestamp;
+    RecordId reference;
+    // Left to the caller; ChatHistory keeps the message's direction here
+    uint8_t flags;
+    // Points into the segment's mapping; valid until the segment is deleted
+    // or the log is closed
+    std::span<const uint8_t> payload;
+  };
+
+  MessageLog() = default;
+  ~MessageLog();
+
+  MessageLog(const MessageLog &) = delete;
+  MessageLog &operator=(const MessageLog &) = delete;
+
+  /// Opens (creating if needed) the log stored in `directory`, validating
+  /// every existing record. A torn write at the tail of the newest segment is
+  /// discarded, as is a segment whose header never made it to disk. Opened
+  /// `read_only`, a log with no segments yet is kNotOpen.
+  Status Open(std::string directory, Options options);
+  Status Open(std::string directory) { return Open(std::move(directory), {}); }
+  void Close();
+  bool IsOpen() const { return !segments_.empty(); }
+
+  /// Appends a record, returning its id. The record is readable immediately
+  /// but is only durable after the next Sync(). Fails if the record couldn't
+  /// fit in a segment, or a new segment couldn't be created, or the log is
+  /// read-only.
+  std::optional<RecordId> Append(RecordKind kind, WireAddress peer,
+                                 uint32_t sequence, WireTimePoint timestamp,
+                                 RecordId reference,
+                                 std::span<const uint8_t> payload,
+                                 uint8_t flags = 0);
+
+  /// Flushes every record appended so far to stable storage.
+  Status Sync();
+
+  /// Sync() in three steps, so that the msyncs themselves can run without
+  /// the caller's lock: take the ranges, flush them (which needs no lock, as
+  /// long as no segment is dropped and the log isn't closed meanwhile), and
+  /// then mark them as flushed.
+  std::vector<UnsyncedRange> UnsyncedRanges() const;
+  static Status SyncRanges(std::span<const UnsyncedRange> ranges);
+  void MarkSynced(std::span<const UnsyncedRange> ranges);
+
+  std::optional<Record> Read(RecordId id) const;
+
+  /// Calls `visit(record)` for every record in append order.
+  template <typename Visitor> void ForEach(Visitor &&visit) const {
+    for (auto const &segment : segments_) {
+      size_t offset = kSegmentHeaderBytes;
+      while (offset < segment.tail) {
+        auto record = ReadAt(segment, offset);
+        assert(record.has_value() && "Validated on open or append");
+        visit(*record);
+        offset += RecordFootprint(record->payload.size());
+      }
+    }
+  }
+
+  /// Deletes the oldest segment if it is not the one currently being
+  /// appended to. Records within it become unreadable. Fails if the log is
+  /// read-only.
+  Status DropOldestSegment();
+  std::optional<uint32_t> OldestSegment() const;
+  /// The segment currently being appended to
+  std::optional<uint32_t> NewestSegment() const;
+  static uint32_t SegmentOf(RecordId id) { return id >> 32; }
+
+  size_t UnsyncedRecords() const { return unsynced_records_; }
+
+private:
+  struct __attribute__((packed)) SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t index;
+    uint32_t reserved;
+  };
+
+  struct __attribute__((packed)) RecordHeader {
+    uint32_t length;
+    uint32_t checksum;
+    RecordId reference;
+    WireTimePoint timestamp;
+    WireAddress peer;
+    uint32_t sequence;
+    RecordKind kind;
+    uint8_t flags;
+    uint8_t reserved[6];
+  };
+
+  struct Segment {
+    uint32_t index;
+    int fd;
+    uint8_t *base;
+    size_t size;
+    size_t tail;
+    // Everything before this offset has been msync'd
+    size_t synced;
+  };
+
+  static constexpr uint32_t kSegmentMagic = 0x4243504c; // "BCPL"
+  static constexpr uint32_t kSegmentVersion = 1;
+  static constexpr size_t kSegmentHeaderBytes = sizeof(SegmentHeader);
+  static constexpr size_t kRecordAlignment = 8;
+
+  static size_t RecordFootprint(size_t payload_bytes) {
+    size_t raw = sizeof(RecordHeader) + payload_bytes;
+    return (raw + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+  }
+  static uint32_t Checksum(RecordHeader const &header,
+                           std::span<const uint8_t> payload);
+
+  std::string SegmentPath(uint32_t index) const;
+  Status MapSegment(uint32_t index, bool create);
+  size_t ValidTail(Segment const &segment) const;
+  Status CreateNextSegment();
+  void UnmapSegment(Segment &segment);
+  Segment const *FindSegment(uint32_t index) const;
+  std::optional<Record> ReadAt(Segment const &segment, size_t offset,
+                               bool verify = false) const;
+  Status SyncSegment(Segment &segment);
+
+  std::string directory_;
+  Options options_;
+  // Sorted by segment index; the last one is the one being appended to
+  std::vector<Segment> segments_;
+  size_t unsynced_records_{0};
+  TimePoint oldest_unsynced_append_;
+};
+
+} // namespace lora_chat
@@ -0,0 +1,356 @@
+#include "message_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unordered_set>
+#include <vector>
+
+#include "time.hpp"
+
+namespace lora_chat {
+
+MessageStore::Status MessageStore::Open(std::string directory,
+                                        Options options) {
+  Close();
+  std::scoped_lock lock(sync_lock_, lock_);
+
+  if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+    perror("MessageStore: mkdir failed");
+    return Status::kIoError;
+  }
+
+  // The committer takes care of it, away from whichever thread appends
+  MessageLog::Options log_options = options.log;
+  log_options.commit_on_append = false;
+  if (auto status = outbox_.Open(directory + "/outbox", log_options);
+      status != Status::kSuccess)
+    return status;
+  if (auto status = inbox_.Open(directory + "/inbox", log_options);
+      status != Status::kSuccess) {
+    outbox_.Close();
+    return status;
+  }
+
+  RebuildOutboxIndex();
+  RebuildInboxIndex();
+
+  commit_records_ = options.log.group_commit_records;
+  stopping_ = false;
+  committer_ = std::thread(&MessageStore::CommitLoop, this,
+                           options.log.group_commit_interval);
+  return Status::kSuccess;
+}
+
+void MessageStore::Close() {
+  if (committer_.joinable()) {
+    {
+      std::scoped_lock lock(lock_);
+      stopping_ = true;
+    }
+    commit_requested_.notify_all();
+    committer_.join();
+  }
+
+  std::scoped_lock lock(sync_lock_, lock_);
+  if (outbox_.IsOpen())
+    WriteTombstones();
+  outbox_.Close();
+  inbox_.Close();
+  outbox_queues_.clear();
+  outbox_by_sequence_.clear();
+  outbox_live_records_.clear();
+  delivered_.clear();
+  inbox_next_sequence_.clear();
+  inbox_by_sequence_.clear();
+}
+
+void MessageStore::RebuildOutboxIndex() {
+  outbox_queues_.clear();
+  outbox_by_sequence_.clear();
+  outbox_live_records_.clear();
+
+  std::unordered_set<RecordId> consumed{};
+  outbox_.ForEach([&](Record const &r) {
+    if (r.kind == MessageLog::RecordKind::kTombstone)
+      consumed.insert(r.reference);
+  });
+  outbox_.ForEach([&](Record const &r) {
+    if (r.kind == MessageLog::RecordKind::kSequenceMark) {
+      auto &queue = outbox_queues_[r.peer];
+      queue.next_sequence = std::max(queue.next_sequence, r.sequence);
+    }
+    if (r.kind != MessageLog::RecordKind::kMessage)
+      return;
+    auto &queue = outbox_queues_[r.peer];
+    queue.next_sequence = std::max(queue.next_sequence, r.sequence + 1);
+    if (consumed.count(r.id))
+      return;
+    queue.pending.push_back(r.id);
+    outbox_by_sequence_[SequenceKey(r.peer, r.sequence)] = r.id;
+    outbox_live_records_[MessageLog::SegmentOf(r.id)]++;
+  });
+  if (!OutboxReclaimable())
+    return;
+  if (auto marked = WriteSequenceMarks();
+      marked && outbox_.Sync() == Status::kSuccess)
+    ReclaimOutboxSegments(*marked);
+}
+
+void MessageStore::RebuildInboxIndex() {
+  inbox_next_sequence_.clear();
+  inbox_by_sequence_.clear();
+  inbox_.ForEach([&](Record const &r) {
+    if (r.kind != MessageLog::RecordKind::kMessage)
+      return;
+    auto &next = inbox_next_sequence_[r.peer];
+    next = std::max(next, r.sequence + 1);
+    inbox_by_sequence_[SequenceKey(r.peer, r.sequence)] = r.id;
+  });
+}
+
+bool MessageStore::OutboxReclaimable() const {
+  auto oldest = outbox_.OldestSegment();
+  if (!oldest || oldest == outbox_.NewestSegment())
+    return false;
+  auto it = outbox_live_records_.find(*oldest);
+  return it == outbox_live_records_.end() || it->second == 0;
+}
+
+std::optional<uint32_t> MessageStore::WriteSequenceMarks() {
+  std::optional<uint32_t> first{};
+  for (auto const &[peer, queue] : outbox_queues_) {
+    auto id = outbox_.Append(MessageLog::RecordKind::kSequenceMark, peer,
+                             queue.next_sequence,
+                             GetFutureWireTime(Duration::zero()), 0, {});
+    if (!id)
+      return {};
+    if (!first)
+      first = MessageLog::SegmentOf(*id);
+  }
+  return first ? first : outbox_.NewestSegment();
+}
+
+void MessageStore::ReclaimOutboxSegments(uint32_t before) {
+  // Only ever drop from the front, so that a tombstone can never outlive the
+  // message it refers to
+  while (auto oldest = outbox_.OldestSegment()) {
+    if (*oldest >= before)
+      return;
+    auto it = outbox_live_records_.find(*oldest);
+    if (it != outbox_live_records_.end() && it->second > 0)
+      return;
+    if (outbox_.DropOldestSegment() != Status::kSuccess ||
+        outbox_.OldestSegment() == oldest)
+      return;
+    if (it != outbox_live_records_.end())
+      outbox_live_records_.erase(it);
+  }
+}
+
+std::optional<uint32_t>
+MessageStore::Enqueue(WireAddress peer, std::span<const uint8_t> message) {
+  std::scoped_lock lock(lock_);
+  auto &queue = outbox_queues_[peer];
+  const uint32_t sequence = queue.next_sequence;
+  auto id = outbox_.Append(MessageLog::RecordKind::kMessage, peer, sequence,
+                           GetFutureWireTime(Duration::zero()), 0, message);
+  if (!id)
+    return {};
+  queue.next_sequence++;
+  queue.pending.push_back(*id);
+  outbox_by_sequence_[SequenceKey(peer, sequence)] = *id;
+  outbox_live_records_[MessageLog::SegmentOf(*id)]++;
+  if (outbox_.UnsyncedRecords() >= commit_records_)
+    commit_requested_.notify_one();
+  return sequence;
+}
+
+std::optional<size_t> MessageStore::DequeueInto(WireAddress peer,
+                                                std::span<uint8_t> out) {
+  std::scoped_lock lock(lock_);
+  auto it = outbox_queues_.find(peer);
+  if (it == outbox_queues_.end() || it->second.pending.empty())
+    return {};
+  auto &queue = it->second;
+
+  const RecordId id = queue.pending.front();
+  auto record = outbox_.Read(id);
+  assert(record.has_value() && "Outbox index points at a missing record");
+
+  const size_t length = std::min(record->payload.size(), out.size());
+  std::memcpy(out.data(), record->payload.data(), length);
+
+  // Still ours until the peer has it
+  queue.pending.pop_front();
+  queue.in_flight.push_back(id);
+  return length;
+}
+
+void MessageStore::ConfirmDelivered(WireAddress peer) {
+  std::scoped_lock lock(lock_);
+  auto it = outbox_queues_.find(peer);
+  // E.g. a message carried over a hot restart, which the store never saw go
+  if (it == outbox_queues_.end() || it->second.in_flight.empty())
+    return;
+  auto &queue = it->second;
+
+  const RecordId id = queue.in_flight.front();
+  queue.in_flight.pop_front();
+  auto record = outbox_.Read(id);
+  assert(record.has_value() && "Outbox index points at a missing record");
+  outbox_by_sequence_.erase(SequenceKey(peer, record->sequence));
+  delivered_.push_back({.peer = peer, .sequence = record->sequence, .id = id});
+}
+
+void MessageStore::RequeueUnconfirmed(WireAddress peer) {
+  std::scoped_lock lock(lock_);
+  auto it = outbox_queues_.find(peer);
+  if (it == outbox_queues_.end())
+    return;
+  auto &queue = it->second;
+  queue.pending.insert(queue.pending.begin(), queue.in_flight.begin(),
+                       queue.in_flight.end());
+  queue.in_flight.clear();
+}
+
+void MessageStore::WriteTombstones() {
+  size_t written = 0;
+  for (auto const &d : delivered_) {
+    if (!outbox_.Append(MessageLog::RecordKind::kTombstone, d.peer, d.sequence,
+                        GetFutureWireTime(Duration::zero()), d.id, {}))
+      break;
+    outbox_live_records_[MessageLog::SegmentOf(d.id)]--;
+    written++;
+  }
+  // Any that didn't make it are tried again at the next commit
+  delivered_.erase(delivered_.begin(), delivered_.begin() + written);
+}
+
+size_t MessageStore::PendingCount(WireAddress peer) const {
+  std::scoped_lock lock(lock_);
+  auto it = outbox_queues_.find(peer);
+  return (it == outbox_queues_.end())
+             ? 0
+             : it->second.pending.size() + it->second.in_flight.size();
+}
+
+size_t MessageStore::PendingCount() const {
+  std::scoped_lock lock(lock_);
+  return outbox_by_sequence_.size();
+}
+
+std::optional<uint32_t>
+MessageStore::Deposit(WireAddress peer, std::span<const uint8_t> message) {
+  std::scoped_lock lock(lock_);
+  auto &next = inbox_next_sequence_[peer];
+  auto id = inbox_.Append(MessageLog::RecordKind::kMessage, peer, next,
+                          GetFutureWireTime(Duration::zero()), 0, message);
+  if (!id)
+    return {};
+  inbox_by_sequence_[SequenceKey(peer, next)] = *id;
+  if (inbox_.UnsyncedRecords() >= commit_records_)
+    commit_requested_.notify_one();
+  return next++;
+}
+
+std::optional<MessageStore::Record>
+MessageStore::FindQueued(WireAddress peer, uint32_t sequence) const {
+  std::scoped_lock lock(lock_);
+  auto it = outbox_by_sequence_.find(SequenceKey(peer, sequence));
+  if (it == outbox_by_sequence_.end())
+    return {};
+  return outbox_.Read(it->second);
+}
+
+std::optional<MessageStore::Record>
+MessageStore::FindReceived(WireAddress peer, uint32_t sequence) const {
+  std::scoped_lock lock(lock_);
+  auto it = inbox_by_sequence_.find(SequenceKey(peer, sequence));
+  if (it == inbox_by_sequence_.end())
+    return {};
+  return inbox_.Read(it->second);
+}
+
+void MessageStore::SetActivePeer(std::optional<WireAddress> peer) {
+  std::scoped_lock lock(lock_);
+  active_peer_ = peer;
+}
+
+std::optional<WireAddress> MessageStore::ActivePeer() const {
+  std::scoped_lock lock(lock_);
+  return active_peer_;
+}
+
+std::optional<size_t>
+MessageStore::DequeueForActivePeer(std::span<uint8_t> out) {
+  auto peer = ActivePeer();
+  if (!peer)
+    return {};
+  return DequeueInto(*peer, out);
+}
+
+void MessageStore::ConfirmDeliveredToActivePeer() {
+  if (auto peer = ActivePeer())
+    ConfirmDelivered(*peer);
+}
+
+void MessageStore::RequeueUnconfirmedForActivePeer() {
+  if (auto peer = ActivePeer())
+    RequeueUnconfirmed(*peer);
+}
+
+std::optional<uint32_t>
+MessageStore::DepositFromActivePeer(std::span<const uint8_t> message) {
+  auto peer = ActivePeer();
+  if (!peer)
+    return {};
+  return Deposit(*peer, message);
+}
+
+MessageStore::Status MessageStore::Sync() {
+  std::scoped_lock sync_lock(sync_lock_);
+  std::vector<MessageLog::UnsyncedRange> outbox_ranges{};
+  std::vector<MessageLog::UnsyncedRange> inbox_ranges{};
+  std::optional<uint32_t> reclaim_before{};
+  {
+    std::scoped_lock lock(lock_);
+    if (!outbox_.IsOpen())
+      return Status::kNotOpen;
+    WriteTombstones();
+    if (OutboxReclaimable())
+      reclaim_before = WriteSequenceMarks();
+    outbox_ranges = outbox_.UnsyncedRanges();
+    inbox_ranges = inbox_.UnsyncedRanges();
+  }
+
+  auto status = MessageLog::SyncRanges(outbox_ranges);
+  if (status == Status::kSuccess)
+    status = MessageLog::SyncRanges(inbox_ranges);
+
+  std::scoped_lock lock(lock_);
+  if (status != Status::kSuccess)
+    return status;
+  outbox_.MarkSynced(outbox_ranges);
+  inbox_.MarkSynced(inbox_ranges);
+  // Here, under sync_lock_, as it unmaps segments
+  if (reclaim_before)
+    ReclaimOutboxSegments(*reclaim_before);
+  return Status::kSuccess;
+}
+
+void MessageStore::CommitLoop(Duration interval) {
+  std::unique_lock lock{lock_};
+  while (!stopping_) {
+    commit_requested_.wait_for(lock, interval);
+    if (stopping_)
+      break;
+    lock.unlock();
+    Sync();
+    lock.lock();
+  }
+}
+
+} // namespace lora_chat
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "message_log.hpp"
+#include "packet.hpp"
+
+namespace lora_chat {
+
+/// Persistent store-and-forward queues for the messages we exchange with our
+/// peers. Messages handed to the outbox survive restarts and sit there until
+/// a session with their peer is established, at which point they drain in
+/// the order they were enqueued. A message handed to the session stays in
+/// the outbox until the peer has acknowledged it (ConfirmDelivered), and goes
+/// back to the head of its queue if the session ends first, so delivery is
+/// at-least-once: one caught in flight by a crash or a hot restart is sent
+/// again. Messages we receive are appended to the inbox so that they survive
+/// restarts as well.
+///
+/// Both queues are backed by a MessageLog, and are indexed by peer and by
+/// per-peer sequence number. The logs are group-committed from a thread of
+/// the store's own, so that neither the session's callbacks nor Enqueue()
+/// ever wait on the disk. All methods are thread-safe.
+class MessageStore {
+public:
+  using Status = MessageLog::Status;
+  using Record = MessageLog::Record;
+
+  struct Options {
+    MessageLog::Options log;
+  };
+
+  MessageStore() = default;
+  ~MessageStore() { Close(); }
+  MessageStore(const MessageStore &) = delete;
+  MessageStore &operator=(const MessageStore &) = delete;
+
+  /// Opens (creating if needed) the store rooted at `directory` and rebuilds
+  /// the in-memory indices from the logs.
+  Status Open(std::string directory, Options options);
+  Status Open(std::string directory) { return Open(std::move(directory), {}); }
+  void Close();
+
+  /// Appends `message` to the outbox for `peer`. Returns the per-peer
+  /// sequence number assigned to the message.
+  std::optional<uint32_t> Enqueue(WireAddress peer,
+                                  std::span<const uint8_t> message);
+
+  /// Copies the oldest message queued for `peer` straight from the log into
+  /// `out` (typically a frame's payload) and marks it as in flight.
+  /// Returns the length of the message, or nothing if none were queued.
+  /// Messages longer than `out` are truncated. Writes nothing to the log.
+  std::optional<size_t> DequeueInto(WireAddress peer, std::span<uint8_t> out);
+  /// The oldest message in flight to `peer` got there: it's dropped from the
+  /// outbox at the next commit.
+  void ConfirmDelivered(WireAddress peer);
+  /// Puts every message in flight to `peer` back at the head of its queue,
+  /// e.g. because the session they were handed to has ended.
+  void RequeueUnconfirmed(WireAddress peer);
+
+  /// Includes the messages in flight
+  size_t PendingCount(WireAddress peer) const;
+  size_t PendingCount() const;
+
+  /// Appends a message received from `peer` to the inbox. Returns the
+  /// per-peer sequence number assigned to the message.
+  std::optional<uint32_t> Deposit(WireAddress peer,
+                                  std::span<const uint8_t> message);
+
+  std::optional<Record> FindQueued(WireAddress peer, uint32_t sequence) const;
+  std::optional<Record> FindReceived(WireAddress peer, uint32_t sequence) const;
+
+  /// Directs DequeueForActivePeer/DepositFromActivePeer at `peer`. Call this
+  /// when a session is established so that the peer's backlog starts to
+  /// drain.
+  void SetActivePeer(std::optional<WireAddress> peer);
+  std::optional<WireAddress> ActivePeer() const;
+  std::optional<size_t> DequeueForActivePeer(std::span<uint8_t> out);
+  void ConfirmDeliveredToActivePeer();
+  void RequeueUnconfirmedForActivePeer();
+  std::optional<uint32_t>
+  DepositFromActivePeer(std::span<const uint8_t> message);
+
+  /// Forces a group commit of both logs, rather than waiting for the next.
+  /// Only the bookkeeping is done under the lock the other methods take; the
+  /// msyncs happen outside it.
+  Status Sync();
+
+private:
+  using RecordId = MessageLog::RecordId;
+
+  struct PeerQueue {
+    std::deque<RecordId> pending{};
+    // Handed to a session, but not yet acknowledged by the peer
+    std::deque<RecordId> in_flight{};
+    uint32_t next_sequence{0};
+  };
+
+  struct Delivered {
+    WireAddress peer;
+    uint32_t sequence;
+    RecordId id;
+  };
+
+  static uint64_t SequenceKey(WireAddress peer, uint32_t sequence) {
+    return (static_cast<uint64_t>(peer) << 32) | sequence;
+  }
+
+  void RebuildOutboxIndex();
+  void RebuildInboxIndex();
+  bool OutboxReclaimable() const;
+  /// Notes every peer's next sequence number in the outbox, since dropping
+  /// segments may take the records they were counted from with them. Returns
+  /// the segment the notes start in, ahead of which segments may go once
+  /// they're synced.
+  std::optional<uint32_t> WriteSequenceMarks();
+  void ReclaimOutboxSegments(uint32_t before);
+  void WriteTombstones();
+  void CommitLoop(Duration interval);
+
+  // Held for the whole of a commit, ahead of lock_: segments are only ever
+  // dropped (or the logs closed) under it, so the msyncs can go without lock_
+  std::mutex sync_lock_{};
+  mutable std::mutex lock_{};
+
+  MessageLog outbox_{};
+  std::unordered_map<WireAddress, PeerQueue> outbox_queues_{};
+  // Only holds messages which are still pending
+  std::unordered_map<uint64_t, RecordId> outbox_by_sequence_{};
+  // Number of pending messages held by each outbox segment
+  std::map<uint32_t, size_t> outbox_live_records_{};
+  // Confirmed since the last commit, which writes their tombstones
+  std::vector<Delivered> delivered_{};
+
+  MessageLog inbox_{};
+  std::unordered_map<WireAddress, uint32_t> inbox_next_sequence_{};
+  std::unordered_map<uint64_t, RecordId> inbox_by_sequence_{};
+
+  std::optional<WireAddress> active_peer_{};
+
+  // Enough appends since the last commit to warrant another straight away
+  size_t commit_records_{0};
+  std::condition_variable commit_requested_{};
+  std::thread committer_{};
+  std::atomic<bool> stopping_{false};
+};
+
+} // namespace lora_chat
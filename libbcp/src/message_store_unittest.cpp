@@ -0,0 +1,338 @@
+#include "message_log.hpp"
+#include "message_store.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::MessageLog;
+using lora_chat::MessageStore;
+using Status = MessageLog::Status;
+using lora_chat::testutils::TempDir;
+
+std::span<const uint8_t> Bytes(const char *str) {
+  return {reinterpret_cast<const uint8_t *>(str), strlen(str)};
+}
+
+std::string Str(std::span<const uint8_t> bytes) {
+  return {bytes.begin(), bytes.end()};
+}
+
+size_t CountSegments(std::string const &dir) {
+  size_t n = 0;
+  for (auto const &entry : std::filesystem::directory_iterator(dir))
+    n += entry.path().extension() == ".log";
+  return n;
+}
+
+TEST(MessageLog, AppendAndRead) {
+  TempDir dir{"bcp-store"};
+  MessageLog log{};
+  ASSERT_EQ(log.Open(dir.path()), Status::kSuccess);
+
+  auto a = log.Append(MessageLog::RecordKind::kMessage, 1, 0, 100, 0,
+                      Bytes("hello"));
+  auto b = log.Append(MessageLog::RecordKind::kMessage, 2, 7, 200, 0,
+                      Bytes("world!"));
+  ASSERT_TRUE(a.has_value());
+  ASSERT_TRUE(b.has_value());
+
+  auto ra = log.Read(*a);
+  ASSERT_TRUE(ra.has_value());
+  EXPECT_EQ(ra->peer, 1u);
+  EXPECT_EQ(ra->timestamp, 100u);
+  EXPECT_EQ(Str(ra->payload), "hello");
+
+  auto rb = log.Read(*b);
+  ASSERT_TRUE(rb.has_value());
+  EXPECT_EQ(rb->sequence, 7u);
+  EXPECT_EQ(Str(rb->payload), "world!");
+
+  EXPECT_FALSE(log.Read(*b + 1).has_value());
+}
+
+TEST(MessageLog, SurvivesReopen) {
+  TempDir dir{"bcp-store"};
+  MessageLog::Options options{.segment_bytes = 4096};
+  std::vector<MessageLog::RecordId> ids{};
+  {
+    MessageLog log{};
+    ASSERT_EQ(log.Open(dir.path(), options), Status::kSuccess);
+    for (uint32_t i = 0; i < 200; i++) {
+      auto msg = "message " + std::to_string(i);
+      auto id = log.Append(MessageLog::RecordKind::kMessage, 3, i, i, 0,
+                           Bytes(msg.c_str()));
+      ASSERT_TRUE(id.has_value());
+      ids.push_back(*id);
+    }
+  }
+  // 200 records don't fit in one 4KiB segment
+  EXPECT_GT(CountSegments(dir.path()), 1u);
+
+  MessageLog log{};
+  ASSERT_EQ(log.Open(dir.path(), options), Status::kSuccess);
+  uint32_t expected = 0;
+  log.ForEach([&](MessageLog::Record const &r) {
+    EXPECT_EQ(r.sequence, expected);
+    EXPECT_EQ(Str(r.payload), "message " + std::to_string(expected));
+    expected++;
+  });
+  EXPECT_EQ(expected, 200u);
+  EXPECT_EQ(Str(log.Read(ids[123])->payload), "message 123");
+}
+
+TEST(MessageLog, ReadOnlyLeavesTheLogAlone) {
+  TempDir dir{"bcp-store"};
+  const std::string missing = dir.path() + "/missing";
+  MessageLog::Options read_only{.read_only = true};
+  {
+    MessageLog log{};
+    EXPECT_NE(log.Open(missing, read_only), Status::kSuccess);
+    EXPECT_FALSE(std::filesystem::exists(missing));
+    ASSERT_EQ(log.Open(dir.path(), {.segment_bytes = 4096}), Status::kSuccess);
+    log.Append(MessageLog::RecordKind::kMessage, 1, 0, 0, 0, Bytes("kept"),
+               0x5a);
+  }
+  const auto before = std::filesystem::last_write_time(dir.path());
+
+  MessageLog log{};
+  ASSERT_EQ(log.Open(dir.path(), read_only), Status::kSuccess);
+  std::vector<MessageLog::Record> records{};
+  log.ForEach([&](MessageLog::Record const &r) { records.push_back(r); });
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(Str(records[0].payload), "kept");
+  EXPECT_EQ(records[0].flags, 0x5a);
+
+  EXPECT_FALSE(log.Append(MessageLog::RecordKind::kMessage, 1, 1, 0, 0,
+                          Bytes("refused"))
+                   .has_value());
+  EXPECT_NE(log.DropOldestSegment(), Status::kSuccess);
+  log.Close();
+  EXPECT_EQ(CountSegments(dir.path()), 1u);
+  EXPECT_EQ(std::filesystem::last_write_time(dir.path()), before);
+}
+
+TEST(MessageLog, DiscardsTornTail) {
+  TempDir dir{"bcp-store"};
+  {
+    MessageLog log{};
+    ASSERT_EQ(log.Open(dir.path()), Status::kSuccess);
+    log.Append(MessageLog::RecordKind::kMessage, 1, 0, 0, 0, Bytes("intact"));
+    log.Append(MessageLog::RecordKind::kMessage, 1, 1, 0, 0, Bytes("torn"));
+  }
+  // Corrupt the last byte of the final record's payload
+  {
+    auto path = dir.path() + "/segment-00000000.log";
+    FILE *f = fopen(path.c_str(), "r+b");
+    ASSERT_NE(f, nullptr);
+    std::array<uint8_t, 256> head{};
+    ASSERT_EQ(fread(head.data(), 1, head.size(), f), head.size());
+    auto *torn = static_cast<uint8_t *>(
+        memmem(head.data(), head.size(), "torn", 4));
+    ASSERT_NE(torn, nullptr);
+    fseek(f, (torn - head.data()) + 3, SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+  }
+
+  MessageLog log{};
+  ASSERT_EQ(log.Open(dir.path()), Status::kSuccess);
+  int count = 0;
+  log.ForEach([&](MessageLog::Record const &r) {
+    EXPECT_EQ(Str(r.payload), "intact");
+    count++;
+  });
+  EXPECT_EQ(count, 1);
+
+  // And appends pick up where the valid data ends
+  auto id = log.Append(MessageLog::RecordKind::kMessage, 1, 1, 0, 0,
+                       Bytes("retry"));
+  ASSERT_TRUE(id.has_value());
+  EXPECT_EQ(Str(log.Read(*id)->payload), "retry");
+}
+
+TEST(MessageLog, StartsAfreshOnANeverWrittenSegment) {
+  TempDir dir{"bcp-store"};
+  MessageLog::Options options{.segment_bytes = 4096};
+  {
+    MessageLog log{};
+    ASSERT_EQ(log.Open(dir.path(), options), Status::kSuccess);
+    log.Append(MessageLog::RecordKind::kMessage, 1, 0, 0, 0, Bytes("kept"));
+  }
+  // As left by a crash between creating the next segment and syncing it
+  {
+    auto path = dir.path() + "/segment-00000001.log";
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    std::vector<uint8_t> zeroes(options.segment_bytes);
+    ASSERT_EQ(fwrite(zeroes.data(), 1, zeroes.size(), f), zeroes.size());
+    fclose(f);
+  }
+
+  MessageLog log{};
+  ASSERT_EQ(log.Open(dir.path(), options), Status::kSuccess);
+  int count = 0;
+  log.ForEach([&](MessageLog::Record const &) { count++; });
+  EXPECT_EQ(count, 1);
+  auto id = log.Append(MessageLog::RecordKind::kMessage, 1, 1, 0, 0,
+                       Bytes("next"));
+  ASSERT_TRUE(id.has_value());
+  EXPECT_EQ(MessageLog::SegmentOf(*id), 1u);
+}
+
+TEST(MessageLog, GroupCommit) {
+  TempDir dir{"bcp-store"};
+  MessageLog log{};
+  MessageLog::Options options{
+      .group_commit_records = 4,
+      .group_commit_interval = std::chrono::hours(1),
+  };
+  ASSERT_EQ(log.Open(dir.path(), options), Status::kSuccess);
+  for (int i = 0; i < 3; i++)
+    log.Append(MessageLog::RecordKind::kMessage, 1, i, 0, 0, Bytes("x"));
+  EXPECT_EQ(log.UnsyncedRecords(), 3u);
+  log.Append(MessageLog::RecordKind::kMessage, 1, 3, 0, 0, Bytes("x"));
+  EXPECT_EQ(log.UnsyncedRecords(), 0u);
+  log.Append(MessageLog::RecordKind::kMessage, 1, 4, 0, 0, Bytes("x"));
+  EXPECT_EQ(log.UnsyncedRecords(), 1u);
+  EXPECT_EQ(log.Sync(), Status::kSuccess);
+  EXPECT_EQ(log.UnsyncedRecords(), 0u);
+}
+
+TEST(MessageStore, DrainsInOrderPerPeer) {
+  TempDir dir{"bcp-store"};
+  MessageStore store{};
+  ASSERT_EQ(store.Open(dir.path()), Status::kSuccess);
+
+  EXPECT_EQ(store.Enqueue(1, Bytes("a0")), 0u);
+  EXPECT_EQ(store.Enqueue(2, Bytes("b0")), 0u);
+  EXPECT_EQ(store.Enqueue(1, Bytes("a1")), 1u);
+  EXPECT_EQ(store.PendingCount(1), 2u);
+  EXPECT_EQ(store.PendingCount(2), 1u);
+  EXPECT_EQ(store.PendingCount(), 3u);
+
+  ASSERT_TRUE(store.FindQueued(1, 1).has_value());
+  EXPECT_EQ(Str(store.FindQueued(1, 1)->payload), "a1");
+
+  lora_chat::SessionPacketPayload payload{};
+  EXPECT_FALSE(store.DequeueForActivePeer(payload).has_value());
+
+  store.SetActivePeer(1);
+  auto len = store.DequeueForActivePeer(payload);
+  ASSERT_TRUE(len.has_value());
+  EXPECT_EQ(Str({payload.data(), *len}), "a0");
+  len = store.DequeueForActivePeer(payload);
+  ASSERT_TRUE(len.has_value());
+  EXPECT_EQ(Str({payload.data(), *len}), "a1");
+  EXPECT_FALSE(store.DequeueForActivePeer(payload).has_value());
+  // In flight, but still ours until the peer acknowledges them
+  EXPECT_TRUE(store.FindQueued(1, 1).has_value());
+  EXPECT_EQ(store.PendingCount(1), 2u);
+
+  store.ConfirmDeliveredToActivePeer();
+  store.ConfirmDeliveredToActivePeer();
+  EXPECT_FALSE(store.FindQueued(1, 1).has_value());
+  EXPECT_EQ(store.PendingCount(1), 0u);
+  EXPECT_EQ(store.PendingCount(2), 1u);
+}
+
+TEST(MessageStore, RequeuesWhatTheSessionDidntGetThrough) {
+  TempDir dir{"bcp-store"};
+  MessageStore store{};
+  ASSERT_EQ(store.Open(dir.path()), Status::kSuccess);
+  for (auto msg : {"m0", "m1", "m2"})
+    store.Enqueue(3, Bytes(msg));
+
+  lora_chat::SessionPacketPayload payload{};
+  ASSERT_TRUE(store.DequeueInto(3, payload).has_value());
+  store.ConfirmDelivered(3);
+  ASSERT_TRUE(store.DequeueInto(3, payload).has_value());
+  // The session ends before m1 is acknowledged
+  store.RequeueUnconfirmed(3);
+  EXPECT_EQ(store.PendingCount(3), 2u);
+
+  auto len = store.DequeueInto(3, payload);
+  ASSERT_TRUE(len.has_value());
+  EXPECT_EQ(Str({payload.data(), *len}), "m1");
+  // Nothing was in flight for this one to confirm
+  store.ConfirmDelivered(4);
+  store.ConfirmDelivered(3);
+  len = store.DequeueInto(3, payload);
+  ASSERT_TRUE(len.has_value());
+  EXPECT_EQ(Str({payload.data(), *len}), "m2");
+}
+
+TEST(MessageStore, BacklogSurvivesRestart) {
+  TempDir dir{"bcp-store"};
+  {
+    MessageStore store{};
+    ASSERT_EQ(store.Open(dir.path()), Status::kSuccess);
+    for (int i = 0; i < 10; i++) {
+      auto msg = "m" + std::to_string(i);
+      store.Enqueue(5, Bytes(msg.c_str()));
+    }
+    lora_chat::SessionPacketPayload payload{};
+    for (int i = 0; i < 4; i++)
+      ASSERT_TRUE(store.DequeueInto(5, payload).has_value());
+    // The last is still in flight when we go down
+    for (int i = 0; i < 3; i++)
+      store.ConfirmDelivered(5);
+    store.SetActivePeer(5);
+    store.DepositFromActivePeer(Bytes("reply"));
+  }
+
+  MessageStore store{};
+  ASSERT_EQ(store.Open(dir.path()), Status::kSuccess);
+  EXPECT_EQ(store.PendingCount(5), 7u);
+  lora_chat::SessionPacketPayload payload{};
+  auto len = store.DequeueInto(5, payload);
+  ASSERT_TRUE(len.has_value());
+  EXPECT_EQ(Str({payload.data(), *len}), "m3");
+  // Sequence numbers keep counting up across restarts
+  EXPECT_EQ(store.Enqueue(5, Bytes("m10")), 10u);
+
+  auto received = store.FindReceived(5, 0);
+  ASSERT_TRUE(received.has_value());
+  EXPECT_EQ(Str(received->payload), "reply");
+  EXPECT_EQ(store.Deposit(5, Bytes("another")), 1u);
+}
+
+TEST(MessageStore, ReclaimsDrainedSegments) {
+  TempDir dir{"bcp-store"};
+  MessageStore store{};
+  MessageStore::Options options{.log = {.segment_bytes = 4096}};
+  ASSERT_EQ(store.Open(dir.path(), options), Status::kSuccess);
+
+  constexpr int kMessages = 1000;
+  for (int i = 0; i < kMessages; i++)
+    ASSERT_TRUE(store.Enqueue(9, Bytes("a deep backlog of messages")));
+  const auto outbox = dir.path() + "/outbox";
+  const size_t full = CountSegments(outbox);
+  EXPECT_GT(full, 4u);
+
+  lora_chat::SessionPacketPayload payload{};
+  for (int i = 0; i < kMessages; i++) {
+    ASSERT_TRUE(store.DequeueInto(9, payload).has_value()) << i;
+    store.ConfirmDelivered(9);
+  }
+  EXPECT_EQ(store.PendingCount(), 0u);
+  // Segments go once the tombstones are committed
+  ASSERT_EQ(store.Sync(), Status::kSuccess);
+  EXPECT_LT(CountSegments(outbox), 3u);
+
+  // Without the messages, the sequence numbers still carry on from theirs
+  store.Close();
+  ASSERT_EQ(store.Open(dir.path(), options), Status::kSuccess);
+  EXPECT_EQ(store.PendingCount(), 0u);
+  EXPECT_EQ(store.Enqueue(9, Bytes("after")), uint32_t{kMessages});
+}
+
+} // namespace
@@ -0,0 +1,262 @@
+#include "metrics.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sx1276/sx1276.hpp"
+
+namespace lora_chat {
+
+namespace {
+
+constexpr uint32_t kPageMagic = 0x42435030; // "BCP0"
+// Bump whenever MetricsSnapshot or Counter changes
+constexpr uint32_t kPageVersion = 2;
+constexpr size_t kSnapshotWords = sizeof(MetricsSnapshot) / sizeof(uint64_t);
+// A reader that loses this many races in a row is up against a publisher that
+// has died mid-update
+constexpr int kReadAttempts = 1000;
+
+/// The shared-memory segment. The snapshot is kept as atomic words so that
+/// the seqlock's racing reads and writes are well-defined; an odd sequence
+/// number means an update is in progress.
+struct MetricsPage {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  std::atomic<uint32_t> sequence;
+  uint32_t snapshot_bytes;
+  alignas(64) std::array<std::atomic<uint64_t>, kSnapshotWords> words;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+constexpr const char *kCounterNames[] = {
+    "sessions started", "sessions ended",   "messages sent",
+    "messages received", "retransmissions", "nacks sent",
+    "receive failures",  "transmit ns",     "receive ns",
+    "airtime ns",        "radio sleep ns",  "spi byte reads",
+    "spi byte writes",   "spi burst reads", "spi burst writes",
+    "slot error samples", "slot error total ns", "delivery receipts",
+    "delivery latency ns",
+};
+static_assert(std::size(kCounterNames) ==
+              static_cast<size_t>(Counter::kNumCounters));
+
+uint64_t SteadyNanos(TimePoint t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+const char *CounterName(Counter counter) {
+  return kCounterNames[static_cast<size_t>(counter)];
+}
+
+Metrics::Metrics() : agent_state_("starting"), started_at_(Now()) {}
+
+Metrics &Metrics::Default() {
+  static Metrics metrics{};
+  return metrics;
+}
+
+void Metrics::EnterSession(uint64_t session_id) {
+  session_id_.store(session_id, std::memory_order_relaxed);
+  in_session_.store(true, std::memory_order_relaxed);
+  Count(Counter::kSessionsStarted);
+}
+
+void Metrics::LeaveSession() {
+  if (in_session_.exchange(false, std::memory_order_relaxed))
+    Count(Counter::kSessionsEnded);
+}
+
+void Metrics::RecordSlotError(Duration error) {
+  const int64_t ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(error).count();
+  last_slot_error_ns_.store(ns, std::memory_order_relaxed);
+  Count(Counter::kSlotErrorSamples);
+  Count(Counter::kSlotErrorTotalNs, static_cast<uint64_t>(ns < 0 ? -ns : ns));
+
+  int64_t worst = worst_slot_error_ns_.load(std::memory_order_relaxed);
+  while (std::abs(ns) > std::abs(worst) &&
+         !worst_slot_error_ns_.compare_exchange_weak(
+             worst, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void Metrics::Snapshot(MetricsSnapshot &out) const {
+  out = {};
+  out.started_at_ns = SteadyNanos(started_at_);
+  out.published_at_ns = SteadyNanos(Now());
+  out.pid = getpid();
+  std::strncpy(out.agent_state, agent_state_.load(std::memory_order_relaxed),
+               sizeof(out.agent_state) - 1);
+  out.session_id = session_id_.load(std::memory_order_relaxed);
+  out.in_session = in_session_.load(std::memory_order_relaxed);
+  out.last_slot_error_ns = last_slot_error_ns_.load(std::memory_order_relaxed);
+  out.worst_slot_error_ns =
+      worst_slot_error_ns_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < counters_.size(); i++)
+    out.counters[i] = counters_[i].load(std::memory_order_relaxed);
+
+  // libsx1276 keeps its own counts, being below all of this
+  auto &spi = spi_counters();
+  auto set = [&](Counter c, std::atomic<uint64_t> const &value) {
+    out.counters[static_cast<size_t>(c)] =
+        value.load(std::memory_order_relaxed);
+  };
+  set(Counter::kSpiByteReads, spi.byte_reads);
+  set(Counter::kSpiByteWrites, spi.byte_writes);
+  set(Counter::kSpiBurstReads, spi.burst_reads);
+  set(Counter::kSpiBurstWrites, spi.burst_writes);
+}
+
+std::string MetricsPublisher::DefaultName(uint64_t address) {
+  return kNamePrefix + std::to_string(address);
+}
+
+MetricsPublisher::Status MetricsPublisher::Open(const char *name,
+                                                Duration interval) {
+  if (page_)
+    return Status::kAlreadyOpen;
+
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    perror("MetricsPublisher: shm_open failed");
+    return Status::kIoError;
+  }
+  if (ftruncate(fd, sizeof(MetricsPage)) < 0) {
+    perror("MetricsPublisher: failed to size segment");
+    close(fd);
+    return Status::kIoError;
+  }
+  void *mapping = mmap(nullptr, sizeof(MetricsPage), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    perror("MetricsPublisher: mmap failed");
+    return Status::kIoError;
+  }
+
+  // Invalidated while we (re)write the header, in case a reader is already
+  // watching a segment left behind by an earlier agent
+  auto *page = new (mapping) MetricsPage;
+  page->magic.store(0, std::memory_order_relaxed);
+  page->version = kPageVersion;
+  page->snapshot_bytes = sizeof(MetricsSnapshot);
+  page->sequence.store(0, std::memory_order_relaxed);
+  page->magic.store(kPageMagic, std::memory_order_release);
+
+  name_ = name;
+  page_ = page;
+  stopping_ = false;
+  Publish();
+  thread_ = std::thread(&MetricsPublisher::PublishLoop, this, interval);
+  return Status::kSuccess;
+}
+
+void MetricsPublisher::Close() {
+  if (!page_)
+    return;
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  stop_requested_.notify_all();
+  thread_.join();
+  munmap(page_, sizeof(MetricsPage));
+  shm_unlink(name_.c_str());
+  page_ = nullptr;
+}
+
+void MetricsPublisher::Publish() {
+  std::lock_guard lock{mutex_};
+  PublishLocked();
+}
+
+void MetricsPublisher::PublishLoop(Duration interval) {
+  std::unique_lock lock{mutex_};
+  while (!stop_requested_.wait_for(lock, interval,
+                                   [this]() { return stopping_.load(); }))
+    PublishLocked();
+}
+
+void MetricsPublisher::PublishLocked() {
+  assert(page_);
+  MetricsSnapshot snapshot;
+  Metrics::Default().Snapshot(snapshot);
+
+  uint64_t words[kSnapshotWords];
+  std::memcpy(words, &snapshot, sizeof(words));
+
+  auto *page = static_cast<MetricsPage *>(page_);
+  const uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+  page->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < kSnapshotWords; i++)
+    page->words[i].store(words[i], std::memory_order_relaxed);
+  page->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool MetricsReader::Open(const char *name) {
+  Close();
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(MetricsPage)) {
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(nullptr, sizeof(MetricsPage), PROT_READ, MAP_SHARED,
+                       fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+  page_ = mapping;
+  return true;
+}
+
+void MetricsReader::Close() {
+  if (!page_)
+    return;
+  munmap(const_cast<void *>(page_), sizeof(MetricsPage));
+  page_ = nullptr;
+}
+
+bool MetricsReader::Read(MetricsSnapshot &out) const {
+  if (!page_)
+    return false;
+  auto const *page = static_cast<MetricsPage const *>(page_);
+  if (page->magic.load(std::memory_order_acquire) != kPageMagic ||
+      page->version != kPageVersion ||
+      page->snapshot_bytes != sizeof(MetricsSnapshot))
+    return false;
+
+  uint64_t words[kSnapshotWords];
+  for (int attempt = 0; attempt < kReadAttempts; attempt++) {
+    const uint32_t before = page->sequence.load(std::memory_order_acquire);
+    if (before & 1)
+      continue;
+    for (size_t i = 0; i < kSnapshotWords; i++)
+      words[i] = page->words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (page->sequence.load(std::memory_order_relaxed) == before) {
+      std::memcpy(&out, words, sizeof(words));
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace lora_chat
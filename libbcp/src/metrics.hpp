@@ -0,0 +1,181 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// Everything an agent counts about itself. Counters only ever go up; a
+/// monitor works out rates from successive snapshots.
+enum class Counter {
+  kSessionsStarted,
+  kSessionsEnded,
+  kMessagesSent,
+  kMessagesReceived,
+  kRetransmissions,
+  kNacksSent,
+  kReceiveFailures,
+  // Time the radio spent transmitting/receiving, from the host's view
+  kTransmitNs,
+  kReceiveNs,
+  // Time on air of everything transmitted
+  kAirtimeNs,
+  // Time the radio spent asleep between operations (see
+  // RadioInterface::IdleUntil)
+  kRadioSleepNs,
+  kSpiByteReads,
+  kSpiByteWrites,
+  kSpiBurstReads,
+  kSpiBurstWrites,
+  // How far from the start of their window session actions began
+  kSlotErrorSamples,
+  kSlotErrorTotalNs,
+  // Receipts for messages we sent, and their enqueue-to-delivery latency
+  kDeliveryReceipts,
+  kDeliveryLatencyTotalNs,
+  kNumCounters,
+};
+
+const char *CounterName(Counter counter);
+
+/// A consistent copy of an agent's metrics, as published to shared memory.
+/// Nothing but whole words, so that it can be copied in and out of the
+/// seqlock a word at a time.
+struct MetricsSnapshot {
+  static constexpr size_t kStateNameBytes = 32;
+
+  // Both on the steady clock, which every process on the host shares
+  uint64_t started_at_ns;
+  uint64_t published_at_ns;
+  uint64_t pid;
+  char agent_state[kStateNameBytes];
+  uint64_t session_id;
+  uint64_t in_session;
+  int64_t last_slot_error_ns;
+  int64_t worst_slot_error_ns;
+  std::array<uint64_t, static_cast<size_t>(Counter::kNumCounters)> counters;
+
+  uint64_t operator[](Counter counter) const {
+    return counters[static_cast<size_t>(counter)];
+  }
+};
+static_assert(sizeof(MetricsSnapshot) % sizeof(uint64_t) == 0);
+
+/// The process-wide live metrics. Updating them is a relaxed atomic add or
+/// store, cheap enough for the radio loop; nothing here blocks or allocates.
+class Metrics {
+public:
+  static Metrics &Default();
+
+  void Count(Counter counter, uint64_t n = 1) {
+    counters_[static_cast<size_t>(counter)].fetch_add(
+        n, std::memory_order_relaxed);
+  }
+  void Count(Counter counter, Duration d) {
+    Count(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                       .count());
+  }
+
+  /// `state` must be a string literal (or otherwise outlive the process)
+  void SetAgentState(const char *state) {
+    agent_state_.store(state, std::memory_order_relaxed);
+  }
+  void EnterSession(uint64_t session_id);
+  void LeaveSession();
+  /// How late (or, if negative, early) a session action began
+  void RecordSlotError(Duration error);
+
+  /// Copies out the current values. Counters are read one at a time, so
+  /// they may be mid-update relative to each other.
+  void Snapshot(MetricsSnapshot &out) const;
+
+private:
+  Metrics();
+
+  std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::kNumCounters)>
+      counters_{};
+  std::atomic<const char *> agent_state_;
+  std::atomic<uint64_t> session_id_{0};
+  std::atomic<bool> in_session_{false};
+  std::atomic<int64_t> last_slot_error_ns_{0};
+  std::atomic<int64_t> worst_slot_error_ns_{0};
+  TimePoint started_at_;
+};
+
+/// Publishes Metrics::Default() to a POSIX shared-memory segment a few times
+/// a second, from a thread of its own. The segment holds a seqlock-protected
+/// MetricsSnapshot: readers map it read-only and retry if they catch it
+/// mid-update, so any number of them can watch without the agent noticing.
+class MetricsPublisher {
+public:
+  enum class Status {
+    kSuccess,
+    kIoError,
+    kAlreadyOpen,
+  };
+
+  /// Segment names are passed to shm_open, so begin with a slash. Agents
+  /// sharing a host each publish under their own (see DefaultName), so that
+  /// none overwrites another's page.
+  static constexpr const char *kNamePrefix = "/bcp-metrics-";
+  static constexpr Duration kDefaultInterval{std::chrono::milliseconds(100)};
+
+  /// The segment the agent at `address` publishes to unless told otherwise
+  static std::string DefaultName(uint64_t address);
+
+  MetricsPublisher() = default;
+  ~MetricsPublisher() { Close(); }
+  MetricsPublisher(const MetricsPublisher &) = delete;
+  MetricsPublisher &operator=(const MetricsPublisher &) = delete;
+
+  /// Creates (or takes over) the segment `name` and starts publishing to it
+  /// every `interval`
+  Status Open(const char *name, Duration interval = kDefaultInterval);
+  /// Stops publishing and removes the segment
+  void Close();
+
+  /// Publishes right away, rather than waiting for the next interval
+  void Publish();
+
+private:
+  void PublishLoop(Duration interval);
+  void PublishLocked();
+
+  std::string name_{};
+  void *page_{nullptr};
+  // Guards the page against Publish() racing the publishing thread
+  std::mutex mutex_{};
+  std::condition_variable stop_requested_{};
+  std::thread thread_{};
+  std::atomic<bool> stopping_{false};
+};
+
+/// The other end of a MetricsPublisher, e.g. for bcp-top
+class MetricsReader {
+public:
+  MetricsReader() = default;
+  ~MetricsReader() { Close(); }
+  MetricsReader(const MetricsReader &) = delete;
+  MetricsReader &operator=(const MetricsReader &) = delete;
+
+  bool Open(const char *name);
+  void Close();
+
+  /// Copies out the latest snapshot. Fails if the segment isn't a metrics
+  /// page of this version, or if the publisher kept it busy throughout.
+  bool Read(MetricsSnapshot &out) const;
+
+private:
+  const void *page_{nullptr};
+};
+
+} // namespace lora_chat
@@ -0,0 +1,169 @@
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "session.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::Counter;
+using lora_chat::Metrics;
+using lora_chat::MetricsPublisher;
+using lora_chat::MetricsReader;
+using lora_chat::MetricsSnapshot;
+
+constexpr lora_chat::testutils::TextTag kSessionTag{"metrics"};
+
+// Per process, so that concurrent test runs don't trip over each other
+std::string SegmentName() {
+  return "/bcp-metrics-test-" + std::to_string(getpid());
+}
+
+TEST(Metrics, AgentsPublishSeparately) {
+  // Addresses no real agent on the host would have, per process as above
+  const uint64_t first = (uint64_t{1} << 40) + 2 * getpid();
+  const auto first_name = MetricsPublisher::DefaultName(first);
+  const auto second_name = MetricsPublisher::DefaultName(first + 1);
+  EXPECT_EQ(first_name.front(), '/');
+  EXPECT_NE(first_name, second_name);
+
+  MetricsPublisher publishers[2];
+  ASSERT_EQ(publishers[0].Open(first_name.c_str()),
+            MetricsPublisher::Status::kSuccess);
+  ASSERT_EQ(publishers[1].Open(second_name.c_str()),
+            MetricsPublisher::Status::kSuccess);
+  // Closing one leaves the other's page be
+  publishers[0].Close();
+  MetricsReader reader{};
+  EXPECT_FALSE(reader.Open(first_name.c_str()));
+  EXPECT_TRUE(reader.Open(second_name.c_str()));
+}
+
+TEST(Metrics, PublishedToReaders) {
+  const auto name = SegmentName();
+  MetricsReader reader{};
+  EXPECT_FALSE(reader.Open(name.c_str()));
+
+  MetricsSnapshot before{};
+  Metrics::Default().Snapshot(before);
+  Metrics::Default().Count(Counter::kNacksSent, 3);
+  Metrics::Default().SetAgentState("<Testing>");
+
+  MetricsPublisher publisher{};
+  ASSERT_EQ(publisher.Open(name.c_str()), MetricsPublisher::Status::kSuccess);
+  EXPECT_EQ(publisher.Open(name.c_str()),
+            MetricsPublisher::Status::kAlreadyOpen);
+  ASSERT_TRUE(reader.Open(name.c_str()));
+
+  MetricsSnapshot snapshot{};
+  ASSERT_TRUE(reader.Read(snapshot));
+  EXPECT_EQ(snapshot.pid, static_cast<uint64_t>(getpid()));
+  EXPECT_STREQ(snapshot.agent_state, "<Testing>");
+  EXPECT_EQ(snapshot[Counter::kNacksSent], before[Counter::kNacksSent] + 3);
+
+  // The publishing thread keeps it up to date by itself
+  Metrics::Default().Count(Counter::kNacksSent);
+  const auto give_up_at = lora_chat::Now() + std::chrono::seconds(2);
+  while (snapshot[Counter::kNacksSent] != before[Counter::kNacksSent] + 4 &&
+         lora_chat::Now() < give_up_at) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(reader.Read(snapshot));
+  }
+  EXPECT_EQ(snapshot[Counter::kNacksSent], before[Counter::kNacksSent] + 4);
+
+  // Gone with the publisher, though existing mappings stay readable
+  publisher.Close();
+  MetricsReader late_reader{};
+  EXPECT_FALSE(late_reader.Open(name.c_str()));
+  EXPECT_TRUE(reader.Read(snapshot));
+}
+
+TEST(Metrics, ReadersNeverSeeTornSnapshots) {
+  const auto name = SegmentName();
+  MetricsPublisher publisher{};
+  ASSERT_EQ(publisher.Open(name.c_str(), std::chrono::hours(1)),
+            MetricsPublisher::Status::kSuccess);
+  MetricsReader reader{};
+  ASSERT_TRUE(reader.Open(name.c_str()));
+
+  // Every publish changes both the timestamp and the counter; a reader that
+  // caught half of one would see one move without the other
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+    while (!done) {
+      Metrics::Default().Count(Counter::kRetransmissions);
+      publisher.Publish();
+    }
+  });
+
+  MetricsSnapshot last{};
+  ASSERT_TRUE(reader.Read(last));
+  int inconsistencies = 0;
+  int reads = 0;
+  for (int i = 0; i < 100000; i++) {
+    MetricsSnapshot snapshot{};
+    if (!reader.Read(snapshot)) continue;
+    reads++;
+    const bool time_moved = snapshot.published_at_ns != last.published_at_ns;
+    const bool count_moved =
+        snapshot[Counter::kRetransmissions] != last[Counter::kRetransmissions];
+    if (time_moved != count_moved ||
+        snapshot.published_at_ns < last.published_at_ns)
+      inconsistencies++;
+    last = snapshot;
+  }
+  done = true;
+  writer.join();
+
+  EXPECT_GT(reads, 0);
+  EXPECT_EQ(inconsistencies, 0);
+}
+
+TEST(Metrics, SessionsCountWhatTheyDo) {
+  constexpr int kPeriods{4};
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+
+  MetricsSnapshot before{};
+  Metrics::Default().Snapshot(before);
+
+  lora_chat::testutils::LocalRadio radio(std::chrono::milliseconds(8));
+  lora_chat::MessagePipe pipe{
+      lora_chat::testutils::MakeMessage<kSessionTag>};
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  lora_chat::Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  lora_chat::Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    for (int i = 0; i < 2 * kPeriods; i++)
+      ponger.ExecuteCurrentAction(radio, pipe);
+  });
+  pinger.SleepUntilStartTime();
+  for (int i = 0; i < 2 * kPeriods; i++)
+    pinger.ExecuteCurrentAction(radio, pipe);
+  ponger_thread.join();
+
+  MetricsSnapshot after{};
+  Metrics::Default().Snapshot(after);
+  auto delta = [&](Counter c) { return after[c] - before[c]; };
+  EXPECT_GE(delta(Counter::kMessagesSent), static_cast<uint64_t>(kPeriods));
+  EXPECT_GE(delta(Counter::kMessagesReceived),
+            static_cast<uint64_t>(kPeriods));
+  // Both sessions, every action
+  EXPECT_EQ(delta(Counter::kSlotErrorSamples),
+            static_cast<uint64_t>(2 * 2 * kPeriods));
+  // Sleeping (or spinning) up to each window should leave the slot error
+  // well below a transmission time
+  EXPECT_LT(delta(Counter::kSlotErrorTotalNs) /
+                delta(Counter::kSlotErrorSamples),
+            static_cast<uint64_t>(std::chrono::nanoseconds(kTransmitTime).count()));
+}
+
+} // namespace
@@ -15,17 +15,30 @@ using WireSessionId = uint32_t;
 using WireAddress = uint32_t;
 using WireSequenceNumber = uint8_t;
 using WirePayloadLength = uint8_t;
+/// How far above the receiver's SNR floor a frame came in, in whole dB
+using WireLinkMargin = int8_t;
+constexpr WireLinkMargin kUnknownLinkMargin = INT8_MIN;
 
 constexpr size_t kSessionPacketPayloadBytes = 32;
 using SessionPacketPayload = std::array<uint8_t, kSessionPacketPayloadBytes>;
+/// A delivery receipt, when a session frame carries one after its payload:
+/// the low byte of the message's number, then when it was delivered, in
+/// milliseconds since the start of the session (mod 2^16)
+constexpr size_t kSessionReceiptBytes = 3;
 
 enum class PacketType : uint8_t {
   kSession = 0,
   kConnectionRequest,
   kConnectionAccept,
   kAdvertising,
+  kBeacon,
+  kSlotRequest,
 };
-constexpr PacketType kFinalPacketType = PacketType::kAdvertising;
+constexpr PacketType kFinalPacketType = PacketType::kSlotRequest;
+
+/// Slots a beacon has room to describe, its own included (see tdma.hpp)
+constexpr size_t kBeaconSlots = 8;
+using BeaconSlotMap = std::array<WireAddress, kBeaconSlots>;
 
 enum PacketFieldFlags : uint32_t {
   kNone = 0,
@@ -57,13 +70,20 @@ struct Packet<PacketType::kSession> {
     kPayload, // must be last field
   };
 
-  enum SubType {
+  enum SubType : uint8_t {
     // TODO 0 should be invalid; keeping it this way for ease of testing
     kNack = 0,
     kData = 1,
     kConnectionRequest = 3,
     kConnectionAccept = 4,
   };
+  // Flags carried in the top bits of the type's byte
+  static constexpr uint8_t kSubTypeMask = 0x3f;
+  /// The message this frame carries (part of) wants a receipt once the
+  /// peer's application has it
+  static constexpr uint8_t kReceiptRequested = 0x40;
+  /// A receipt follows the payload
+  static constexpr uint8_t kCarriesReceipt = 0x80;
 
   static constexpr Field kFinalField = Field::kPayload;
 
@@ -186,8 +206,10 @@ struct Packet<PacketType::kConnectionRequest> {
   enum class Field {
     kSourceAddress = 0,
     kTargetAddress,
+    kLinkMargin,
+    kGuardMicros,
   };
-  static constexpr Field kFinalField = Field::kTargetAddress;
+  static constexpr Field kFinalField = Field::kGuardMicros;
 
   static constexpr PacketFieldInfo FieldMetadata(Field f) {
     using Flag = PacketFieldFlags;
@@ -196,6 +218,10 @@ struct Packet<PacketType::kConnectionRequest> {
       return {0, 32, Flag::kNone};
     case Field::kTargetAddress:
       return {32, 32, Flag::kNone};
+    case Field::kLinkMargin:
+      return {64, 8, Flag::kNone};
+    case Field::kGuardMicros:
+      return {72, 32, Flag::kNone};
     }
     __builtin_trap();
   }
@@ -207,6 +233,10 @@ struct Packet<PacketType::kConnectionRequest> {
     case Field::kTargetAddress:
       return reinterpret_cast<uint8_t const*>(&(target_address));
       break;
+    case Field::kLinkMargin:
+      return reinterpret_cast<uint8_t const*>(&(link_margin));
+    case Field::kGuardMicros:
+      return reinterpret_cast<uint8_t const*>(&(guard_micros));
     }
     __builtin_trap();
   }
@@ -219,10 +249,19 @@ struct Packet<PacketType::kConnectionRequest> {
 
   WireAddress source_address;
   WireAddress target_address;
+  /// The margin the advertisement being answered came in at, for the
+  /// advertiser's transmit power control
+  WireLinkMargin link_margin{kUnknownLinkMargin};
+  /// The least gap between session windows the requester can turn its radio
+  /// around in, or 0 if it doesn't know
+  uint32_t guard_micros{0};
 };
 
 inline bool operator==(const Packet<PacketType::kConnectionRequest> &lhs, const Packet<PacketType::kConnectionRequest> &rhs) {
-  return (lhs.source_address == rhs.source_address && lhs.target_address == rhs.target_address);
+  return (lhs.source_address == rhs.source_address &&
+          lhs.target_address == rhs.target_address &&
+          lhs.link_margin == rhs.link_margin &&
+          lhs.guard_micros == rhs.guard_micros);
 }
 
 template <>
@@ -234,9 +273,11 @@ struct Packet<PacketType::kConnectionAccept> {
     kTargetAddress,
     kSessionStartTime,
     kSessionId,
+    kLinkMargin,
+    kGapMicros,
     // TODO specify and hop to a new frequency
   };
-  static constexpr Field kFinalField = Field::kSessionId;
+  static constexpr Field kFinalField = Field::kGapMicros;
 
   static constexpr PacketFieldInfo FieldMetadata(Field f) {
     using Flag = PacketFieldFlags;
@@ -249,6 +290,10 @@ struct Packet<PacketType::kConnectionAccept> {
       return {64, 8 * sizeof(WireTimePoint), Flag::kNone};
     case Field::kSessionId:
       return {128,  8 * sizeof(WireSessionId), Flag::kNone};
+    case Field::kLinkMargin:
+      return {160, 8, Flag::kNone};
+    case Field::kGapMicros:
+      return {168, 32, Flag::kNone};
     }
     __builtin_trap();
   }
@@ -263,6 +308,10 @@ struct Packet<PacketType::kConnectionAccept> {
       return reinterpret_cast<uint8_t const*>(&(session_start_time));
     case Field::kSessionId:
       return reinterpret_cast<uint8_t const*>(&(session_id));
+    case Field::kLinkMargin:
+      return reinterpret_cast<uint8_t const*>(&(link_margin));
+    case Field::kGapMicros:
+      return reinterpret_cast<uint8_t const*>(&(gap_micros));
     }
     __builtin_trap();
   }
@@ -277,13 +326,137 @@ struct Packet<PacketType::kConnectionAccept> {
   WireAddress target_address;
   WireTimePoint session_start_time;  // TODO hold a deserialized TimePoint
   WireSessionId session_id;
+  /// The margin the connection request came in at, likewise for the
+  /// requester's
+  WireLinkMargin link_margin{kUnknownLinkMargin};
+  /// The gap between the session's windows, or 0 for the usual one
+  uint32_t gap_micros{0};
 };
 
 inline bool operator==(const Packet<PacketType::kConnectionAccept> &lhs, const Packet<PacketType::kConnectionAccept> &rhs) {
   return (lhs.source_address == rhs.source_address &&
           lhs.target_address == rhs.target_address &&
           lhs.session_start_time == rhs.session_start_time &&
-          lhs.session_id == rhs.session_id);
+          lhs.session_id == rhs.session_id &&
+          lhs.link_margin == rhs.link_margin &&
+          lhs.gap_micros == rhs.gap_micros);
+}
+
+/// Heads each superframe of a coordinated network (see TdmaCoordinator): when
+/// it began, how it divides into slots, and who holds each one
+template <>
+struct Packet<PacketType::kBeacon> {
+  static constexpr PacketType kType = PacketType::kBeacon;
+
+  enum class Field {
+    kSourceAddress = 0,
+    kEpoch,
+    kTransmissionMicros,
+    kGapMicros,
+    kSlotOwners,
+  };
+  static constexpr Field kFinalField = Field::kSlotOwners;
+
+  static constexpr PacketFieldInfo FieldMetadata(Field f) {
+    using Flag = PacketFieldFlags;
+    switch (f) {
+    case Field::kSourceAddress:
+      return {0, 32, Flag::kNone};
+    case Field::kEpoch:
+      return {32, 8 * sizeof(WireTimePoint), Flag::kNone};
+    case Field::kTransmissionMicros:
+      return {96, 32, Flag::kNone};
+    case Field::kGapMicros:
+      return {128, 32, Flag::kNone};
+    case Field::kSlotOwners:
+      return {160, 8 * sizeof(BeaconSlotMap), Flag::kNone};
+    }
+    __builtin_trap();
+  }
+
+  const uint8_t* GetFieldPointer(Field f) const {
+    switch (f) {
+    case Field::kSourceAddress:
+      return reinterpret_cast<uint8_t const*>(&(source_address));
+    case Field::kEpoch:
+      return reinterpret_cast<uint8_t const*>(&(epoch));
+    case Field::kTransmissionMicros:
+      return reinterpret_cast<uint8_t const*>(&(transmission_micros));
+    case Field::kGapMicros:
+      return reinterpret_cast<uint8_t const*>(&(gap_micros));
+    case Field::kSlotOwners:
+      return reinterpret_cast<uint8_t const*>(&(slot_owners));
+    }
+    __builtin_trap();
+  }
+
+  uint8_t* GetFieldPointer(Field f) {
+    using ConstThis = const Packet<kType>*;
+    // this is legal because we know that the original type is non-const
+    return const_cast<uint8_t*>(const_cast<ConstThis>(this)->GetFieldPointer(f));
+  }
+
+  WireAddress source_address;
+  WireTimePoint epoch;
+  uint32_t transmission_micros;
+  uint32_t gap_micros;
+  // Zero for a free slot
+  BeaconSlotMap slot_owners;
+};
+using BeaconPacket = Packet<PacketType::kBeacon>;
+
+inline bool operator==(const Packet<PacketType::kBeacon> &lhs, const Packet<PacketType::kBeacon> &rhs) {
+  return (lhs.source_address == rhs.source_address && lhs.epoch == rhs.epoch &&
+          lhs.transmission_micros == rhs.transmission_micros &&
+          lhs.gap_micros == rhs.gap_micros &&
+          lhs.slot_owners == rhs.slot_owners);
+}
+
+/// Asks a coordinator for a slot, in its contention window
+template <>
+struct Packet<PacketType::kSlotRequest> {
+  static constexpr PacketType kType = PacketType::kSlotRequest;
+
+  enum class Field {
+    kSourceAddress = 0,
+    kTargetAddress,
+  };
+  static constexpr Field kFinalField = Field::kTargetAddress;
+
+  static constexpr PacketFieldInfo FieldMetadata(Field f) {
+    using Flag = PacketFieldFlags;
+    switch (f) {
+    case Field::kSourceAddress:
+      return {0, 32, Flag::kNone};
+    case Field::kTargetAddress:
+      return {32, 32, Flag::kNone};
+    }
+    __builtin_trap();
+  }
+
+  const uint8_t* GetFieldPointer(Field f) const {
+    switch (f) {
+    case Field::kSourceAddress:
+      return reinterpret_cast<uint8_t const*>(&(source_address));
+    case Field::kTargetAddress:
+      return reinterpret_cast<uint8_t const*>(&(target_address));
+    }
+    __builtin_trap();
+  }
+
+  uint8_t* GetFieldPointer(Field f) {
+    using ConstThis = const Packet<kType>*;
+    // this is legal because we know that the original type is non-const
+    return const_cast<uint8_t*>(const_cast<ConstThis>(this)->GetFieldPointer(f));
+  }
+
+  WireAddress source_address;
+  WireAddress target_address;
+};
+using SlotRequestPacket = Packet<PacketType::kSlotRequest>;
+
+inline bool operator==(const Packet<PacketType::kSlotRequest> &lhs, const Packet<PacketType::kSlotRequest> &rhs) {
+  return (lhs.source_address == rhs.source_address && lhs.target_address == rhs.target_address);
 }
 
 } // namespace lora_chat
@@ -0,0 +1,66 @@
+#include "packet_buffer.hpp"
+
+#include <cassert>
+
+namespace lora_chat {
+
+namespace {
+
+constexpr uint64_t kIndexMask = 0xffffffff;
+
+constexpr uint64_t NextHead(uint64_t head, uint32_t index) {
+  return ((head & ~kIndexMask) + (kIndexMask + 1)) | index;
+}
+
+} // namespace
+
+PacketBufferPool::PacketBufferPool(size_t capacity)
+    : capacity_(capacity),
+      buffers_(std::make_unique<PacketBuffer[]>(capacity)),
+      free_head_(capacity ? 0 : kEndOfList), available_(capacity) {
+  assert(capacity < kEndOfList);
+  for (size_t i = 0; i < capacity; i++) {
+    buffers_[i].pool_ = this;
+    buffers_[i].next_free_.store(i + 1 < capacity ? i + 1 : kEndOfList,
+                                 std::memory_order_relaxed);
+  }
+}
+
+// Any buffer still referenced must not be released after this
+PacketBufferPool::~PacketBufferPool() = default;
+
+PacketBufferPool &PacketBufferPool::Default() {
+  static PacketBufferPool pool{kDefaultCapacity};
+  return pool;
+}
+
+PacketRef PacketBufferPool::Acquire() {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (true) {
+    const uint32_t index = head & kIndexMask;
+    if (index == kEndOfList) return {};
+    const uint32_t next =
+        buffers_[index].next_free_.load(std::memory_order_relaxed);
+    if (free_head_.compare_exchange_weak(head, NextHead(head, next),
+                                         std::memory_order_acquire,
+                                         std::memory_order_acquire)) {
+      available_.fetch_sub(1, std::memory_order_relaxed);
+      PacketBuffer *buffer = &buffers_[index];
+      buffer->refs_.store(1, std::memory_order_relaxed);
+      return PacketRef{buffer};
+    }
+  }
+}
+
+void PacketBufferPool::Release(PacketBuffer *buffer) {
+  const uint32_t index = buffer - buffers_.get();
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  do {
+    buffer->next_free_.store(head & kIndexMask, std::memory_order_relaxed);
+  } while (!free_head_.compare_exchange_weak(head, NextHead(head, index),
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+  available_.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace lora_chat
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include "packet.hpp"
+#include "radio_interface.hpp"
+#include "wire_packet.hpp"
+
+namespace lora_chat {
+
+class PacketBufferPool;
+
+constexpr size_t kCacheLineBytes = 64;
+
+/// Where a session packet's payload sits within its wire frame
+constexpr size_t kSessionPayloadOffset =
+    kWirePacketTagBytes +
+    Packet<PacketType::kSession>::FieldMetadata(
+        Packet<PacketType::kSession>::Field::kPayload)
+            .starting_bit /
+        8;
+/// Where a session packet's length field sits within its wire frame
+constexpr size_t kSessionLengthOffset =
+    kWirePacketTagBytes +
+    Packet<PacketType::kSession>::FieldMetadata(
+        Packet<PacketType::kSession>::Field::kLength)
+            .starting_bit /
+        8;
+/// Where a session packet's type (and its flags) sits within its wire frame
+constexpr size_t kSessionTypeOffset =
+    kWirePacketTagBytes +
+    Packet<PacketType::kSession>::FieldMetadata(
+        Packet<PacketType::kSession>::Field::kType)
+            .starting_bit /
+        8;
+/// The longest a session packet's wire frame gets: a full payload, and a
+/// receipt after it
+constexpr size_t kMaxSessionFrameBytes =
+    kSessionPayloadOffset + kSessionPacketPayloadBytes + kSessionReceiptBytes;
+static_assert(kMaxSessionFrameBytes <= SX127x_FIFO_CAPACITY);
+static_assert(alignof(ReceiveBuffer) == 1);
+
+/// One frame's worth of bytes, as received from or bound for the radio.
+/// Only ever handed out by a PacketBufferPool, through a PacketRef.
+///
+/// Frames are built in place: the application writes its payload straight
+/// into SessionPayload(), the session serializes its header around it, and
+/// the radio sends it all from here, headroom included.
+struct alignas(kCacheLineBytes) PacketBuffer {
+  // Both byte-aligned, so nothing comes between them
+  std::array<uint8_t, kFrameHeadroomBytes> headroom;
+  ReceiveBuffer bytes;
+
+  std::span<uint8_t> SessionPayload() {
+    return {bytes.data() + kSessionPayloadOffset, kSessionPacketPayloadBytes};
+  }
+  std::span<const uint8_t> SessionPayload() const {
+    return {bytes.data() + kSessionPayloadOffset, kSessionPacketPayloadBytes};
+  }
+  /// How much payload the serialized session header says follows it
+  size_t SessionPayloadLength() const {
+    return std::min<size_t>(bytes.buffer[kSessionLengthOffset],
+                            kSessionPacketPayloadBytes);
+  }
+  /// The flags in the serialized session header's type byte
+  uint8_t SessionFlags() const {
+    return bytes.buffer[kSessionTypeOffset] &
+           ~Packet<PacketType::kSession>::kSubTypeMask;
+  }
+  /// Where a delivery receipt goes: right after the payload, however long
+  /// the header says that is
+  std::span<uint8_t, kSessionReceiptBytes> SessionReceipt() {
+    return std::span<uint8_t, kSessionReceiptBytes>{
+        bytes.data() + kSessionPayloadOffset + SessionPayloadLength(),
+        kSessionReceiptBytes};
+  }
+  std::span<const uint8_t, kSessionReceiptBytes> SessionReceipt() const {
+    return std::span<const uint8_t, kSessionReceiptBytes>{
+        bytes.data() + kSessionPayloadOffset + SessionPayloadLength(),
+        kSessionReceiptBytes};
+  }
+  /// The whole of a session packet's wire frame, as handed to the radio: the
+  /// header, as much of the payload as it says is there, and any receipt
+  std::span<const uint8_t> SessionFrame() const {
+    const bool receipt =
+        SessionFlags() & Packet<PacketType::kSession>::kCarriesReceipt;
+    return {bytes.data(), kSessionPayloadOffset + SessionPayloadLength() +
+                              (receipt ? kSessionReceiptBytes : 0)};
+  }
+  /// The headroom and the first `length` bytes of the frame after it, for
+  /// RadioInterface::TransmitStaged
+  std::span<uint8_t> Staged(size_t length) {
+    return {headroom.data(), kFrameHeadroomBytes + length};
+  }
+  std::span<uint8_t> StagedSessionFrame() {
+    return Staged(SessionFrame().size());
+  }
+
+private:
+  friend PacketBufferPool;
+  friend class PacketRef;
+
+  std::atomic<uint32_t> refs_{0};
+  // Index of the next buffer on the pool's free list
+  std::atomic<uint32_t> next_free_{0};
+  PacketBufferPool *pool_{nullptr};
+};
+
+/// A counted reference to a pooled PacketBuffer; the buffer goes back to its
+/// pool when the last reference is dropped. Moving hands the buffer on
+/// without touching the count, which is how frames are meant to travel:
+/// from the radio up to the application, and from the application back down.
+class PacketRef {
+public:
+  PacketRef() = default;
+  PacketRef(const PacketRef &other) : buffer_(other.buffer_) {
+    if (buffer_) buffer_->refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+  PacketRef(PacketRef &&other) noexcept
+      : buffer_(std::exchange(other.buffer_, nullptr)) {}
+  PacketRef &operator=(PacketRef other) noexcept {
+    std::swap(buffer_, other.buffer_);
+    return *this;
+  }
+  ~PacketRef() {
+    if (buffer_) Reset();
+  }
+
+  void Reset();
+
+  explicit operator bool() const { return buffer_ != nullptr; }
+  PacketBuffer &operator*() const { return *buffer_; }
+  PacketBuffer *operator->() const { return buffer_; }
+
+  /// How many references there are to the buffer, for tests and assertions
+  uint32_t UseCount() const {
+    return buffer_ ? buffer_->refs_.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+  friend PacketBufferPool;
+  explicit PacketRef(PacketBuffer *buffer) : buffer_(buffer) {}
+
+  PacketBuffer *buffer_ = nullptr;
+};
+
+/// A fixed set of PacketBuffers, allocated up front. Acquiring and releasing
+/// are lock-free and never allocate, so they're safe on every hot path,
+/// including radio completion threads.
+class PacketBufferPool {
+public:
+  /// Enough for a handful of sessions and protocol agents, which is what a
+  /// single device runs
+  static constexpr size_t kDefaultCapacity = 256;
+
+  explicit PacketBufferPool(size_t capacity);
+  ~PacketBufferPool();
+  PacketBufferPool(const PacketBufferPool &) = delete;
+  PacketBufferPool &operator=(const PacketBufferPool &) = delete;
+
+  /// The pool everything uses unless it's given one of its own
+  static PacketBufferPool &Default();
+
+  /// Takes a buffer from the pool, or returns an empty reference if every
+  /// buffer is in use. The buffer's contents are left as they were.
+  PacketRef Acquire();
+
+  size_t Capacity() const { return capacity_; }
+  size_t Available() const {
+    return available_.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend PacketRef;
+
+  static constexpr uint32_t kEndOfList = UINT32_MAX;
+
+  void Release(PacketBuffer *buffer);
+
+  size_t capacity_;
+  std::unique_ptr<PacketBuffer[]> buffers_;
+  // Head of the free list: a buffer index in the low half, and a count of
+  // updates in the high half so that a pop racing a pop-then-push of the
+  // same buffer fails its compare-exchange instead of corrupting the list
+  alignas(kCacheLineBytes) std::atomic<uint64_t> free_head_;
+  std::atomic<size_t> available_;
+};
+
+inline void PacketRef::Reset() {
+  if (!buffer_) return;
+  if (buffer_->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    buffer_->pool_->Release(buffer_);
+  buffer_ = nullptr;
+}
+
+} // namespace lora_chat
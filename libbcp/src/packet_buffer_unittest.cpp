@@ -0,0 +1,191 @@
+#include "packet_buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "session.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::PacketBufferPool;
+using lora_chat::PacketRef;
+
+TEST(PacketBufferPool, RunsDryAndRefills) {
+  PacketBufferPool pool{4};
+  std::vector<PacketRef> held{};
+  for (int i = 0; i < 4; i++) {
+    held.push_back(pool.Acquire());
+    ASSERT_TRUE(held.back());
+  }
+  EXPECT_EQ(pool.Available(), 0u);
+  EXPECT_FALSE(pool.Acquire());
+
+  held.pop_back();
+  EXPECT_EQ(pool.Available(), 1u);
+  EXPECT_TRUE(pool.Acquire());
+  held.clear();
+  EXPECT_EQ(pool.Available(), pool.Capacity());
+}
+
+TEST(PacketBufferPool, SharedUntilTheLastReferenceGoes) {
+  PacketBufferPool pool{2};
+  PacketRef a = pool.Acquire();
+  a->bytes.buffer[0] = 42;
+  {
+    PacketRef b = a;
+    EXPECT_EQ(&*a, &*b);
+    EXPECT_EQ(a.UseCount(), 2u);
+    EXPECT_EQ(pool.Available(), 1u);
+  }
+  EXPECT_EQ(a.UseCount(), 1u);
+  EXPECT_EQ(pool.Available(), 1u);
+
+  // Moving hands the buffer over without touching the count
+  auto *buffer = &*a;
+  PacketRef c = std::move(a);
+  EXPECT_FALSE(a);
+  EXPECT_EQ(&*c, buffer);
+  EXPECT_EQ(c.UseCount(), 1u);
+  EXPECT_EQ(c->bytes.buffer[0], 42);
+
+  c = PacketRef{};
+  EXPECT_EQ(pool.Available(), 2u);
+}
+
+TEST(PacketBufferPool, BuffersAreCacheAligned) {
+  PacketBufferPool pool{8};
+  std::vector<PacketRef> held{};
+  for (int i = 0; i < 8; i++) {
+    held.push_back(pool.Acquire());
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&*held.back()) %
+                  lora_chat::kCacheLineBytes,
+              0u);
+  }
+}
+
+// Records what reaches the radio, to check that staged frames arrive intact
+class RecordingRadio : public lora_chat::RadioInterface {
+public:
+  Status Transmit(std::span<uint8_t const> buffer) {
+    sent.assign(buffer.begin(), buffer.end());
+    return kSuccess;
+  }
+  Status Receive(std::span<uint8_t>) { return kTimeout; }
+  size_t MaximumMessageLength() const { return SX127x_FIFO_CAPACITY; }
+
+  std::vector<uint8_t> sent{};
+};
+
+TEST(PacketBufferPool, StagedFramesKeepHeadroomInFront) {
+  PacketBufferPool pool{1};
+  PacketRef frame = pool.Acquire();
+  for (size_t i = 0; i < frame->bytes.size(); i++) frame->bytes.buffer[i] = i;
+  frame->bytes.buffer[lora_chat::kSessionLengthOffset] =
+      lora_chat::kSessionPacketPayloadBytes;
+
+  auto staged = frame->StagedSessionFrame();
+  EXPECT_EQ(staged.data() + lora_chat::kFrameHeadroomBytes,
+            frame->bytes.data());
+  EXPECT_EQ(staged.size(), lora_chat::kFrameHeadroomBytes +
+                               frame->SessionFrame().size());
+
+  // Radios without a use for the headroom send just the frame
+  RecordingRadio radio{};
+  EXPECT_EQ(radio.TransmitStaged(staged), RecordingRadio::kSuccess);
+  auto expected = frame->SessionFrame();
+  EXPECT_TRUE(std::equal(radio.sent.begin(), radio.sent.end(),
+                         expected.begin(), expected.end()));
+
+  // Only as much of the payload goes on air as the header says is there
+  frame->bytes.buffer[lora_chat::kSessionLengthOffset] = 4;
+  EXPECT_EQ(frame->StagedSessionFrame().size(),
+            lora_chat::kFrameHeadroomBytes + lora_chat::kSessionPayloadOffset +
+                4);
+}
+
+TEST(PacketBufferPool, ConcurrentOwnersNeverShare) {
+  constexpr int kThreads = 4;
+  constexpr int kIterations = 100000;
+  PacketBufferPool pool{kThreads + 1};
+  std::atomic<int> conflicts{0};
+
+  std::vector<std::thread> threads{};
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kIterations; i++) {
+        PacketRef frame = pool.Acquire();
+        if (!frame) continue;
+        // Anyone else holding this buffer would scribble over our mark
+        std::memset(frame->bytes.data(), t, frame->bytes.size());
+        for (uint8_t byte : frame->bytes.buffer)
+          if (byte != t) conflicts++;
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_EQ(conflicts, 0);
+  EXPECT_EQ(pool.Available(), pool.Capacity());
+}
+
+// Frames for the session test below come from, and must all return to, here
+PacketBufferPool session_pool{16};
+std::atomic<int> frames_sent{0};
+std::atomic<int> frames_received{0};
+
+PacketRef MakeFrame() {
+  PacketRef frame = session_pool.Acquire();
+  if (!frame) return {};
+  auto payload = frame->SessionPayload();
+  std::snprintf(reinterpret_cast<char *>(payload.data()), payload.size(),
+                "frame %d", frames_sent++);
+  return frame;
+}
+
+void ConsumeFrame(PacketRef &&frame) {
+  EXPECT_EQ(std::strncmp(reinterpret_cast<const char *>(
+                             frame->SessionPayload().data()),
+                         "frame ", 6),
+            0);
+  frames_received++;
+}
+
+TEST(PacketBufferPool, FramesFlowThroughSessions) {
+  using lora_chat::MessagePipe;
+  using lora_chat::Session;
+  constexpr int kPeriods{6};
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+
+  lora_chat::testutils::LocalRadio radio(std::chrono::milliseconds(8));
+  MessagePipe pipe{MakeFrame, ConsumeFrame};
+  {
+    auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+    Session ponger(start_time, 0, kTransmitTime, kGapTime, false, session_pool);
+    Session pinger(start_time, 0, kTransmitTime, kGapTime, true, session_pool);
+
+    std::thread ponger_thread([&]() {
+      std::this_thread::sleep_until(start_time);
+      for (int i = 0; i < 2 * kPeriods; i++)
+        ponger.ExecuteCurrentAction(radio, pipe);
+    });
+    std::this_thread::sleep_until(start_time);
+    for (int i = 0; i < 2 * kPeriods; i++)
+      pinger.ExecuteCurrentAction(radio, pipe);
+    ponger_thread.join();
+
+    // Each session holds on to its last frame sent and received
+    EXPECT_EQ(session_pool.Available(), session_pool.Capacity() - 4);
+  }
+  EXPECT_GE(frames_received, kPeriods);
+  EXPECT_EQ(session_pool.Available(), session_pool.Capacity());
+}
+
+} // namespace
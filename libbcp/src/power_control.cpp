@@ -0,0 +1,53 @@
+#include "power_control.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace lora_chat {
+
+TxPowerController::TxPowerController(int8_t min_dbm, int8_t max_dbm,
+                                     float target_margin_db)
+    : min_dbm_(min_dbm), max_dbm_(max_dbm),
+      target_margin_db_(target_margin_db) {
+  assert(min_dbm <= max_dbm);
+}
+
+int8_t TxPowerController::PowerFor(WireAddress peer) const {
+  auto link = links_.find(peer);
+  return link == links_.end() ? max_dbm_ : link->second.dbm;
+}
+
+void TxPowerController::Report(WireAddress peer, int8_t sent_dbm,
+                               WireLinkMargin margin_db) {
+  if (margin_db == kUnknownLinkMargin)
+    return;
+  const float excess = margin_db - target_margin_db_;
+  const int current = PowerFor(peer);
+  if (std::abs(excess) <= kDeadBandDb) {
+    Set(peer, current);
+    return;
+  }
+  // Rounded towards more power: short of the target by any amount is short
+  const int wanted = sent_dbm - static_cast<int>(std::floor(excess));
+  Set(peer, std::max(wanted, current - kMaxStepDownDb));
+}
+
+void TxPowerController::ReportLoss(WireAddress peer) {
+  Set(peer, PowerFor(peer) + kLossStepUpDb);
+}
+
+void TxPowerController::Set(WireAddress peer, int dbm) {
+  if (!links_.contains(peer) && links_.size() >= kMaxLinks) {
+    auto oldest = std::min_element(
+        links_.begin(), links_.end(), [](auto const &a, auto const &b) {
+          return a.second.last_heard < b.second.last_heard;
+        });
+    links_.erase(oldest);
+  }
+  links_[peer] = {
+      .dbm = static_cast<int8_t>(std::clamp<int>(dbm, min_dbm_, max_dbm_)),
+      .last_heard = ++reports_};
+}
+
+} // namespace lora_chat
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+#include "packet.hpp"
+
+namespace lora_chat {
+
+/// Picks the transmit power for each link: the least that keeps the frames
+/// the peer gets from us a target margin above its demodulator's floor.
+///
+/// The peer tells us the margin it saw on one of our frames, sent at a power
+/// we know, and every dB of margin over the target is a dB of power we can
+/// drop (or under it, one we need to add). Power comes down at most
+/// kMaxStepDownDb per report, so that one lucky frame doesn't strand the
+/// link, but goes back up all at once; a handshake that goes unanswered
+/// raises it by kLossStepUpDb. Links we've heard nothing about get the most
+/// power there is.
+class TxPowerController {
+public:
+  static constexpr float kDefaultTargetMarginDb = 10;
+  static constexpr int kMaxStepDownDb = 3;
+  static constexpr int kLossStepUpDb = 6;
+  // Margins this close to the target leave the power be, so that noise in
+  // the SNR estimate doesn't keep nudging it
+  static constexpr float kDeadBandDb = 1;
+  // Past this many, the link heard about longest ago is forgotten
+  static constexpr size_t kMaxLinks = 64;
+
+  TxPowerController(int8_t min_dbm, int8_t max_dbm,
+                    float target_margin_db = kDefaultTargetMarginDb);
+
+  /// What to send to `peer` at
+  int8_t PowerFor(WireAddress peer) const;
+  /// Records that a frame sent at `sent_dbm` reached `peer` with
+  /// `margin_db` to spare; kUnknownLinkMargin records nothing
+  void Report(WireAddress peer, int8_t sent_dbm, WireLinkMargin margin_db);
+  /// Records that a frame sent to `peer` at its power went unanswered
+  void ReportLoss(WireAddress peer);
+
+  int8_t MinPower() const { return min_dbm_; }
+  int8_t MaxPower() const { return max_dbm_; }
+  float TargetMargin() const { return target_margin_db_; }
+
+private:
+  struct Link {
+    int8_t dbm;
+    uint64_t last_heard;
+  };
+
+  void Set(WireAddress peer, int dbm);
+
+  int8_t min_dbm_;
+  int8_t max_dbm_;
+  float target_margin_db_;
+  std::map<WireAddress, Link> links_{};
+  uint64_t reports_{0};
+};
+
+} // namespace lora_chat
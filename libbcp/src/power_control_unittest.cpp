@@ -0,0 +1,80 @@
+#include "power_control.hpp"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::TxPowerController;
+using lora_chat::WireLinkMargin;
+
+constexpr int8_t kMin = 2;
+constexpr int8_t kMax = 17;
+
+// A link where frames come in `path_db` below what they went out at, relative
+// to the receiver's floor
+WireLinkMargin MarginAt(int8_t dbm, int path_db) {
+  return static_cast<WireLinkMargin>(dbm - path_db);
+}
+
+TEST(TxPowerController, SettlesOnTheLeastThatKeepsTheMargin) {
+  TxPowerController control{kMin, kMax, 10};
+  EXPECT_EQ(control.PowerFor(7), kMax);
+
+  // 15dB to spare at full power: 5dB could go, a few at a time
+  int path_db = 2;
+  for (int i = 0; i < 4; i++) {
+    const int8_t dbm = control.PowerFor(7);
+    control.Report(7, dbm, MarginAt(dbm, path_db));
+    EXPECT_GE(MarginAt(control.PowerFor(7), path_db), 10);
+  }
+  EXPECT_EQ(control.PowerFor(7), 12);
+
+  // Near enough the target that it stays put
+  control.Report(7, 12, 10);
+  control.Report(7, 12, 9);
+  EXPECT_EQ(control.PowerFor(7), 12);
+
+  // Other links have their own
+  EXPECT_EQ(control.PowerFor(8), kMax);
+}
+
+TEST(TxPowerController, ClimbsBackAllAtOnce) {
+  TxPowerController control{kMin, kMax, 10};
+  for (int i = 0; i < 8; i++)
+    control.Report(7, control.PowerFor(7), 30);
+  EXPECT_EQ(control.PowerFor(7), kMin);
+
+  // The path gets 6dB worse
+  control.Report(7, kMin, 4);
+  EXPECT_EQ(control.PowerFor(7), kMin + 6);
+  // ... and then nothing gets through at all
+  control.ReportLoss(7);
+  EXPECT_EQ(control.PowerFor(7), kMin + 6 + TxPowerController::kLossStepUpDb);
+  control.ReportLoss(7);
+  EXPECT_EQ(control.PowerFor(7), kMax);
+
+  // What the peer couldn't measure changes nothing
+  control.Report(7, kMax, lora_chat::kUnknownLinkMargin);
+  EXPECT_EQ(control.PowerFor(7), kMax);
+
+  // A report is on the power the frame went out at, which for an
+  // advertisement is full power, whatever the link's at
+  for (int i = 0; i < 8; i++)
+    control.Report(9, control.PowerFor(9), 30);
+  control.Report(9, kMax, 12);
+  EXPECT_EQ(control.PowerFor(9), kMax - 2);
+}
+
+TEST(TxPowerController, ForgetsTheLinkHeardFromLongestAgo) {
+  TxPowerController control{kMin, kMax, 10};
+  for (lora_chat::WireAddress peer = 1;
+       peer <= TxPowerController::kMaxLinks + 1; peer++)
+    control.Report(peer, kMax, 13);
+  EXPECT_EQ(control.PowerFor(1), kMax);
+  EXPECT_EQ(control.PowerFor(2), kMax - 3);
+  EXPECT_EQ(control.PowerFor(TxPowerController::kMaxLinks + 1), kMax - 3);
+}
+
+} // namespace
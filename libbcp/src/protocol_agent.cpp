@@ -1,7 +1,10 @@
 #include "protocol_agent.hpp"
+#include "metrics.hpp"
 #include "packet.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdarg>
 #include <cstring>
 #include <sys/types.h>
@@ -191,17 +194,34 @@ void ProtocolAgent::ChangeState(ProtocolState new_state) {
   }
   prior_state_ = state_;
   state_ = new_state;
-}
 
-std::pair<RadioInterface::Status, ReceiveBuffer>
-ProtocolAgent::ReceivePacket() {
-  ReceiveBuffer buff{};
-  auto status = radio_.get().Receive(buff.span());
+  // Sessions run on the usual preamble (see SetLowPowerListening)
+  if (wake_interval_ > Duration::zero()) {
+    if (new_state == ProtocolState::kExecuteSession)
+      radio_.get().SetWakeUpInterval(Duration::zero());
+    else if (prior_state_ == ProtocolState::kExecuteSession)
+      radio_.get().SetWakeUpInterval(wake_interval_);
+  }
+
+  auto &metrics = Metrics::Default();
+  metrics.SetAgentState(StateStr(new_state));
+  if (new_state == ProtocolState::kExecuteSession && session_)
+    metrics.EnterSession(session_->id());
+  else if (prior_state_ == ProtocolState::kExecuteSession)
+    metrics.LeaveSession();
+
+  if (prior_state_ == ProtocolState::kExecuteSession &&
+      new_state != ProtocolState::kExecuteSession)
+    pipe_.NotifySessionEnded();
+}
 
-  // TODO rearchitect internals to avoid this unnecessary copy
-  ReceiveBuffer w_p{};
-  std::memcpy(&w_p, buff.data(), buff.size());
-  return {status, w_p};
+std::pair<RadioInterface::Status, PacketRef> ProtocolAgent::ReceivePacket() {
+  PacketRef frame = PacketBufferPool::Default().Acquire();
+  if (!frame)
+    return {RadioInterface::Status::kUnspecifiedError, {}};
+  frame->bytes = {};
+  auto status = radio_.get().Receive(frame->bytes.span());
+  return {status, std::move(frame)};
 }
 
 void ProtocolAgent::DispatchNextState() {
@@ -225,11 +245,94 @@ void ProtocolAgent::DispatchNextState() {
 
 void ProtocolAgent::Pend() {
   // TODO use a CV instead of busy-waiting
-  std::this_thread::sleep_for(kPendSleepTime);
+  const TimePoint until = Now() + kPendSleepTime;
+  radio_.get().IdleUntil(until);
+  std::this_thread::sleep_until(until);
   ChangeState(ProtocolState::kDispatch);
 }
 
+bool ProtocolAgent::SetLowPowerListening(Duration interval) {
+  if (!radio_.get().SetWakeUpInterval(interval))
+    return false;
+  if (state_ == ProtocolState::kExecuteSession)
+    radio_.get().SetWakeUpInterval(Duration::zero());
+  wake_interval_ = interval;
+  return true;
+}
+
+bool ProtocolAgent::ControlTransmitPower(int8_t min_dbm, int8_t max_dbm,
+                                         float target_margin_db) {
+  if (!radio_.get().SetTransmitPower(max_dbm))
+    return false;
+  power_.emplace(min_dbm, max_dbm, target_margin_db);
+  sent_dbm_ = max_dbm;
+  return true;
+}
+
+uint32_t ProtocolAgent::OwnGuardMicros() const {
+  auto gap = guard_times_.SafeGap();
+  if (!calibrated_guards_ || !gap)
+    return 0;
+  return std::chrono::ceil<std::chrono::microseconds>(*gap).count();
+}
+
+std::pair<Duration, bool>
+ProtocolAgent::NegotiateGap(uint32_t peer_guard_micros) const {
+  const uint32_t own = OwnGuardMicros();
+  // A coordinated network's timing isn't ours to change
+  if (superframe_ || !own || !peer_guard_micros)
+    return {SessionGapTime(), false};
+  return {std::chrono::microseconds(std::max(own, peer_guard_micros)), true};
+}
+
+void ProtocolAgent::ConfigureSession() {
+  session_->SetSelfClocked(turnaround_);
+  session_->SetGuardTimeCalibrator(&guard_times_);
+}
+
+void ProtocolAgent::CheckSlot() {
+  const Duration period = superframe_->Period();
+  // Missing the beacon tells us nothing, so we keep to what we had
+  if (network_->ListenForBeacon(Now() + period) && !network_->slot())
+    network_->AcquireSlot(Now() + kSlotReacquirePeriods * period);
+  if constexpr (kLogLevel > kNone) {
+    if (slot_ && network_->slot() != slot_)
+      LogStr("slot %zu was taken back", *slot_);
+    if (network_->slot() && network_->slot() != slot_)
+      LogStr("now in slot %zu", *network_->slot());
+  }
+  superframe_ = network_->superframe();
+  slot_ = network_->slot();
+  slot_checked_ = Now();
+}
+
+WireLinkMargin ProtocolAgent::MeasureMargin() const {
+  auto margin = radio_.get().LastLinkMarginDb();
+  if (!margin)
+    return kUnknownLinkMargin;
+  // Rounded down: the controller takes it as all there is to spare
+  return static_cast<WireLinkMargin>(
+      std::clamp(std::floor(*margin), -127.0f, 127.0f));
+}
+
+void ProtocolAgent::UsePower(int8_t dbm) {
+  if (!power_)
+    return;
+  sent_dbm_ = radio_.get().SetTransmitPower(dbm).value_or(dbm);
+}
+
 void ProtocolAgent::Seek() {
+  // Asleep until there's something worth receiving: anything sent our way
+  // is still in its preamble when we next wake
+  if (wake_interval_ > Duration::zero()) {
+    radio_.get().Sleep();
+    std::this_thread::sleep_for(wake_interval_);
+    if (radio_.get().DetectActivity() != RadioInterface::Status::kSuccess) {
+      ChangeState(ProtocolState::kDispatch);
+      return;
+    }
+  }
+
   auto get_ad = [&]() -> bool {
     auto [status, w_p] = ReceivePacket();
     if (!(status == RadioInterface::Status::kSuccess)) {
@@ -237,14 +340,15 @@ void ProtocolAgent::Seek() {
       return false;
     }
     // TODO re-seek if we get a non-ad packet?
-    auto maybe_ad = Deserialize<PacketType::kAdvertising>(w_p);
+    auto maybe_ad = Deserialize<PacketType::kAdvertising>(w_p->bytes);
     if (!maybe_ad)
       return false;
     auto ad = maybe_ad.value();
 
     if constexpr (kLogLevel >= kLogPacketMetadata)
-      LogPacket(ad, w_p.span(), "Received");
+      LogPacket(ad, w_p->bytes.span(), "Received");
     advertiser_address_ = ad.source_address;
+    heard_margin_ = MeasureMargin();
     return true;
   };
   bool got_packet = get_ad();
@@ -255,10 +359,15 @@ void ProtocolAgent::Seek() {
 void ProtocolAgent::RequestConnection() {
   assert(advertiser_address_.has_value());
 
+  const Address advertiser = *advertiser_address_;
   Packet<PacketType::kConnectionRequest> conn_req{};
   conn_req.source_address = address_;
-  conn_req.target_address = *advertiser_address_;
+  conn_req.target_address = advertiser;
+  conn_req.link_margin = heard_margin_;
+  conn_req.guard_micros = OwnGuardMicros();
   advertiser_address_ = {};
+  if (power_)
+    UsePower(power_->PowerFor(advertiser));
 
   auto w_conn_req = Serialize(conn_req);
   auto status = radio_.get().Transmit(w_conn_req);
@@ -274,7 +383,7 @@ void ProtocolAgent::RequestConnection() {
       LogStr("failed to receive connection-accept: %d", status);
       continue;
     }
-    auto maybe_response = Deserialize<PacketType::kConnectionAccept>(w_p);
+    auto maybe_response = Deserialize<PacketType::kConnectionAccept>(w_p->bytes);
     if (!maybe_response)
       continue;
     auto response = maybe_response.value();
@@ -282,30 +391,49 @@ void ProtocolAgent::RequestConnection() {
     const bool is_for_us = (response.target_address == address_);
     if constexpr (kLogLevel > kNone) {
       const char *for_us_str = is_for_us ? "(for us)" : "(not for us)";
-      LogPacket(response, w_p.span(), "Received", for_us_str);
+      LogPacket(response, w_p->bytes.span(), "Received", for_us_str);
     }
     if (response.target_address != address_)
       continue;
 
+    if (power_) {
+      power_->Report(advertiser, sent_dbm_, response.link_margin);
+      UsePower(power_->PowerFor(advertiser));
+    }
+
     TimePoint start_time(DeserializeWireTime(response.session_start_time));
+    const Duration gap = (!superframe_ && response.gap_micros)
+                             ? std::chrono::microseconds(response.gap_micros)
+                             : SessionGapTime();
     session_.emplace(start_time, response.session_id,
-                     kHardcodedTransmissionTime, kHardcodedSleepTime, false);
+                     SessionTransmissionTime(), gap, false);
+    ConfigureSession();
     // Success!
+    peer_address_ = response.source_address;
+    pipe_.NotifySessionEstablished(response.source_address);
     ChangeState(ProtocolState::kExecuteSession);
-    session_->SleepUntilStartTime();
+    session_->SleepUntilStartTime(&radio_.get());
     return;
-  } while (Now() - receive_begin < kHandshakeReceiveDuration);
+  } while (Now() - receive_begin < kHandshakeReceiveDuration + WakeUpAllowance());
 
-  // Disappointment: no response
+  // Disappointment: no response. Maybe the request never got there.
+  if (power_)
+    power_->ReportLoss(advertiser);
   if constexpr (kLogLevel > kNone)
     LogStr("connection-request failed", status);
   ChangeState(ProtocolState::kDispatch);
 }
 
 void ProtocolAgent::Advertise() {
+  // The slot a session we accept goes in had better still be ours
+  if (network_ && Now() - slot_checked_ >= superframe_->Period())
+    CheckSlot();
+
   // First we broadcast the advertisement
   Packet<PacketType::kAdvertising> advert{};
   advert.source_address = address_;
+  if (power_)
+    UsePower(power_->MaxPower());
   auto w_advert = Serialize(advert);
   auto status = radio_.get().Transmit(w_advert);
   assert(status == RadioInterface::Status::kSuccess); // TODO handle err
@@ -318,7 +446,7 @@ void ProtocolAgent::Advertise() {
     auto [status, w_p] = ReceivePacket();
     if (status != RadioInterface::Status::kSuccess)
       continue;
-    auto maybe_response = Deserialize<PacketType::kConnectionRequest>(w_p);
+    auto maybe_response = Deserialize<PacketType::kConnectionRequest>(w_p->bytes);
     if (!maybe_response)
       continue;
 
@@ -326,15 +454,20 @@ void ProtocolAgent::Advertise() {
     const bool is_for_us = (response.target_address == address_);
     if constexpr (kLogLevel > kNone) {
       const char *for_us_str = is_for_us ? "(for us)" : "(not for us)";
-      LogPacket(response, w_p.span(), "Received", for_us_str);
+      LogPacket(response, w_p->bytes.span(), "Received", for_us_str);
     }
     if (response.target_address != address_)
       continue;
     // Success: got a fish!
     requester_address_ = response.source_address;
+    heard_margin_ = MeasureMargin();
+    requester_guard_micros_ = response.guard_micros;
+    if (power_)
+      power_->Report(response.source_address, sent_dbm_, response.link_margin);
     ChangeState(ProtocolState::kExecuteHandshakeFromAdvertise);
     return;
-  } while (Now() - receive_begin < kConnectionRequestInterval);
+  } while (Now() - receive_begin <
+           kConnectionRequestInterval + WakeUpAllowance());
 
   // Disappointment: empty line
   ChangeState(ProtocolState::kDispatch);
@@ -342,16 +475,37 @@ void ProtocolAgent::Advertise() {
 
 void ProtocolAgent::AcceptConnection() {
   assert(requester_address_.has_value());
+  const auto [gap, negotiated] = NegotiateGap(requester_guard_micros_);
+  // Measured guard times make for a measured lead time too: the accept's
+  // airtime, then a gap to set the session up in
+  const auto accept_airtime = radio_.get().TimeOnAir(
+      WirePacketWidthBytes<PacketType::kConnectionAccept>());
+  const Duration lead_time = (negotiated && accept_airtime)
+                                 ? *accept_airtime + gap
+                                 : kHandshakeLeadTime;
+
   Packet<PacketType::kConnectionAccept> accept{};
   accept.source_address = address_;
-  accept.session_start_time = GetFutureWireTime(kHandshakeLeadTime);
+  accept.session_start_time =
+      (superframe_ && slot_)
+          ? SerializeWireTime(superframe_->SlotStartAtOrAfter(
+                *slot_, Now() + lead_time + WakeUpAllowance()))
+          : GetFutureWireTime(lead_time + WakeUpAllowance());
   accept.session_id = address_; // TODO generate session IDs
   accept.target_address = *requester_address_;
+  accept.link_margin = heard_margin_;
+  accept.gap_micros =
+      superframe_ ? 0
+                  : std::chrono::ceil<std::chrono::microseconds>(gap).count();
   requester_address_ = {};
+  requester_guard_micros_ = 0;
+  if (power_)
+    UsePower(power_->PowerFor(accept.target_address));
 
   auto start_time = DeserializeWireTime(accept.session_start_time);
-  session_.emplace(start_time, address_, kHardcodedTransmissionTime,
-                   kHardcodedSleepTime, true);
+  session_.emplace(start_time, address_, SessionTransmissionTime(), gap,
+                   true);
+  ConfigureSession();
 
   auto w_accept = Serialize(accept);
   if constexpr (kLogLevel >= kLogPacketMetadata)
@@ -363,8 +517,27 @@ void ProtocolAgent::AcceptConnection() {
     return;
   }
 
+  peer_address_ = accept.target_address;
+  pipe_.NotifySessionEstablished(accept.target_address);
+  ChangeState(ProtocolState::kExecuteSession);
+  session_->SleepUntilStartTime(&radio_.get());
+}
+
+std::optional<std::pair<Session::State, WireAddress>>
+ProtocolAgent::SaveSession() const {
+  if (state_ != ProtocolState::kExecuteSession || !session_ || !peer_address_)
+    return {};
+  return std::make_pair(session_->SaveState(), *peer_address_);
+}
+
+void ProtocolAgent::ResumeSession(Session::State const &state, Address peer) {
+  session_.emplace(state);
+  session_->SetGuardTimeCalibrator(&guard_times_);
+  peer_address_ = peer;
+  pipe_.NotifySessionEstablished(peer);
   ChangeState(ProtocolState::kExecuteSession);
-  session_->SleepUntilStartTime();
+  // Partway through a window is too late to join in; the next one will do
+  session_->SleepUntilNextSlot(&radio_.get());
 }
 
 void ProtocolAgent::ExecuteSession() {
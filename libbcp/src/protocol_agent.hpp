@@ -3,11 +3,17 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <optional>
+#include <utility>
 
 #include "clock.hpp"
+#include "guard_times.hpp"
 #include "packet.hpp"
+#include "packet_buffer.hpp"
+#include "power_control.hpp"
 #include "radio_interface.hpp"
 #include "session.hpp"
+#include "tdma.hpp"
 #include "time.hpp"
 
 namespace lora_chat {
@@ -71,8 +77,76 @@ public:
 
   void SetGoal(ConnectionGoal goal) { goal_ = goal; }
 
+  /// Self-clocks the sessions this agent goes on to set up (see
+  /// Session::SetSelfClocked); zero keeps them on the grid. The peer's agent
+  /// must be set up alike.
+  void SetSelfClocking(Duration turnaround) { turnaround_ = turnaround; }
+
+  /// Low-power listening: while seeking, the radio sleeps, waking once every
+  /// `interval` to check the channel, and only receives if there's a frame on
+  /// the air. Frames sent outside of sessions get a preamble longer than
+  /// `interval`, so that agents listening this way can't miss them, and the
+  /// handshake allows for the extra airtime. Every agent on the channel must
+  /// be set up alike. Zero turns it off. Returns false, changing nothing, if
+  /// the radio can't.
+  bool SetLowPowerListening(Duration interval);
+
+  /// Closed-loop transmit power control (see TxPowerController). Each end of
+  /// a handshake tells the other what margin the other's frame came in at,
+  /// and the session runs at the least power between `min_dbm` and `max_dbm`
+  /// that keeps us `target_margin_db` above the peer's floor. What's learned
+  /// is kept per peer, for the sessions after. Advertisements are for anyone
+  /// to hear, so they go out at `max_dbm`. Agents report margins whether or
+  /// not they control their own power, so the peer needn't. Returns false,
+  /// changing nothing, if the radio can't set its power.
+  bool ControlTransmitPower(
+      int8_t min_dbm, int8_t max_dbm,
+      float target_margin_db = TxPowerController::kDefaultTargetMarginDb);
+  std::optional<TxPowerController> const &power_control() const {
+    return power_;
+  }
+
+  /// The turnarounds of every session are measured (see GuardTimeCalibrator).
+  /// With this on, once there are enough of them, the sessions this agent
+  /// sets up leave the larger of our safe gap and the peer's between windows
+  /// rather than the hardcoded one, and the handshake sets them to start as
+  /// soon as the connection-accept is through and the gap after it. Each end
+  /// tells the other its safe gap in the handshake; if the peer doesn't,
+  /// sessions with it keep the hardcoded one.
+  void UseCalibratedGuardTimes(bool on) { calibrated_guards_ = on; }
+  GuardTimeCalibrator const &guard_times() const { return guard_times_; }
+
+  /// Runs the sessions this agent goes on to set up on the superframe of the
+  /// coordinated network `member` follows (see tdma.hpp), rather than on a
+  /// grid of their own. `member` must have heard a beacon, and must outlive
+  /// the agent. Sessions this agent initiates (i.e. when advertising) go in
+  /// the member's slot; without one, they keep to the superframe's timing but
+  /// may collide. The peer's agent must follow the same network.
+  ///
+  /// Handshakes run off the schedule, so an advertiser's slot goes quiet and
+  /// may be taken back (see TdmaCoordinator). While advertising, the agent
+  /// hears a beacon once a superframe and checks that it still holds its
+  /// slot, contending for one again for up to kSlotReacquirePeriods
+  /// superframes if not.
+  void FollowNetwork(TdmaMember &member) {
+    assert(member.superframe().has_value());
+    network_ = &member;
+    superframe_ = member.superframe();
+    slot_ = member.slot();
+    slot_checked_ = Now();
+  }
+  /// The slot sessions this agent initiates go in, as of the last check
+  std::optional<size_t> slot() const { return slot_; }
+
   bool InSession() { return (state_ == ProtocolState::kExecuteSession); }
 
+  /// The session in progress and who it's with, for handing over to another
+  /// process (see HotRestart); nullopt unless InSession()
+  std::optional<std::pair<Session::State, Address>> SaveSession() const;
+  /// Picks up a session saved by another agent's SaveSession, from its next
+  /// slot on
+  void ResumeSession(Session::State const &state, Address peer);
+
 private:
   enum LogLevel {
     kNone = 0,
@@ -96,12 +170,59 @@ private:
   static constexpr auto kHandshakeReceiveDuration =
       std::chrono::milliseconds(400);
   static constexpr auto kPendSleepTime = std::chrono::milliseconds(100);
+  // How many superframes an advertiser contends for a slot at a time
+  static constexpr size_t kSlotReacquirePeriods = 8;
 
   // TODO this is implicitly tied to the ToA computations I don't do yet
   static constexpr auto kHardcodedTransmissionTime =
       std::chrono::milliseconds(800);
   static constexpr auto kHardcodedSleepTime = std::chrono::milliseconds(200);
 
+  Duration turnaround_{0};
+  Duration wake_interval_{0};
+  std::optional<TxPowerController> power_{};
+  // The margin the last handshake frame we heard came in at, to report back
+  WireLinkMargin heard_margin_{kUnknownLinkMargin};
+  // What our last handshake frame went out at, while power_ is on
+  int8_t sent_dbm_{0};
+  GuardTimeCalibrator guard_times_{};
+  bool calibrated_guards_{false};
+  // The safe gap the requester being answered told us, if any
+  uint32_t requester_guard_micros_{0};
+  TdmaMember *network_{nullptr};
+  std::optional<Superframe> superframe_{};
+  std::optional<size_t> slot_{};
+  // When we last heard a beacon, or gave up listening for one
+  TimePoint slot_checked_{};
+
+  Duration SessionTransmissionTime() const {
+    return superframe_ ? superframe_->transmission_duration
+                       : kHardcodedTransmissionTime;
+  }
+  Duration SessionGapTime() const {
+    return superframe_ ? superframe_->gap_duration : kHardcodedSleepTime;
+  }
+  /// Our safe gap as it goes on the wire, if we're to use it (see
+  /// UseCalibratedGuardTimes), or 0
+  uint32_t OwnGuardMicros() const;
+  /// The gap for a session with a peer whose safe gap is `peer_guard_micros`
+  /// (0 if it doesn't know), and whether it was worked out from both
+  std::pair<Duration, bool> NegotiateGap(uint32_t peer_guard_micros) const;
+  /// Sets up a session just emplaced in session_ the way this agent runs them
+  void ConfigureSession();
+  /// Hears the network's next beacon, and contends for a slot if it shows
+  /// we've none (see FollowNetwork)
+  void CheckSlot();
+
+  /// The margin the last frame received came in at, as it goes on the wire
+  WireLinkMargin MeasureMargin() const;
+  /// Sends frames from here on at `dbm`, if power_ is on
+  void UsePower(int8_t dbm);
+
+  /// How much longer each handshake frame may take to arrive than usual: its
+  /// stretched preamble, and the receive it might land partway through
+  Duration WakeUpAllowance() const { return 2 * wake_interval_; }
+
   void LogStr(const char* format, ...) const;
   void LogPacket(Packet<PacketType::kSession> const &p, [[maybe_unused]] std::span<const uint8_t> w_p,
                  const char *action, const char *addendum = "") const;
@@ -115,7 +236,9 @@ private:
   const char *StateStr(ProtocolState s) const;
   void ChangeState(ProtocolState new_state);
 
-  std::pair<RadioInterface::Status, ReceiveBuffer> ReceivePacket();
+  /// Receives into a frame from the default pool, or fails with
+  /// kUnspecifiedError (and an empty frame) if it's out of buffers
+  std::pair<RadioInterface::Status, PacketRef> ReceivePacket();
 
   void DispatchNextState();
   void Pend();
@@ -133,6 +256,8 @@ private:
   std::optional<Session> session_;
   std::optional<Address> advertiser_address_;
   std::optional<Address> requester_address_;
+  // Who the session in progress is with
+  std::optional<Address> peer_address_;
 
   ProtocolState prior_state_{ProtocolState::kPend};
   std::atomic<ProtocolState> state_{ProtocolState::kDispatch};
@@ -203,6 +203,52 @@ constexpr static TextTag kPongTag = {"PONG"};
 constexpr static TextTag kPingerTag = {"Pinger"};
 constexpr static TextTag kPongerTag = {"Ponger"};
 
+// Hears activity on the channel on every `busy_every`th check
+class SniffingRadio : public CountingRadio {
+public:
+  SniffingRadio(int busy_every)
+      : CountingRadio(std::chrono::milliseconds(1)), busy_every_(busy_every) {}
+
+  bool SetWakeUpInterval(lora_chat::Duration interval) override {
+    wake_interval = interval;
+    return true;
+  }
+  void Sleep() override { sleeps++; }
+  Status DetectActivity() override {
+    return ++checks % busy_every_ == 0 ? Status::kSuccess : Status::kTimeout;
+  }
+
+  lora_chat::Duration wake_interval{0};
+  int sleeps{0};
+  int checks{0};
+
+private:
+  int busy_every_;
+};
+
+TEST(LowPowerListening, SeekSleepsUntilTheChannelIsBusy) {
+  using ProtocolAgent = lora_chat::ProtocolAgent;
+  using Goal = ProtocolAgent::ConnectionGoal;
+
+  SniffingRadio radio{3};
+  lora_chat::MessagePipe pipe{};
+  ProtocolAgent agent{0, radio, pipe};
+  ASSERT_TRUE(agent.SetLowPowerListening(std::chrono::milliseconds(5)));
+  EXPECT_EQ(radio.wake_interval, std::chrono::milliseconds(5));
+
+  agent.SetGoal(Goal::kSeekConnection);
+  for (int i = 0; i < 3; i++)
+    agent.ExecuteAgentAction();
+  // Only the third check found anything worth waking up for
+  EXPECT_EQ(radio.sleeps, 3);
+  EXPECT_EQ(radio.GetAndClearObservedActions(), (std::pair{0, 1}));
+
+  ASSERT_TRUE(agent.SetLowPowerListening(lora_chat::Duration::zero()));
+  agent.ExecuteAgentAction();
+  EXPECT_EQ(radio.sleeps, 3);
+  EXPECT_EQ(radio.GetAndClearObservedActions(), (std::pair{0, 1}));
+}
+
 TEST(Handshake, Simple) {
   using ProtocolAgent = lora_chat::ProtocolAgent;
   using Goal = ProtocolAgent::ConnectionGoal;
@@ -0,0 +1,243 @@
+#include "radio_interface.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+
+namespace lora_chat {
+
+/// Runs submitted operations through the blocking interface, one at a time,
+/// on its own thread, and signals an eventfd as each one finishes.
+class RadioInterface::AsyncWorker {
+public:
+  struct Operation {
+    bool transmit;
+    std::span<uint8_t const> tx_buffer;
+    std::span<uint8_t> rx_buffer;
+    TimePoint deadline;
+    Completion done;
+  };
+
+  AsyncWorker(RadioInterface &radio)
+      : radio_(radio), event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (event_fd_ < 0) perror("RadioInterface: eventfd failed");
+    thread_ = std::thread(&AsyncWorker::Run, this);
+  }
+
+  ~AsyncWorker() {
+    {
+      std::scoped_lock lock(lock_);
+      assert(!busy_ && "radio destroyed with an operation in flight");
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    if (event_fd_ >= 0) close(event_fd_);
+  }
+
+  bool Submit(Operation const &op) {
+    {
+      std::scoped_lock lock(lock_);
+      if (busy_) return false;
+      busy_ = true;
+      pending_ = op;
+    }
+    wake_.notify_one();
+    return true;
+  }
+
+  int fd() const { return event_fd_; }
+
+  size_t Dispatch() {
+    eventfd_t count;
+    if (eventfd_read(event_fd_, &count) < 0) return 0;
+
+    Completion done;
+    Status status;
+    {
+      std::scoped_lock lock(lock_);
+      assert(finished_);
+      done = finished_->done;
+      status = finished_status_;
+      finished_.reset();
+      busy_ = false;
+    }
+    // Only once we're no longer busy, so that the callback may submit again
+    done.func(done.ctx, status);
+    return 1;
+  }
+
+private:
+  void Run() {
+    std::unique_lock lock(lock_);
+    while (true) {
+      wake_.wait(lock, [this] { return stop_ || pending_; });
+      if (stop_) return;
+
+      Operation op = *pending_;
+      pending_.reset();
+      lock.unlock();
+
+      Status status;
+      if (Now() >= op.deadline)
+        status = kTimeout;
+      else if (op.transmit)
+        status = radio_.Transmit(op.tx_buffer);
+      else
+        status = radio_.Receive(op.rx_buffer);
+      // The blocking receive has its own window, which may overrun ours; a
+      // frame it caught is still a frame, so that's reported as is
+
+      lock.lock();
+      finished_ = op;
+      finished_status_ = status;
+      eventfd_write(event_fd_, 1);
+    }
+  }
+
+  RadioInterface &radio_;
+  int event_fd_;
+  std::thread thread_{};
+
+  std::mutex lock_{};
+  std::condition_variable wake_{};
+  bool stop_{false};
+  // From submission until the completion has been dispatched
+  bool busy_{false};
+  std::optional<Operation> pending_{};
+  std::optional<Operation> finished_{};
+  Status finished_status_{kSuccess};
+};
+
+RadioInterface::RadioInterface() = default;
+
+// Out of line so that AsyncWorker is complete here. A radio which used the
+// default async operations must be idle by the time its derived destructor
+// has run, since the worker calls back into Transmit/Receive.
+RadioInterface::~RadioInterface() = default;
+
+RadioInterface::AsyncWorker &RadioInterface::Worker() {
+  // Started lazily so that radios which never go async never pay for a thread
+  if (!worker_) worker_ = std::make_unique<AsyncWorker>(*this);
+  return *worker_;
+}
+
+RadioInterface::Status
+RadioInterface::TransmitStaged(std::span<uint8_t> staged) {
+  assert(staged.size() > kFrameHeadroomBytes);
+  return Transmit(staged.subspan(kFrameHeadroomBytes));
+}
+
+RadioInterface::Status
+RadioInterface::ReceiveWithin(std::span<uint8_t> buffer_out, Duration) {
+  return Receive(buffer_out);
+}
+
+std::optional<Duration> RadioInterface::TimeOnAir(size_t) const {
+  return {};
+}
+
+bool RadioInterface::SetWakeUpInterval(Duration) { return false; }
+
+void RadioInterface::Sleep() {}
+
+RadioInterface::Status RadioInterface::DetectActivity() {
+  return Status::kUnspecifiedError;
+}
+
+std::optional<int8_t> RadioInterface::SetTransmitPower(int8_t) { return {}; }
+
+std::optional<float> RadioInterface::LastLinkMarginDb() const { return {}; }
+
+std::optional<TimePoint> RadioInterface::LastOperationLive() const {
+  return {};
+}
+
+std::optional<Duration> RadioInterface::WakeUpTime() const { return {}; }
+
+void RadioInterface::Wake() {}
+
+bool RadioInterface::IdleUntil(TimePoint t) {
+  const auto wake_up = WakeUpTime();
+  if (!wake_up)
+    return false;
+  // Twice the lateness we've seen, since the next wake-up may be later still
+  const TimePoint wake_at = t - *wake_up - 2 * wake_latency_;
+  const TimePoint asleep_at = Now();
+  if (wake_at - asleep_at < kMinRadioSleep)
+    return false;
+
+  Sleep();
+  std::this_thread::sleep_until(wake_at);
+  Wake();
+  // After Wake, so that its own time counts towards the lateness
+  const TimePoint awake_at = Now();
+  Metrics::Default().Count(Counter::kRadioSleepNs, awake_at - asleep_at);
+
+  const Duration late = awake_at - wake_at;
+  if (late > wake_latency_)
+    wake_latency_ = late;
+  else
+    wake_latency_ -= (wake_latency_ - late) / kWakeLatencyDecay;
+  return true;
+}
+
+bool RadioInterface::SubmitTransmitStaged(std::span<uint8_t> staged,
+                                          TimePoint deadline,
+                                          Completion done) {
+  assert(staged.size() > kFrameHeadroomBytes);
+  return SubmitTransmit(staged.subspan(kFrameHeadroomBytes), deadline, done);
+}
+
+bool RadioInterface::SubmitTransmit(std::span<uint8_t const> buffer,
+                                    TimePoint deadline, Completion done) {
+  assert(done.func);
+  return Worker().Submit({.transmit = true,
+                          .tx_buffer = buffer,
+                          .rx_buffer = {},
+                          .deadline = deadline,
+                          .done = done});
+}
+
+bool RadioInterface::SubmitReceive(std::span<uint8_t> buffer_out,
+                                   TimePoint deadline, Completion done) {
+  assert(done.func);
+  return Worker().Submit({.transmit = false,
+                          .tx_buffer = {},
+                          .rx_buffer = buffer_out,
+                          .deadline = deadline,
+                          .done = done});
+}
+
+int RadioInterface::CompletionFd() { return Worker().fd(); }
+
+size_t RadioInterface::DispatchCompletions() { return Worker().Dispatch(); }
+
+bool RadioInterface::WaitForCompletion(TimePoint deadline) {
+  using std::chrono::ceil;
+  using std::chrono::milliseconds;
+
+  pollfd pfd{.fd = CompletionFd(), .events = POLLIN, .revents = 0};
+  while (true) {
+    if (size_t dispatched = DispatchCompletions()) return dispatched;
+    auto remaining = ceil<milliseconds>(deadline - Now()).count();
+    if (remaining <= 0) return false;
+    if (poll(&pfd, 1, remaining) < 0 && errno != EINTR) {
+      perror("RadioInterface: poll failed");
+      return false;
+    }
+  }
+}
+
+} // namespace lora_chat
@@ -1,14 +1,23 @@
 #pragma once
 
+#include <memory>
+#include <optional>
 #include <span>
 
 #include <cstdint>
 
+#include "time.hpp"
+
 namespace lora_chat {
 
+/// Bytes kept free in front of a staged frame, for radios to put their own
+/// framing in without copying the frame (the SX1276's FIFO address byte)
+constexpr size_t kFrameHeadroomBytes = 1;
+
 class RadioInterface {
 public:
-  virtual ~RadioInterface() = default;
+  RadioInterface();
+  virtual ~RadioInterface();
 
   enum Status {
     kSuccess,
@@ -21,8 +30,128 @@ public:
 
   virtual Status Transmit(std::span<uint8_t const> buffer) = 0;
   virtual Status Receive(std::span<uint8_t> buffer_out) = 0;
+  /// Receive, listening for no longer than `window`, for callers which know
+  /// the frames they expect are shorter than the longest the radio allows
+  /// for. A frame still coming in when the window closes is lost. The
+  /// default just receives as usual.
+  virtual Status ReceiveWithin(std::span<uint8_t> buffer_out, Duration window);
+
+  // Staged transmits: `staged` is kFrameHeadroomBytes of scratch space the
+  // radio may overwrite, followed by the frame. Radios which can make use of
+  // the headroom save a copy on the way out; the defaults just send the frame.
+  virtual Status TransmitStaged(std::span<uint8_t> staged);
 
   virtual size_t MaximumMessageLength() const = 0;
+
+  /// How long a frame of `frame_bytes` spends on air, for radios which can
+  /// work it out. The default doesn't know.
+  virtual std::optional<Duration> TimeOnAir(size_t frame_bytes) const;
+
+  // Low-power listening, for radios which can check the channel for a frame
+  // far more cheaply than they can receive one. The defaults can't.
+
+  /// Stretches the preamble of frames sent and received from here on to last
+  /// longer than `interval`, so that a listener checking once per `interval`
+  /// can't miss one; zero goes back to the usual. Returns whether it could.
+  virtual bool SetWakeUpInterval(Duration interval);
+  /// Puts the radio in its lowest-power state, until the next operation
+  virtual void Sleep();
+  /// Checks briefly for a frame on the air: kSuccess if there's one, kTimeout
+  /// if not, kUnspecifiedError if the radio can't tell
+  virtual Status DetectActivity();
+
+  // Transmit power control, for radios which can change power frame to frame.
+  // The defaults can't.
+
+  /// Sends frames from here on at `dbm`, or as near to it as the radio goes.
+  /// Returns the power it's set to, or nullopt if it can't be set.
+  virtual std::optional<int8_t> SetTransmitPower(int8_t dbm);
+  /// How far above the demodulator's SNR floor the last frame received came
+  /// in, in dB, or nullopt if the radio can't tell
+  virtual std::optional<float> LastLinkMarginDb() const;
+
+  /// When the last blocking Transmit or Receive actually had the radio on air
+  /// or listening, counting the chip's own wake-up after it was told to: how
+  /// late that was against when it was wanted is the turnaround the guard
+  /// times have to cover (see GuardTimeCalibrator). nullopt if the radio
+  /// can't tell, as the default can't.
+  virtual std::optional<TimePoint> LastOperationLive() const;
+
+  // Sleep between operations, for radios which draw much less asleep than
+  // idle and can be woken ahead of the next operation. The defaults can't.
+
+  /// How long after Wake the radio is ready for an operation, or nullopt if
+  /// it can't be put to sleep between operations
+  virtual std::optional<Duration> WakeUpTime() const;
+  /// Brings the radio out of Sleep, with its settings as they were
+  virtual void Wake();
+
+  /// Idles the radio, and the calling thread, until shortly before `t`:
+  /// asleep, if there's long enough to be worth it, and woken early by
+  /// WakeUpTime and then by as much again as the thread has lately been late
+  /// waking up, so that the radio is ready at `t`. The caller waits out what's
+  /// left. Returns whether the radio slept.
+  bool IdleUntil(TimePoint t);
+
+  // Non-blocking operations. The radio is half-duplex, so at most one may be
+  // in flight at a time; it stays in flight until its completion has been
+  // dispatched. Completions are only ever run from DispatchCompletions (and
+  // so from WaitForCompletion), on the caller's thread, so that the callback
+  // needs no locking against the code that submitted the operation.
+  //
+  // The default implementations run the blocking Transmit/Receive on a
+  // background thread; radios which can do better (e.g. by arming a timer
+  // for the airtime) should override all four.
+
+  using CompletionFunc = void (*)(void *ctx, Status status);
+  struct Completion {
+    CompletionFunc func;
+    void *ctx;
+  };
+
+  /// Begins transmitting `buffer`, which must stay valid until completion.
+  /// Completes with kTimeout, without transmitting, if the transmission can't
+  /// begin before `deadline`.
+  /// Returns false (and will not complete) if an operation is in flight.
+  virtual bool SubmitTransmit(std::span<uint8_t const> buffer,
+                              TimePoint deadline, Completion done);
+  /// SubmitTransmit, for a staged frame (see TransmitStaged)
+  virtual bool SubmitTransmitStaged(std::span<uint8_t> staged,
+                                    TimePoint deadline, Completion done);
+  /// Begins receiving into `buffer_out`, which must stay valid until
+  /// completion. Completes with kTimeout if the receive can't begin before
+  /// `deadline`; otherwise the window closes at `deadline` at the latest,
+  /// except under the default implementation, where it's the blocking
+  /// Receive's own window. A frame is reported with kSuccess either way.
+  /// Returns false (and will not complete) if an operation is in flight.
+  virtual bool SubmitReceive(std::span<uint8_t> buffer_out, TimePoint deadline,
+                             Completion done);
+
+  /// Readable whenever DispatchCompletions has something to dispatch, for
+  /// use with poll/epoll. Owned by the radio.
+  virtual int CompletionFd();
+  /// Runs the callback of a finished operation, if there is one, without
+  /// blocking. Returns the number of callbacks run.
+  virtual size_t DispatchCompletions();
+
+  /// Blocks until an operation finishes or `deadline` passes, then dispatches
+  /// it. Returns whether anything was dispatched.
+  bool WaitForCompletion(TimePoint deadline);
+
+private:
+  class AsyncWorker;
+  AsyncWorker &Worker();
+
+  // Idle stretches shorter than this, past the wake-up, aren't slept through
+  static constexpr Duration kMinRadioSleep{std::chrono::milliseconds(5)};
+  // Each wake-up on time counts for this fraction of the way back down
+  static constexpr int kWakeLatencyDecay = 16;
+
+  std::unique_ptr<AsyncWorker> worker_;
+  // How late the thread has lately come out of IdleUntil's sleep, counting
+  // the Wake call itself: the worst seen, easing back down as wake-ups come
+  // in on time
+  Duration wake_latency_{std::chrono::milliseconds(1)};
 };
 
 } // namespace lora_chat
@@ -0,0 +1,201 @@
+#include "radio_interface.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include <poll.h>
+
+#include "session.hpp"
+#include "test_utils.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using namespace lora_chat::testutils;
+using Status = lora_chat::RadioInterface::Status;
+
+struct Outcome {
+  std::optional<Status> status{};
+  int calls{0};
+};
+
+void Record(void *ctx, Status status) {
+  auto *outcome = static_cast<Outcome *>(ctx);
+  outcome->status = status;
+  outcome->calls++;
+}
+
+lora_chat::TimePoint In(std::chrono::milliseconds ms) {
+  return lora_chat::Now() + ms;
+}
+
+TEST(AsyncRadio, ReceiveOverlapsTransmit) {
+  LocalRadio radio{std::chrono::milliseconds(50)};
+  const std::array<uint8_t, 4> sent{1, 2, 3, 4};
+  std::array<uint8_t, 1 << 10> received{};
+
+  // The receive is in flight while this thread goes on to transmit into it,
+  // which would deadlock with the blocking interface alone
+  Outcome rx{};
+  ASSERT_TRUE(radio.SubmitReceive(received, In(std::chrono::seconds(1)),
+                                  {Record, &rx}));
+  EXPECT_EQ(radio.Transmit(sent), Status::kSuccess);
+
+  EXPECT_TRUE(radio.WaitForCompletion(In(std::chrono::seconds(1))));
+  EXPECT_EQ(rx.calls, 1);
+  EXPECT_EQ(rx.status, Status::kSuccess);
+  EXPECT_TRUE(std::equal(sent.begin(), sent.end(), received.begin()));
+}
+
+TEST(AsyncRadio, OneOperationAtATime) {
+  CountingRadio radio{std::chrono::milliseconds(20)};
+  std::array<uint8_t, 8> buffer{};
+
+  Outcome tx{};
+  Outcome rx{};
+  ASSERT_TRUE(radio.SubmitTransmit(buffer, In(std::chrono::seconds(1)),
+                                   {Record, &tx}));
+  EXPECT_FALSE(radio.SubmitReceive(buffer, In(std::chrono::seconds(1)),
+                                   {Record, &rx}));
+
+  // Still busy after finishing, until the completion has been dispatched
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  EXPECT_FALSE(radio.SubmitReceive(buffer, In(std::chrono::seconds(1)),
+                                   {Record, &rx}));
+  EXPECT_EQ(tx.calls, 0);
+
+  EXPECT_EQ(radio.DispatchCompletions(), 1u);
+  EXPECT_EQ(tx.status, Status::kSuccess);
+  EXPECT_EQ(radio.DispatchCompletions(), 0u);
+
+  ASSERT_TRUE(radio.SubmitReceive(buffer, In(std::chrono::seconds(1)),
+                                  {Record, &rx}));
+  EXPECT_TRUE(radio.WaitForCompletion(In(std::chrono::seconds(1))));
+  EXPECT_EQ(rx.status, Status::kSuccess);
+  EXPECT_EQ(tx.calls, 1);
+  EXPECT_EQ(rx.calls, 1);
+  EXPECT_EQ(radio.GetAndClearObservedActions(), (std::pair{1, 1}));
+}
+
+TEST(AsyncRadio, ExpiredDeadline) {
+  CountingRadio radio{};
+  std::array<uint8_t, 8> buffer{};
+
+  Outcome tx{};
+  ASSERT_TRUE(radio.SubmitTransmit(buffer, lora_chat::Now(), {Record, &tx}));
+  EXPECT_TRUE(radio.WaitForCompletion(In(std::chrono::seconds(1))));
+  EXPECT_EQ(tx.status, Status::kTimeout);
+  // Never reached the radio
+  EXPECT_EQ(radio.GetAndClearObservedActions(), (std::pair{0, 0}));
+}
+
+TEST(AsyncRadio, FrameReceivedPastTheDeadline) {
+  // The blocking receive outlasts the deadline, but still catches a frame
+  CountingRadio radio{std::chrono::milliseconds(20)};
+  std::array<uint8_t, 8> buffer{};
+
+  Outcome rx{};
+  ASSERT_TRUE(radio.SubmitReceive(buffer, In(std::chrono::milliseconds(5)),
+                                  {Record, &rx}));
+  EXPECT_TRUE(radio.WaitForCompletion(In(std::chrono::seconds(1))));
+  EXPECT_EQ(rx.status, Status::kSuccess);
+}
+
+TEST(AsyncRadio, PollableCompletionFd) {
+  CountingRadio radio{std::chrono::milliseconds(20)};
+  std::array<uint8_t, 8> buffer{};
+
+  Outcome tx{};
+  ASSERT_TRUE(radio.SubmitTransmit(buffer, In(std::chrono::seconds(1)),
+                                   {Record, &tx}));
+  pollfd pfd{.fd = radio.CompletionFd(), .events = POLLIN, .revents = 0};
+  EXPECT_EQ(poll(&pfd, 1, 0), 0) << "readable while still in the air";
+  EXPECT_EQ(poll(&pfd, 1, 1000), 1);
+  EXPECT_EQ(tx.calls, 0);
+  EXPECT_EQ(radio.DispatchCompletions(), 1u);
+  EXPECT_EQ(tx.calls, 1);
+  EXPECT_EQ(poll(&pfd, 1, 0), 0);
+}
+
+TEST(AsyncRadio, WaitTimesOut) {
+  CountingRadio radio{std::chrono::milliseconds(200)};
+  std::array<uint8_t, 8> buffer{};
+
+  Outcome tx{};
+  ASSERT_TRUE(radio.SubmitTransmit(buffer, In(std::chrono::seconds(1)),
+                                   {Record, &tx}));
+  EXPECT_FALSE(radio.WaitForCompletion(In(std::chrono::milliseconds(20))));
+  EXPECT_EQ(tx.calls, 0);
+  EXPECT_TRUE(radio.WaitForCompletion(In(std::chrono::seconds(1))));
+  EXPECT_EQ(tx.calls, 1);
+}
+
+// A radio which is quick to wake, and which notes anything asked of it while
+// asleep
+class DozingRadio : public CountingRadio {
+public:
+  DozingRadio() : CountingRadio(std::chrono::milliseconds(1)) {}
+
+  std::optional<lora_chat::Duration> WakeUpTime() const override {
+    return std::chrono::microseconds(500);
+  }
+  void Sleep() override {
+    asleep = true;
+    sleeps++;
+  }
+  void Wake() override { asleep = false; }
+  Status Transmit(std::span<uint8_t const> buffer) override {
+    woken_too_late += asleep;
+    return CountingRadio::Transmit(buffer);
+  }
+  Status Receive(std::span<uint8_t> buffer_out) override {
+    woken_too_late += asleep;
+    return CountingRadio::Receive(buffer_out);
+  }
+
+  bool asleep{false};
+  int sleeps{0};
+  int woken_too_late{0};
+};
+
+TEST(RadioSleep, OnlyWithTimeToWakeUp) {
+  CountingRadio plain{};
+  EXPECT_FALSE(plain.IdleUntil(In(std::chrono::milliseconds(50))));
+
+  DozingRadio radio{};
+  EXPECT_FALSE(radio.IdleUntil(In(std::chrono::milliseconds(2))));
+  EXPECT_EQ(radio.sleeps, 0);
+
+  for (int i = 0; i < 3; i++) {
+    const auto due = In(std::chrono::milliseconds(30));
+    EXPECT_TRUE(radio.IdleUntil(due));
+    EXPECT_FALSE(radio.asleep);
+    EXPECT_LT(lora_chat::Now(), due);
+  }
+  EXPECT_EQ(radio.sleeps, 3);
+}
+
+TEST(RadioSleep, SessionSleepsThroughItsGaps) {
+  using lora_chat::AgentAction;
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(30);
+
+  DozingRadio radio{};
+  lora_chat::MessagePipe pipe{};
+  lora_chat::Session session{In(std::chrono::milliseconds(20)), 0,
+                             kTransmitTime, kGapTime, true};
+  session.SleepUntilStartTime(&radio);
+  EXPECT_EQ(radio.sleeps, 1);
+  for (int i = 0; i < 6; i++)
+    session.ExecuteCurrentAction(radio, pipe);
+  // Every gap slept through, and the radio up again for every window
+  EXPECT_GE(radio.sleeps, 6);
+  EXPECT_EQ(radio.woken_too_late, 0);
+  EXPECT_EQ(radio.GetAndClearObservedActions(), (std::pair{3, 3}));
+}
+
+} // namespace
@@ -1,5 +1,6 @@
 #include "session.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -9,17 +10,54 @@
 #include <unistd.h>
 
 #include "clock.hpp"
+#include "metrics.hpp"
 #include "sequence_number.hpp"
 #include "wire_packet.hpp"
 
 namespace lora_chat {
 
-std::optional<SessionPacketPayload> MessagePipe::GetNextMessageToSend() {
-  return get_msg_();
+PacketRef MessagePipe::GetNextFrameToSend(PacketBufferPool &pool) {
+  if (get_frame_)
+    return get_frame_();
+  // Acquired first, so that the message isn't taken only to be dropped
+  PacketRef frame = pool.Acquire();
+  if (!frame)
+    return {};
+  auto message = get_msg_();
+  if (!message)
+    return {};
+  std::memcpy(frame->SessionPayload().data(), message->data(),
+              message->size());
+  return frame;
 }
-void MessagePipe::DepositReceivedMessage(SessionPacketPayload &&message) {
+void MessagePipe::DepositReceivedFrame(PacketRef &&frame) {
+  if (recv_frame_) {
+    if (frame)
+      recv_frame_(std::move(frame));
+    return;
+  }
+  SessionPacketPayload message{};
+  if (frame)
+    std::memcpy(message.data(), frame->SessionPayload().data(),
+                message.size());
+  frame.Reset();
   return recv_msg_(std::move(message));
 }
+void MessagePipe::NotifySessionEstablished(WireAddress peer) {
+  return session_established_(peer);
+}
+void MessagePipe::NotifyDelivered(DeliveryReceipt const &receipt) {
+  if (on_receipt_)
+    on_receipt_(receipt);
+}
+void MessagePipe::NotifyAcknowledged() {
+  if (on_acknowledged_)
+    on_acknowledged_();
+}
+void MessagePipe::NotifySessionEnded() {
+  if (on_session_ended_)
+    on_session_ended_();
+}
 
 Duration Session::SessionClock::ElapsedTimeInPeriod(TimePoint t) const {
   return (t - start_time()) % TransmissionPeriod();
@@ -54,10 +92,23 @@ TimePoint Session::SessionClock::TimeOfNextActionImpl(TimePoint t) const {
   return t0 + TransmissionPeriod();
 }
 
+TimePoint Session::SessionClock::StartOfActionAt(TimePoint t) const {
+  const auto elapsed{ElapsedTimeInPeriod(t)};
+  const auto t0 = t - elapsed;
+  if (elapsed < transmission_duration_)
+    return t0;
+  else if (elapsed < transmission_duration_ + gap_duration_)
+    return t0 + transmission_duration_;
+  else if (elapsed < (transmission_duration_ * 2) + gap_duration_)
+    return t0 + transmission_duration_ + gap_duration_;
+  return t0 + (transmission_duration_ * 2) + gap_duration_;
+}
+
 Session::Session(TimePoint start_time, Session::Id id,
                  Duration transmission_duration, Duration gap_duration,
-                 bool we_initiated)
+                 bool we_initiated, PacketBufferPool &pool)
     : id_(id), clock_(start_time, transmission_duration, gap_duration),
+      pool_(&pool),
       last_acked_sent_sn_(InitFictitiousLastAckedSentSn(we_initiated)),
       last_sent_packet_{.id = id_,
                         .length = 0,
@@ -68,6 +119,94 @@ Session::Session(TimePoint start_time, Session::Id id,
   // or insufficiently far in the future?
 }
 
+Session::Session(State const &state, PacketBufferPool &pool)
+    : id_(state.id),
+      clock_(state.start_time, state.transmission_duration,
+             state.gap_duration),
+      pool_(&pool), last_recv_sn_(state.last_recv_sn),
+      last_acked_sent_sn_(state.last_acked_sent_sn),
+      received_good_packet_in_last_receive_sequence_(
+          state.received_good_packet_in_last_receive_sequence),
+      last_sent_packet_(state.last_sent_packet),
+      outgoing_offset_(state.outgoing_offset),
+      incoming_offset_(state.incoming_offset),
+      frame_sizer_(state.frame_sizer),
+      awaiting_outcome_(state.awaiting_outcome),
+      turnaround_(state.turnaround), timeout_counter_(state.timeout_counter),
+      session_complete_(state.session_complete),
+      messages_sent_(state.messages_sent),
+      messages_delivered_(state.messages_delivered),
+      incoming_wants_receipt_(state.incoming_wants_receipt),
+      awaited_receipts_(state.awaited_receipts),
+      pending_receipts_(state.pending_receipts),
+      pending_receipt_count_(state.pending_receipt_count),
+      we_initiated_(state.we_initiated) {
+  // Out of buffers, a frame is as good as lost: a missing last-sent frame is
+  // re-serialized (without its payload) if it's asked for again
+  if (state.has_last_sent_frame && (last_sent_frame_ = pool_->Acquire()))
+    last_sent_frame_->bytes = state.last_sent_frame;
+  if (state.has_last_recv_frame && (last_recv_frame_ = pool_->Acquire()))
+    last_recv_frame_->bytes = state.last_recv_frame;
+  // As with the frames, a partial message without a buffer to go in is lost
+  if (state.has_outgoing_message && (outgoing_message_ = pool_->Acquire()))
+    std::memcpy(outgoing_message_->SessionPayload().data(),
+                state.outgoing_message.data(), kSessionPacketPayloadBytes);
+  else
+    outgoing_offset_ = 0;
+  if (state.has_incoming_message && (incoming_message_ = pool_->Acquire()))
+    std::memcpy(incoming_message_->SessionPayload().data(),
+                state.incoming_message.data(), kSessionPacketPayloadBytes);
+}
+
+Session::State Session::SaveState() const {
+  State state{
+      .id = id_,
+      .start_time = clock_.start_time(),
+      .transmission_duration = clock_.transmission_duration(),
+      .gap_duration = clock_.gap_duration(),
+      .we_initiated = we_initiated_,
+      .last_recv_sn = last_recv_sn_,
+      .last_acked_sent_sn = last_acked_sent_sn_,
+      .received_good_packet_in_last_receive_sequence =
+          received_good_packet_in_last_receive_sequence_,
+      .last_sent_packet = last_sent_packet_,
+      .has_last_sent_frame = static_cast<bool>(last_sent_frame_),
+      .last_sent_frame = {},
+      .has_last_recv_frame = static_cast<bool>(last_recv_frame_),
+      .last_recv_frame = {},
+      .timeout_counter = timeout_counter_,
+      .session_complete = session_complete_,
+      .messages_sent = messages_sent_,
+      .has_outgoing_message = static_cast<bool>(outgoing_message_),
+      .outgoing_message = {},
+      .outgoing_offset = static_cast<uint8_t>(outgoing_offset_),
+      .has_incoming_message = static_cast<bool>(incoming_message_),
+      .incoming_message = {},
+      .incoming_offset = static_cast<uint8_t>(incoming_offset_),
+      .frame_sizer = frame_sizer_,
+      .awaiting_outcome = awaiting_outcome_,
+      .messages_delivered = messages_delivered_,
+      .incoming_wants_receipt = incoming_wants_receipt_,
+      .awaited_receipts = awaited_receipts_,
+      .pending_receipts = pending_receipts_,
+      .pending_receipt_count = pending_receipt_count_,
+      .turnaround = turnaround_,
+  };
+  if (last_sent_frame_)
+    state.last_sent_frame = last_sent_frame_->bytes;
+  if (last_recv_frame_)
+    state.last_recv_frame = last_recv_frame_->bytes;
+  if (outgoing_message_)
+    std::memcpy(state.outgoing_message.data(),
+                outgoing_message_->SessionPayload().data(),
+                kSessionPacketPayloadBytes);
+  if (incoming_message_)
+    std::memcpy(state.incoming_message.data(),
+                incoming_message_->SessionPayload().data(),
+                kSessionPacketPayloadBytes);
+  return state;
+}
+
 SequenceNumber Session::InitFictitiousLastAckedSentSn(bool we_initiated) {
   return SequenceNumber(we_initiated ? SequenceNumber::kMaximumValue
                                      : SequenceNumber::kMaximumValue - 1);
@@ -77,41 +216,170 @@ SequenceNumber Session::InitFictitiousPrevSentNesn(bool we_initiated) {
   return SequenceNumber(we_initiated ? SequenceNumber::kMaximumValue : 0);
 }
 
-AgentAction Session::WhatToDoRightNow() const {
-  return WhatToDoIgnoringCurrentTime(LocalizeActionKind(clock_.ActionKind()));
+AgentAction Session::WhatToDoAt(TimePoint t) const {
+  return WhatToDoIgnoringCurrentTime(LocalizeActionKind(clock_.ActionKind(t)));
 }
 
 AgentAction Session::ExecuteCurrentAction(RadioInterface &radio,
                                           MessagePipe &pipe) {
-  auto action = WhatToDoRightNow();
+  PacketRef frame{};
+  // When this window began, as far as both ends are concerned
+  const auto now = Now();
+  const bool chained = Chained();
+  const TimePoint start = chained ? chain_next_ : clock_.StartOfActionAt(now);
+  const AgentAction action =
+      chained ? PrepareAction(WhatToDoIgnoringCurrentTime(
+                                  chain_transmit_
+                                      ? TransmissionState::kTransmitting
+                                      : TransmissionState::kReceiving),
+                              now - start, pipe, frame)
+              : PrepareCurrentAction(pipe, frame);
+  // Until a frame of ours is known to be going out or coming in
+  chain_next_ = {};
+  std::optional<Duration> airtime{};
+
+  switch (action) {
+  case AgentAction::kReceive: {
+    frame = pool_->Acquire();
+    // Cleared, so that stale bytes can't pass for a received packet
+    if (frame)
+      frame->bytes = {};
+    // Self-clocked, the longest frame the peer could send is over by the time
+    // we're due to answer it, so there's no listening past that: half the
+    // turnaround goes to the peer starting late, half to our answering. A
+    // radio which would otherwise wait out a frame as long as it can take
+    // would hold the chain up.
+    // TODO enforce timeout on the grid according to how long we're supposed
+    // to receive for
+    const auto longest = turnaround_ > Duration::zero()
+                             ? radio.TimeOnAir(kMaxSessionFrameBytes)
+                             : std::nullopt;
+    auto status =
+        !frame    ? RadioInterface::Status::kUnspecifiedError
+        : longest ? radio.ReceiveWithin(frame->bytes.span(),
+                                        start + *longest + turnaround_ / 2 -
+                                            Now())
+                  : radio.Receive(frame->bytes.span());
+    if (frame)
+      RecordTurnaround(radio, GuardTimeCalibrator::Switch::kToReceive, start,
+                       chained);
+    if (CompleteReceive(status, std::move(frame), pipe))
+      airtime = longest;
+    chain_transmit_ = true;
+    break;
+  }
+  case AgentAction::kTransmitNextMessage:
+  case AgentAction::kTransmitNack:
+  case AgentAction::kRetransmitMessage:
+    radio.TransmitStaged(frame->StagedSessionFrame());
+    RecordTurnaround(radio, GuardTimeCalibrator::Switch::kToTransmit, start,
+                     chained);
+    if (turnaround_ > Duration::zero())
+      airtime = radio.TimeOnAir(kMaxSessionFrameBytes);
+    chain_transmit_ = false;
+    break;
+  case AgentAction::kTerminateSession:
+  case AgentAction::kSleepUntilNextAction:
+  case AgentAction::kSessionComplete:
+    break;
+  }
+
+  if (!airtime)
+    return SleepThroughNextGapTime(radio);
+  // The reply (or our answer to it) goes out a turnaround after the longest
+  // frame would be done, whatever this one's length, which both ends can work
+  // out alike; or as soon as the radio is, if it held on past that (one which
+  // can't cut a receive short may wait out its whole timeout), since the
+  // schedule would otherwise fall further behind with every one
+  chain_next_ = std::max(start + *airtime + turnaround_, Now());
+  const AgentAction next = WhatToDoIgnoringCurrentTime(
+      chain_transmit_ ? TransmissionState::kTransmitting
+                      : TransmissionState::kReceiving);
+  SleepUntil(chain_next_, &radio);
+  return next;
+}
+
+void Session::RecordTurnaround(RadioInterface const &radio,
+                               GuardTimeCalibrator::Switch kind,
+                               TimePoint start, bool chained) const {
+  if (!calibrator_)
+    return;
+  // A chained window lasts as long as its frame, which the grid's gaps don't
+  // have to allow for
+  if (!chained)
+    calibrator_->RecordOverrun(
+        kind, Now() - (start + clock_.transmission_duration()));
+  // Anything from before the window began is left over from an earlier one
+  auto live = radio.LastOperationLive();
+  if (live && *live >= start)
+    calibrator_->Record(kind, *live - start);
+}
+
+AgentAction Session::PrepareCurrentAction(MessagePipe &pipe,
+                                          PacketRef &frame) {
+  return PrepareActionAt(Now(), pipe, frame);
+}
+
+AgentAction Session::PrepareActionAt(TimePoint t, MessagePipe &pipe,
+                                     PacketRef &frame) {
+  return PrepareAction(WhatToDoAt(t), t - clock_.StartOfActionAt(t), pipe,
+                       frame);
+}
+
+AgentAction Session::PrepareAction(AgentAction action, Duration lateness,
+                                   MessagePipe &pipe, PacketRef &frame) {
+  bool prepared = true;
+  // Radio actions are meant to begin right at the start of their window
+  if (action != AgentAction::kSleepUntilNextAction &&
+      action != AgentAction::kTerminateSession &&
+      action != AgentAction::kSessionComplete)
+    Metrics::Default().RecordSlotError(lateness);
   switch (action) {
   case AgentAction::kReceive:
-    ReceiveMessage(radio, pipe);
     break;
   case AgentAction::kTransmitNextMessage:
-    TransmitNextMessage(radio, pipe);
+    prepared = PrepareNextMessage(pipe, frame);
     break;
   case AgentAction::kTransmitNack:
-    TransmitNack(radio, pipe);
+    prepared = PrepareNack(frame);
     break;
   case AgentAction::kRetransmitMessage:
-    RetransmitMessage(radio, pipe);
+    prepared = PrepareRetransmission(frame);
     break;
   case AgentAction::kTerminateSession:
-    TerminateSession(radio, pipe);
+    TerminateSession();
     break;
   case AgentAction::kSleepUntilNextAction:
   case AgentAction::kSessionComplete:
     break;
   }
-  return SleepThroughNextGapTime();
+  // What we hear between now and our next transmission decides what that
+  // is. Cleared here rather than when the receive starts, so that a receive
+  // window we were too late for counts as hearing nothing, and gets a NACK
+  // rather than a retransmission the peer can't make sense of.
+  if (action == AgentAction::kTransmitNextMessage ||
+      action == AgentAction::kTransmitNack ||
+      action == AgentAction::kRetransmitMessage)
+    received_good_packet_in_last_receive_sequence_ = false;
+  // Out of buffers, so we sit this one out as though the frame were lost
+  return prepared ? action : AgentAction::kSleepUntilNextAction;
 }
 
-AgentAction Session::SleepThroughNextGapTime() const {
+TimePoint Session::TimeOfNextActiveAction() const {
   TimePoint wake_time = clock_.TimeOfNextAction();
   if (LocalizeActionKind(clock_.ActionKind(wake_time)) ==
       TransmissionState::kInactive)
     wake_time = clock_.TimeOfNextAction(clock_.TimeOfNextAction());
+  return wake_time;
+}
+
+void Session::ScheduleNextAction(TimerWheel &wheel,
+                                 TimerWheel::Timer &timer) const {
+  wheel.Schedule(timer, TimeOfNextActiveAction());
+}
+
+AgentAction Session::SleepThroughNextGapTime(RadioInterface &radio) const {
+  TimePoint wake_time = TimeOfNextActiveAction();
 
   // Pre-compute what action we'll be doing once we're done sleeping,
   // to save time once we wake up
@@ -120,13 +388,27 @@ AgentAction Session::SleepThroughNextGapTime() const {
   // The action should not be 'sleep more': if that's the case, we should just
   // sleep for a longer duration
   assert(action != AgentAction::kSleepUntilNextAction);
-  SleepUntil(wake_time);
+  SleepUntil(wake_time, &radio);
   return action;
 }
 
-void Session::SleepUntilStartTime() const { SleepUntil(clock_.start_time()); }
+void Session::SleepUntilStartTime(RadioInterface *radio) const {
+  SleepUntil(clock_.start_time(), radio);
+}
+
+void Session::SleepUntilNextSlot(RadioInterface *radio) {
+  if (Now() < clock_.start_time())
+    return SleepUntilStartTime(radio);
+  if (LocalizeActionKind(clock_.ActionKind()) == TransmissionState::kReceiving)
+    received_good_packet_in_last_receive_sequence_ = false;
+  SleepUntil(TimeOfNextActiveAction(), radio);
+}
+
+bool Session::PrepareNack(PacketRef &frame) {
+  PacketRef nack = pool_->Acquire();
+  if (!nack)
+    return false;
 
-void Session::TransmitNack(RadioInterface &radio, MessagePipe &pipe) {
   SessionPacket p{};
   p.type = SessionPacket::kNack;
   p.nesn = last_recv_sn_ + 1;
@@ -134,103 +416,306 @@ void Session::TransmitNack(RadioInterface &radio, MessagePipe &pipe) {
   p.id = id_;
   p.length = 0;
 
-  auto w_p = Serialize(p);
+  SerializeInto(p, nack->bytes.span());
   if constexpr (kLogLevel > kNone)
-    LogForPacket(p, w_p, "Transmitted NACK");
-  radio.Transmit(w_p);
+    LogForPacket(p, *nack, "Transmitted NACK");
+  frame = std::move(nack);
   timeout_counter_++;
+  Metrics::Default().Count(Counter::kNacksSent);
+  return true;
 }
 
-void Session::TransmitNextMessage(RadioInterface &radio, MessagePipe &pipe) {
+bool Session::PrepareNextMessage(MessagePipe &pipe, PacketRef &frame) {
+  if (!outgoing_message_) {
+    outgoing_message_ = pipe.GetNextFrameToSend(*pool_);
+    outgoing_offset_ = 0;
+    if (outgoing_message_ && pipe.WantsReceipts())
+      awaited_receipts_[messages_sent_ % kReceiptsTracked] = {
+          .message = static_cast<uint32_t>(messages_sent_),
+          .sent_at = Now(),
+          .awaited = true};
+    if (outgoing_message_)
+      messages_sent_++;
+  }
+  const bool has_message = static_cast<bool>(outgoing_message_);
+  const size_t chunk =
+      has_message ? std::min(frame_sizer_.NextPayloadBytes(),
+                             kSessionPacketPayloadBytes - outgoing_offset_)
+                  : 0;
+  const bool carries_receipt = pending_receipt_count_ > 0;
+
+  PacketRef next{};
+  if (has_message && outgoing_offset_ == 0 &&
+      (chunk == kSessionPacketPayloadBytes || !carries_receipt)) {
+    // The first chunk is the start of the message as it already sits in its
+    // frame, so that frame goes out as is, with the length cutting it short.
+    // Not if a receipt would go after it, on top of the rest of the message.
+    next = outgoing_message_;
+  } else {
+    // Nothing past the length goes on air, so there's nothing to clear
+    next = pool_->Acquire();
+    if (!next)
+      return false; // Any message stays where it is, for next time
+    if (has_message)
+      std::memcpy(next->SessionPayload().data(),
+                  outgoing_message_->SessionPayload().data() + outgoing_offset_,
+                  chunk);
+  }
+
+  uint8_t flags = 0;
+  if (has_message && pipe.WantsReceipts())
+    flags |= SessionPacket::kReceiptRequested;
+  if (carries_receipt)
+    flags |= SessionPacket::kCarriesReceipt;
+
   SessionPacket &p = last_sent_packet_;
-  p.type = SessionPacket::kData;
+  p.type = static_cast<SessionPacket::SubType>(SessionPacket::kData | flags);
   p.nesn = last_recv_sn_ + 1;
   p.sn = last_acked_sent_sn_ + 1;
   p.id = id_;
-
-  auto message = pipe.GetNextMessageToSend();
-  if (message) {
-    p.length = message.value().size();
-    std::memcpy(&p.payload, message.value().data(), message.value().size());
-  } else {
-    p.length = 0;
+  p.length = chunk;
+
+  // The payload is already in place; just fill in the header around it
+  SerializeInto(p, next->bytes.span(),
+                static_cast<size_t>(SessionPacket::Field::kPayload));
+  if (carries_receipt) {
+    // Gone for good once it's on air, bar the retransmissions of this frame
+    PendingReceipt const &r = pending_receipts_[--pending_receipt_count_];
+    auto receipt = next->SessionReceipt();
+    receipt[0] = r.message;
+    receipt[1] = r.delivered_ms >> 8;
+    receipt[2] = r.delivered_ms & 0xff;
   }
-
-  auto w_p = Serialize(p);
   if constexpr (kLogLevel > kNone)
-    LogForPacket(p, w_p, "Transmitted");
-  radio.Transmit(w_p);
+    LogForPacket(p, *next, "Transmitted");
+  last_sent_frame_ = next;
+  frame = std::move(next);
+  awaiting_outcome_ = true;
+  return true;
 }
 
-void Session::ReceiveMessage(RadioInterface &radio, MessagePipe &pipe) {
-  received_good_packet_in_last_receive_sequence_ = false;
-  ReceiveBuffer buff{};
+bool Session::CompleteReceive(RadioInterface::Status status, PacketRef &&frame,
+                              MessagePipe &pipe) {
   // TODO repeat receive until we get the proper session id
-  // TODO enforce timeout according to how long we're supposed to receive for
-  auto status = radio.Receive(buff.span());
-  if (status != RadioInterface::Status::kSuccess) {
+  if (status != RadioInterface::Status::kSuccess || !frame) {
     // TODO do we need to do anything special for bad packets?
-    return;
+    Metrics::Default().Count(Counter::kReceiveFailures);
+    return false;
+  }
+  // Just the header: the payload stays in the frame, which is what gets
+  // handed on
+  auto maybe_p{DeserializeImpl<PacketType::kSession>(
+      {frame->bytes.data(), frame->bytes.size()},
+      static_cast<size_t>(SessionPacket::Field::kPayload))};
+  if (!maybe_p) {
+    Metrics::Default().Count(Counter::kReceiveFailures);
+    return false; // Not a session packet -- TODO handle control packets?
   }
-  auto maybe_p{Deserialize<PacketType::kSession>(buff)};
-  if (!maybe_p)
-    return; // Not a session packet -- TODO handle control packets?
 
   SessionPacket p = maybe_p.value();
   if (p.id != id_)
-    return; // Not for us
+    return false; // Not for us
+  const uint8_t flags = frame->SessionFlags();
+  p.type = static_cast<SessionPacket::SubType>(p.type &
+                                               SessionPacket::kSubTypeMask);
 
   // TODO Also log session packets which were received but not for us??
   if constexpr (kLogLevel > kNone)
-    LogForPacket(p, buff, "Received");
+    LogForPacket(p, *frame, "Received");
 
   received_good_packet_in_last_receive_sequence_ = true;
   timeout_counter_ = 0;
 
   if (p.nesn == static_cast<SequenceNumber>(last_sent_packet_.sn + 1)) {
     last_acked_sent_sn_ = last_sent_packet_.sn;
-
-    if (p.sn == last_recv_sn_) {
-      // For whatever reason, they're retransmitting their last
-      // message -- even though we already received it.
-      // TODO Is this retransmit case legal??
-      last_recv_message_ = std::move(p.payload);
-      // If so, we don't propogate out the old message since it was logically
-      // overridden by the new one with the same SN
-    } else if (p.sn == last_recv_sn_ + 1) {
-      pipe.DepositReceivedMessage(std::move(last_recv_message_));
-      last_recv_message_ = std::move(p.payload);
+    if (awaiting_outcome_) {
+      frame_sizer_.Record(last_sent_packet_.length, true);
+      // That much of the message is through
+      if (outgoing_message_ &&
+          (outgoing_offset_ += last_sent_packet_.length) >=
+              kSessionPacketPayloadBytes) {
+        outgoing_message_.Reset();
+        outgoing_offset_ = 0;
+        Metrics::Default().Count(Counter::kMessagesSent);
+        pipe.NotifyAcknowledged();
+      }
+    }
+    awaiting_outcome_ = false;
+  } else if (p.nesn == last_sent_packet_.sn) {
+    // They're still waiting on our last frame: a NACK, or data they sent
+    // off the back of an ack we got to them without theirs getting to us.
+    // Either way, they want us to retransmit
+    if (awaiting_outcome_)
+      frame_sizer_.Record(last_sent_packet_.length, false);
+    awaiting_outcome_ = false;
+    // And they don't have any of it, so if frames that long have stopped
+    // getting through, the retransmission can carry less of the message:
+    // the rest follows in the frames after it
+    if (outgoing_message_ && last_sent_frame_ &&
+        last_sent_packet_.length > frame_sizer_.PayloadBytes()) {
+      // A receipt after the payload would have to move up over the message,
+      // so it goes back in the queue for a later frame instead
+      if (last_sent_packet_.type & SessionPacket::kCarriesReceipt) {
+        auto receipt = last_sent_frame_->SessionReceipt();
+        if (pending_receipt_count_ < kReceiptsTracked)
+          pending_receipts_[pending_receipt_count_++] = {
+              .message = receipt[0],
+              .delivered_ms = static_cast<uint16_t>(receipt[1] << 8 |
+                                                    receipt[2])};
+        last_sent_packet_.type = static_cast<SessionPacket::SubType>(
+            last_sent_packet_.type & ~SessionPacket::kCarriesReceipt);
+      }
+      last_sent_packet_.length = frame_sizer_.PayloadBytes();
+      SerializeInto(last_sent_packet_, last_sent_frame_->bytes.span(),
+                    static_cast<size_t>(SessionPacket::Field::kPayload));
     }
-    last_recv_sn_ = p.sn;
-  } else if (p.type == SessionPacket::kNack && p.nesn == last_sent_packet_.sn) {
-    // If p.nesn matches but p.type != kNack, it's a reflected/desync'd data msg
-    // If p.type is kNack but p.nesn is something else, same but a nack
-
-    // Do nothing, they want us to retransmit
   } else {
     // Something bad happened!
     assert(false && "Bad protocol state");
+    return false;
   }
+
+  if (flags & SessionPacket::kCarriesReceipt)
+    TakeReceipt(*frame, pipe);
+
+  // NACKs carry no data, and their SN is just the one they last sent, which
+  // we may never have seen; taking it as received would ack data we never got
+  if (p.type == SessionPacket::kNack)
+    return true;
+  if (p.sn == last_recv_sn_) {
+    // For whatever reason, they're retransmitting their last
+    // message -- even though we already received it.
+    // TODO Is this retransmit case legal??
+    last_recv_frame_ = std::move(frame);
+    // If so, we don't propogate out the old message since it was logically
+    // overridden by the new one with the same SN
+  } else if (p.sn == last_recv_sn_ + 1) {
+    DepositFinalFrame(std::move(last_recv_frame_), pipe);
+    last_recv_frame_ = std::move(frame);
+  }
+  last_recv_sn_ = p.sn;
+  return true;
 }
 
-void Session::RetransmitMessage(RadioInterface &radio, MessagePipe &pipe) {
+bool Session::PrepareRetransmission(PacketRef &frame) {
   // TODO how to handle it when they nack our nack?
-  auto w_p = Serialize(last_sent_packet_);
+  // Whatever we've received since, the retransmission acks: left as it was,
+  // they'd take it for a NACK and go on retransmitting too
+  last_sent_packet_.nesn = last_recv_sn_ + 1;
+  if (!last_sent_frame_) {
+    // Nothing sent yet, so there's no payload to keep
+    last_sent_frame_ = pool_->Acquire();
+    if (!last_sent_frame_)
+      return false;
+    // Nor any receipt after it
+    last_sent_packet_.type = static_cast<SessionPacket::SubType>(
+        last_sent_packet_.type & ~SessionPacket::kCarriesReceipt);
+    SerializeInto(last_sent_packet_, last_sent_frame_->bytes.span());
+  } else {
+    SerializeInto(last_sent_packet_, last_sent_frame_->bytes.span(),
+                  static_cast<size_t>(SessionPacket::Field::kPayload));
+  }
   if constexpr (kLogLevel > kNone)
-    LogForPacket(last_sent_packet_, w_p, "Retransmitted");
-  radio.Transmit(w_p);
+    LogForPacket(last_sent_packet_, *last_sent_frame_, "Retransmitted");
+  frame = last_sent_frame_;
+  awaiting_outcome_ = true;
+  Metrics::Default().Count(Counter::kRetransmissions);
+  return true;
+}
+
+void Session::DepositFinalFrame(PacketRef &&frame, MessagePipe &pipe) {
+  const size_t length = frame ? frame->SessionPayloadLength() : 0;
+  const bool wants_receipt =
+      frame && (frame->SessionFlags() & SessionPacket::kReceiptRequested);
+  if (length == 0 ||
+      (length == kSessionPacketPayloadBytes && incoming_offset_ == 0)) {
+    pipe.DepositReceivedFrame(std::move(frame));
+    if (length) {
+      Metrics::Default().Count(Counter::kMessagesReceived);
+      if (wants_receipt)
+        QueueReceipt(messages_delivered_);
+      messages_delivered_++;
+    }
+    return;
+  }
+
+  // A chunk. Out of buffers, its bytes are lost, but are still counted so
+  // that the messages after this one stay aligned.
+  if (!incoming_message_ && incoming_offset_ == 0)
+    incoming_message_ = pool_->Acquire();
+  const size_t n = std::min(length, kSessionPacketPayloadBytes - incoming_offset_);
+  if (incoming_message_)
+    std::memcpy(incoming_message_->SessionPayload().data() + incoming_offset_,
+                frame->SessionPayload().data(), n);
+  frame.Reset();
+  incoming_offset_ += n;
+  incoming_wants_receipt_ |= wants_receipt;
+  if (incoming_offset_ < kSessionPacketPayloadBytes)
+    return;
+  incoming_offset_ = 0;
+  // Numbered whether or not it made it, to stay in step with the peer
+  if (incoming_message_) {
+    Metrics::Default().Count(Counter::kMessagesReceived);
+    pipe.DepositReceivedFrame(std::move(incoming_message_));
+    if (incoming_wants_receipt_)
+      QueueReceipt(messages_delivered_);
+  }
+  messages_delivered_++;
+  incoming_wants_receipt_ = false;
+}
+
+void Session::QueueReceipt(uint64_t message) {
+  if (pending_receipt_count_ >= kReceiptsTracked)
+    return;
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      Now() - clock_.start_time())
+                      .count();
+  pending_receipts_[pending_receipt_count_++] = {
+      .message = static_cast<uint8_t>(message),
+      .delivered_ms = static_cast<uint16_t>(ms)};
+}
+
+void Session::TakeReceipt(PacketBuffer const &frame, MessagePipe &pipe) {
+  auto receipt = frame.SessionReceipt();
+  const uint8_t message = receipt[0];
+  const uint16_t delivered_ms = receipt[1] << 8 | receipt[2];
+  // Retransmissions carry it again, by which time it's no longer awaited
+  AwaitedReceipt &awaited = awaited_receipts_[message % kReceiptsTracked];
+  if (!awaited.awaited || static_cast<uint8_t>(awaited.message) != message)
+    return;
+  awaited.awaited = false;
+
+  // Whenever it was within the last 2^16 ms that matches the low bits
+  using std::chrono::milliseconds;
+  const auto now = Now();
+  const auto now_ms =
+      std::chrono::duration_cast<milliseconds>(now - clock_.start_time())
+          .count();
+  const uint16_t ago_ms = static_cast<uint16_t>(now_ms) - delivered_ms;
+  DeliveryReceipt r{.message = awaited.message,
+                    .sent_at = awaited.sent_at,
+                    .delivered_at = clock_.start_time() +
+                                    milliseconds(now_ms - ago_ms)};
+  Metrics::Default().Count(Counter::kDeliveryReceipts);
+  if (r.delivered_at > r.sent_at)
+    Metrics::Default().Count(Counter::kDeliveryLatencyTotalNs, r.Latency());
+  pipe.NotifyDelivered(r);
 }
 
-void Session::TerminateSession(RadioInterface &, MessagePipe &) {
+void Session::TerminateSession() {
   session_complete_ = true;
   // TODO flush buffers
   // TODO send a termination packet
 }
 
-void Session::SleepUntil(TimePoint t) const {
+void Session::SleepUntil(TimePoint t, RadioInterface *radio) const {
   // May need to be higher depending on the target system
   constexpr Duration kSpinloopThreshold = std::chrono::milliseconds(5);
 
+  // Woken with a little time to spare, which is waited out as usual
+  if (radio)
+    radio->IdleUntil(t);
+
   // TODO strictly we should be switching behavior based on the duration of the
   // event taking place AFTER we wake up
   if (t - std::chrono::steady_clock::now() >= kSpinloopThreshold) {
@@ -243,7 +728,7 @@ void Session::SleepUntil(TimePoint t) const {
 }
 
 void Session::LogForPacket(SessionPacket const &p,
-                           [[maybe_unused]] WireSessionPacket const &w_p,
+                           [[maybe_unused]] PacketBuffer const &frame,
                            const char *action) const {
   if constexpr (kLogLevel >= kLogPacketMetadata) {
     auto tid = gettid();
@@ -253,35 +738,27 @@ void Session::LogForPacket(SessionPacket const &p,
            "%s  sn %03u,  nesn %03u\n"
            "%slrsn %03u,  lssn %03u\n"
            "%s          lassn %03u\n",
-           tid, role, action, TypeStr(p.type), p.length, kIndent, p.sn.value,
+           tid, role, action,
+           TypeStr(static_cast<SessionPacket::SubType>(
+               p.type & SessionPacket::kSubTypeMask)), p.length, kIndent, p.sn.value,
            p.nesn.value, kIndent, last_recv_sn_.value,
            last_sent_packet_.sn.value, kIndent, last_acked_sent_sn_.value);
     if constexpr (kLogLevel >= kLogPacketBytes) {
       printf("%s[ ", kIndent);
-      for (uint8_t i = 0; i < w_p.size(); i++) {
-        printf("%02x ", w_p[i]);
+      for (uint8_t byte : frame.SessionFrame()) {
+        printf("%02x ", byte);
       }
       printf("]\n");
     }
     if constexpr (kLogLevel >= kLogPacketAscii) {
       if (p.type == SessionPacket::kData)
-        printf("%s\"%s\"\n", kIndent, p.payload.data());
+        printf("%s\"%.*s\"\n", kIndent,
+               static_cast<int>(kSessionPacketPayloadBytes),
+               reinterpret_cast<const char *>(frame.SessionPayload().data()));
     }
   }
 }
 
-void Session::LogForPacket(SessionPacket const &p,
-                           [[maybe_unused]] ReceiveBuffer const &buff,
-                           const char *action) const {
-  if constexpr (kLogLevel >= kLogPacketMetadata) {
-    // TODO actually include the packet type in our logging
-    NewWirePacket<PacketType::kSession> w_p{};
-    // TODO this is a horrible abstraction violation
-    std::memcpy(&w_p, buff.data() + (kWirePacketTagBits / 8), sizeof(w_p));
-    LogForPacket(p, w_p, action);
-  }
-}
-
 AgentAction
 Session::WhatToDoIgnoringCurrentTime(TransmissionState supposed_state) const {
   if (session_complete_)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <limits>
@@ -8,10 +9,14 @@
 #include <utility>
 
 #include "clock.hpp"
+#include "frame_sizer.hpp"
+#include "guard_times.hpp"
 #include "packet.hpp"
+#include "packet_buffer.hpp"
 #include "radio_interface.hpp"
 #include "sequence_number.hpp"
 #include "time.hpp"
+#include "timer_wheel.hpp"
 #include "wire_packet.hpp"
 
 namespace lora_chat {
@@ -27,11 +32,33 @@ enum class AgentAction {
   // TODO support ending the session
 };
 
+/// Word from the peer that one of our messages reached its application
+struct DeliveryReceipt {
+  /// Which of the session's messages, counting from 0 in the order sent
+  uint32_t message;
+  /// When the session took it from the MessagePipe
+  TimePoint sent_at;
+  /// When the peer's session handed it over, to the millisecond on the
+  /// session clock both ends share. That's a frame or so after it arrived:
+  /// a received frame is only final once the next one comes.
+  TimePoint delivered_at;
+
+  Duration Latency() const { return delivered_at - sent_at; }
+};
+
 class MessagePipe {
   // Any other asynchronous status update callbacks go here
 public:
   using GetMessageFunc = std::optional<SessionPacketPayload> (*)();
   using ReceiveMessageFunc = void (*)(SessionPacketPayload &&);
+  using SessionEstablishedFunc = void (*)(WireAddress peer);
+  // Zero-copy variants: messages travel in the SessionPayload() of pooled
+  // frames, and the frames themselves change hands
+  using GetFrameFunc = PacketRef (*)();
+  using ReceiveFrameFunc = void (*)(PacketRef &&frame);
+  using DeliveryReceiptFunc = void (*)(DeliveryReceipt const &receipt);
+  using MessageAcknowledgedFunc = void (*)();
+  using SessionEndedFunc = void (*)();
 
   MessagePipe() : get_msg_(DontSendAMessage), recv_msg_(DropMessage) {}
 
@@ -41,15 +68,67 @@ public:
   MessagePipe(GetMessageFunc get_msg, ReceiveMessageFunc recv_msg)
       : get_msg_(get_msg), recv_msg_(recv_msg) {}
 
-  std::optional<SessionPacketPayload> GetNextMessageToSend();
-  void DepositReceivedMessage(SessionPacketPayload &&message);
+  MessagePipe(GetMessageFunc get_msg, ReceiveMessageFunc recv_msg,
+              SessionEstablishedFunc session_established)
+      : get_msg_(get_msg), recv_msg_(recv_msg),
+        session_established_(session_established) {}
+
+  MessagePipe(GetFrameFunc get_frame, ReceiveFrameFunc recv_frame)
+      : get_msg_(DontSendAMessage), recv_msg_(DropMessage),
+        get_frame_(get_frame), recv_frame_(recv_frame) {}
+
+  MessagePipe(GetFrameFunc get_frame, ReceiveFrameFunc recv_frame,
+              SessionEstablishedFunc session_established)
+      : get_msg_(DontSendAMessage), recv_msg_(DropMessage),
+        session_established_(session_established), get_frame_(get_frame),
+        recv_frame_(recv_frame) {}
+
+  /// The next message to send, already in place in the returned frame's
+  /// SessionPayload(). Empty if there's nothing to send, or if `pool` has no
+  /// buffer to copy a GetMessageFunc's message into.
+  PacketRef GetNextFrameToSend(PacketBufferPool &pool);
+  /// Hands the application a received frame. Frames go over as they are;
+  /// messages get copied out of them, with an empty frame standing for the
+  /// empty message each session starts off with (which frames skip).
+  void DepositReceivedFrame(PacketRef &&frame);
+  /// Lets the application know which peer the following messages will be
+  /// exchanged with, e.g. so that it can start draining a queued backlog.
+  void NotifySessionEstablished(WireAddress peer);
+
+  /// Asks the peer for a receipt as each message sent from here on reaches
+  /// its application, for `on_receipt` to be handed as they come back.
+  /// Receipts ride on frames the peer sends anyway, three bytes apiece.
+  void RequestReceipts(DeliveryReceiptFunc on_receipt) {
+    on_receipt_ = on_receipt;
+  }
+  bool WantsReceipts() const { return on_receipt_ != nullptr; }
+  void NotifyDelivered(DeliveryReceipt const &receipt);
+
+  /// Tells `on_acknowledged` as the peer acknowledges the last of each
+  /// message, in the order they were handed over, and `on_session_ended` once
+  /// the session is over, when any message not yet acknowledged never will
+  /// be. Unlike receipts these cost nothing on air, and aren't best-effort.
+  void TrackAcknowledgements(MessageAcknowledgedFunc on_acknowledged,
+                             SessionEndedFunc on_session_ended) {
+    on_acknowledged_ = on_acknowledged;
+    on_session_ended_ = on_session_ended;
+  }
+  void NotifyAcknowledged();
+  void NotifySessionEnded();
 
 private:
   GetMessageFunc get_msg_;
   ReceiveMessageFunc recv_msg_;
+  SessionEstablishedFunc session_established_{IgnoreSessionEstablished};
+  GetFrameFunc get_frame_{nullptr};
+  ReceiveFrameFunc recv_frame_{nullptr};
+  DeliveryReceiptFunc on_receipt_{nullptr};
+  MessageAcknowledgedFunc on_acknowledged_{nullptr};
+  SessionEndedFunc on_session_ended_{nullptr};
 
   static std::optional<SessionPacketPayload> DontSendAMessage() { return {}; }
   static void DropMessage(SessionPacketPayload &&) { return; }
+  static void IgnoreSessionEstablished(WireAddress) { return; }
 };
 
 class Session {
@@ -83,6 +162,12 @@ private:
         : Clock(start_time), transmission_duration_(transmission_duration),
           gap_duration_(gap_duration) {}
 
+    /// When the transmission/reception/gap window containing `t` began
+    TimePoint StartOfActionAt(TimePoint t) const;
+
+    Duration transmission_duration() const { return transmission_duration_; }
+    Duration gap_duration() const { return gap_duration_; }
+
   private:
     // The "transmission period" Tp is the interval between when the session's
     // initiator should begin transmitting the Nth message and when it should
@@ -117,15 +202,137 @@ public:
   /// For sessions initiated by the counterparty -- we receive first, and
   /// transmit second as well as at every time
   /// t ≡ Tp/2 (mod Tp)
+  /// Frames are drawn from `pool`, which must outlive the session.
   Session(TimePoint start_time, Id id, Duration transmission_duration,
-          Duration gap_duration, bool we_initiated);
+          Duration gap_duration, bool we_initiated,
+          PacketBufferPool &pool = PacketBufferPool::Default());
+
+  /// Messages are numbered in the order they're sent, which is also the
+  /// order the peer delivers them in, and receipts name them by the low
+  /// byte of that number: with a message or two in flight at a time, a
+  /// handful of receipts outstanding is plenty
+  static constexpr size_t kReceiptsTracked = 8;
+  struct AwaitedReceipt {
+    uint32_t message;
+    TimePoint sent_at;
+    bool awaited;
+  };
+  struct PendingReceipt {
+    uint8_t message;
+    uint16_t delivered_ms;
+  };
+
+  /// Everything it takes to pick a session up again in another process on
+  /// the same host, e.g. across a hot restart. Times are on the steady clock,
+  /// which every process on the host shares.
+  struct State {
+    Id id;
+    TimePoint start_time;
+    Duration transmission_duration;
+    Duration gap_duration;
+    bool we_initiated;
+    SequenceNumber last_recv_sn;
+    SequenceNumber last_acked_sent_sn;
+    bool received_good_packet_in_last_receive_sequence;
+    Packet<PacketType::kSession> last_sent_packet;
+    // The frames the session holds on to: the last sent, for retransmission,
+    // and the last received, which the application hasn't been given yet
+    bool has_last_sent_frame;
+    ReceiveBuffer last_sent_frame;
+    bool has_last_recv_frame;
+    ReceiveBuffer last_recv_frame;
+    int timeout_counter;
+    bool session_complete;
+    uint64_t messages_sent;
+    // Messages partway through being sent or reassembled a chunk at a time
+    bool has_outgoing_message;
+    SessionPacketPayload outgoing_message;
+    uint8_t outgoing_offset;
+    bool has_incoming_message;
+    SessionPacketPayload incoming_message;
+    uint8_t incoming_offset;
+    FrameSizer frame_sizer;
+    bool awaiting_outcome;
+    uint64_t messages_delivered;
+    bool incoming_wants_receipt;
+    std::array<AwaitedReceipt, kReceiptsTracked> awaited_receipts;
+    std::array<PendingReceipt, kReceiptsTracked> pending_receipts;
+    uint8_t pending_receipt_count;
+    // Zero if the session keeps to the grid; a restored session starts back
+    // on it either way
+    Duration turnaround;
+  };
+
+  /// Picks up a session from the State another Session saved
+  explicit Session(State const &state,
+                   PacketBufferPool &pool = PacketBufferPool::Default());
+  State SaveState() const;
+
+  Id id() const { return id_; }
+  /// What the session has learned about which frame sizes get through
+  FrameSizer const &frame_sizer() const { return frame_sizer_; }
+
+  /// Self-clocking: rather than waiting out the rest of the slot, each frame
+  /// begins `turnaround` after the one before it could have ended, for as
+  /// long as frames keep getting through, so that the period shrinks to the
+  /// airtime of the longest session frame (RadioInterface::TimeOnAir), and
+  /// receives listen for no longer than that takes
+  /// (RadioInterface::ReceiveWithin). An end whose radio only returns later
+  /// than that picks up from when it did. A missed frame puts both back on
+  /// the grid, which they meet again on at its next slot. Both ends must be
+  /// set up alike, and the radio must know its airtimes. Only
+  /// ExecuteCurrentAction clocks itself: sessions driven through
+  /// PrepareCurrentAction share their radio, and keep to their slots.
+  void SetSelfClocked(Duration turnaround) { turnaround_ = turnaround; }
+  /// Whether the next action follows on from the last frame, off the grid
+  bool Chained() const { return chain_next_ != TimePoint{}; }
+
+  /// Has ExecuteCurrentAction record, in `calibrator` (which must outlive the
+  /// session, or be unset first), how late after the start of each window
+  /// the radio went live and, for windows on the grid, how late after its end
+  /// it finished; nullptr stops it
+  void SetGuardTimeCalibrator(GuardTimeCalibrator *calibrator) {
+    calibrator_ = calibrator;
+  }
 
   /// Executes the action which the session expects for the current time.
   AgentAction ExecuteCurrentAction(RadioInterface &radio, MessagePipe &pipe);
 
+  /// Decides on the action which the session expects for the current time,
+  /// and does all of it that doesn't involve the radio, for callers which
+  /// drive many sessions from one thread rather than blocking in
+  /// ExecuteCurrentAction. For transmissions `frame` is set to the frame to
+  /// send before EndOfCurrentAction(), e.g. with SubmitTransmitStaged(
+  /// frame->StagedSessionFrame(), ...); its SessionFrame() must not change
+  /// while it's held; for kReceive, whatever is received before then should
+  /// be handed to CompleteReceive. Returns kSleepUntilNextAction, having done
+  /// nothing, if the pool is out of buffers.
+  AgentAction PrepareCurrentAction(MessagePipe &pipe, PacketRef &frame);
+  /// As PrepareCurrentAction, for the window containing `t` rather than the
+  /// current one, for callers that keep time themselves (e.g. tests stepping
+  /// both ends of a session in lockstep). `t` must not be before the start.
+  AgentAction PrepareActionAt(TimePoint t, MessagePipe &pipe, PacketRef &frame);
+  /// Finishes a kReceive begun by PrepareCurrentAction, taking over `frame`.
+  /// `frame` is only read if `status` is kSuccess. Returns whether it was a
+  /// frame of this session's.
+  bool CompleteReceive(RadioInterface::Status status, PacketRef &&frame,
+                       MessagePipe &pipe);
+  /// When the current transmission/reception window closes
+  TimePoint EndOfCurrentAction() const { return clock_.TimeOfNextAction(); }
+
   /// Sleep the current thread until this session is ready to begin executing.
-  /// May return immediately if the session is already ready.
-  void SleepUntilStartTime() const;
+  /// May return immediately if the session is already ready. Given `radio`,
+  /// it sleeps too, for as long as it can (see RadioInterface::IdleUntil), as
+  /// it does through ExecuteCurrentAction's gaps.
+  void SleepUntilStartTime(RadioInterface *radio = nullptr) const;
+  /// Sleeps until the start of the next window in which there's something to
+  /// do, for sessions restored partway through one. A reception skipped on the
+  /// way counts as lost, so that the peer is NACKed rather than desynced.
+  void SleepUntilNextSlot(RadioInterface *radio = nullptr);
+
+  /// Schedules `timer` for the next time this session has something to do,
+  /// skipping over gap time just like ExecuteCurrentAction's sleep does.
+  void ScheduleNextAction(TimerWheel &wheel, TimerWheel::Timer &timer) const;
 
 private:
   enum LogLevel {
@@ -143,8 +350,8 @@ private:
   static constexpr int kTimeoutLimit{4};
 
   /// Returns the specific action an agent executing this session should
-  /// start doing right now.
-  AgentAction WhatToDoRightNow() const;
+  /// start doing at `t`.
+  AgentAction WhatToDoAt(TimePoint t) const;
 
   /// Decides what we'd do if we were transmitting/receiving/etc. (according to
   /// `supposed_state`) given the current values of our stored sequence numbers.
@@ -159,31 +366,53 @@ private:
   TransmissionState
   LocalizeActionKind(TransmissionState initiator_action_kind) const;
 
+  /// Does all of `action` that doesn't involve the radio, for a window that
+  /// began `lateness` ago (see PrepareCurrentAction)
+  AgentAction PrepareAction(AgentAction action, Duration lateness,
+                            MessagePipe &pipe, PacketRef &frame);
+
   // TODO I really want to encapsulate these somehow...
-  void TransmitNack(RadioInterface &radio, MessagePipe &pipe);
-  void TransmitNextMessage(RadioInterface &radio, MessagePipe &pipe);
-  void ReceiveMessage(RadioInterface &radio, MessagePipe &pipe);
-  void RetransmitMessage(RadioInterface &radio, MessagePipe &pipe);
-  void TerminateSession(RadioInterface &radio, MessagePipe &pipe);
+  // Each returns false, having changed nothing, if out of buffers
+  bool PrepareNack(PacketRef &frame);
+  bool PrepareNextMessage(MessagePipe &pipe, PacketRef &frame);
+  bool PrepareRetransmission(PacketRef &frame);
+  void TerminateSession();
+  /// Hands on a received frame which can no longer be retransmitted over:
+  /// whole messages go straight to the application, chunks of one are
+  /// collected until the message is complete
+  void DepositFinalFrame(PacketRef &&frame, MessagePipe &pipe);
+  /// Queues a receipt for the peer's message number `message`, just
+  /// delivered, to go out on our next data frame
+  void QueueReceipt(uint64_t message);
+  /// Hands the receipt `frame` carries to the pipe, if it's one we're after
+  void TakeReceipt(PacketBuffer const &frame, MessagePipe &pipe);
+  /// Records how long after `start` the radio's last operation went live,
+  /// and, unless its window was `chained` (which has no set end), how long
+  /// after the window closed it finished (now), if there's a calibrator to
+  /// record them in
+  void RecordTurnaround(RadioInterface const &radio,
+                        GuardTimeCalibrator::Switch kind, TimePoint start,
+                        bool chained) const;
 
   /// Sleeps the current thread until the next time at which
-  /// WhatToDoRightNow would not return either the current action or kInactive.
+  /// WhatToDoAt would not return either the current action or kInactive.
   /// N.b. this means that if the current action is e.g. kReceiving, this
   /// function will sleep through both the remainder of the reception block as
   /// well as the following gap-time.
   /// Returns the action to take upon waking.
-  AgentAction SleepThroughNextGapTime() const;
+  AgentAction SleepThroughNextGapTime(RadioInterface &radio) const;
+
+  /// When the action following the current one begins, not counting gaps
+  TimePoint TimeOfNextActiveAction() const;
 
-  /// Waits until time t to return.
+  /// Waits until time t to return, with `radio` (if any) asleep for as much of
+  /// the wait as it can be.
   /// If the remaining time is short enough, does not actually sleep the current
   /// thread: just spins until we hit it instead.
-  void SleepUntil(TimePoint t) const;
+  void SleepUntil(TimePoint t, RadioInterface *radio) const;
 
   void LogForPacket(Packet<PacketType::kSession> const &p,
-                    NewWirePacket<PacketType::kSession> const &w_p,
-                    const char *action) const;
-  void LogForPacket(Packet<PacketType::kSession> const &p,
-                    ReceiveBuffer const &buff, const char *action) const;
+                    PacketBuffer const &frame, const char *action) const;
 
   static SequenceNumber InitFictitiousLastAckedSentSn(bool we_initiated);
   static SequenceNumber InitFictitiousPrevSentNesn(bool we_initiated);
@@ -191,6 +420,7 @@ private:
   Id id_;
 
   SessionClock clock_;
+  PacketBufferPool *pool_;
 
   // When a packet is received, we cannot be sure that it is final until a
   // packet with greater sn is received -- this is because the transmitter could
@@ -199,15 +429,50 @@ private:
   SequenceNumber last_recv_sn_{SequenceNumber::kMaximumValue};
   SequenceNumber last_acked_sent_sn_;
   bool received_good_packet_in_last_receive_sequence_{true};
-  // We buffer this so that we can retransmit it
+  // We buffer this so that we can retransmit it. Only the header is kept
+  // up to date: the payload lives in the frame, which is retransmitted as is.
   Packet<PacketType::kSession> last_sent_packet_;
+  PacketRef last_sent_frame_{};
   // We buffer this and only hand it back out when it's about to be overridden
-  SessionPacketPayload last_recv_message_{};
+  PacketRef last_recv_frame_{};
+
+  // Messages are cut into frames of whatever size frame_sizer_ picks. The
+  // message being sent, and how much of it the peer has acked...
+  PacketRef outgoing_message_{};
+  size_t outgoing_offset_{0};
+  // ...and likewise for the one being put back together from the peer's
+  // frames. Messages are always kSessionPacketPayloadBytes long, and frames
+  // arrive in order, so the byte count alone says where each one ends.
+  PacketRef incoming_message_{};
+  size_t incoming_offset_{0};
+  FrameSizer frame_sizer_{};
+  // Whether the outcome of our last transmission is yet to be learned from
+  // the peer's reply
+  bool awaiting_outcome_{false};
+
+  // Self-clocking (see SetSelfClocked), zero if off. While it's on and
+  // frames keep getting through, when the next one begins and whether it's
+  // ours to send; TimePoint{} once we're back on the grid.
+  Duration turnaround_{0};
+  TimePoint chain_next_{};
+  bool chain_transmit_{false};
+
+  GuardTimeCalibrator *calibrator_{nullptr};
 
   int timeout_counter_{0};
   bool session_complete_{false};
 
+  // Messages taken from the pipe, and messages handed to it, this session
   uint64_t messages_sent_{0};
+  uint64_t messages_delivered_{0};
+  // Whether any frame of the message being reassembled asked for a receipt
+  bool incoming_wants_receipt_{false};
+  // Indexed by message number, modulo kReceiptsTracked
+  std::array<AwaitedReceipt, kReceiptsTracked> awaited_receipts_{};
+  // Receipts for the peer, yet to go out; past kReceiptsTracked they're
+  // dropped
+  std::array<PendingReceipt, kReceiptsTracked> pending_receipts_{};
+  uint8_t pending_receipt_count_{0};
 
   bool we_initiated_;
 };
@@ -1,16 +1,20 @@
 #include "packet.hpp"
 #include "session.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <chrono>
 #include <cstdio>
 #include <limits>
+#include <optional>
+#include <string>
 #include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
 
+#include "metrics.hpp"
 #include "radio_interface.hpp"
 #include "test_utils.hpp"
 #include "gtest/gtest.h"
@@ -314,6 +318,451 @@ TEST(PingPong, OneSidedFailures) {
   ponger_thread.join();
 }
 
+std::vector<lora_chat::DeliveryReceipt> ping_receipts{};
+std::vector<lora_chat::DeliveryReceipt> pong_receipts{};
+void KeepPingReceipt(lora_chat::DeliveryReceipt const &r) {
+  ping_receipts.push_back(r);
+}
+void KeepPongReceipt(lora_chat::DeliveryReceipt const &r) {
+  pong_receipts.push_back(r);
+}
+
+TEST(Receipts, ComeBackForDeliveredMessages) {
+  using MessagePipe = lora_chat::MessagePipe;
+  using Session = lora_chat::Session;
+  // Left over from an earlier run, e.g. with --gtest_repeat
+  ping_receipts.clear();
+  pong_receipts.clear();
+
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, ConsumeMessage<kPingerTag>};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, ConsumeMessage<kPongerTag>};
+  ping_pipe.RequestReceipts(KeepPingReceipt);
+  pong_pipe.RequestReceipts(KeepPongReceipt);
+
+  LocalRadio radio(std::chrono::milliseconds(8));
+
+  constexpr int kPeriods{12};
+  constexpr auto kTransmitTime = std::chrono::milliseconds(10);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    for (int i = 0; i < 2 * kPeriods; i++)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+  pinger.SleepUntilStartTime();
+  for (int i = 0; i < 2 * kPeriods; i++)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  ponger_thread.join();
+
+  // A message is delivered once the frame after it arrives, and its receipt
+  // comes back on the frame after that, so the last couple are still out
+  for (auto const *receipts : {&ping_receipts, &pong_receipts}) {
+    ASSERT_GE(receipts->size(), kPeriods / 2u);
+    for (size_t i = 0; i < receipts->size(); i++) {
+      auto const &r = (*receipts)[i];
+      if (i > 0) {
+        EXPECT_GT(r.message, (*receipts)[i - 1].message);
+      }
+      // A frame or two each way, give or take the millisecond rounding
+      EXPECT_GT(r.Latency(), -std::chrono::milliseconds(1));
+      EXPECT_LT(r.Latency(), 6 * (kTransmitTime + kGapTime));
+    }
+  }
+}
+
+int pings_delivered{0};
+int pongs_delivered{0};
+void CountPing(lora_chat::SessionPacketPayload &&) { pings_delivered++; }
+void CountPong(lora_chat::SessionPacketPayload &&) { pongs_delivered++; }
+
+TEST(SelfClocking, OutpacesTheGrid) {
+  using MessagePipe = lora_chat::MessagePipe;
+  using Session = lora_chat::Session;
+  pings_delivered = 0;
+  pongs_delivered = 0;
+
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, CountPong};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, CountPing};
+
+  // Frames take a fraction of their window, so the grid mostly waits
+  LocalRadio radio(std::chrono::milliseconds(8));
+  constexpr auto kTransmitTime = std::chrono::milliseconds(40);
+  constexpr auto kGapTime = std::chrono::milliseconds(10);
+  constexpr auto kTurnaround = std::chrono::milliseconds(4);
+  constexpr auto kRunTime = std::chrono::milliseconds(500);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+  ponger.SetSelfClocked(kTurnaround);
+  pinger.SetSelfClocked(kTurnaround);
+  const auto end_time = start_time + kRunTime;
+
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    while (lora_chat::Now() < end_time)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+  pinger.SleepUntilStartTime();
+  while (lora_chat::Now() < end_time)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  ponger_thread.join();
+
+  // The grid fits one message each way per 2 * (kTransmitTime + kGapTime);
+  // clocked off the frames, it's one per 2 * (8ms + kTurnaround), so allow
+  // for a good few frames lost to scheduling and still expect twice as many
+  const int grid_messages = kRunTime / (2 * (kTransmitTime + kGapTime));
+  EXPECT_GT(pings_delivered, 2 * grid_messages);
+  EXPECT_GT(pongs_delivered, 2 * grid_messages);
+}
+
+// Like LoraInterface, only returns from a receive once the longest frame
+// could have arrived, whenever the one sent actually did; unless `bounded`,
+// ReceiveWithin can't cut that short
+class WholeWindowReceiveRadio : public lora_chat::RadioInterface {
+public:
+  WholeWindowReceiveRadio(std::chrono::milliseconds timeout,
+                          std::chrono::milliseconds window,
+                          bool bounded = false)
+      : radio_{timeout}, window_(window), bounded_(bounded) {}
+
+  Status Transmit(std::span<uint8_t const> buffer) {
+    return radio_.Transmit(buffer);
+  }
+  Status Receive(std::span<uint8_t> buffer_out) {
+    return ReceiveWithin(buffer_out, lora_chat::Duration::max());
+  }
+  Status ReceiveWithin(std::span<uint8_t> buffer_out,
+                       lora_chat::Duration window) override {
+    const auto end =
+        lora_chat::Now() + (bounded_ ? std::min<lora_chat::Duration>(
+                                           window_, window)
+                                     : lora_chat::Duration{window_});
+    Status status = Status::kTimeout;
+    while (status != Status::kSuccess && lora_chat::Now() < end)
+      status = radio_.Receive(buffer_out);
+    std::this_thread::sleep_until(end);
+    return status;
+  }
+  size_t MaximumMessageLength() const { return radio_.MaximumMessageLength(); }
+  std::optional<lora_chat::Duration> TimeOnAir(size_t bytes) const override {
+    return radio_.TimeOnAir(bytes);
+  }
+
+private:
+  LocalRadio radio_;
+  std::chrono::milliseconds window_;
+  bool bounded_;
+};
+
+TEST(SelfClocking, PicksUpAfterAReceiveThatHeldOn) {
+  using MessagePipe = lora_chat::MessagePipe;
+  using Session = lora_chat::Session;
+  using lora_chat::Counter;
+  pings_delivered = 0;
+  pongs_delivered = 0;
+
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, CountPong};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, CountPing};
+
+  // Each received frame is handed over 30ms after its receive began, long
+  // after the 8ms it took plus the turnaround
+  constexpr auto kReceiveWindow = std::chrono::milliseconds(30);
+  WholeWindowReceiveRadio radio(std::chrono::milliseconds(8), kReceiveWindow);
+  constexpr auto kTransmitTime = std::chrono::milliseconds(40);
+  constexpr auto kGapTime = std::chrono::milliseconds(10);
+  constexpr auto kTurnaround = std::chrono::milliseconds(4);
+  constexpr auto kRunTime = std::chrono::milliseconds(500);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+  ponger.SetSelfClocked(kTurnaround);
+  pinger.SetSelfClocked(kTurnaround);
+  const auto end_time = start_time + kRunTime;
+
+  lora_chat::MetricsSnapshot before{};
+  lora_chat::Metrics::Default().Snapshot(before);
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    while (lora_chat::Now() < end_time)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+  pinger.SleepUntilStartTime();
+  while (lora_chat::Now() < end_time)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  ponger_thread.join();
+  lora_chat::MetricsSnapshot after{};
+  lora_chat::Metrics::Default().Snapshot(after);
+
+  // Still chained, and outpacing the grid...
+  const int grid_messages = kRunTime / (2 * (kTransmitTime + kGapTime));
+  EXPECT_GT(pings_delivered, grid_messages);
+  EXPECT_GT(pongs_delivered, grid_messages);
+  // ...with every action starting when it was meant to. Had the chain kept
+  // to the frames' airtimes, each would be 18ms later than the one before.
+  const uint64_t samples = after[Counter::kSlotErrorSamples] -
+                           before[Counter::kSlotErrorSamples];
+  ASSERT_GT(samples, 0u);
+  const auto mean_error = std::chrono::nanoseconds(
+      (after[Counter::kSlotErrorTotalNs] - before[Counter::kSlotErrorTotalNs]) /
+      samples);
+  EXPECT_LT(mean_error, std::chrono::milliseconds(5));
+}
+
+TEST(SelfClocking, CutsReceivesShortAfterTheLongestFrame) {
+  using MessagePipe = lora_chat::MessagePipe;
+  using Session = lora_chat::Session;
+  pings_delivered = 0;
+  pongs_delivered = 0;
+
+  MessagePipe ping_pipe{MakeMessage<kPingTag>, CountPong};
+  MessagePipe pong_pipe{MakeMessage<kPongTag>, CountPing};
+
+  // Left to itself, each receive would hold on for 45ms; bounded, it gives up
+  // once the 8ms frame (plus some of the turnaround) would be over
+  WholeWindowReceiveRadio radio(std::chrono::milliseconds(8),
+                                std::chrono::milliseconds(45), true);
+  constexpr auto kTransmitTime = std::chrono::milliseconds(40);
+  constexpr auto kGapTime = std::chrono::milliseconds(10);
+  constexpr auto kTurnaround = std::chrono::milliseconds(4);
+  constexpr auto kRunTime = std::chrono::milliseconds(500);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+  ponger.SetSelfClocked(kTurnaround);
+  pinger.SetSelfClocked(kTurnaround);
+  const auto end_time = start_time + kRunTime;
+
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    while (lora_chat::Now() < end_time)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+  pinger.SleepUntilStartTime();
+  while (lora_chat::Now() < end_time)
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  ponger_thread.join();
+
+  // Held on for the whole 45ms, it'd be one message each way per ~100ms,
+  // no better than the grid
+  const int grid_messages = kRunTime / (2 * (kTransmitTime + kGapTime));
+  EXPECT_GT(pings_delivered, 2 * grid_messages);
+  EXPECT_GT(pongs_delivered, 2 * grid_messages);
+}
+
+TEST(GuardTimes, AReceiveThatRunsOverItsWindowIsRecorded) {
+  using GuardTimeCalibrator = lora_chat::GuardTimeCalibrator;
+  using Switch = GuardTimeCalibrator::Switch;
+
+  // Nobody's transmitting, so each receive waits out the radio's own
+  // timeout, well past the end of its window
+  LocalRadio radio(std::chrono::milliseconds(30));
+  constexpr auto kTransmitTime = std::chrono::milliseconds(5);
+  constexpr auto kGapTime = std::chrono::milliseconds(5);
+  lora_chat::MessagePipe pipe{};
+  GuardTimeCalibrator calibrator{};
+  lora_chat::Session session{lora_chat::Now(), 0, kTransmitTime, kGapTime,
+                             false};
+  session.SetGuardTimeCalibrator(&calibrator);
+
+  // The follower receives first
+  session.ExecuteCurrentAction(radio, pipe);
+  EXPECT_GE(calibrator.OverrunPercentile(Switch::kToReceive, 0.5),
+            std::chrono::milliseconds(20));
+}
+
+TEST(GuardTimes, ChainedWindowsRecordNoOverrun) {
+  using GuardTimeCalibrator = lora_chat::GuardTimeCalibrator;
+  using Switch = GuardTimeCalibrator::Switch;
+  using Session = lora_chat::Session;
+
+  lora_chat::MessagePipe ping_pipe{MakeMessage<kPingTag>};
+  lora_chat::MessagePipe pong_pipe{MakeMessage<kPongTag>};
+  LocalRadio radio(std::chrono::milliseconds(8));
+  constexpr auto kTransmitTime = std::chrono::milliseconds(40);
+  constexpr auto kGapTime = std::chrono::milliseconds(10);
+  constexpr auto kTurnaround = std::chrono::milliseconds(4);
+  constexpr auto kRunTime = std::chrono::milliseconds(300);
+
+  auto start_time = lora_chat::Now() + std::chrono::milliseconds(10);
+  Session ponger(start_time, 0, kTransmitTime, kGapTime, false);
+  Session pinger(start_time, 0, kTransmitTime, kGapTime, true);
+  ponger.SetSelfClocked(kTurnaround);
+  pinger.SetSelfClocked(kTurnaround);
+  GuardTimeCalibrator calibrator{};
+  pinger.SetGuardTimeCalibrator(&calibrator);
+  const auto end_time = start_time + kRunTime;
+
+  std::thread ponger_thread([&]() {
+    ponger.SleepUntilStartTime();
+    while (lora_chat::Now() < end_time)
+      ponger.ExecuteCurrentAction(radio, pong_pipe);
+  });
+  pinger.SleepUntilStartTime();
+  uint64_t on_grid = 0;
+  uint64_t chained = 0;
+  while (lora_chat::Now() < end_time) {
+    (pinger.Chained() ? chained : on_grid)++;
+    pinger.ExecuteCurrentAction(radio, ping_pipe);
+  }
+  ponger_thread.join();
+
+  // Only the windows on the grid have an end to have run past
+  EXPECT_GT(chained, 0u);
+  EXPECT_EQ(calibrator.OverrunSamples(Switch::kToReceive) +
+                calibrator.OverrunSamples(Switch::kToTransmit),
+            on_grid);
+}
+
+std::array<int, 2> lockstep_sent{};
+std::array<std::vector<std::string>, 2> lockstep_received{};
+template <size_t kEnd>
+std::optional<lora_chat::SessionPacketPayload> SendNumbered() {
+  lora_chat::SessionPacketPayload p{};
+  std::snprintf(reinterpret_cast<char *>(p.data()), p.size(), "%zu:%d", kEnd,
+                lockstep_sent[kEnd]++);
+  return p;
+}
+template <size_t kEnd> void KeepNumbered(lora_chat::SessionPacketPayload &&p) {
+  // Each end's first delivery is the empty message the session starts with
+  if (p[0])
+    lockstep_received[kEnd].emplace_back(
+        reinterpret_cast<const char *>(p.data()));
+}
+
+// The two ends of a session, driven a window at a time from this thread with
+// each frame handed straight across, so that a test decides exactly which
+// frames get through and which windows an end is too late for. Each end is
+// told the time outright, halfway into the window, rather than reading the
+// clock, so that nothing depends on how the threads get scheduled.
+class Lockstep {
+public:
+  using AgentAction = lora_chat::AgentAction;
+  static constexpr auto kTransmitTime = std::chrono::milliseconds(20);
+  static constexpr auto kGapTime = std::chrono::milliseconds(20);
+
+  Lockstep() {
+    lockstep_sent = {};
+    lockstep_received = {};
+  }
+
+  /// Runs the next window, the initiator and the follower taking turns to
+  /// transmit, and returns what was sent. Unless `delivered`, the frame is
+  /// lost on the way; with `late`, the other end misses the window entirely.
+  AgentAction Step(bool delivered = true, bool late = false) {
+    using Status = lora_chat::RadioInterface::Status;
+    const bool initiator_sends = (window_ % 2) == 0;
+    const lora_chat::TimePoint t =
+        start_ + window_ * (kTransmitTime + kGapTime) + kTransmitTime / 2;
+    window_++;
+    auto &tx = initiator_sends ? initiator_ : follower_;
+    auto &rx = initiator_sends ? follower_ : initiator_;
+    auto &tx_pipe = initiator_sends ? initiator_pipe_ : follower_pipe_;
+    auto &rx_pipe = initiator_sends ? follower_pipe_ : initiator_pipe_;
+
+    lora_chat::PacketRef frame{};
+    const AgentAction action = tx.PrepareActionAt(t, tx_pipe, frame);
+    if (late)
+      return action;
+    lora_chat::PacketRef unused{};
+    EXPECT_EQ(rx.PrepareActionAt(t, rx_pipe, unused), AgentAction::kReceive);
+    if (!delivered || !frame) {
+      rx.CompleteReceive(Status::kTimeout, {}, rx_pipe);
+      return action;
+    }
+    auto received = lora_chat::PacketBufferPool::Default().Acquire();
+    received->bytes = {};
+    auto sent = frame->SessionFrame();
+    std::copy(sent.begin(), sent.end(), received->bytes.span().begin());
+    EXPECT_TRUE(rx.CompleteReceive(Status::kSuccess, std::move(received),
+                                   rx_pipe));
+    return action;
+  }
+
+  /// Checks that each end has been given the other's messages in order, with
+  /// none missing
+  void ExpectNothingLost() const {
+    for (size_t end = 0; end < 2; end++) {
+      auto const &received = lockstep_received[end];
+      for (size_t i = 0; i < received.size(); i++)
+        EXPECT_EQ(received[i], std::to_string(1 - end) + ":" +
+                                   std::to_string(i))
+            << "at end " << end;
+    }
+  }
+
+private:
+  const lora_chat::TimePoint start_{lora_chat::Now()};
+  lora_chat::Session initiator_{start_, 4, kTransmitTime, kGapTime, true};
+  lora_chat::Session follower_{start_, 4, kTransmitTime, kGapTime, false};
+  lora_chat::MessagePipe initiator_pipe_{SendNumbered<0>, KeepNumbered<0>};
+  lora_chat::MessagePipe follower_pipe_{SendNumbered<1>, KeepNumbered<1>};
+  int window_{0};
+};
+
+TEST(Lockstep, AWindowMissedForLatenessIsNacked) {
+  using AgentAction = lora_chat::AgentAction;
+  Lockstep session{};
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  // The initiator only gets to its receive once the window's over. Having
+  // heard something the time before counts for nothing now
+  session.Step(true, true);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNack);
+  EXPECT_EQ(session.Step(), AgentAction::kRetransmitMessage);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage) << i;
+  session.ExpectNothingLost();
+  EXPECT_EQ(lockstep_received[1].size(), 3u);
+}
+
+// Loses a frame each way, so that the initiator NACKs with the SN of a frame
+// the follower never got
+void LoseTheInitiatorsFrameAndTheNackBack(Lockstep &session) {
+  using AgentAction = lora_chat::AgentAction;
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(false), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(false), AgentAction::kTransmitNack);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNack);
+}
+
+TEST(Lockstep, ANacksSnIsNotTakenAsReceived) {
+  Lockstep session{};
+  LoseTheInitiatorsFrameAndTheNackBack(session);
+  for (int i = 0; i < 6; i++)
+    session.Step();
+  // Taken as received, the lost frame would have been acknowledged, and its
+  // message would never have come
+  session.ExpectNothingLost();
+  EXPECT_EQ(lockstep_received[1].size(), 3u);
+}
+
+TEST(Lockstep, ARetransmissionAcksWhatCameSince) {
+  using AgentAction = lora_chat::AgentAction;
+  Lockstep session{};
+  LoseTheInitiatorsFrameAndTheNackBack(session);
+  // The NACK acks the follower's last frame, so it goes on to the next; not
+  // having had the initiator's, it can't ack that, which the initiator takes
+  // as a NACK
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(), AgentAction::kRetransmitMessage);
+  // The retransmission acks the follower's new frame, rather than still
+  // carrying the nesn it went out with first, which would have the follower
+  // retransmit in turn
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  EXPECT_EQ(session.Step(), AgentAction::kTransmitNextMessage);
+  session.ExpectNothingLost();
+}
+
 // TODO test that two sessions can coexist on the same link
 
 } // namespace
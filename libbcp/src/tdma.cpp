@@ -0,0 +1,198 @@
+#include "tdma.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+#include "wire_packet.hpp"
+
+namespace lora_chat {
+
+namespace {
+
+using Micros = std::chrono::microseconds;
+
+} // namespace
+
+size_t Superframe::Slots() const {
+  return std::min<size_t>(1 + gap_duration / transmission_duration,
+                          kBeaconSlots);
+}
+
+TimePoint Superframe::SlotStartAtOrAfter(size_t slot, TimePoint t) const {
+  const TimePoint first = epoch + slot * transmission_duration;
+  if (t <= first) return first;
+  const auto periods = (t - first + Period() - Duration(1)) / Period();
+  return first + periods * Period();
+}
+
+TimePoint Superframe::ContentionStartAtOrAfter(TimePoint t) const {
+  const Duration offset = transmission_duration + gap_duration;
+  return SlotStartAtOrAfter(0, t - offset) + offset;
+}
+
+Superframe Superframe::FromBeacon(BeaconPacket const &beacon) {
+  return {
+      .epoch = DeserializeWireTime(beacon.epoch),
+      .transmission_duration = Micros(beacon.transmission_micros),
+      .gap_duration = Micros(beacon.gap_micros),
+  };
+}
+
+BeaconPacket Superframe::ToBeacon(WireAddress source, TimePoint start,
+                                  BeaconSlotMap const &owners) const {
+  return {
+      .source_address = source,
+      .epoch = SerializeWireTime(start),
+      .transmission_micros = static_cast<uint32_t>(
+          std::chrono::duration_cast<Micros>(transmission_duration).count()),
+      .gap_micros = static_cast<uint32_t>(
+          std::chrono::duration_cast<Micros>(gap_duration).count()),
+      .slot_owners = owners,
+  };
+}
+
+TdmaCoordinator::TdmaCoordinator(WireAddress address, RadioInterface &radio,
+                                 Duration transmission_duration,
+                                 Duration gap_duration, size_t idle_checks)
+    : address_(address), radio_(radio),
+      frame_{Now(), transmission_duration, gap_duration},
+      idle_checks_(idle_checks) {
+  assert(transmission_duration > Duration::zero());
+  assert(address != 0 && "0 marks a free slot");
+  owners_[0] = address_;
+}
+
+void TdmaCoordinator::RunSuperframe() {
+  const TimePoint start = frame_.SlotStartAtOrAfter(0, Now());
+  std::this_thread::sleep_until(start);
+
+  auto w_beacon = Serialize(frame_.ToBeacon(address_, start, owners_));
+  if (radio_.Transmit(w_beacon) != RadioInterface::Status::kSuccess)
+    printf("TdmaCoordinator: failed to send a beacon\n");
+
+  CheckNextSlot(start);
+
+  const TimePoint contention = frame_.ContentionStartAtOrAfter(start);
+  const TimePoint end = contention + frame_.transmission_duration;
+  std::this_thread::sleep_until(contention);
+  ReceiveBuffer frame{};
+  while (Now() < end) {
+    frame = {};
+    if (radio_.Receive(frame.span()) != RadioInterface::Status::kSuccess)
+      continue;
+    auto request = Deserialize<PacketType::kSlotRequest>(frame);
+    if (request && request->target_address == address_)
+      Grant(request->source_address);
+  }
+}
+
+void TdmaCoordinator::Grant(WireAddress requester) {
+  const size_t slots = frame_.Slots();
+  // A holder asking again hasn't seen a beacon since it was granted one
+  for (size_t slot = 1; slot < slots; slot++)
+    if (owners_[slot] == requester)
+      return;
+  for (size_t slot = 1; slot < slots; slot++) {
+    if (owners_[slot])
+      continue;
+    owners_[slot] = requester;
+    missed_checks_[slot] = 0;
+    granted_++;
+    return;
+  }
+}
+
+void TdmaCoordinator::CheckNextSlot(TimePoint start) {
+  const size_t slots = frame_.Slots();
+  size_t slot = last_checked_;
+  do {
+    slot = (slot + 1) % slots;
+  } while (slot != last_checked_ && (slot == 0 || !owners_[slot]));
+  if (slot == 0 || !owners_[slot])
+    return;
+  last_checked_ = slot;
+
+  // The holder's session transmits first thing in its slot, every superframe
+  std::this_thread::sleep_until(start + slot * frame_.transmission_duration);
+  ReceiveBuffer frame{};
+  if (radio_.Receive(frame.span()) == RadioInterface::Status::kSuccess) {
+    missed_checks_[slot] = 0;
+  } else if (++missed_checks_[slot] >= idle_checks_) {
+    owners_[slot] = 0;
+    reclaimed_++;
+  }
+}
+
+TdmaMember::TdmaMember(WireAddress address, RadioInterface &radio)
+    : address_(address), radio_(radio),
+      rng_(address ^ Now().time_since_epoch().count()) {}
+
+bool TdmaMember::ListenForBeacon(TimePoint deadline) {
+  ReceiveBuffer frame{};
+  while (true) {
+    if (frame_) {
+      // No sense listening until the next one's due
+      const TimePoint due = frame_->SlotStartAtOrAfter(0, Now());
+      if (due > deadline)
+        return false;
+      std::this_thread::sleep_until(due - kBeaconGuard);
+    } else if (Now() >= deadline) {
+      return false;
+    }
+
+    frame = {};
+    if (radio_.Receive(frame.span()) != RadioInterface::Status::kSuccess)
+      continue;
+    auto beacon = Deserialize<PacketType::kBeacon>(frame);
+    if (!beacon || (coordinator_ && beacon->source_address != coordinator_))
+      continue;
+
+    coordinator_ = beacon->source_address;
+    frame_ = Superframe::FromBeacon(*beacon);
+    slot_ = {};
+    for (size_t slot = 1; slot < frame_->Slots(); slot++)
+      if (beacon->slot_owners[slot] == address_)
+        slot_ = slot;
+    return true;
+  }
+}
+
+std::optional<size_t> TdmaMember::AcquireSlot(TimePoint deadline) {
+  size_t misses = 0;
+  while (ListenForBeacon(deadline)) {
+    if (slot_)
+      return slot_;
+    const size_t window = size_t{1} << std::min(misses, kMaxBackoffExponent);
+    const size_t wait =
+        std::uniform_int_distribution<size_t>(0, window - 1)(rng_);
+    if (!RequestSlot(wait, deadline))
+      return {};
+    misses++;
+  }
+  return {};
+}
+
+bool TdmaMember::RequestSlot(size_t superframes_out, TimePoint deadline) {
+  assert(frame_.has_value());
+  const size_t mini_slot = std::uniform_int_distribution<size_t>(
+      0, Superframe::kContentionSlots - 1)(rng_);
+  const TimePoint send_at = frame_->ContentionStartAtOrAfter(Now()) +
+                            superframes_out * frame_->Period() +
+                            mini_slot * frame_->ContentionSlotDuration();
+  if (send_at > deadline)
+    return false;
+  std::this_thread::sleep_until(send_at);
+
+  SlotRequestPacket request{};
+  request.source_address = address_;
+  request.target_address = coordinator_;
+  auto w_request = Serialize(request);
+  // Lost, as far as we can tell, like one that collided
+  if (radio_.Transmit(w_request) != RadioInterface::Status::kSuccess)
+    printf("TdmaMember: failed to send a slot request\n");
+  return true;
+}
+
+} // namespace lora_chat
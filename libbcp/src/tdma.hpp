@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+
+#include "packet.hpp"
+#include "radio_interface.hpp"
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// The schedule of a coordinated network, shared by every session on its
+/// channel. It's the gateway's slot layout (see Gateway), network-wide: a
+/// period 2(T+G) divides into 1 + G/T slots, the initiator of slot k's
+/// session transmitting at offset kT and its follower at T+G+kT, so that
+/// sessions in different slots never overlap.
+///
+/// Slot 0 is the coordinator's: it beacons in the first half, and in the
+/// second (the contention window) listens for slot requests, which come in
+/// one of kContentionSlots mini-slots picked at random (slotted ALOHA). A
+/// slot request must fit in a mini-slot, and a beacon in T.
+struct Superframe {
+  static constexpr size_t kContentionSlots = 4;
+
+  /// When some superframe began; any of them will do
+  TimePoint epoch;
+  Duration transmission_duration;
+  Duration gap_duration;
+
+  Duration Period() const {
+    return 2 * (transmission_duration + gap_duration);
+  }
+  /// Slots per superframe, slot 0 included, as many as a beacon can describe
+  size_t Slots() const;
+  Duration ContentionSlotDuration() const {
+    return transmission_duration / kContentionSlots;
+  }
+
+  /// When `slot`'s first window next begins, at or after `t`. A session
+  /// starting then, with this superframe's durations, keeps to the slot.
+  TimePoint SlotStartAtOrAfter(size_t slot, TimePoint t) const;
+  /// When the next contention window begins, at or after `t`
+  TimePoint ContentionStartAtOrAfter(TimePoint t) const;
+
+  static Superframe FromBeacon(BeaconPacket const &beacon);
+  /// A beacon from `source` for the superframe beginning at `start`
+  BeaconPacket ToBeacon(WireAddress source, TimePoint start,
+                        BeaconSlotMap const &owners) const;
+};
+
+/// Runs a coordinated network: beacons every superframe, hands out slots to
+/// whoever asks for one, and takes them back once they fall silent.
+///
+/// Slots aren't leased or released: instead, each superframe the coordinator
+/// listens in on one held slot's first window, in turn, and frees a slot that
+/// has gone `idle_checks` checks in a row without a frame. A holder has that
+/// long to get its session going, and must keep an eye on the beacons to
+/// learn that its slot is gone (as ProtocolAgent::FollowNetwork does).
+class TdmaCoordinator {
+public:
+  static constexpr size_t kDefaultIdleChecks = 16;
+
+  /// Runs `radio`, which must outlive the coordinator, on a superframe of
+  /// `transmission_duration` and `gap_duration` (see Superframe)
+  TdmaCoordinator(WireAddress address, RadioInterface &radio,
+                  Duration transmission_duration, Duration gap_duration,
+                  size_t idle_checks = kDefaultIdleChecks);
+
+  /// Runs the coordinator's part of the next superframe: its beacon, a check
+  /// on a held slot and the contention window. Returns once the window closes.
+  void RunSuperframe();
+
+  Superframe const &superframe() const { return frame_; }
+  /// Who holds `slot`, or 0 if nobody does
+  WireAddress Owner(size_t slot) const { return owners_[slot]; }
+  /// Slots handed out so far, and taken back for want of use
+  uint64_t Granted() const { return granted_; }
+  uint64_t Reclaimed() const { return reclaimed_; }
+
+private:
+  /// Gives `requester` a slot, unless it has one already or there are none
+  void Grant(WireAddress requester);
+  /// Listens in on the next held slot after the last one checked, in the
+  /// superframe beginning at `start`
+  void CheckNextSlot(TimePoint start);
+
+  WireAddress address_;
+  RadioInterface &radio_;
+  Superframe frame_;
+  size_t idle_checks_;
+  BeaconSlotMap owners_{};
+  // Checks in a row that each held slot has gone without a frame
+  std::array<size_t, kBeaconSlots> missed_checks_{};
+  size_t last_checked_{0};
+  uint64_t granted_{0};
+  uint64_t reclaimed_{0};
+};
+
+/// A node's view of a coordinated network: follows its beacons, and contends
+/// for a slot of its own when it wants to initiate sessions.
+class TdmaMember {
+public:
+  /// After each request that goes unanswered, a member sits out up to twice as
+  /// many superframes as before, picked at random, up to 2^this
+  static constexpr size_t kMaxBackoffExponent = 4;
+
+  /// `radio` must outlive the member
+  TdmaMember(WireAddress address, RadioInterface &radio);
+
+  /// Listens for the next beacon, until `deadline`. The first coordinator
+  /// heard is the one followed from then on. Returns whether one came.
+  bool ListenForBeacon(TimePoint deadline);
+  /// Contends for a slot, once a superframe (backing off after each miss),
+  /// until a beacon shows one granted or `deadline` passes. Returns the slot.
+  std::optional<size_t> AcquireSlot(TimePoint deadline);
+
+  /// The superframe, from the last beacon heard; nullopt before the first
+  std::optional<Superframe> const &superframe() const { return frame_; }
+  /// Our slot, as of the last beacon heard
+  std::optional<size_t> slot() const { return slot_; }
+
+private:
+  // Listening begins this long before a beacon is due, to be sure of its start
+  static constexpr Duration kBeaconGuard{std::chrono::milliseconds(1)};
+
+  /// Sends a slot request in a random mini-slot of the contention window
+  /// `superframes_out` superframes after the next; false, having sent
+  /// nothing, if that's past `deadline`
+  bool RequestSlot(size_t superframes_out, TimePoint deadline);
+
+  WireAddress address_;
+  RadioInterface &radio_;
+  WireAddress coordinator_{0};
+  std::optional<Superframe> frame_{};
+  std::optional<size_t> slot_{};
+  std::minstd_rand rng_;
+};
+
+} // namespace lora_chat
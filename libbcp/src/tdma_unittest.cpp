@@ -0,0 +1,181 @@
+#include "tdma.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "protocol_agent.hpp"
+#include "test_utils.hpp"
+#include "wire_packet.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::Duration;
+using lora_chat::ProtocolAgent;
+using lora_chat::Superframe;
+using lora_chat::TdmaCoordinator;
+using lora_chat::TdmaMember;
+using lora_chat::TimePoint;
+using lora_chat::testutils::LocalRadio;
+using std::chrono::milliseconds;
+
+constexpr auto kTransmitTime = milliseconds(20);
+constexpr auto kGapTime = milliseconds(60);
+
+// Runs a coordinator on its own thread for as long as it's in scope
+class RunningCoordinator {
+public:
+  RunningCoordinator(TdmaCoordinator &coordinator)
+      : thread_([this, &coordinator]() {
+          while (!stopping_)
+            coordinator.RunSuperframe();
+        }) {}
+  ~RunningCoordinator() {
+    stopping_ = true;
+    thread_.join();
+  }
+
+private:
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+TEST(Superframe, SlotsNeverOverlap) {
+  const Superframe frame{lora_chat::Now(), kTransmitTime, kGapTime};
+  ASSERT_EQ(frame.Slots(), 4u);
+
+  // Both windows of every slot, the beacon and contention window included
+  const TimePoint t = frame.epoch + 6 * frame.Period();
+  std::vector<std::pair<TimePoint, TimePoint>> windows{};
+  for (size_t slot = 0; slot < frame.Slots(); slot++) {
+    const TimePoint start = frame.SlotStartAtOrAfter(slot, t);
+    EXPECT_GE(start, t);
+    EXPECT_LT(start, t + frame.Period());
+    const TimePoint reply = start + kTransmitTime + kGapTime;
+    windows.emplace_back(start, start + kTransmitTime);
+    windows.emplace_back(reply, reply + kTransmitTime);
+  }
+  EXPECT_EQ(frame.ContentionStartAtOrAfter(frame.SlotStartAtOrAfter(0, t)),
+            windows[1].first);
+
+  std::sort(windows.begin(), windows.end());
+  for (size_t i = 1; i < windows.size(); i++)
+    EXPECT_LE(windows[i - 1].second, windows[i].first) << i;
+  // ... and the last is done before the first comes round again
+  EXPECT_LE(windows.back().second, windows.front().first + frame.Period());
+
+  // However big the gap, a beacon only has room for so many
+  const Superframe wide{frame.epoch, kTransmitTime, 100 * kTransmitTime};
+  EXPECT_EQ(wide.Slots(), lora_chat::kBeaconSlots);
+}
+
+TEST(Superframe, TravelsInABeacon) {
+  const Superframe frame{lora_chat::Now(), kTransmitTime, kGapTime};
+  lora_chat::BeaconSlotMap owners{7, 0, 9};
+  auto w_beacon = lora_chat::Serialize(frame.ToBeacon(7, frame.epoch, owners));
+
+  lora_chat::ReceiveBuffer received{};
+  std::copy(w_beacon.begin(), w_beacon.end(), received.buffer.begin());
+  auto beacon = lora_chat::Deserialize<lora_chat::PacketType::kBeacon>(received);
+  ASSERT_TRUE(beacon.has_value());
+  EXPECT_EQ(beacon->source_address, 7u);
+  EXPECT_EQ(beacon->slot_owners, owners);
+
+  const Superframe heard = Superframe::FromBeacon(*beacon);
+  EXPECT_EQ(heard.transmission_duration, kTransmitTime);
+  EXPECT_EQ(heard.gap_duration, kGapTime);
+  // Give or take the trip through the wall clock
+  EXPECT_LT(std::chrono::abs(heard.epoch - frame.epoch), milliseconds(1));
+}
+
+TEST(Tdma, MembersGetSlotsOfTheirOwn) {
+  LocalRadio radio(milliseconds(5));
+  TdmaCoordinator coordinator(1, radio, kTransmitTime, kGapTime);
+  std::optional<size_t> first{};
+  std::optional<size_t> second{};
+  {
+    RunningCoordinator running(coordinator);
+    TdmaMember a(10, radio);
+    TdmaMember b(11, radio);
+    first = a.AcquireSlot(lora_chat::Now() + milliseconds(3000));
+    second = b.AcquireSlot(lora_chat::Now() + milliseconds(3000));
+
+    // Anyone listening learns the schedule, slot or no slot
+    TdmaMember c(12, radio);
+    ASSERT_TRUE(c.ListenForBeacon(lora_chat::Now() + milliseconds(1000)));
+    ASSERT_TRUE(c.superframe().has_value());
+    EXPECT_EQ(c.superframe()->Period(), coordinator.superframe().Period());
+    EXPECT_FALSE(c.slot().has_value());
+  }
+
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(second.has_value());
+  EXPECT_NE(*first, *second);
+  EXPECT_NE(*first, 0u);
+  EXPECT_NE(*second, 0u);
+  EXPECT_EQ(coordinator.Owner(*first), 10u);
+  EXPECT_EQ(coordinator.Owner(*second), 11u);
+  EXPECT_EQ(coordinator.Granted(), 2u);
+}
+
+TEST(Tdma, ReclaimsSilentSlots) {
+  LocalRadio radio(milliseconds(5));
+  constexpr size_t kIdleChecks = 2;
+  TdmaCoordinator coordinator(1, radio, kTransmitTime, kGapTime, kIdleChecks);
+  TdmaMember member(10, radio);
+  std::optional<size_t> slot{};
+  {
+    RunningCoordinator running(coordinator);
+    slot = member.AcquireSlot(lora_chat::Now() + milliseconds(3000));
+    ASSERT_TRUE(slot.has_value());
+    // Nothing's ever sent in it, so it's checked and found idle each time
+    std::this_thread::sleep_for((kIdleChecks + 1) *
+                                coordinator.superframe().Period());
+    ASSERT_TRUE(member.ListenForBeacon(lora_chat::Now() + milliseconds(1000)));
+    EXPECT_FALSE(member.slot().has_value());
+  }
+  EXPECT_EQ(coordinator.Owner(*slot), 0u);
+  EXPECT_EQ(coordinator.Reclaimed(), 1u);
+}
+
+TEST(Tdma, AnAdvertiserNoticesItsSlotTakenBack) {
+  LocalRadio radio(milliseconds(5));
+  // Long enough that the newcomer, silent too, keeps the slot it's given
+  // until the test is through
+  constexpr size_t kIdleChecks = 8;
+  TdmaCoordinator coordinator(1, radio, kTransmitTime, kGapTime, kIdleChecks);
+  TdmaMember holder(10, radio);
+  lora_chat::MessagePipe pipe{};
+  ProtocolAgent agent{10, radio, pipe};
+  agent.SetGoal(ProtocolAgent::ConnectionGoal::kAdvertiseConnection);
+  std::optional<size_t> first{};
+  std::optional<size_t> taken_by{};
+  {
+    RunningCoordinator running(coordinator);
+    first = holder.AcquireSlot(lora_chat::Now() + milliseconds(3000));
+    ASSERT_TRUE(first.has_value());
+    agent.FollowNetwork(holder);
+    EXPECT_EQ(agent.slot(), first);
+
+    // Waiting on a peer, the advertiser is silent in its slot, which is
+    // reclaimed and handed to the next to ask
+    std::this_thread::sleep_for((kIdleChecks + 1) *
+                                coordinator.superframe().Period());
+    TdmaMember newcomer(11, radio);
+    taken_by = newcomer.AcquireSlot(lora_chat::Now() + milliseconds(3000));
+    ASSERT_EQ(taken_by, first);
+
+    // The next round of advertising finds out, and gets another
+    agent.ExecuteAgentAction();
+  }
+  ASSERT_TRUE(agent.slot().has_value());
+  EXPECT_NE(agent.slot(), first);
+  EXPECT_EQ(coordinator.Owner(*first), 11u);
+  EXPECT_EQ(coordinator.Owner(*agent.slot()), 10u);
+}
+
+} // namespace
@@ -4,12 +4,15 @@
 #include <cassert>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <functional>
 #include <limits>
 #include <mutex>
 #include <optional>
 #include <semaphore>
+#include <string>
 #include <thread>
 #include <tuple>
 #include <utility>
@@ -100,6 +103,9 @@ public:
 
   size_t MaximumMessageLength() const { return 1 << 10; }
 
+  // Every transmission takes the same time, whatever its length
+  std::optional<Duration> TimeOnAir(size_t) const override { return timeout_; }
+
 private:
   std::mutex transmission_lock_{};
   std::binary_semaphore transmission_ready_{0};
@@ -142,6 +148,10 @@ public:
 
   size_t MaximumMessageLength() const { return radio_.MaximumMessageLength(); }
 
+  std::optional<Duration> TimeOnAir(size_t frame_bytes) const override {
+    return radio_.TimeOnAir(frame_bytes);
+  }
+
 private:
   LocalRadio radio_;
   int transmission_failure_period_;
@@ -160,9 +170,9 @@ std::optional<lora_chat::SessionPacketPayload> MakeMessage() {
   lora_chat::SessionPacketPayload p{0};
 
   static std::atomic<int> i{0};
-  std::stringstream ss{};
-  ss << Tag.str << " " << i++;
-  std::strcpy(reinterpret_cast<char *>(&p), ss.str().c_str());
+  // snprintf rather than a stringstream, so that sessions driven by this pipe
+  // stay allocation-free
+  std::snprintf(reinterpret_cast<char *>(&p), p.size(), "%s %d", Tag.str, i++);
 
   return std::optional<lora_chat::SessionPacketPayload>(p);
 }
@@ -175,4 +185,19 @@ void ConsumeMessage([[maybe_unused]] lora_chat::SessionPacketPayload &&msg) {
            reinterpret_cast<const char *>(&msg));
 }
 
+/// A fresh directory under /tmp, named for `prefix`, removed with everything
+/// in it when the test's done
+class TempDir {
+public:
+  explicit TempDir(const char *prefix) {
+    std::string templ = std::string("/tmp/") + prefix + "-XXXXXX";
+    path_ = mkdtemp(templ.data());
+  }
+  ~TempDir() { std::filesystem::remove_all(path_); }
+  std::string const &path() const { return path_; }
+
+private:
+  std::string path_;
+};
+
 } // namespace lora_chat::testutils
@@ -50,6 +50,11 @@ inline WireTimePoint GetFutureWireTime(Duration delay) {
   return FlipBitsIfBigEndian(future_time_count);
 }
 
+/// The wire time at which the local clock will read (or read) `t`
+inline WireTimePoint SerializeWireTime(TimePoint t) {
+  return GetFutureWireTime(t - Now());
+}
+
 inline TimePoint DeserializeWireTime(WireTimePoint t) {
   auto wire_time_count = WireTimeUnit(FlipBitsIfBigEndian(t));
   auto wire_time = WireTimeClock::time_point(wire_time_count);
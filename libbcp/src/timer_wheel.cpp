@@ -0,0 +1,245 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace lora_chat {
+
+namespace {
+
+constexpr uint64_t kHorizonTicks = uint64_t{1}
+                                   << (TimerWheel::kLevels *
+                                       TimerWheel::kSlotBits);
+
+// Ticks spanned by one full rotation of `level`
+constexpr uint64_t RotationMask(int level) {
+  return (uint64_t{1} << ((level + 1) * TimerWheel::kSlotBits)) - 1;
+}
+
+constexpr int SlotIndex(uint64_t tick, int level) {
+  return (tick >> (level * TimerWheel::kSlotBits)) & (TimerWheel::kSlots - 1);
+}
+
+} // namespace
+
+TimerWheel::Timer::~Timer() {
+  if (wheel_) wheel_->Cancel(*this);
+}
+
+TimerWheel::TimerWheel(TimePoint origin)
+    : origin_(origin),
+      timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+  // The timerfd is armed in steady_clock time
+  static_assert(std::chrono::steady_clock::is_steady);
+  if (timer_fd_ < 0) perror("TimerWheel: timerfd_create failed");
+}
+
+TimerWheel::~TimerWheel() {
+  // Orphan anything still scheduled, so that its destructor leaves us be
+  auto orphan = [](Timer *t) {
+    while (t) {
+      Timer *next = t->next_;
+      t->wheel_ = nullptr;
+      t->prev_ = t->next_ = nullptr;
+      t = next;
+    }
+  };
+  for (Timer *head : slots_) orphan(head);
+  orphan(expired_);
+  if (timer_fd_ >= 0) close(timer_fd_);
+}
+
+uint64_t TimerWheel::ToTick(TimePoint t) const {
+  if (t <= origin_) return 0;
+  // Rounded up, so that nothing fires early
+  return std::chrono::ceil<std::chrono::microseconds>(t - origin_).count();
+}
+
+TimePoint TimerWheel::FromTick(uint64_t tick) const {
+  return origin_ + std::chrono::microseconds(tick);
+}
+
+void TimerWheel::Schedule(Timer &timer, TimePoint when) {
+  if (timer.wheel_) timer.wheel_->Cancel(timer);
+
+  timer.wheel_ = this;
+  timer.expiry_ = std::min(ToTick(when), now_ + kHorizonTicks - 1);
+  Insert(timer);
+  size_++;
+
+  if (!armed_ || timer.expiry_ < *armed_) Rearm();
+}
+
+void TimerWheel::Cancel(Timer &timer) {
+  if (!timer.wheel_) return;
+  assert(timer.wheel_ == this && "timer belongs to another wheel");
+  Unlink(timer);
+  timer.wheel_ = nullptr;
+  size_--;
+  // The timerfd may now go off early, which costs a spurious wakeup; cheaper
+  // than recomputing the next event on every cancellation
+}
+
+void TimerWheel::Insert(Timer &timer) {
+  if (timer.expiry_ <= now_) {
+    Link(timer, kExpiredSlot);
+    return;
+  }
+  // File under the most significant byte in which the expiry differs from
+  // now; its slot index there is necessarily ahead of now's
+  int level = (63 - std::countl_zero(timer.expiry_ ^ now_)) / kSlotBits;
+  assert(level < kLevels);
+  Link(timer, level * kSlots + SlotIndex(timer.expiry_, level));
+}
+
+void TimerWheel::Link(Timer &timer, uint16_t slot) {
+  timer.slot_ = slot;
+  if (slot == kExpiredSlot) {
+    // Appended, so that due timers fire in the order they fell due
+    timer.prev_ = expired_tail_;
+    timer.next_ = nullptr;
+    if (expired_tail_) expired_tail_->next_ = &timer;
+    else expired_ = &timer;
+    expired_tail_ = &timer;
+    return;
+  }
+
+  Timer *&head = slots_[slot];
+  timer.prev_ = nullptr;
+  timer.next_ = head;
+  if (head) head->prev_ = &timer;
+  head = &timer;
+  occupied_[slot / kSlots][(slot % kSlots) / 64] |= uint64_t{1} << (slot % 64);
+}
+
+void TimerWheel::Unlink(Timer &timer) {
+  const bool expired = timer.slot_ == kExpiredSlot;
+  Timer *&head = expired ? expired_ : slots_[timer.slot_];
+
+  if (timer.prev_) timer.prev_->next_ = timer.next_;
+  else head = timer.next_;
+  if (timer.next_) timer.next_->prev_ = timer.prev_;
+  else if (expired) expired_tail_ = timer.prev_;
+  timer.prev_ = timer.next_ = nullptr;
+
+  if (!expired && !head) {
+    auto slot = timer.slot_;
+    occupied_[slot / kSlots][(slot % kSlots) / 64] &=
+        ~(uint64_t{1} << (slot % 64));
+  }
+}
+
+void TimerWheel::Cascade(int level) {
+  const uint16_t slot = level * kSlots + SlotIndex(now_, level);
+  Timer *t = slots_[slot];
+  if (!t) return;
+
+  slots_[slot] = nullptr;
+  occupied_[level][(slot % kSlots) / 64] &= ~(uint64_t{1} << (slot % 64));
+  while (t) {
+    Timer *next = t->next_;
+    Insert(*t);
+    t = next;
+  }
+}
+
+int TimerWheel::NextOccupiedSlot(int level, int after) const {
+  for (int word = (after + 1) / 64; word < static_cast<int>(kSlots / 64);
+       word++) {
+    uint64_t bits = occupied_[level][word];
+    if (word == (after + 1) / 64) bits &= ~uint64_t{0} << ((after + 1) % 64);
+    if (bits) return word * 64 + std::countr_zero(bits);
+  }
+  return -1;
+}
+
+std::optional<uint64_t> TimerWheel::NextEventTick() const {
+  if (expired_) return now_;
+  // Every slot at a level starts later than every slot at the levels below
+  // it, so the first occupied slot found is the next event
+  for (int level = 0; level < kLevels; level++) {
+    int slot = NextOccupiedSlot(level, SlotIndex(now_, level));
+    if (slot >= 0)
+      return (now_ & ~RotationMask(level)) +
+             (static_cast<uint64_t>(slot) << (level * kSlotBits));
+  }
+  return {};
+}
+
+std::optional<TimePoint> TimerWheel::NextEvent() const {
+  auto tick = NextEventTick();
+  if (!tick) return {};
+  return FromTick(*tick);
+}
+
+size_t TimerWheel::Advance(TimePoint now) {
+  const uint64_t target =
+      (now <= origin_)
+          ? 0
+          : std::chrono::duration_cast<std::chrono::microseconds>(now - origin_)
+                .count();
+
+  size_t fired = 0;
+  while (true) {
+    while (expired_) {
+      Timer &timer = *expired_;
+      Unlink(timer);
+      timer.wheel_ = nullptr;
+      size_--;
+      fired++;
+      // May schedule more timers, possibly onto the expired list
+      timer.callback_(timer.ctx_);
+    }
+
+    auto next = NextEventTick();
+    if (!next || *next > target) break;
+    // Jump straight to the next slot boundary with anything in it. Slots
+    // starting there get re-filed from the top down, and level 0's slot (all
+    // due exactly now) ends up on the expired list.
+    now_ = *next;
+    for (int level = kLevels - 1; level >= 0; level--)
+      Cascade(level);
+  }
+  // Nothing is due before the next event, so skipping ahead is safe
+  now_ = std::max(now_, target);
+
+  Rearm();
+  return fired;
+}
+
+size_t TimerWheel::Dispatch() {
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) ==
+      sizeof(expirations))
+    armed_.reset();
+  return Advance(Now());
+}
+
+void TimerWheel::Rearm() {
+  auto next = NextEventTick();
+  if (next == armed_) return;
+  armed_ = next;
+
+  itimerspec spec{};
+  if (next) {
+    auto when = FromTick(*next).time_since_epoch();
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(when);
+    spec.it_value.tv_sec = secs.count();
+    spec.it_value.tv_nsec =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(when - secs)
+            .count();
+    // An all-zero it_value would disarm the timer instead
+    if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+      spec.it_value.tv_nsec = 1;
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    perror("TimerWheel: timerfd_settime failed");
+}
+
+} // namespace lora_chat
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "time.hpp"
+
+namespace lora_chat {
+
+/// A hierarchical timing wheel with microsecond ticks: six levels of 256
+/// slots, each level covering 256 times the span of the one below, for a
+/// horizon of 2^48us (~9 years). Scheduling and cancelling are O(1); each
+/// timer is cascaded down at most once per level before it fires.
+///
+/// Timers are intrusive and owned by the caller, so the wheel never
+/// allocates. Everything is single-threaded: callbacks run from Advance (or
+/// Dispatch), and may freely schedule or cancel any timer, themselves
+/// included.
+///
+/// The wheel keeps a timerfd armed for its next event, so that one poll/epoll
+/// loop can wait on all of its deadlines at once.
+class TimerWheel {
+public:
+  using Callback = void (*)(void *ctx);
+
+  class Timer {
+  public:
+    Timer(Callback callback, void *ctx) : callback_(callback), ctx_(ctx) {}
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    /// Cancels the timer if it's still scheduled
+    ~Timer();
+
+    bool Scheduled() const { return wheel_ != nullptr; }
+
+  private:
+    friend TimerWheel;
+
+    Callback callback_;
+    void *ctx_;
+
+    TimerWheel *wheel_{nullptr};
+    Timer *prev_{nullptr};
+    Timer *next_{nullptr};
+    uint64_t expiry_{0};
+    uint16_t slot_{0};
+  };
+
+  static constexpr int kLevels = 6;
+  static constexpr int kSlotBits = 8;
+  static constexpr size_t kSlots = 1 << kSlotBits;
+  static constexpr Duration kResolution = std::chrono::microseconds(1);
+
+  explicit TimerWheel(TimePoint origin = Now());
+  ~TimerWheel();
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  /// Schedules `timer` to fire at `when`, rescheduling it if it already was.
+  /// Times at or before the wheel's current time fire on the next Advance;
+  /// times past the horizon are pulled in to it.
+  void Schedule(Timer &timer, TimePoint when);
+  void Cancel(Timer &timer);
+
+  /// Fires, in expiry order, every timer due at or before `now`.
+  /// Returns how many fired.
+  size_t Advance(TimePoint now = Now());
+
+  /// The earliest time at which Advance might have work to do, or nullopt if
+  /// no timers are scheduled. May be earlier than the next expiry: timers
+  /// far in the future are re-filed on the way.
+  std::optional<TimePoint> NextEvent() const;
+
+  size_t size() const { return size_; }
+
+  /// Readable once NextEvent has passed, for use with poll/epoll
+  int Fd() const { return timer_fd_; }
+  /// Clears the timerfd and advances to the current time
+  size_t Dispatch();
+
+private:
+  // Slot ids past the wheel itself
+  static constexpr uint16_t kExpiredSlot = kLevels * kSlots;
+
+  uint64_t ToTick(TimePoint t) const;
+  TimePoint FromTick(uint64_t tick) const;
+
+  void Insert(Timer &timer);
+  void Link(Timer &timer, uint16_t slot);
+  void Unlink(Timer &timer);
+  void Cascade(int level);
+  int NextOccupiedSlot(int level, int after) const;
+  std::optional<uint64_t> NextEventTick() const;
+  void Rearm();
+
+  TimePoint origin_;
+  // Every timer with an expiry at or before this tick has been moved to the
+  // expired list (and most likely fired)
+  uint64_t now_{0};
+  size_t size_{0};
+
+  std::array<Timer *, kLevels * kSlots> slots_{};
+  // One bit per slot, set while the slot's list is non-empty
+  std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied_{};
+  // Due timers waiting to be fired by the current Advance
+  Timer *expired_{nullptr};
+  Timer *expired_tail_{nullptr};
+
+  int timer_fd_;
+  // Tick the timerfd is armed for, if any
+  std::optional<uint64_t> armed_{};
+};
+
+} // namespace lora_chat
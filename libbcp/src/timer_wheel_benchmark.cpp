@@ -0,0 +1,75 @@
+#include "timer_wheel.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+using lora_chat::TimerWheel;
+using Clock = std::chrono::steady_clock;
+
+// Roughly a gateway's worth of peers, each with a few outstanding deadlines
+constexpr int kTimerCounts[] = {10000, 100000, 1000000};
+// Deadlines land within the next minute, like slot and handshake timeouts
+constexpr uint32_t kHorizonUs = 60 * 1000 * 1000;
+
+double NanosecondsSince(Clock::time_point start, int n) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() / n;
+}
+
+void Count(void *ctx) { (*static_cast<size_t *>(ctx))++; }
+
+void Run(int count) {
+  std::mt19937 rng(static_cast<uint32_t>(count));
+  std::vector<uint32_t> delays_us(count);
+  for (auto &d : delays_us) d = 1 + rng() % kHorizonUs;
+
+  size_t fired = 0;
+  std::vector<std::unique_ptr<TimerWheel::Timer>> timers{};
+  timers.reserve(count);
+  for (int i = 0; i < count; i++)
+    timers.push_back(std::make_unique<TimerWheel::Timer>(Count, &fired));
+
+  const auto origin = lora_chat::Now();
+  TimerWheel wheel{origin};
+
+  auto start = Clock::now();
+  for (int i = 0; i < count; i++)
+    wheel.Schedule(*timers[i], origin + std::chrono::microseconds(delays_us[i]));
+  double insert_ns = NanosecondsSince(start, count);
+
+  // Push every deadline back a little, as a session does each slot
+  start = Clock::now();
+  for (int i = 0; i < count; i++)
+    wheel.Schedule(*timers[i],
+                   origin + std::chrono::microseconds(delays_us[i] + 1000));
+  double reschedule_ns = NanosecondsSince(start, count);
+
+  // Then walk the clock forward in 1ms steps, as an event loop would
+  start = Clock::now();
+  for (auto t = origin; wheel.size(); t += std::chrono::milliseconds(1))
+    wheel.Advance(t);
+  double fire_ns = NanosecondsSince(start, count);
+
+  // And the cost of cancelling
+  for (int i = 0; i < count; i++)
+    wheel.Schedule(*timers[i], origin + std::chrono::microseconds(delays_us[i]));
+  start = Clock::now();
+  for (int i = 0; i < count; i++) wheel.Cancel(*timers[i]);
+  double cancel_ns = NanosecondsSince(start, count);
+
+  printf("%8d timers: insert %6.1f ns, reschedule %6.1f ns, "
+         "fire %6.1f ns, cancel %6.1f ns (per timer, %zu fired)\n",
+         count, insert_ns, reschedule_ns, fire_ns, cancel_ns, fired);
+}
+
+} // namespace
+
+int main() {
+  for (int count : kTimerCounts) Run(count);
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <poll.h>
+
+#include "session.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+using lora_chat::Duration;
+using lora_chat::TimePoint;
+using lora_chat::TimerWheel;
+using std::chrono::hours;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+// Records the order in which timers fire
+struct Firing {
+  std::vector<int> *order;
+  int id;
+};
+
+void RecordFiring(void *ctx) {
+  auto *f = static_cast<Firing *>(ctx);
+  f->order->push_back(f->id);
+}
+
+TEST(TimerWheel, FiresInOrderAcrossLevels) {
+  const TimePoint origin = lora_chat::Now();
+  TimerWheel wheel{origin};
+  std::vector<int> order{};
+
+  // One per level, plus a couple sharing a slot, scheduled out of order
+  const std::vector<Duration> delays{
+      hours(5),         seconds(20),      microseconds(1), milliseconds(70),
+      microseconds(300), microseconds(301), hours(24 * 400)};
+  std::vector<Firing> firings{};
+  for (size_t i = 0; i < delays.size(); i++)
+    firings.push_back({&order, static_cast<int>(i)});
+  std::vector<std::unique_ptr<TimerWheel::Timer>> timers{};
+  for (size_t i = 0; i < delays.size(); i++) {
+    timers.push_back(
+        std::make_unique<TimerWheel::Timer>(RecordFiring, &firings[i]));
+    wheel.Schedule(*timers.back(), origin + delays[i]);
+  }
+  EXPECT_EQ(wheel.size(), delays.size());
+
+  // Nothing fires even a microsecond early
+  auto sorted = delays;
+  std::sort(sorted.begin(), sorted.end());
+  for (size_t i = 0; i < sorted.size(); i++) {
+    // Each step fires the timer before this one
+    EXPECT_EQ(wheel.Advance(origin + sorted[i] - microseconds(1)), i ? 1u : 0u)
+        << "just before the timer at " << sorted[i].count() << "ns";
+  }
+
+  EXPECT_EQ(wheel.Advance(origin + hours(24 * 401)), 1u);
+  EXPECT_EQ(order, (std::vector<int>{2, 4, 5, 3, 1, 0, 6}));
+  EXPECT_EQ(wheel.size(), 0u);
+  EXPECT_FALSE(wheel.NextEvent());
+}
+
+TEST(TimerWheel, CancelAndReschedule) {
+  const TimePoint origin = lora_chat::Now();
+  TimerWheel wheel{origin};
+  std::vector<int> order{};
+  Firing a_f{&order, 1}, b_f{&order, 2}, c_f{&order, 3};
+  TimerWheel::Timer a{RecordFiring, &a_f};
+  TimerWheel::Timer b{RecordFiring, &b_f};
+
+  wheel.Schedule(a, origin + milliseconds(10));
+  wheel.Schedule(b, origin + milliseconds(20));
+  wheel.Cancel(a);
+  EXPECT_FALSE(a.Scheduled());
+  // Pulled in, past the cancelled one
+  wheel.Schedule(b, origin + milliseconds(5));
+  {
+    // Goes out of scope scheduled, which cancels it
+    TimerWheel::Timer c{RecordFiring, &c_f};
+    wheel.Schedule(c, origin + milliseconds(1));
+  }
+  EXPECT_EQ(wheel.size(), 1u);
+
+  EXPECT_EQ(wheel.Advance(origin + seconds(1)), 1u);
+  EXPECT_EQ(order, (std::vector<int>{2}));
+}
+
+struct Periodic {
+  TimerWheel *wheel;
+  TimerWheel::Timer *timer;
+  TimePoint next;
+  Duration period;
+  int remaining;
+};
+
+void Reschedule(void *ctx) {
+  auto *p = static_cast<Periodic *>(ctx);
+  if (!--p->remaining) return;
+  p->next += p->period;
+  p->wheel->Schedule(*p->timer, p->next);
+}
+
+TEST(TimerWheel, CallbacksMayReschedule) {
+  const TimePoint origin = lora_chat::Now();
+  TimerWheel wheel{origin};
+  Periodic periodic{&wheel, nullptr, origin + milliseconds(1), milliseconds(1),
+                    100};
+  TimerWheel::Timer timer{Reschedule, &periodic};
+  periodic.timer = &timer;
+  wheel.Schedule(timer, periodic.next);
+
+  // All one hundred firings happen within a single Advance
+  EXPECT_EQ(wheel.Advance(origin + seconds(1)), 100u);
+  EXPECT_FALSE(timer.Scheduled());
+}
+
+struct Checked {
+  TimePoint expiry;
+  TimePoint *now;
+  TimePoint *last_fired;
+  int *fired;
+};
+
+void CheckFiring(void *ctx) {
+  auto *c = static_cast<Checked *>(ctx);
+  EXPECT_LE(c->expiry, *c->now) << "fired early";
+  EXPECT_GE(c->expiry, *c->last_fired) << "fired out of order";
+  *c->last_fired = c->expiry;
+  (*c->fired)++;
+}
+
+TEST(TimerWheel, MatchesReferenceOrder) {
+  const TimePoint origin = lora_chat::Now();
+  TimerWheel wheel{origin};
+  std::mt19937 rng{99};
+
+  constexpr int kTimers = 10000;
+  TimePoint now = origin;
+  TimePoint last_fired = origin;
+  int fired = 0;
+  std::vector<Checked> checks(kTimers);
+  std::vector<std::unique_ptr<TimerWheel::Timer>> timers{};
+  for (int i = 0; i < kTimers; i++) {
+    // Spread over six orders of magnitude, rounded to whole microseconds
+    auto delay = microseconds(1 + rng() % (1 << (4 + rng() % 24)));
+    checks[i] = {origin + delay, &now, &last_fired, &fired};
+    timers.push_back(std::make_unique<TimerWheel::Timer>(CheckFiring, &checks[i]));
+    wheel.Schedule(*timers.back(), checks[i].expiry);
+  }
+  // Cancel a tenth of them
+  int cancelled = 0;
+  for (int i = 0; i < kTimers; i += 10, cancelled++)
+    wheel.Cancel(*timers[i]);
+
+  while (wheel.size()) {
+    now += microseconds(rng() % 200000);
+    wheel.Advance(now);
+  }
+  EXPECT_EQ(fired, kTimers - cancelled);
+}
+
+TEST(TimerWheel, TimerFdWakesForNextEvent) {
+  TimerWheel wheel{};
+  std::vector<int> order{};
+  Firing f{&order, 7};
+  TimerWheel::Timer timer{RecordFiring, &f};
+
+  pollfd pfd{.fd = wheel.Fd(), .events = POLLIN, .revents = 0};
+  const auto deadline = lora_chat::Now() + milliseconds(20);
+  wheel.Schedule(timer, deadline);
+  EXPECT_EQ(poll(&pfd, 1, 0), 0);
+  // The wheel may wake early to re-file the timer on its way down
+  while (order.empty()) {
+    ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+    wheel.Dispatch();
+  }
+  EXPECT_GE(lora_chat::Now(), deadline);
+  EXPECT_EQ(order, (std::vector<int>{7}));
+  // Nothing left, so the timerfd is disarmed
+  EXPECT_EQ(poll(&pfd, 1, 50), 0);
+}
+
+TEST(TimerWheel, SessionSchedulesPastGaps) {
+  constexpr auto kTransmitTime = milliseconds(10);
+  constexpr auto kGapTime = milliseconds(5);
+  const TimePoint start = lora_chat::Now();
+  lora_chat::Session session{start, 0, kTransmitTime, kGapTime, true};
+
+  TimerWheel wheel{start};
+  std::vector<int> order{};
+  Firing f{&order, 0};
+  TimerWheel::Timer timer{RecordFiring, &f};
+  // We're transmitting now; the next thing to do is receive, after the gap
+  session.ScheduleNextAction(wheel, timer);
+  EXPECT_EQ(wheel.Advance(start + kTransmitTime + kGapTime - microseconds(2)),
+            0u);
+  EXPECT_EQ(wheel.Advance(start + kTransmitTime + kGapTime), 1u);
+}
+
+} // namespace
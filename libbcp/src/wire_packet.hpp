@@ -52,6 +52,7 @@ template <PacketType Pt>
 using NewWirePacket = std::array<uint8_t, WirePacketWidthBytes<Pt>()>;
 using WireSessionPacket = NewWirePacket<PacketType::kSession>;
 using WireAdvertisingPacket = NewWirePacket<PacketType::kAdvertising>;
+using WireBeaconPacket = NewWirePacket<PacketType::kBeacon>;
 
 struct __attribute__ ((packed)) ReceiveBuffer {
   using value_type = uint8_t;
@@ -105,21 +106,27 @@ static_assert(AllFieldInvariantsAreSatisfied<PacketType::kSession>());
 static_assert(AllFieldInvariantsAreSatisfied<PacketType::kAdvertising>());
 static_assert(AllFieldInvariantsAreSatisfied<PacketType::kConnectionAccept>());
 static_assert(AllFieldInvariantsAreSatisfied<PacketType::kConnectionRequest>());
+static_assert(AllFieldInvariantsAreSatisfied<PacketType::kBeacon>());
+static_assert(AllFieldInvariantsAreSatisfied<PacketType::kSlotRequest>());
 static_assert(WirePacketWidthBytes<PacketType::kSession>() <= SX127x_FIFO_CAPACITY);
 static_assert(WirePacketWidthBytes<PacketType::kAdvertising>() <= SX127x_FIFO_CAPACITY);
 static_assert(WirePacketWidthBytes<PacketType::kConnectionAccept>() <= SX127x_FIFO_CAPACITY);
 static_assert(WirePacketWidthBytes<PacketType::kConnectionRequest>() <= SX127x_FIFO_CAPACITY);
-static_assert(static_cast<size_t>(kFinalPacketType) == 3);  // As a reminder
+static_assert(WirePacketWidthBytes<PacketType::kBeacon>() <= SX127x_FIFO_CAPACITY);
+static_assert(WirePacketWidthBytes<PacketType::kSlotRequest>() <= SX127x_FIFO_CAPACITY);
+static_assert(static_cast<size_t>(kFinalPacketType) == 5);  // As a reminder
                                                             // until I
                                                             // un-hard-code this
 
+/// Serializes the first `num_fields` fields of `packet` into `buffer`, which
+/// must hold at least WirePacketWidthBytes<Pt>(). Fields past those are left
+/// untouched, e.g. a payload which was written into place beforehand.
 template <PacketType Pt>
-NewWirePacket<Pt> Serialize(Packet<Pt> const &packet) {
+void SerializeInto(Packet<Pt> const &packet, std::span<uint8_t> buffer,
+                   size_t num_fields = static_cast<size_t>(Packet<Pt>::kFinalField) + 1) {
   using Field = typename Packet<Pt>::Field;
-  constexpr Field kFinalField = Packet<Pt>::kFinalField;
   constexpr auto kBitOffset = kWirePacketTagBits;
-
-  NewWirePacket<Pt> buffer{};
+  assert(buffer.size_bytes() >= WirePacketWidthBytes<Pt>());
 
   // TODO allow non-byte-sized tags
   static_assert((kWirePacketTagBits % 8) == 0);
@@ -127,7 +134,7 @@ NewWirePacket<Pt> Serialize(Packet<Pt> const &packet) {
   std::memcpy(&buffer[0], &tag, sizeof(tag));
 
   // All fields are byte-aligned for now so just do a simple copy
-  for (size_t i = 0; i <= static_cast<size_t>(kFinalField); i++) {
+  for (size_t i = 0; i < num_fields; i++) {
     auto f = static_cast<Field>(i);
     auto m = packet.FieldMetadata(f);
     uint8_t const* src = packet.GetFieldPointer(f);
@@ -136,7 +143,12 @@ NewWirePacket<Pt> Serialize(Packet<Pt> const &packet) {
     uint8_t* dst = &buffer[(m.starting_bit + kBitOffset) / 8];
     std::memcpy(dst, src, m.length_bits / 8);
   }
+}
 
+template <PacketType Pt>
+NewWirePacket<Pt> Serialize(Packet<Pt> const &packet) {
+  NewWirePacket<Pt> buffer{};
+  SerializeInto(packet, buffer);
   return buffer;
 }
 
@@ -182,11 +194,14 @@ void VisualizeSerializationLayout(std::ostream& os) {
   os << buff;
 }
 
+/// Deserializes the first `num_fields` fields of the packet in `bytes`; the
+/// rest are left zeroed.
 template <PacketType Pt>
-std::optional<Packet<Pt>> DeserializeImpl(std::span<uint8_t const> bytes) {
+std::optional<Packet<Pt>> DeserializeImpl(
+    std::span<uint8_t const> bytes,
+    size_t num_fields = static_cast<size_t>(Packet<Pt>::kFinalField) + 1) {
   using Packet = Packet<Pt>;
   using Field = typename Packet::Field;
-  constexpr Field kFinalField = Packet::kFinalField;
   constexpr auto kBitOffset = kWirePacketTagBits;
 
   if (bytes.size_bytes() < kWirePacketTagBytes)
@@ -200,7 +215,7 @@ std::optional<Packet<Pt>> DeserializeImpl(std::span<uint8_t const> bytes) {
   Packet packet{};
 
   // All fields are byte-aligned for now so just do a simple copy
-  for (size_t i = 0; i <= static_cast<size_t>(kFinalField); i++) {
+  for (size_t i = 0; i < num_fields; i++) {
     auto f = static_cast<Field>(i);
     auto m = Packet::FieldMetadata(f);
     assert((m.starting_bit + kBitOffset) % 8 == 0);  // TODO allow
@@ -214,8 +229,8 @@ std::optional<Packet<Pt>> DeserializeImpl(std::span<uint8_t const> bytes) {
 }
 
 template <PacketType Pt>
-std::optional<Packet<Pt>> Deserialize(ReceiveBuffer bytes) {
-  return DeserializeImpl<Pt>(bytes.span());
+std::optional<Packet<Pt>> Deserialize(ReceiveBuffer const &bytes) {
+  return DeserializeImpl<Pt>({bytes.data(), bytes.size()});
 }
 
 } // namespace lora_chat
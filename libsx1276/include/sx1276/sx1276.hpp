@@ -2,6 +2,9 @@
 
 // TODO make an opaque library wrapper instead
 
+#include "../src/presets.hpp"
+#include "../src/radio_math.hpp"
 #include "../src/radio_operations.hpp"
+#include "../src/spi_calibration.hpp"
 #include "../src/spi_wrappers.hpp"
 #include "../src/sx1276_lora_registers.hpp"
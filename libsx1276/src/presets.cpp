@@ -0,0 +1,122 @@
+#include "presets.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+
+#include "radio_math.hpp"
+
+namespace sx1276 {
+
+namespace {
+
+constexpr Frequency kDefaultFrequency{0xe4c000}; // 915MHz
+
+// Meshtastic frames carry a 16-symbol preamble and a payload CRC.
+// NB we still use our own sync word, so these won't interoperate with actual
+// Meshtastic nodes -- they just borrow the well-trodden modem settings.
+constexpr PacketConfig kMeshtasticPacketConfig{
+  .preamble_symbols = 16,
+  .payload_crc = true,
+  .implicit_header = false,
+};
+
+constexpr Preset kDefaultPreset{
+  "lora-chat",
+  {kDefaultFrequency, Bandwidth::k125kHz, CodingRate::k4_7, SpreadingFactor::kSF9},
+  kDefaultPacketConfig,
+};
+
+constexpr std::array kPresets{
+  Preset{"short-turbo",
+         {kDefaultFrequency, Bandwidth::k500kHz, CodingRate::k4_5, SpreadingFactor::kSF7},
+         kMeshtasticPacketConfig},
+  Preset{"short-fast",
+         {kDefaultFrequency, Bandwidth::k250kHz, CodingRate::k4_5, SpreadingFactor::kSF7},
+         kMeshtasticPacketConfig},
+  Preset{"short-slow",
+         {kDefaultFrequency, Bandwidth::k250kHz, CodingRate::k4_5, SpreadingFactor::kSF8},
+         kMeshtasticPacketConfig},
+  Preset{"medium-fast",
+         {kDefaultFrequency, Bandwidth::k250kHz, CodingRate::k4_5, SpreadingFactor::kSF9},
+         kMeshtasticPacketConfig},
+  Preset{"medium-slow",
+         {kDefaultFrequency, Bandwidth::k250kHz, CodingRate::k4_5, SpreadingFactor::kSF10},
+         kMeshtasticPacketConfig},
+  kDefaultPreset,
+  Preset{"long-fast",
+         {kDefaultFrequency, Bandwidth::k250kHz, CodingRate::k4_5, SpreadingFactor::kSF11},
+         kMeshtasticPacketConfig},
+  Preset{"long-moderate",
+         {kDefaultFrequency, Bandwidth::k125kHz, CodingRate::k4_8, SpreadingFactor::kSF11},
+         kMeshtasticPacketConfig},
+  Preset{"long-slow",
+         {kDefaultFrequency, Bandwidth::k125kHz, CodingRate::k4_8, SpreadingFactor::kSF12},
+         kMeshtasticPacketConfig},
+  Preset{"very-long-slow",
+         {kDefaultFrequency, Bandwidth::k62_5kHz, CodingRate::k4_8, SpreadingFactor::kSF12},
+         kMeshtasticPacketConfig},
+};
+
+bool names_match(std::string_view preset_name, std::string_view name) {
+  if (preset_name.size() != name.size()) return false;
+  for (size_t i = 0; i < name.size(); i++) {
+    char c = std::tolower(static_cast<unsigned char>(name[i]));
+    if (c == '_') c = '-';
+    if (c != preset_name[i]) return false;
+  }
+  return true;
+}
+
+} // namespace
+
+std::span<const Preset> all_presets() {
+  return kPresets;
+}
+
+Preset const& default_preset() {
+  return *find_preset(kDefaultPreset.name);
+}
+
+Preset const* find_preset(std::string_view name) {
+  for (auto const& preset : kPresets)
+    if (names_match(preset.name, name))
+      return &preset;
+  return nullptr;
+}
+
+PresetCharacteristics characterize(Preset const& preset, int frame_bytes) {
+  return {
+    .bitrate_bps = bitrate_bps(preset.channel),
+    .airtime_ms = time_on_air_s(frame_bytes, preset.channel, preset.packet) * 1000,
+    .sensitivity_dbm = sensitivity_dbm(preset.channel),
+  };
+}
+
+float path_loss_db(float distance_m, float frequency_hz, float exponent) {
+  constexpr float kSpeedOfLight = 299792458.0f;
+  constexpr float kReferenceDistanceM = 1.0f;
+  float reference_loss =
+      20 * log10f(4 * M_PI * kReferenceDistanceM * frequency_hz / kSpeedOfLight);
+  distance_m = std::max(distance_m, kReferenceDistanceM);
+  return reference_loss + 10 * exponent * log10f(distance_m / kReferenceDistanceM);
+}
+
+float link_margin_db(Preset const& preset, float tx_power_dbm, float path_loss_db) {
+  return tx_power_dbm - path_loss_db - sensitivity_dbm(preset.channel);
+}
+
+Preset const* select_preset(float tx_power_dbm, float path_loss_db,
+                            float required_margin_db) {
+  Preset const* best = nullptr;
+  for (auto const& preset : kPresets) {
+    if (link_margin_db(preset, tx_power_dbm, path_loss_db) < required_margin_db)
+      continue;
+    if (!best || bitrate_bps(preset.channel) > bitrate_bps(best->channel))
+      best = &preset;
+  }
+  return best;
+}
+
+} // namespace sx1276
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <span>
+#include <string_view>
+
+#include "types.hpp"
+
+namespace sx1276 {
+
+/// A named radio configuration: everything both ends need to agree on in
+/// order to hear each other.
+struct Preset {
+  const char* name;
+  ChannelConfig channel;
+  PacketConfig packet;
+};
+
+/// What a preset buys you, for a frame of a given size.
+struct PresetCharacteristics {
+  float bitrate_bps;
+  float airtime_ms;
+  float sensitivity_dbm;
+};
+
+/// Every preset we know about, ordered from fastest to longest-range. Besides
+/// our original configuration these are the Meshtastic modem presets.
+std::span<const Preset> all_presets();
+
+/// The configuration lora-chat has always used.
+Preset const& default_preset();
+
+/// Looks a preset up by name. Matching ignores case and treats '_' as '-', so
+/// Meshtastic's own spelling ("LONG_FAST") works too.
+Preset const* find_preset(std::string_view name);
+
+PresetCharacteristics characterize(Preset const& preset, int frame_bytes);
+
+/// Log-distance path loss: free space out to 1m, then falling off with
+/// `exponent` (2 for free space, ~2.7-3.5 for suburban, 4+ for indoors).
+float path_loss_db(float distance_m, float frequency_hz, float exponent = 2.0f);
+
+/// How far above the receiver's sensitivity a signal arrives.
+float link_margin_db(Preset const& preset, float tx_power_dbm, float path_loss_db);
+
+/// The highest-bitrate preset which closes the link with at least
+/// `required_margin_db` to spare, or nullptr if none of them do.
+Preset const* select_preset(float tx_power_dbm, float path_loss_db,
+                            float required_margin_db);
+
+} // namespace sx1276
@@ -0,0 +1,104 @@
+#include "presets.hpp"
+#include "radio_math.hpp"
+
+#include <string_view>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using namespace sx1276;
+
+constexpr PacketConfig kCrcOn{
+  .preamble_symbols = 8,
+  .payload_crc = true,
+  .implicit_header = false,
+};
+
+TEST(RadioMath, TimeOnAirMatchesSemtechCalculator) {
+  ChannelConfig sf7{0xe4c000, Bandwidth::k125kHz, CodingRate::k4_5, SpreadingFactor::kSF7};
+  EXPECT_NEAR(time_on_air_s(10, sf7, kCrcOn) * 1000, 41.216, 0.01);
+
+  // Low data-rate optimization kicks in at SF12/125kHz
+  ChannelConfig sf12{0xe4c000, Bandwidth::k125kHz, CodingRate::k4_5, SpreadingFactor::kSF12};
+  EXPECT_TRUE(low_data_rate_optimization_is_mandated(sf12));
+  EXPECT_NEAR(time_on_air_s(10, sf12, kCrcOn) * 1000, 991.232, 0.01);
+
+  // Dropping the header & CRC can only make frames shorter
+  PacketConfig lean{.preamble_symbols = 8, .payload_crc = false, .implicit_header = true};
+  EXPECT_LT(time_on_air_s(10, sf7, lean), time_on_air_s(10, sf7, kCrcOn));
+  // ... and tiny frames at high SFs mustn't wrap around
+  EXPECT_LT(time_on_air_s(1, sf12, lean), time_on_air_s(10, sf12, kCrcOn));
+}
+
+TEST(RadioMath, BitrateAndSensitivity) {
+  ChannelConfig sf12{0xe4c000, Bandwidth::k125kHz, CodingRate::k4_5, SpreadingFactor::kSF12};
+  EXPECT_NEAR(bitrate_bps(sf12), 293, 1);
+  EXPECT_NEAR(sensitivity_dbm(sf12), -137, 0.5);
+  EXPECT_NEAR(frequency_in_hz(0xe4c000), 915e6, 1);
+  EXPECT_EQ(frequency_from_hz(915e6), 0xe4c000u);
+}
+
+TEST(RadioMath, WakeUpPreambleOutlastsTheInterval) {
+  ChannelConfig sf9{0xe4c000, Bandwidth::k125kHz, CodingRate::k4_7, SpreadingFactor::kSF9};
+  // A symbol and a quarter's listening: 4.1ms + 0.26ms
+  EXPECT_NEAR(cad_duration_s(sf9) * 1000, 4.35, 0.01);
+
+  for (float interval_s : {0.1f, 1.0f}) {
+    PacketConfig woken{.preamble_symbols = wake_up_preamble_symbols(interval_s, sf9)};
+    PacketConfig usual{.preamble_symbols = 8};
+    // However the wake-ups fall, one lands on the preamble with the usual
+    // preamble still to come
+    EXPECT_GE(time_on_air_s(10, sf9, woken) - time_on_air_s(10, sf9, usual),
+              interval_s + cad_duration_s(sf9));
+  }
+  // Waking once a second, the receiver's on for well under 1% of the time
+  EXPECT_LT(cad_duration_s(sf9) / 1.0f, 0.01f);
+
+  // Waking once a day is past what the registers hold: it's as long as it'll go
+  ChannelConfig sf12{0xe4c000, Bandwidth::k7_8kHz, CodingRate::k4_5, SpreadingFactor::kSF12};
+  EXPECT_EQ(wake_up_preamble_symbols(86400, sf12), 0xffff);
+}
+
+TEST(RadioMath, PowerSettingsKeepToTheDatasheet) {
+  // What init_lora has always written
+  EXPECT_EQ(pa_config_for_power(kDefaultTxPowerDbm), 0xf8);
+  EXPECT_EQ(ocp_for_power(kDefaultTxPowerDbm), 0x23);
+  EXPECT_EQ(pa_config_for_power(kMaxTxPowerDbm), 0xff);
+  EXPECT_EQ(ocp_for_power(kMaxTxPowerDbm), 0x2b);
+  EXPECT_EQ(pa_config_for_power(kMinTxPowerDbm), 0xf0);
+  // Out of range is as far as it'll go, never wrapped into the PA's bits
+  EXPECT_EQ(pa_config_for_power(20), pa_config_for_power(kMaxTxPowerDbm));
+  EXPECT_EQ(pa_config_for_power(-10), pa_config_for_power(kMinTxPowerDbm));
+}
+
+TEST(Presets, Lookup) {
+  ASSERT_NE(find_preset("long-fast"), nullptr);
+  EXPECT_EQ(find_preset("LONG_FAST"), find_preset("long-fast"));
+  EXPECT_EQ(find_preset("long-fast")->channel.sf, SpreadingFactor::kSF11);
+  EXPECT_EQ(find_preset("nonexistent"), nullptr);
+  EXPECT_EQ(std::string_view(default_preset().name), "lora-chat");
+  EXPECT_EQ(default_preset().channel.sf, SpreadingFactor::kSF9);
+}
+
+TEST(Presets, SelectsFastestPresetThatClosesTheLink) {
+  // Short, clean links get the fastest preset
+  EXPECT_EQ(select_preset(20, 100, 10), find_preset("short-turbo"));
+  // Needs ~-130dBm of sensitivity: SF11 at 250kHz is the quickest way there
+  EXPECT_EQ(select_preset(20, 140, 10), find_preset("long-fast"));
+  // Nothing closes this one
+  EXPECT_EQ(select_preset(20, 200, 10), nullptr);
+
+  // Longer range never buys a faster preset
+  float freq = frequency_in_hz(default_preset().channel.freq);
+  float previous = 1e9;
+  for (float range_m : {10.0f, 100.0f, 1000.0f, 5000.0f}) {
+    auto* preset = select_preset(20, path_loss_db(range_m, freq, 2.7f), 10);
+    ASSERT_NE(preset, nullptr) << range_m;
+    float bitrate = bitrate_bps(preset->channel);
+    EXPECT_LE(bitrate, previous) << range_m;
+    previous = bitrate;
+  }
+}
+
+} // namespace
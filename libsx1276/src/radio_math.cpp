@@ -1,5 +1,6 @@
 #include "radio_math.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
@@ -31,17 +32,27 @@ uint32_t bandwidth_in_hz(Bandwidth bw) {
   return bw;
 }
 
+namespace {
+constexpr float kCrystalOscillatorHz = 32e6;
+constexpr float kFrequencyStepHz = kCrystalOscillatorHz / (1 << 19);
+} // namespace
+
+float frequency_in_hz(Frequency freq) {
+  return freq * kFrequencyStepHz;
+}
+
+Frequency frequency_from_hz(float hz) {
+  return static_cast<Frequency>(lroundf(hz / kFrequencyStepHz));
+}
+
 namespace {
 float symbol_duration_s(ChannelConfig const& config) {
   auto bw_hz = bandwidth_in_hz(config.bw) * 1.0f;
   return (1 << config.sf) / bw_hz;
 }
 
-bool low_data_rate_optimization_is_mandated(ChannelConfig const& config) {
-  return symbol_duration_s(config) > 16e-3;
-}
-
-float payload_length_symbols(uint32_t n_msg, ChannelConfig const& config) {
+float payload_length_symbols(uint32_t n_msg, ChannelConfig const& config,
+                             PacketConfig const& packet) {
   // This computation is all from page 31 of Semtech's datasheet for the SX1276/77/78/79
   // https://semtech.my.salesforce.com/sfc/p/#E0000000JelG/a/2R0000001Rbr/6EfVZUorrpoKFfvaF_Fkpgp5kzjiNyiAbqcpqh9qSjE
   
@@ -49,35 +60,90 @@ float payload_length_symbols(uint32_t n_msg, ChannelConfig const& config) {
   auto adjusted_sf = sf - (low_data_rate_optimization_is_mandated(config) ? 2 : 0);
   auto cr_expansion_factor = cr + 4;
 
-  // 5 is for the explicit header: if we ever start using implicit it goes away
-  auto n_overhead = 2 + (kEnablePayloadCrc ? 4 : 0) + 5;
+  // 5 is for the explicit header
+  auto n_overhead = 2 + (packet.payload_crc ? 4 : 0) +
+                    (packet.implicit_header ? 0 : 5);
   // In the manual this is given with an extra multiple of 4 applied to the
   // numerator and denominator, but AFAICT it's not necessary -- and doesn't
-  // actually get optimized out b/c floating point rules
-  auto base_length = std::max(1.0f, ceilf((2 * n_msg - sf + n_overhead) / adjusted_sf));
+  // actually get optimized out b/c floating point rules.
+  // Keep it signed & floating-point though, so that short frames at high SFs
+  // don't wrap and the division isn't truncated before we round it up.
+  float numerator = 2.0f * n_msg - static_cast<int>(sf) + n_overhead;
+  auto base_length = std::max(0.0f, ceilf(numerator / adjusted_sf));
   auto full_length = 8 + (base_length * cr_expansion_factor);
 
   return full_length;
 }
 
-float preamble_length_symbols() {
-  return kPreambleLengthBytes + 4.25f;
+float preamble_length_symbols(PacketConfig const& packet) {
+  return packet.preamble_symbols + 4.25f;
 }
 
 } // namespace
 
-uint32_t compute_time_on_air_ms(int msg_bytes, ChannelConfig const& config) {
+bool low_data_rate_optimization_is_mandated(ChannelConfig const& config) {
+  return symbol_duration_s(config) > 16e-3;
+}
+
+float time_on_air_s(int msg_bytes, ChannelConfig const& config,
+                    PacketConfig const& packet) {
+  assert(msg_bytes > 0);
+  auto total_symbols = preamble_length_symbols(packet) +
+    payload_length_symbols(static_cast<uint32_t>(msg_bytes), config, packet);
+  return symbol_duration_s(config) * total_symbols;
+}
+
+uint32_t compute_time_on_air_ms(int msg_bytes, ChannelConfig const& config,
+                                PacketConfig const& packet) {
   // Using the raw ToA calculations gave me flaky results -- it might be because
   // we don't/can't wait for the RxDone IRQ?
   // 50 was mostly fine but I noticed a few failures so we're playing it safe.
   constexpr uint32_t kTimeOnAirFudgeFactorMs = 75;
 
-  assert(msg_bytes > 0);
-  auto total_symbols = preamble_length_symbols() +
-    payload_length_symbols(static_cast<uint32_t>(msg_bytes), config);
-  float time_on_air_s = symbol_duration_s(config) * total_symbols;
+  return (time_on_air_s(msg_bytes, config, packet) * 1000) +
+         kTimeOnAirFudgeFactorMs;
+}
+
+float cad_duration_s(ChannelConfig const& config) {
+  return symbol_duration_s(config) + 32.0f / bandwidth_in_hz(config.bw);
+}
+
+uint16_t wake_up_preamble_symbols(float interval_s, ChannelConfig const& config) {
+  // The usual preamble is what the receiver wants left over to lock on
+  auto symbols = ceilf((interval_s + cad_duration_s(config)) /
+                       symbol_duration_s(config)) +
+                 kDefaultPacketConfig.preamble_symbols;
+  return static_cast<uint16_t>(std::min(symbols, 65535.0f));
+}
+
+uint8_t pa_config_for_power(int8_t dbm) {
+  dbm = std::clamp(dbm, kMinTxPowerDbm, kMaxTxPowerDbm);
+  // PaSelect = PA_BOOST; MaxPower only matters on RFO, so it stays at 7
+  return 0x80 | 0x70 | (dbm - kMinTxPowerDbm);
+}
+
+uint8_t ocp_for_power(int8_t dbm) {
+  // OcpOn, with Imax = 45 + 5 * OcpTrim mA: 60mA (what we've always run
+  // with) covers the PA up to 10dBm, and the 100mA reset default covers it
+  // the rest of the way
+  return dbm > kDefaultTxPowerDbm ? 0x2b : 0x23;
+}
+
+float bitrate_bps(ChannelConfig const& config) {
+  float coding_rate = 4.0f / (config.cr + 4);
+  return static_cast<int>(config.sf) * coding_rate / symbol_duration_s(config);
+}
+
+float snr_limit_db(SpreadingFactor sf) {
+  // From the SX1276 datasheet, table 13: -5dB at SF6, falling 2.5dB per step
+  return -5.0f - 2.5f * (static_cast<int>(sf) - SpreadingFactor::kSF6);
+}
 
-  return (time_on_air_s * 1000) + kTimeOnAirFudgeFactorMs;
+float sensitivity_dbm(ChannelConfig const& config) {
+  constexpr float kThermalNoiseDbmPerHz = -174.0f;
+  constexpr float kNoiseFigureDb = 6.0f;
+  return kThermalNoiseDbmPerHz + 10 * log10f(bandwidth_in_hz(config.bw)) +
+         kNoiseFigureDb + snr_limit_db(config.sf);
 }
 
 } // namespace sx1276
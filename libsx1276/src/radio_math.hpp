@@ -4,12 +4,63 @@
 
 namespace sx1276 {
 
-const uint16_t kPreambleLengthBytes = 8;
 const uint8_t kSyncWordValue = 0x12;
-const bool kEnablePayloadCrc = false;
+
+// Output power on PA_BOOST, which is what the module's antenna is wired to.
+// Past 17dBm takes the high-power DAC, which the datasheet only allows at a
+// 1% duty cycle, so we stop short of it.
+constexpr int8_t kMinTxPowerDbm = 2;
+constexpr int8_t kMaxTxPowerDbm = 17;
+// What init_lora has always set
+constexpr int8_t kDefaultTxPowerDbm = 10;
+
+// How long the chip takes, after the op-mode write, to be on air or listening
+// from standby: the synthesizer's wake-up (TS_FS) and then the transmitter's
+// (TS_TR) or receiver's (TS_RE), per the datasheet's timing table, rounded up
+constexpr uint32_t kStandbyToTransmitUs = 180;
+constexpr uint32_t kStandbyToReceiveUs = 310;
+// And to standby from sleep: the crystal oscillator's start-up (TS_OSC)
+constexpr uint32_t kSleepToStandbyUs = 250;
 
 uint32_t bandwidth_in_hz(Bandwidth bw);
 
-uint32_t compute_time_on_air_ms(int msg_bytes, ChannelConfig const& config);
+// The frequency registers count in units of F_XOSC / 2^19 (~61Hz)
+float frequency_in_hz(Frequency freq);
+Frequency frequency_from_hz(float hz);
+
+bool low_data_rate_optimization_is_mandated(ChannelConfig const& config);
+
+/// Exact time-on-air for a single frame, per the datasheet.
+float time_on_air_s(int msg_bytes, ChannelConfig const& config,
+                    PacketConfig const& packet = kDefaultPacketConfig);
+
+/// Time-on-air padded out with enough slack to wait on without an IRQ line.
+uint32_t compute_time_on_air_ms(int msg_bytes, ChannelConfig const& config,
+                                PacketConfig const& packet = kDefaultPacketConfig);
+
+/// How long one channel activity detection keeps the receiver on: a symbol,
+/// plus the processing after it (AN1200.21).
+float cad_duration_s(ChannelConfig const& config);
+
+/// The preamble, in symbols, that a frame needs so that a listener waking
+/// for a CAD once every `interval_s` can't sleep through all of it, and still
+/// has enough of it left to lock on to once it's woken.
+uint16_t wake_up_preamble_symbols(float interval_s, ChannelConfig const& config);
+
+/// RegPaConfig for `dbm` out of PA_BOOST (clamped to the range above):
+/// Pout = 2 + OutputPower dBm
+uint8_t pa_config_for_power(int8_t dbm);
+/// RegOcp for `dbm`: the overcurrent trip, with headroom over what the PA
+/// draws there (datasheet table 8: 87mA at +17dBm)
+uint8_t ocp_for_power(int8_t dbm);
+
+/// The raw (post-FEC) bitrate of the modulation, ignoring framing overhead.
+float bitrate_bps(ChannelConfig const& config);
+
+/// The demodulator's SNR floor for this spreading factor, in dB.
+float snr_limit_db(SpreadingFactor sf);
+
+/// Approximate receiver sensitivity, assuming the SX1276's ~6dB noise figure.
+float sensitivity_dbm(ChannelConfig const& config);
 
 } // namespace sx1276
@@ -1,8 +1,11 @@
 #include "radio_operations.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdio>
 #include <mutex>
+#include <optional>
 #include <utility>
 #include <unordered_map>
 
@@ -13,7 +16,17 @@ constexpr bool verbose { false };
 
 // TODO move this to its own file?
 namespace {
-using ConfigCacheT = std::unordered_map<int, sx1276::ChannelConfig>;
+struct CachedConfig {
+  sx1276::ChannelConfig channel;
+  sx1276::PacketConfig packet;
+  // IrqFlagsMask from before a continuous receive began, to restore after
+  uint8_t saved_irq_mask{0};
+  // The power frames go out at, and what the radio's PA is actually set to,
+  // if we know: a radio adopted from another process could be on anything
+  int8_t tx_power_dbm{sx1276::kDefaultTxPowerDbm};
+  std::optional<int8_t> written_tx_power_dbm{};
+};
+using ConfigCacheT = std::unordered_map<int, CachedConfig>;
 ConfigCacheT* config_cache_storage;
 ConfigCacheT& config_cache() {
   static std::once_flag once_flag;
@@ -26,19 +39,74 @@ ConfigCacheT& config_cache() {
 uint32_t compute_time_on_air_ms_via_fd(int msg_bytes, int fd) {
   assert(config_cache().count(fd) > 0);
 
-  return compute_time_on_air_ms(msg_bytes, config_cache()[fd]);
+  auto const& cached = config_cache()[fd];
+  return compute_time_on_air_ms(msg_bytes, cached.channel, cached.packet);
+}
+
+void write_preamble_length(int fd) {
+  using RegAddr = sx1276::RegAddr;
+  auto preamble = config_cache()[fd].packet.preamble_symbols;
+  spi_write_byte(fd, RegAddr::kPreambleMsb, (preamble >> 8) & 0xFF);
+  spi_write_byte(fd, RegAddr::kPreambleLsb, preamble & 0xFF);
+}
+
+void write_tx_power(int fd) {
+  using RegAddr = sx1276::RegAddr;
+  auto& cached = config_cache()[fd];
+  // Most frames go out at the power the last one did, for a session's worth
+  if (cached.written_tx_power_dbm == cached.tx_power_dbm) return;
+  spi_write_byte(fd, RegAddr::kOcp, sx1276::ocp_for_power(cached.tx_power_dbm));
+  spi_write_byte(fd, RegAddr::kPaConfig,
+                 sx1276::pa_config_for_power(cached.tx_power_dbm));
+  cached.written_tx_power_dbm = cached.tx_power_dbm;
 }
 
 } // namespace
 
+void sx1276::adopt_lora(int fd, ChannelConfig config, PacketConfig packet) {
+  if (config_cache().count(fd) > 0) {
+    printf("Error: multiple initializations for fd %d\n", fd);
+    exit(-1);
+  }
+  config_cache()[fd] = {.channel = config, .packet = packet};
+}
+
 bool sx1276::get_channel_config(int fd, ChannelConfig* config) {
   if (config_cache().count(fd) == 0) return false;
 
-  *config = config_cache()[fd];
+  *config = config_cache()[fd].channel;
+  return true;
+}
+
+bool sx1276::get_packet_config(int fd, PacketConfig* packet) {
+  if (config_cache().count(fd) == 0) return false;
+
+  *packet = config_cache()[fd].packet;
   return true;
 }
 
-void sx1276::init_lora(int fd, sx1276::ChannelConfig config) {
+void sx1276::set_preamble_symbols(int fd, uint16_t symbols) {
+  assert(config_cache().count(fd) > 0);
+  // Written to the radio ahead of each operation
+  config_cache()[fd].packet.preamble_symbols = symbols;
+}
+
+int8_t sx1276::set_tx_power(int fd, int8_t dbm) {
+  assert(config_cache().count(fd) > 0);
+  dbm = std::clamp(dbm, kMinTxPowerDbm, kMaxTxPowerDbm);
+  // Written to the radio ahead of the next transmission, if it's a change
+  config_cache()[fd].tx_power_dbm = dbm;
+  return dbm;
+}
+
+float sx1276::lora_last_packet_snr_db(int fd) {
+  // Two's complement, in quarter-dB steps
+  auto raw = static_cast<int8_t>(spi_read_byte(fd, RegAddr::kPktSnrValue).second);
+  return raw / 4.0f;
+}
+
+void sx1276::init_lora(int fd, sx1276::ChannelConfig config,
+                       sx1276::PacketConfig packet) {
   using RegAddr = sx1276::RegAddr;
   using OpMode = sx1276::OpMode;
 
@@ -100,17 +168,21 @@ void sx1276::init_lora(int fd, sx1276::ChannelConfig config) {
     fence(RegAddr::kIfFreq2);
 
     // Overload current protection
-    check(spi_write_byte(fd, RegAddr::kOcp, 0x23));
+    check(spi_write_byte(fd, RegAddr::kOcp, ocp_for_power(kDefaultTxPowerDbm)));
     fence(RegAddr::kOcp);
-    // Power limits
+    // Power limits; set_tx_power changes them from here on
     // Unsure whether we need to set these one at a time but I'm not going to
     // start messing with the power settings now lol
     check(spi_set_bit(fd, RegAddr::kPaConfig, 7));
     fence(RegAddr::kPaConfig);
-    check(spi_write_byte(fd, RegAddr::kPaConfig, 0xf8));
+    check(spi_write_byte(fd, RegAddr::kPaConfig,
+                         pa_config_for_power(kDefaultTxPowerDbm)));
     fence(RegAddr::kPaConfig);
-    // Use automatic gain control for LNA gain instead of manual control
-    check(spi_write_byte(fd, RegAddr::kModemConfig3, 0x04));
+    // Use automatic gain control for LNA gain instead of manual control, and
+    // turn on low data-rate optimization when symbols get long enough that
+    // the datasheet requires it (our ToA math assumes it's on in that case)
+    uint8_t ldro = low_data_rate_optimization_is_mandated(config) ? 0x08 : 0x00;
+    check(spi_write_byte(fd, RegAddr::kModemConfig3, 0x04 | ldro));
     fence(RegAddr::kModemConfig3);
   }
   // Setup preamble length, sync word
@@ -118,9 +190,9 @@ void sx1276::init_lora(int fd, sx1276::ChannelConfig config) {
     // 0x12 seems to be standard, but anything other than 0x34 should be OK?
     check(spi_write_byte(fd, RegAddr::kSyncWord, sx1276::kSyncWordValue));
     fence(RegAddr::kSyncWord);
-    check(spi_write_byte(fd, RegAddr::kPreambleMsb, (sx1276::kPreambleLengthBytes >> 8) && 0xFF));
+    check(spi_write_byte(fd, RegAddr::kPreambleMsb, (packet.preamble_symbols >> 8) & 0xFF));
     fence(RegAddr::kPreambleMsb);
-    check(spi_write_byte(fd, RegAddr::kPreambleLsb, sx1276::kPreambleLengthBytes & 0xFF));
+    check(spi_write_byte(fd, RegAddr::kPreambleLsb, packet.preamble_symbols & 0xFF));
     fence(RegAddr::kPreambleLsb);
   }
   // Setup detection threashold/optimization
@@ -156,32 +228,45 @@ void sx1276::init_lora(int fd, sx1276::ChannelConfig config) {
     check(spi_write_byte(fd, RegAddr::kFreqLsb, freq_lsb));
     fence(RegAddr::kFreqLsb);
 
-    // Bandwidth & coding rate (w/ explicit header mode)
-    check(spi_write_byte(fd, RegAddr::kModemConfig1, (bw << 4) | (cr << 1)));
+    // Bandwidth, coding rate & header mode
+    uint8_t implicit_header = packet.implicit_header ? 0x01 : 0x00;
+    check(spi_write_byte(fd, RegAddr::kModemConfig1, (bw << 4) | (cr << 1) | implicit_header));
     fence(RegAddr::kModemConfig1);
 
     // Spreading factor & some other bits ig
-    uint8_t rx_payload_crc = (kEnablePayloadCrc << 2);
+    uint8_t rx_payload_crc = (packet.payload_crc << 2);
     uint8_t up_rx_symb_timeout = 1;
     check(spi_write_byte(fd, RegAddr::kModemConfig2, (sf << 4) | rx_payload_crc | up_rx_symb_timeout));
     fence(RegAddr::kModemConfig2);
   }
 
-  config_cache()[fd] = config;
+  config_cache()[fd] = {.channel = config,
+                        .packet = packet,
+                        .written_tx_power_dbm = kDefaultTxPowerDbm};
 }
 
 void sx1276::lora_transmit(int fd, const uint8_t* msg, int len) {
+  usleep(lora_transmit_begin(fd, msg, len));
+  lora_transmit_end(fd);
+}
+
+void sx1276::lora_transmit_staged(int fd, uint8_t* staged, int len) {
+  usleep(lora_transmit_begin_staged(fd, staged, len));
+  lora_transmit_end(fd);
+}
+
+namespace {
+void lora_transmit_setup(int fd, int len) {
   assert(len > 0);
   assert(len < 0xffff);
-  assert(msg);
 
   using RegAddr = sx1276::RegAddr;
 
   // TODO error handle every single write :')
 
   spi_write_byte(fd, RegAddr::kOpMode, 0x89);
-  spi_write_byte(fd, RegAddr::kPreambleMsb, 0x00);
-  spi_write_byte(fd, RegAddr::kPreambleLsb, 0x08);
+  write_preamble_length(fd);
+  write_tx_power(fd);
   spi_write_byte(fd, RegAddr::kHopPeriod, 0x00);
 
   spi_write_byte(fd, RegAddr::kPayloadLength, len);
@@ -189,27 +274,48 @@ void sx1276::lora_transmit(int fd, const uint8_t* msg, int len) {
   spi_write_byte(fd, RegAddr::kIrqFlags, 0xff);  // clear interrupts
   spi_write_byte(fd, RegAddr::kFifoTxBaseAddr, 0x80);
   spi_write_byte(fd, RegAddr::kFifoAddrPtr, 0x80);
+}
 
-  spi_write_burst(fd, RegAddr::kFifo, msg, len); // write msg to hw buffer
-  spi_write_byte(fd, RegAddr::kOpMode, 0x8b); // begin transmitting
+uint32_t lora_transmit_start(int fd, int len) {
+  spi_write_byte(fd, sx1276::RegAddr::kOpMode, 0x8b); // begin transmitting
 
   auto time_on_air_us = compute_time_on_air_ms_via_fd(len, fd) * 1000;
   if (verbose)
     printf("lora_transmit: ToA  %u, now is %u\n", 150 + 7*len, time_on_air_us / 1000);
-  usleep(time_on_air_us);
-  spi_write_byte(fd, RegAddr::kOpMode, 0x89); // end transmitting
+  return time_on_air_us;
+}
+} // namespace
+
+uint32_t sx1276::lora_transmit_begin(int fd, const uint8_t* msg, int len) {
+  assert(msg);
+  lora_transmit_setup(fd, len);
+  spi_write_burst(fd, RegAddr::kFifo, msg, len); // write msg to hw buffer
+  return lora_transmit_start(fd, len);
+}
+
+uint32_t sx1276::lora_transmit_begin_staged(int fd, uint8_t* staged, int len) {
+  assert(staged);
+  lora_transmit_setup(fd, len);
+  spi_write_burst_staged(fd, RegAddr::kFifo, staged, len);
+  return lora_transmit_start(fd, len);
+}
+
+void sx1276::lora_transmit_end(int fd) {
+  spi_write_byte(fd, sx1276::RegAddr::kOpMode, 0x89); // end transmitting
 }
 
 namespace {
-bool lora_receive_common_setup(int fd) {
+bool lora_receive_common_setup(int fd, int max_len) {
   using RegAddr = sx1276::RegAddr;
 
   // TODO error handle every single write :')
 
   spi_write_byte(fd, RegAddr::kOpMode, 0x89);
-  spi_write_byte(fd, RegAddr::kPreambleMsb, 0x00);
-  spi_write_byte(fd, RegAddr::kPreambleLsb, 0x08);
+  write_preamble_length(fd);
   spi_write_byte(fd, RegAddr::kHopPeriod, 0x00);
+  // Without a header the radio has no other way of knowing the frame length
+  if (config_cache()[fd].packet.implicit_header)
+    spi_write_byte(fd, RegAddr::kPayloadLength, std::min(max_len, 0xff));
 
   spi_write_byte(fd, RegAddr::kFifoRxBaseAddr, 0x00);
   spi_write_byte(fd, RegAddr::kFifoAddrPtr, 0x00);
@@ -230,29 +336,32 @@ bool copy_received_message(int fd, uint8_t* dest, int max_len) {
     payload_len = max_len;
   }
 
-  auto [burst_status, burst_result] = spi_read_burst(fd, RegAddr::kFifo, payload_len);
+  // Straight into the caller's buffer; this runs once per received frame
+  int burst_status = spi_read_burst(fd, RegAddr::kFifo, dest, payload_len);
   // TODO handle the case where we read too few bytes
   if (burst_status < 0) {
-    printf("SPI burst-read failed: %s\n", strerror(-burst_status));
+    printf("SPI burst-read failed: %s\n", strerror(errno));
     return false;
   }
 
-  // We ignore the first byte because it's duplicated for whatever reason
-  std::memcpy(dest, burst_result.data() + 1, burst_result.size());
-
   return true;
 }
 } // namespace
 
 bool sx1276::lora_receive_continuous(int fd, uint8_t* dest, int max_len) {
-  assert(max_len);
   assert(dest);
+  uint32_t wait_us = lora_receive_continuous_begin(fd, max_len);
+  if (!wait_us) return false;
+  usleep(wait_us);
+  return lora_receive_continuous_end(fd, dest, max_len) ==
+         ReceiveResult::kReceived;
+}
+
+uint32_t sx1276::lora_receive_continuous_begin(int fd, int max_len) {
+  assert(max_len);
   using RegAddr = sx1276::RegAddr;
 
-  {
-    auto result = lora_receive_common_setup(fd);
-    if (!result) return result;
-  }
+  if (!lora_receive_common_setup(fd, max_len)) return 0;
 
   // If an RxDone interrupt is received in continuous mode, the chip enters an
   // unstable state (?) wherein any write to the IrqFlags register will drop the
@@ -264,33 +373,69 @@ bool sx1276::lora_receive_continuous(int fd, uint8_t* dest, int max_len) {
   // was cut off midway -- TODO investigate further. If needed handle at the
   // protocol layer.
   uint8_t irq_mask { spi_read_byte(fd, RegAddr::kIrqFlagsMask).second };
+  config_cache()[fd].saved_irq_mask = irq_mask;
   spi_write_byte(fd, RegAddr::kIrqFlagsMask, irq_mask | 0x40); // lol
 
   spi_write_byte(fd, RegAddr::kOpMode, 0x8d); // begin receiving
   auto time_on_air_us = compute_time_on_air_ms_via_fd(max_len, fd) * 1000;
   if (verbose)
     printf("lora_receive_continuous: ToA %ums\n", time_on_air_us / 1000);
-  usleep(time_on_air_us);
+  // 0 is reserved for failure
+  return std::max<uint32_t>(time_on_air_us, 1);
+}
+
+sx1276::ReceiveResult sx1276::lora_receive_continuous_end(int fd, uint8_t* dest,
+                                                          int max_len) {
+  assert(max_len);
+  assert(dest);
+  using RegAddr = sx1276::RegAddr;
+
   spi_write_byte(fd, RegAddr::kOpMode, 0x89); // stop receiving
 
-  spi_write_byte(fd, RegAddr::kIrqFlagsMask, irq_mask); // restore prior state
+  // restore prior state
+  spi_write_byte(fd, RegAddr::kIrqFlagsMask, config_cache()[fd].saved_irq_mask);
   uint8_t irqs { spi_read_byte(fd, RegAddr::kIrqFlags).second };
   spi_write_byte(fd, RegAddr::kIrqFlags, 0x10 | 0x20);
   if (!(irqs & 0x10)) {
-    return false;
+    return ReceiveResult::kNoFrame;
   }
   // Check for CRC error
   if (irqs & 0x20) {
     printf("error: crc error detected\n");
-    return false;
+    return ReceiveResult::kCrcError;
   }
 
-  {
-    auto result = copy_received_message(fd, dest, max_len);
-    if (!result) return result;
-  }
+  if (!copy_received_message(fd, dest, max_len))
+    return ReceiveResult::kReadFailed;
 
-  return true;
+  return ReceiveResult::kReceived;
+}
+
+void sx1276::lora_sleep(int fd) {
+  spi_write_byte(fd, sx1276::RegAddr::kOpMode, 0x88);
+}
+
+void sx1276::lora_wake(int fd) {
+  spi_write_byte(fd, sx1276::RegAddr::kOpMode, 0x89);
+}
+
+bool sx1276::lora_channel_activity(int fd) {
+  assert(config_cache().count(fd) > 0);
+  using RegAddr = sx1276::RegAddr;
+  // Past the datasheet's figure, the radio's already back in standby
+  constexpr uint32_t kCadSlackUs = 1000;
+
+  spi_write_byte(fd, RegAddr::kOpMode, 0x89);
+  spi_write_byte(fd, RegAddr::kIrqFlags, 0xff);  // clear interrupts
+  spi_write_byte(fd, RegAddr::kOpMode, 0x8f);    // begin CAD
+  usleep(cad_duration_s(config_cache()[fd].channel) * 1e6 + kCadSlackUs);
+
+  // CadDone is bit 2, CadDetected bit 0
+  uint8_t irqs { spi_read_byte(fd, RegAddr::kIrqFlags).second };
+  spi_write_byte(fd, RegAddr::kIrqFlags, 0x04 | 0x01);
+  if (verbose)
+    printf("lora_channel_activity: irqs %02x\n", irqs);
+  return (irqs & 0x04) && (irqs & 0x01);
 }
 
 bool sx1276::lora_receive_single(int fd, uint8_t* dest, int max_len) {
@@ -299,7 +444,7 @@ bool sx1276::lora_receive_single(int fd, uint8_t* dest, int max_len) {
   using RegAddr = sx1276::RegAddr;
 
   {
-    auto result = lora_receive_common_setup(fd);
+    auto result = lora_receive_common_setup(fd, max_len);
     if (!result) return result;
   }
 
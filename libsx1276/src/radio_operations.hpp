@@ -6,12 +6,53 @@
 
 namespace sx1276 {
 
-void init_lora(int fd, ChannelConfig config);
+void init_lora(int fd, ChannelConfig config,
+               PacketConfig packet = kDefaultPacketConfig);
+// Takes on a radio which was set up by init_lora in another process, e.g. an
+// fd handed over across a hot restart: records its configuration as init_lora
+// would have, without touching the radio.
+void adopt_lora(int fd, ChannelConfig config,
+                PacketConfig packet = kDefaultPacketConfig);
 bool get_channel_config(int fd, ChannelConfig* config);
+bool get_packet_config(int fd, PacketConfig* packet);
+// Frames sent and received from here on have a preamble of `symbols`
+void set_preamble_symbols(int fd, uint16_t symbols);
+// Frames sent from here on go out at `dbm`, clamped to what the PA allows,
+// which is returned. The PA and OCP registers are only rewritten ahead of a
+// transmission that changes them: two SPI writes, when it does.
+int8_t set_tx_power(int fd, int8_t dbm);
+// The SNR the last frame received came in at, in dB
+float lora_last_packet_snr_db(int fd);
 
 // TODO propogate errors
 void lora_transmit(int fd, const uint8_t* msg, int len);
+// See lora_transmit_begin_staged
+void lora_transmit_staged(int fd, uint8_t* staged, int len);
 bool lora_receive_single(int fd, uint8_t* dest, int max_len);
 bool lora_receive_continuous(int fd, uint8_t* dest, int max_len);
 
+// Split-phase versions of lora_transmit and lora_receive_continuous, for
+// callers that have something better to do than sleep while the radio is busy.
+// Each *_begin returns how many microseconds to wait before calling the
+// matching *_end (0 if the operation couldn't be started). Ending a receive
+// early just shortens the receive window.
+uint32_t lora_transmit_begin(int fd, const uint8_t* msg, int len);
+// As lora_transmit_begin, for a message at `staged + 1` with a byte to spare
+// in front of it: the FIFO address goes there, so that the message reaches the
+// radio in one SPI transfer, straight from the caller's buffer.
+uint32_t lora_transmit_begin_staged(int fd, uint8_t* staged, int len);
+void lora_transmit_end(int fd);
+uint32_t lora_receive_continuous_begin(int fd, int max_len);
+ReceiveResult lora_receive_continuous_end(int fd, uint8_t* dest, int max_len);
+
+// Low-power listening. The radio keeps its settings through sleep, though
+// not the FIFO's contents, and every operation above wakes it. lora_wake puts
+// it back in standby ahead of one, to save the oscillator's start-up
+// (kSleepToStandbyUs) when the operation's due. A CAD listens for a symbol's
+// worth of preamble, then drops back to standby; it returns whether it found
+// one.
+void lora_sleep(int fd);
+void lora_wake(int fd);
+bool lora_channel_activity(int fd);
+
 } // namespace sx1276
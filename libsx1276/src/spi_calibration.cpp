@@ -0,0 +1,118 @@
+#include "spi_calibration.hpp"
+
+#include <array>
+#include <chrono>
+
+#include "spi_wrappers.hpp"
+#include "sx1276_lora_registers.hpp"
+#include "types.hpp"
+
+namespace sx1276 {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The FIFO address pointer is an ordinary read/write register with no side
+// effects in standby, so it doubles as our scratch register
+constexpr uint8_t kScratchRegister = RegAddr::kFifoAddrPtr;
+constexpr int kFifoTestBytes = 64;
+
+constexpr std::array<uint8_t, 12> kScratchPatterns{
+  0x00, 0xff, 0x55, 0xaa, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+};
+
+float microseconds(Clock::duration d) {
+  return std::chrono::duration<float, std::micro>(d).count();
+}
+
+SpiSpeedResult measure_speed(int fd, uint32_t speed_hz, int rounds) {
+  SpiSpeedResult result{.speed_hz = speed_hz};
+  if (spi_set_speed(fd, speed_hz) < 0) {
+    result.errors = 1;
+    return result;
+  }
+
+  Clock::duration single_time{};
+  Clock::duration burst_time{};
+  uint32_t singles = 0;
+  uint32_t bursts = 0;
+  auto transaction = [&](int status, Clock::duration& total, uint32_t& count,
+                         Clock::time_point start) {
+    total += Clock::now() - start;
+    count++;
+    result.transactions++;
+    if (status < 0) result.errors++;
+  };
+
+  uint8_t lfsr = 0xe1;
+  std::array<uint8_t, kFifoTestBytes> pattern{};
+  std::array<uint8_t, kFifoTestBytes> fifo_readback{};
+  for (int round = 0; round < rounds; round++) {
+    for (uint8_t value : kScratchPatterns) {
+      auto start = Clock::now();
+      auto [write_status, _] = spi_write_byte(fd, kScratchRegister, value);
+      transaction(write_status, single_time, singles, start);
+
+      start = Clock::now();
+      auto [read_status, readback] = spi_read_byte(fd, kScratchRegister);
+      transaction(read_status, single_time, singles, start);
+      if (readback != value) result.errors++;
+    }
+
+    // A fresh pseudo-random pattern each round, so that a stuck line can't
+    // happen to read back correctly
+    for (auto& b : pattern) {
+      lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xb8);
+      b = lfsr;
+    }
+    spi_write_byte(fd, RegAddr::kFifoAddrPtr, 0);
+    auto start = Clock::now();
+    int write_status =
+        spi_write_burst(fd, RegAddr::kFifo, pattern.data(), pattern.size());
+    transaction(write_status, burst_time, bursts, start);
+
+    spi_write_byte(fd, RegAddr::kFifoAddrPtr, 0);
+    fifo_readback.fill(0);
+    start = Clock::now();
+    int read_status =
+        spi_read_burst(fd, RegAddr::kFifo, fifo_readback.data(),
+                       fifo_readback.size());
+    transaction(read_status, burst_time, bursts, start);
+    if (fifo_readback != pattern) result.errors++;
+  }
+
+  result.single_register_us = singles ? microseconds(single_time) / singles : 0;
+  result.fifo_burst_us = bursts ? microseconds(burst_time) / bursts : 0;
+  return result;
+}
+
+} // namespace
+
+SpiCalibration calibrate_spi_speed(int fd, SpiCalibrationOptions const& options) {
+  const uint32_t original_speed = spi_get_speed(fd);
+  SpiCalibration calibration{.selected_hz = 0};
+
+  // Run the checks at the original speed, which we already trust
+  auto op_mode = spi_read_byte(fd, RegAddr::kOpMode).second;
+  auto fifo_addr = spi_read_byte(fd, RegAddr::kFifoAddrPtr).second;
+  spi_write_byte(fd, RegAddr::kOpMode, (op_mode & ~0x07) | OpMode::kStandby);
+
+  for (uint32_t speed_hz : options.speeds_hz) {
+    auto result = measure_speed(fd, speed_hz, options.rounds);
+    calibration.results.push_back(result);
+    // Past the first failure, faster speeds are only going to be worse; we
+    // don't want to pick a speed that works by chance above one that doesn't
+    if (!result.stable()) break;
+    calibration.selected_hz = speed_hz;
+  }
+
+  spi_set_speed(fd, original_speed);
+  spi_write_byte(fd, RegAddr::kFifoAddrPtr, fifo_addr);
+  spi_write_byte(fd, RegAddr::kOpMode, op_mode);
+  if (calibration.selected_hz)
+    spi_set_speed(fd, calibration.selected_hz);
+  return calibration;
+}
+
+} // namespace sx1276
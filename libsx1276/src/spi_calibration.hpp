@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace sx1276 {
+
+struct SpiSpeedResult {
+  uint32_t speed_hz;
+  // Transactions which failed outright or read back the wrong value
+  uint32_t errors;
+  uint32_t transactions;
+  // Mean wall-clock time per transaction, including the ioctl overhead
+  float single_register_us;
+  float fifo_burst_us;
+
+  bool stable() const { return errors == 0; }
+};
+
+struct SpiCalibration {
+  // The fastest speed which, along with every slower speed tried, passed
+  // verification; 0 if none did
+  uint32_t selected_hz;
+  std::vector<SpiSpeedResult> results;
+};
+
+struct SpiCalibrationOptions {
+  // Tried in order; stepping stops at the first unstable speed
+  std::vector<uint32_t> speeds_hz{1000000, 2000000, 4000000, 5000000,
+                                  8000000, 10000000};
+  // Rounds of write/readback patterns to run at each speed
+  int rounds{32};
+};
+
+/// Steps the SPI clock up through `options.speeds_hz`, verifying each speed
+/// with write/readback patterns on a scratch register and the FIFO, and leaves
+/// the device running at the fastest reliable one.
+///
+/// The radio is put into standby for the duration and its op-mode and FIFO
+/// pointer are restored afterwards; FIFO contents are clobbered. If no speed
+/// verifies, the original speed is restored.
+SpiCalibration calibrate_spi_speed(int fd, SpiCalibrationOptions const& options);
+inline SpiCalibration calibrate_spi_speed(int fd) {
+  return calibrate_spi_speed(fd, {});
+}
+
+} // namespace sx1276
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <array>
-#include <vector>
+#include <atomic>
 #include <unordered_set>
 #include <utility>
 
@@ -20,10 +20,42 @@ constexpr bool kSpiWrapperLogRw = 0;
 
 constexpr size_t kSpiMode = SPI_MODE_0;
 constexpr size_t kSpiBits = 8;
-constexpr size_t kSpiSpeed = 1000000;
+constexpr uint32_t kSpiSpeed = 1000000;
+// The SX1276 datasheet caps SCK at 10MHz
+constexpr uint32_t kSpiMaxSpeed = 10000000;
+constexpr const char* kSpiDefaultDevice = "/dev/spidev0.0";
+
+// Transfers leave speed_hz zeroed so that they run at whatever speed was last
+// configured for the device through spi_set_speed.
+constexpr uint32_t kSpiTransferUseDeviceSpeed = 0;
+
+/// Transfers issued so far, across every device, for monitoring. Relaxed
+/// increments only, so that counting costs the SPI path next to nothing.
+struct SpiCounters {
+  std::atomic<uint64_t> byte_reads{0};
+  std::atomic<uint64_t> byte_writes{0};
+  std::atomic<uint64_t> burst_reads{0};
+  std::atomic<uint64_t> burst_writes{0};
+};
+
+inline SpiCounters& spi_counters() {
+  static SpiCounters counters;
+  return counters;
+}
+
+inline int spi_set_speed(int fd, uint32_t speed_hz) {
+  return ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz);
+}
+
+inline uint32_t spi_get_speed(int fd) {
+  uint32_t speed_hz = 0;
+  if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed_hz) < 0) return 0;
+  return speed_hz;
+}
 
-inline int spi_init() {
-  int fd = open("/dev/spidev0.0", O_RDWR);
+inline int spi_init(const char* device = kSpiDefaultDevice,
+                    uint32_t speed_hz = kSpiSpeed) {
+  int fd = open(device, O_RDWR);
 
   auto report_setup_failure_and_die = [](const char* ioctl, int status) {
     perror("failed: ");
@@ -37,7 +69,7 @@ inline int spi_init() {
   if (status < 0) report_setup_failure_and_die("SPI_IOC_WR_MODE", status);
   status = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &kSpiBits);
   if (status < 0) report_setup_failure_and_die("SPI_IOC_WR_BITS_PER_WORD", status);
-  status = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &kSpiSpeed);
+  status = spi_set_speed(fd, speed_hz);
   if (status < 0) report_setup_failure_and_die("SPI_IOC_WR_MAX_SPEED_HZ", status);
 
   return fd;
@@ -50,12 +82,13 @@ inline std::pair<int, uint8_t> spi_read_byte(int fd, uint8_t addr) {
     .tx_buf = reinterpret_cast<unsigned long>(tx),
     .rx_buf = reinterpret_cast<unsigned long>(rx),
     .len = 2,
-    .speed_hz = kSpiSpeed,
+    .speed_hz = kSpiTransferUseDeviceSpeed,
     .delay_usecs = 0,
     .bits_per_word = kSpiBits,
   };
 
 
+  spi_counters().byte_reads.fetch_add(1, std::memory_order_relaxed);
   int status = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
   if constexpr (kSpiWrapperLogRw) {
     printf("*** reading 0x%02x from 0x%02x\n", rx[1], addr);
@@ -70,12 +103,13 @@ inline std::pair<int, uint8_t> spi_write_byte(int fd, uint8_t addr, uint8_t val)
     .tx_buf = reinterpret_cast<unsigned long>(tx),
     .rx_buf = reinterpret_cast<unsigned long>(rx),
     .len = 2,
-    .speed_hz = kSpiSpeed,
+    .speed_hz = kSpiTransferUseDeviceSpeed,
     .delay_usecs = 0,
     .bits_per_word = kSpiBits,
   };
 
 
+  spi_counters().byte_writes.fetch_add(1, std::memory_order_relaxed);
   int status = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
   if constexpr (kSpiWrapperLogRw) {
     printf("*** writing 0x%02x  to  0x%02x\n", val, addr);
@@ -105,49 +139,88 @@ inline std::pair<int, uint8_t> spi_unset_bit(int fd, uint8_t addr, int bit_idx)
   return spi_write_bit(fd, addr, false, bit_idx);
 }
 
-inline std::pair<int, std::vector<uint8_t>> spi_read_burst(int fd, uint8_t addr, int len) {
-  assert(len > 0);
-  len += 1; // need space for the address byte
-
-  std::vector<uint8_t> tx (len, '\0');
-  std::vector<uint8_t> rx (len, '\0');
-
-  tx[0] = addr;
+// Bursts are sent as two transfers in one message, with chip-select held
+// across both: the address byte, then the data straight to/from the caller's
+// buffer. No staging copies or allocations, so these are safe to call from the
+// session hot path.
 
-  struct spi_ioc_transfer tr = {
-    .tx_buf = reinterpret_cast<uint64_t>(tx.data()),
-    .rx_buf = reinterpret_cast<uint64_t>(rx.data()),
-    .len = static_cast<uint32_t>(len),
-    .speed_hz = kSpiSpeed,
-    .delay_usecs = 0,
-    .bits_per_word = kSpiBits,
+/// Reads `len` consecutive bytes starting at `addr` into `dest`.
+inline int spi_read_burst(int fd, uint8_t addr, uint8_t* dest, int len) {
+  assert(len > 0);
+  assert(dest);
+
+  uint8_t tx_addr = addr;
+  struct spi_ioc_transfer tr[2] = {
+    {
+      .tx_buf = reinterpret_cast<uint64_t>(&tx_addr),
+      .rx_buf = 0,
+      .len = 1,
+      .speed_hz = kSpiTransferUseDeviceSpeed,
+      .delay_usecs = 0,
+      .bits_per_word = kSpiBits,
+    },
+    {
+      // spidev clocks out zeroes when there's no tx buffer
+      .tx_buf = 0,
+      .rx_buf = reinterpret_cast<uint64_t>(dest),
+      .len = static_cast<uint32_t>(len),
+      .speed_hz = kSpiTransferUseDeviceSpeed,
+      .delay_usecs = 0,
+      .bits_per_word = kSpiBits,
+    },
   };
 
-  int status = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-
-  return {status, rx};
+  spi_counters().burst_reads.fetch_add(1, std::memory_order_relaxed);
+  return ioctl(fd, SPI_IOC_MESSAGE(2), tr);
 }
 
-inline std::pair<int, std::vector<uint8_t>> spi_write_burst(int fd, uint8_t addr, const uint8_t* data, int len) {
+/// Writes `len` bytes from `data` to consecutive registers starting at `addr`.
+inline int spi_write_burst(int fd, uint8_t addr, const uint8_t* data, int len) {
   assert(len > 0);
-  len += 1; // need space for the address byte
+  assert(data);
+
+  uint8_t tx_addr = addr | 0x80;
+  struct spi_ioc_transfer tr[2] = {
+    {
+      .tx_buf = reinterpret_cast<uint64_t>(&tx_addr),
+      .rx_buf = 0,
+      .len = 1,
+      .speed_hz = kSpiTransferUseDeviceSpeed,
+      .delay_usecs = 0,
+      .bits_per_word = kSpiBits,
+    },
+    {
+      .tx_buf = reinterpret_cast<uint64_t>(data),
+      .rx_buf = 0,
+      .len = static_cast<uint32_t>(len),
+      .speed_hz = kSpiTransferUseDeviceSpeed,
+      .delay_usecs = 0,
+      .bits_per_word = kSpiBits,
+    },
+  };
 
-  std::vector<uint8_t> tx (len, '\0');
-  std::vector<uint8_t> rx (len, '\0');
+  spi_counters().burst_writes.fetch_add(1, std::memory_order_relaxed);
+  return ioctl(fd, SPI_IOC_MESSAGE(2), tr);
+}
 
-  tx[0] = addr | 0x80;
-  std::memcpy(tx.data() + 1, data, len - 1);
+/// Like spi_write_burst, but for data which already has a spare byte in front
+/// of it: `staged[0]` is overwritten with the address, and the address and
+/// `len` bytes of data from `staged + 1` go out as a single transfer.
+inline int spi_write_burst_staged(int fd, uint8_t addr, uint8_t* staged,
+                                  int len) {
+  assert(len > 0);
+  assert(staged);
 
+  staged[0] = addr | 0x80;
   struct spi_ioc_transfer tr = {
-    .tx_buf = reinterpret_cast<uint64_t>(tx.data()),
-    .rx_buf = reinterpret_cast<uint64_t>(rx.data()),
-    .len = static_cast<uint32_t>(len),
-    .speed_hz = kSpiSpeed,
+    .tx_buf = reinterpret_cast<uint64_t>(staged),
+    .rx_buf = 0,
+    .len = static_cast<uint32_t>(len) + 1,
+    .speed_hz = kSpiTransferUseDeviceSpeed,
     .delay_usecs = 0,
     .bits_per_word = kSpiBits,
   };
 
-  int status = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-
-  return {status, rx};
+  spi_counters().burst_writes.fetch_add(1, std::memory_order_relaxed);
+  return ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
 }
@@ -57,4 +57,30 @@ struct ChannelConfig {
   SpreadingFactor sf;
 };
 
+// Framing options which don't change the modulation but do change airtime
+struct PacketConfig {
+  uint16_t preamble_symbols;
+  bool payload_crc;
+  // Implicit-header mode drops the PHY header, so both ends must agree on the
+  // payload length out-of-band
+  bool implicit_header;
+};
+
+constexpr PacketConfig kDefaultPacketConfig {
+  .preamble_symbols = 8,
+  .payload_crc = false,
+  .implicit_header = false,
+};
+
+// How a receive turned out
+enum class ReceiveResult {
+  kReceived,
+  // Nothing came before the window closed
+  kNoFrame,
+  // A frame came, but failed its payload CRC
+  kCrcError,
+  // A frame came, but couldn't be read out of the FIFO
+  kReadFailed,
+};
+
 } // namespace sx1276
@@ -1,20 +1,46 @@
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstdio>
-#include <sstream>
+#include <cstring>
+#include <map>
+#include <optional>
 #include <string>
+#include <thread>
 
 #include "bcp.hpp"
 
 using namespace lora_chat;
 
 static int kNextMessageId{0};
+static MessageStore kMessageStore{};
+static ChatHistory kChatHistory{};
+static bool kUseHistory{false};
+static WireAddress kActivePeer{0};
+static BulkSender kBulkSender{};
+// Set once the receiver has everything we're sending, which ends the run
+static bool kTransferDone{false};
+static BulkReceiver kBulkReceiver{};
+
+// Enqueue-to-delivery latency of our messages, per peer
+struct LatencyStats {
+  uint64_t receipts{0};
+  Duration total{0};
+  Duration min{Duration::max()};
+  Duration max{0};
+};
+static std::map<WireAddress, LatencyStats> kLatencies{};
+
+// Slot width of a coordinated network, one session window each, as long as
+// ProtocolAgent's own sessions' windows
+static constexpr Duration kNetworkSlotTime{std::chrono::milliseconds(800)};
+// How long to wait for a network's beacon, or a slot on it, with --tdma
+static constexpr Duration kNetworkJoinTimeout{std::chrono::seconds(60)};
 
 std::optional<SessionPacketPayload> GetMessageToSend() {
-  std::stringstream ss {};
-  ss << "Ping " << kNextMessageId++;
-  auto str = ss.str();
   SessionPacketPayload p{};
-  std::copy(str.begin(), str.end(), p.begin());
+  snprintf(reinterpret_cast<char *>(p.data()), p.size(), "Ping %d",
+           kNextMessageId++);
   return p;
 }
 
@@ -23,26 +49,411 @@ void ConsumeMessage(SessionPacketPayload &&payload) {
       payload.data());
 }
 
+// Payloads are zero-padded out to the full frame
+std::span<const uint8_t> TrimPadding(std::span<const uint8_t> payload) {
+  return {payload.data(),
+          strnlen(reinterpret_cast<const char *>(payload.data()),
+                  payload.size())};
+}
+
+void RecordHistory(ChatHistory::Direction direction,
+                   std::span<const uint8_t> payload) {
+  auto text = TrimPadding(payload);
+  if (kUseHistory && !text.empty())
+    kChatHistory.Record(kActivePeer, direction, text);
+}
+
+std::optional<SessionPacketPayload> GetRecordedMessageToSend() {
+  auto p = GetMessageToSend();
+  RecordHistory(ChatHistory::Direction::kSent, *p);
+  return p;
+}
+
+void ConsumeAndRecordMessage(SessionPacketPayload &&payload) {
+  RecordHistory(ChatHistory::Direction::kReceived, payload);
+  ConsumeMessage(std::move(payload));
+}
+
+// Straight from the outbox's log into the payload of the frame that goes out
+PacketRef GetStoredFrameToSend() {
+  PacketRef frame = PacketBufferPool::Default().Acquire();
+  if (!frame)
+    return {};
+  auto payload = frame->SessionPayload();
+  auto length = kMessageStore.DequeueForActivePeer(payload);
+  if (!length)
+    return {};
+  // Pooled buffers come back as they were left
+  std::fill(payload.begin() + *length, payload.end(), 0);
+  RecordHistory(ChatHistory::Direction::kSent, payload);
+  return frame;
+}
+
+void ConsumeAndStoreFrame(PacketRef &&frame) {
+  auto text = TrimPadding(frame->SessionPayload());
+  if (text.empty())
+    return;
+  kMessageStore.DepositFromActivePeer(text);
+  RecordHistory(ChatHistory::Direction::kReceived, text);
+  printf("Message received \"%.*s\"\n", static_cast<int>(text.size()),
+         reinterpret_cast<const char *>(text.data()));
+}
+
+void NoteActivePeer(WireAddress peer) {
+  printf("Session established with 0x%08x\n", peer);
+  kActivePeer = peer;
+}
+
+void ConfirmStoredMessage() { kMessageStore.ConfirmDeliveredToActivePeer(); }
+
+// Whatever the session hadn't got through goes out again in the next one
+void RequeueStoredMessages() {
+  kMessageStore.RequeueUnconfirmedForActivePeer();
+}
+
+void BeginDrainingBacklog(WireAddress peer) {
+  printf("Session established with 0x%08x (%zu messages queued)\n", peer,
+         kMessageStore.PendingCount(peer));
+  kActivePeer = peer;
+  kMessageStore.SetActivePeer(peer);
+}
+
+std::optional<SessionPacketPayload> GetNextBlock() {
+  SessionPacketPayload p{};
+  if (!kBulkSender.NextMessage(p))
+    return {};
+  return p;
+}
+
+void ConsumeReport(SessionPacketPayload &&payload) {
+  kBulkSender.Receive(payload);
+  if (kBulkSender.Complete()) {
+    printf("Transfer complete: %zu blocks, %" PRIu64 " sent\n",
+           kBulkSender.Blocks(), kBulkSender.BlocksSent());
+    kTransferDone = true;
+  }
+}
+
+void AnnounceFile(WireAddress peer) {
+  printf("Session established with 0x%08x\n", peer);
+  kBulkSender.Restart();
+}
+
+std::optional<SessionPacketPayload> GetNextReport() {
+  SessionPacketPayload p{};
+  if (!kBulkReceiver.NextMessage(p))
+    return {};
+  return p;
+}
+
+void ConsumeBlock(SessionPacketPayload &&payload) {
+  const bool was_complete = kBulkReceiver.Complete();
+  kBulkReceiver.Receive(payload);
+  const size_t received = kBulkReceiver.BlocksReceived();
+  if (kBulkReceiver.Complete() && !was_complete)
+    printf("Transfer complete: %zu blocks\n", kBulkReceiver.Blocks());
+  else if (!kBulkReceiver.Complete() && received && received % 256 == 0)
+    printf("Received %zu of %zu blocks\n", received, kBulkReceiver.Blocks());
+}
+
+void NoteReceipt(DeliveryReceipt const &receipt) {
+  auto &stats = kLatencies[kActivePeer];
+  const auto latency = receipt.Latency();
+  stats.receipts++;
+  stats.total += latency;
+  stats.min = std::min(stats.min, latency);
+  stats.max = std::max(stats.max, latency);
+  auto ms = [](Duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  printf("Message %u delivered to 0x%08x after %.0f ms (%" PRIu64
+         " so far: min %.0f, mean %.0f, max %.0f ms)\n",
+         receipt.message, kActivePeer, ms(latency), stats.receipts,
+         ms(stats.min), ms(stats.total / stats.receipts), ms(stats.max));
+}
+
+// Reads lines of the form "<PEER-ID> <MESSAGE>" and queues them for delivery
+void QueueMessagesFromStdin() {
+  char line[256];
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\n")] = '\0';
+    unsigned peer = 0;
+    int offset = 0;
+    if (sscanf(line, "%u %n", &peer, &offset) != 1 || !line[offset]) {
+      printf("usage: <PEER-ID> <MESSAGE>\n");
+      continue;
+    }
+    std::span<const uint8_t> message{
+        reinterpret_cast<const uint8_t *>(line + offset),
+        std::min(strlen(line + offset), kSessionPacketPayloadBytes)};
+    // Durable by the store's next group commit, which happens off this
+    // thread and off the radio's
+    if (!kMessageStore.Enqueue(peer, message))
+      printf("failed to queue message for %u\n", peer);
+  }
+}
+
+bool HandOff(HotRestart &restart, ProtocolAgent const &agent,
+             LoraInterface &radio) {
+  HotRestart::Handoff handoff{};
+  if (!sx1276::get_channel_config(radio.SpiFd(), &handoff.channel) ||
+      !sx1276::get_packet_config(radio.SpiFd(), &handoff.packet))
+    return false;
+  // The successor stretches it again if it's listening at low power too
+  handoff.packet.preamble_symbols = radio.UsualPreambleSymbols();
+  if (auto session = agent.SaveSession()) {
+    handoff.in_session = true;
+    handoff.session = session->first;
+    handoff.peer = session->second;
+  }
+  // So that the successor finds everything queued so far, less what's been
+  // acknowledged (a no-op without --store). Anything still in flight goes
+  // again from there.
+  kMessageStore.Sync();
+  if (!restart.HandOff(handoff, radio.SpiFd())) {
+    printf("handoff failed; carrying on\n");
+    return false;
+  }
+  printf("Handed off%s\n", handoff.in_session ? " mid-session" : "");
+  return true;
+}
+
+void PrintUsage(const char *argv0) {
+  printf("usage: %s <ID> <ACTION> [--store DIR] [--history DIR] "
+         "[--metrics SEGMENT] [--handoff SOCKET] [--send FILE | --receive "
+         "FILE]\n"
+         "    [--receipts 1] [--turnaround MS] [--coordinate SLOTS | --tdma "
+         "1] [--lpl MS]\n"
+         "    [--power-margin DB] [--calibrate 1];\n"
+         "    ACTION 0 to seek, 1 to advertise\n"
+         "    with --store, messages are read from stdin as "
+         "\"<PEER-ID> <MESSAGE>\"\n"
+         "    and held in DIR until a session with that peer is "
+         "established\n"
+         "    with --history, every message sent or received is recorded in "
+         "DIR\n"
+         "    for later search with bcp-history\n"
+         "    metrics are published to shared memory for bcp-top, under %s<ID>\n"
+         "    unless --metrics says otherwise\n"
+         "    with --handoff, takes over the radio and session of the agent\n"
+         "    already running with the same SOCKET, if there is one, and\n"
+         "    listens there to hand them on in turn\n"
+         "    with --send, streams FILE to the peer instead of chatting, and "
+         "exits\n"
+         "    once it's all there; with --receive, writes what's sent into "
+         "FILE,\n"
+         "    resuming an interrupted transfer from FILE.progress\n"
+         "    with --receipts 1, the peer confirms each message as it's "
+         "delivered,\n"
+         "    and the latency from enqueue to delivery is reported per peer\n"
+         "    with --turnaround, each frame of a session follows MS after the "
+         "last\n"
+         "    ends rather than waiting for its slot, for as long as none are "
+         "lost;\n"
+         "    the peer must be run with the same MS\n"
+         "    with --coordinate, runs a network of SLOTS slots (the beacon's "
+         "included)\n"
+         "    on the channel instead of chatting; with --tdma 1, sessions keep "
+         "to its\n"
+         "    schedule, in a slot of our own when advertising\n"
+         "    with --lpl, the radio sleeps while seeking, waking every MS to "
+         "check\n"
+         "    the channel, and wakes peers doing the same; every agent on the "
+         "channel\n"
+         "    must be run with the same MS\n"
+         "    with --power-margin, each session is sent at the least power "
+         "that keeps\n"
+         "    it DB above the peer's SNR floor, as the peer reports it\n"
+         "    with --calibrate 1, once enough sessions have run, the gap "
+         "between their\n"
+         "    frames is set from the radio's measured turnaround times "
+         "rather than\n"
+         "    a fixed guess, if the peer does the same\n",
+         argv0, MetricsPublisher::kNamePrefix);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    printf("usage: %s <ID> <ACTION>; ACTION 0 to seek, 1 to advertise\n", argv[0]);
+  if (argc < 3 || (argc % 2) == 0) {
+    PrintUsage(argv[0]);
     return -1;
   }
 
   const WireSessionId id = std::stoi(argv[1]);
   const bool advertise = std::stoi(argv[2]);
-  
-  auto& radio = LoraInterface::instance();
-  MessagePipe mpipe{GetMessageToSend, ConsumeMessage};
+  const char *store_dir = nullptr;
+  const char *history_dir = nullptr;
+  std::string metrics_name = MetricsPublisher::DefaultName(id);
+  const char *handoff_path = nullptr;
+  const char *send_path = nullptr;
+  const char *receive_path = nullptr;
+  bool receipts = false;
+  int turnaround_ms = 0;
+  size_t coordinate_slots = 0;
+  bool tdma = false;
+  int wake_interval_ms = 0;
+  std::optional<float> power_margin_db{};
+  bool calibrate = false;
+  for (int i = 3; i < argc; i += 2) {
+    if (!strcmp(argv[i], "--store")) {
+      store_dir = argv[i + 1];
+    } else if (!strcmp(argv[i], "--history")) {
+      history_dir = argv[i + 1];
+    } else if (!strcmp(argv[i], "--metrics")) {
+      metrics_name = argv[i + 1];
+    } else if (!strcmp(argv[i], "--handoff")) {
+      handoff_path = argv[i + 1];
+    } else if (!strcmp(argv[i], "--send")) {
+      send_path = argv[i + 1];
+    } else if (!strcmp(argv[i], "--receive")) {
+      receive_path = argv[i + 1];
+    } else if (!strcmp(argv[i], "--receipts")) {
+      receipts = std::stoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--turnaround")) {
+      turnaround_ms = std::stoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--coordinate")) {
+      coordinate_slots = std::stoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--tdma")) {
+      tdma = std::stoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--lpl")) {
+      wake_interval_ms = std::stoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--power-margin")) {
+      power_margin_db = std::stof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--calibrate")) {
+      calibrate = std::stoi(argv[i + 1]);
+    } else {
+      PrintUsage(argv[0]);
+      return -1;
+    }
+  }
+  const bool use_store = (store_dir != nullptr);
+  if ((send_path && receive_path) || (coordinate_slots && tdma) ||
+      coordinate_slots == 1) {
+    PrintUsage(argv[0]);
+    return -1;
+  }
+  kUseHistory = (history_dir != nullptr);
+
+  // First, before opening anything our predecessor might still have open
+  std::optional<HotRestart::Takeover> takeover{};
+  if (handoff_path) {
+    takeover = HotRestart::TakeOver(handoff_path);
+    if (takeover)
+      printf("Took over from the agent at %s\n", handoff_path);
+  }
 
+  if (use_store && kMessageStore.Open(store_dir) != MessageStore::Status::kSuccess) {
+    printf("failed to open message store at %s\n", store_dir);
+    return -1;
+  }
+  if (kUseHistory &&
+      kChatHistory.Open(history_dir) != ChatHistory::Status::kSuccess) {
+    printf("failed to open chat history at %s\n", history_dir);
+    return -1;
+  }
+
+  if (send_path) {
+    auto status = kBulkSender.Open(send_path);
+    if (status == BulkSender::Status::kTooLarge) {
+      printf("%s is too big to send (at most %zu bytes)\n", send_path,
+             bulk::kMaxFileBytes);
+      return -1;
+    } else if (status != BulkSender::Status::kSuccess) {
+      printf("failed to open %s\n", send_path);
+      return -1;
+    }
+    printf("Sending %s (%zu blocks)\n", send_path, kBulkSender.Blocks());
+  }
+  if (receive_path)
+    kBulkReceiver.Open(receive_path);
+
+  // Not fatal: the agent runs just the same, only unwatched
+  MetricsPublisher metrics{};
+  if (metrics.Open(metrics_name.c_str()) != MetricsPublisher::Status::kSuccess)
+    printf("failed to publish metrics at %s\n", metrics_name.c_str());
+
+  std::optional<LoraInterface> adopted_radio{};
+  if (takeover)
+    adopted_radio.emplace(takeover->radio_fd, takeover->handoff.channel,
+                          takeover->handoff.packet);
+  auto& radio = adopted_radio ? *adopted_radio : LoraInterface::instance();
+
+  if (coordinate_slots) {
+    TdmaCoordinator coordinator{id, radio, kNetworkSlotTime,
+                                (coordinate_slots - 1) * kNetworkSlotTime};
+    printf("Coordinating %zu slots\n", coordinator.superframe().Slots());
+    while (true)
+      coordinator.RunSuperframe();
+  }
+
+  MessagePipe mpipe = send_path
+      ? MessagePipe{GetNextBlock, ConsumeReport, AnnounceFile}
+      : receive_path
+      ? MessagePipe{GetNextReport, ConsumeBlock, NoteActivePeer}
+      : use_store
+      ? MessagePipe{GetStoredFrameToSend, ConsumeAndStoreFrame,
+                    BeginDrainingBacklog}
+      : MessagePipe{GetRecordedMessageToSend, ConsumeAndRecordMessage,
+                    NoteActivePeer};
+  if (receipts)
+    mpipe.RequestReceipts(NoteReceipt);
+  if (use_store && !send_path && !receive_path)
+    mpipe.TrackAcknowledgements(ConfirmStoredMessage, RequeueStoredMessages);
+
+  if (use_store)
+    std::thread(QueueMessagesFromStdin).detach();
+
+  // Followed by the agent for as long as it runs
+  std::optional<TdmaMember> member{};
   ProtocolAgent agent{id, radio, mpipe};
   if (advertise)
     agent.SetGoal(ProtocolAgent::ConnectionGoal::kAdvertiseConnection);
   else
     agent.SetGoal(ProtocolAgent::ConnectionGoal::kSeekConnection);
+  agent.SetSelfClocking(std::chrono::milliseconds(turnaround_ms));
+  if (wake_interval_ms > 0 &&
+      !agent.SetLowPowerListening(std::chrono::milliseconds(wake_interval_ms)))
+    printf("the radio can't listen at low power; listening continuously\n");
+  if (power_margin_db &&
+      !agent.ControlTransmitPower(sx1276::kMinTxPowerDbm,
+                                  sx1276::kMaxTxPowerDbm, *power_margin_db))
+    printf("the radio can't set its power; sending at full power\n");
+  agent.UseCalibratedGuardTimes(calibrate);
+
+  if (tdma) {
+    member.emplace(id, radio);
+    const TimePoint deadline = Now() + kNetworkJoinTimeout;
+    // Only the initiating end of a session needs a slot: the advertiser's
+    std::optional<size_t> slot{};
+    if (advertise)
+      slot = member->AcquireSlot(deadline);
+    else
+      member->ListenForBeacon(deadline);
+    if (member->superframe()) {
+      agent.FollowNetwork(*member);
+      if (slot)
+        printf("Joined the network in slot %zu\n", *slot);
+      else if (advertise)
+        printf("Joined the network, but got no slot\n");
+      else
+        printf("Joined the network\n");
+    } else {
+      printf("No network heard; keeping to our own schedule\n");
+    }
+  }
+
+  if (takeover && takeover->handoff.in_session)
+    agent.ResumeSession(takeover->handoff.session, takeover->handoff.peer);
+
+  HotRestart restart{};
+  if (handoff_path && !restart.Listen(handoff_path))
+    printf("failed to listen for a successor at %s\n", handoff_path);
 
-  while (true) {
+  while (!kTransferDone) {
     agent.ExecuteAgentAction();
+    if (restart.SuccessorWaiting() && HandOff(restart, agent, radio))
+      // Straight out: nothing of ours may touch the radio again, and the
+      // metrics segment and socket are the successor's now
+      exit(0);
   }
 
   return 0;
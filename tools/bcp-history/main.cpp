@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "bcp.hpp"
+
+using namespace lora_chat;
+
+namespace {
+
+void print_usage(const char *argv0) {
+  printf("usage: %s <HISTORY-DIR> [--peer ID] [--since MINUTES-AGO]\n"
+         "          [--until MINUTES-AGO] [--limit N] [KEYWORD...]\n",
+         argv0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  const auto now = ChatHistory::Timestamp::clock::now();
+  auto minutes_ago = [&](const char *arg) {
+    return now - std::chrono::minutes(std::atoi(arg));
+  };
+
+  ChatHistory::Query query{};
+  for (int i = 2; i < argc; i++) {
+    const bool has_value = (i + 1 < argc);
+    if (!strcmp(argv[i], "--peer") && has_value) {
+      query.peer = std::strtoul(argv[++i], nullptr, 0);
+    } else if (!strcmp(argv[i], "--since") && has_value) {
+      query.since = minutes_ago(argv[++i]);
+    } else if (!strcmp(argv[i], "--until") && has_value) {
+      query.until = minutes_ago(argv[++i]);
+    } else if (!strcmp(argv[i], "--limit") && has_value) {
+      query.limit = std::atoi(argv[++i]);
+    } else if (!strncmp(argv[i], "--", 2)) {
+      print_usage(argv[0]);
+      return -1;
+    } else {
+      query.keywords += argv[i];
+      query.keywords += ' ';
+    }
+  }
+
+  ChatHistory history{};
+  // The agent may be appending to it as we read
+  if (history.Open(argv[1], {.read_only = true}) !=
+      ChatHistory::Status::kSuccess) {
+    printf("failed to open history at %s\n", argv[1]);
+    return -1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto results = history.Search(query);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  for (auto const &entry : results) {
+    std::time_t t = ChatHistory::Timestamp::clock::to_time_t(entry.timestamp);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S",
+                  std::localtime(&t));
+    const bool sent = (entry.direction == ChatHistory::Direction::kSent);
+    printf("%s  %s 0x%08x  %.*s\n", when, sent ? "->" : "<-", entry.peer,
+           static_cast<int>(entry.text.size()), entry.text.data());
+  }
+  printf("(%zu results from %zu messages in %.3f ms)\n", results.size(),
+         history.size(),
+         std::chrono::duration<double, std::milli>(elapsed).count());
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bcp.hpp"
+
+using namespace lora_chat;
+
+namespace {
+
+void print_usage(const char *argv0) {
+  printf("usage: %s (--path-loss DB | --distance M [--exponent N])\n"
+         "          [--tx-power DBM] [--fading DB] [--margin DB] [--duty PERCENT]\n"
+         "          [--freq MHZ] [--threads N] [--all]\n"
+         "    sweeps spreading factor, bandwidth, coding rate, payload size and\n"
+         "    slot gap, and prints the settings worth choosing between for the\n"
+         "    link (--all prints every setting that closes it)\n",
+         argv0);
+}
+
+double Millis(Duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void PrintPlans(std::vector<LinkPlan> const &plans) {
+  printf("%4s %8s %4s %7s %7s %6s %7s %7s %10s %9s %7s %9s\n", "sf", "bw kHz",
+         "cr", "payload", "tx ms", "gap ms", "margin", "loss %", "goodput",
+         "latency", "duty %", "mJ/msg");
+  for (auto const &[s, p] : plans)
+    printf("%4d %8.1f  4/%d %7zu %7.0f %6.0f %7.1f %7.2f %8.1f b/s %8.2fs "
+           "%7.2f %9.2f\n",
+           static_cast<int>(s.channel.sf),
+           sx1276::bandwidth_in_hz(s.channel.bw) / 1000.0, s.channel.cr + 4,
+           s.payload_bytes, Millis(s.transmission_duration),
+           Millis(s.gap_duration), p.margin_db, 100 * p.frame_loss_rate,
+           p.goodput_bps, p.latency_s, 100 * p.duty_cycle,
+           p.energy_per_message_mj);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  LinkConditions conditions{};
+  bool have_path_loss = false;
+  float distance_m = 0;
+  float exponent = 2.7f;
+  unsigned threads = 0;
+  bool all = false;
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = (i + 1 < argc);
+    if (!strcmp(argv[i], "--path-loss") && has_value) {
+      conditions.path_loss_db = std::atof(argv[++i]);
+      have_path_loss = true;
+    } else if (!strcmp(argv[i], "--distance") && has_value) {
+      distance_m = std::atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--exponent") && has_value) {
+      exponent = std::atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--tx-power") && has_value) {
+      conditions.tx_power_dbm = std::atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--fading") && has_value) {
+      conditions.fading_db = std::atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--margin") && has_value) {
+      conditions.required_margin_db = std::atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--duty") && has_value) {
+      conditions.max_duty_cycle = std::atof(argv[++i]) / 100;
+    } else if (!strcmp(argv[i], "--freq") && has_value) {
+      conditions.freq = sx1276::frequency_from_hz(std::atof(argv[++i]) * 1e6);
+    } else if (!strcmp(argv[i], "--threads") && has_value) {
+      threads = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--all")) {
+      all = true;
+    } else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+  if (!have_path_loss) {
+    if (distance_m <= 0) {
+      print_usage(argv[0]);
+      return -1;
+    }
+    conditions.path_loss_db = sx1276::path_loss_db(
+        distance_m, sx1276::frequency_in_hz(conditions.freq), exponent);
+  }
+
+  printf("%.1f MHz, %.1f dBm over %.1f dB of path loss, %.1f dB fading; "
+         "needing %.1f dB of margin and at most %.1f%% duty cycle\n\n",
+         sx1276::frequency_in_hz(conditions.freq) / 1e6,
+         conditions.tx_power_dbm, conditions.path_loss_db,
+         conditions.fading_db, conditions.required_margin_db,
+         100 * conditions.max_duty_cycle);
+
+  LinkPlanner planner{conditions};
+  const auto start = Now();
+  auto plans = planner.Sweep(threads);
+  const auto elapsed = Now() - start;
+  if (plans.empty()) {
+    printf("nothing closes this link -- try more power, a better antenna, or "
+           "less required margin\n");
+    return -1;
+  }
+  const size_t feasible = plans.size();
+  if (!all)
+    plans = LinkPlanner::ParetoFront(plans);
+  PrintPlans(plans);
+  printf("\n%zu settings close the link; %zu shown (swept in %.1f ms)\n",
+         feasible, plans.size(), Millis(elapsed));
+  return 0;
+}
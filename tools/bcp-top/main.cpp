@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "bcp.hpp"
+
+using namespace lora_chat;
+
+namespace {
+
+void print_usage(const char *argv0) {
+  printf("usage: %s <ID | SEGMENT> [--interval MS] [--once]\n"
+         "    watches the metrics published by the running bcp-agent with "
+         "that ID\n"
+         "    (segment %s<ID>), or by whichever agent was given --metrics "
+         "SEGMENT\n",
+         argv0, MetricsPublisher::kNamePrefix);
+}
+
+double Seconds(uint64_t ns) { return ns / 1e9; }
+double Millis(int64_t ns) { return ns / 1e6; }
+
+double Percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+void Render(MetricsSnapshot const &now, MetricsSnapshot const *before) {
+  const uint64_t steady_now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  Now().time_since_epoch())
+                                  .count();
+  const uint64_t uptime = now.published_at_ns - now.started_at_ns;
+  printf("bcp-agent pid %" PRIu64 "   up %.1f s   (published %.0f ms ago)\n\n",
+         now.pid, Seconds(uptime),
+         Millis(static_cast<int64_t>(steady_now - now.published_at_ns)));
+
+  printf("state     %s\n", now.agent_state);
+  if (now.in_session)
+    printf("session   %" PRIu64 "\n", now.session_id);
+  else
+    printf("session   -\n");
+
+  const uint64_t tx = now[Counter::kTransmitNs];
+  const uint64_t rx = now[Counter::kReceiveNs];
+  const uint64_t sleep = now[Counter::kRadioSleepNs];
+  const uint64_t idle =
+      uptime > tx + rx + sleep ? uptime - tx - rx - sleep : 0;
+  printf("radio     tx %5.1f%%   rx %5.1f%%   asleep %5.1f%%   idle %5.1f%%   "
+         "airtime %.3f s\n",
+         Percent(tx, uptime), Percent(rx, uptime), Percent(sleep, uptime),
+         Percent(idle, uptime), Seconds(now[Counter::kAirtimeNs]));
+
+  const uint64_t samples = now[Counter::kSlotErrorSamples];
+  printf("slots     last %+.3f ms   worst %+.3f ms   mean |err| %.3f ms\n",
+         Millis(now.last_slot_error_ns), Millis(now.worst_slot_error_ns),
+         samples ? Millis(now[Counter::kSlotErrorTotalNs] / samples) : 0.0);
+  const uint64_t receipts = now[Counter::kDeliveryReceipts];
+  if (receipts)
+    printf("delivery  %" PRIu64 " receipts   mean latency %.1f ms\n",
+           receipts, Millis(now[Counter::kDeliveryLatencyTotalNs] / receipts));
+  printf("\n");
+
+  // Rates are per second, over the time between the last two snapshots
+  const double elapsed =
+      before ? Seconds(now.published_at_ns - before->published_at_ns) : 0;
+  printf("%-22s %14s %12s\n", "counter", "total", "per second");
+  for (size_t i = 0; i < static_cast<size_t>(Counter::kNumCounters); i++) {
+    const auto counter = static_cast<Counter>(i);
+    if (elapsed > 0)
+      printf("%-22s %14" PRIu64 " %12.1f\n", CounterName(counter),
+             now[counter], (now[counter] - (*before)[counter]) / elapsed);
+    else
+      printf("%-22s %14" PRIu64 " %12s\n", CounterName(counter),
+             now[counter], "-");
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argv[1][0] == '-') {
+    print_usage(argv[0]);
+    return -1;
+  }
+  // Segment names begin with a slash; anything else is an agent's ID
+  const std::string segment = argv[1][0] == '/'
+                                  ? std::string(argv[1])
+                                  : MetricsPublisher::DefaultName(
+                                        std::strtoull(argv[1], nullptr, 10));
+  const char *name = segment.c_str();
+  int interval_ms = 500;
+  bool once = false;
+  for (int i = 2; i < argc; i++) {
+    const bool has_value = (i + 1 < argc);
+    if (!strcmp(argv[i], "--interval") && has_value) {
+      interval_ms = std::atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--once")) {
+      once = true;
+    } else {
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  MetricsReader reader{};
+  if (!reader.Open(name)) {
+    printf("no metrics published at %s -- is bcp-agent running?\n", name);
+    return -1;
+  }
+
+  // The latest snapshot, and the one the agent published before it
+  MetricsSnapshot current{};
+  MetricsSnapshot previous{};
+  bool have_current = false;
+  bool have_previous = false;
+  while (true) {
+    MetricsSnapshot snapshot{};
+    if (!reader.Read(snapshot)) {
+      printf("couldn't read %s (agent restarted or gone?)\n", name);
+      return -1;
+    }
+    // We may well poll faster than the agent publishes
+    if (!have_current || snapshot.published_at_ns != current.published_at_ns) {
+      previous = current;
+      have_previous = have_current;
+      current = snapshot;
+      have_current = true;
+    }
+
+    if (!once)
+      printf("\x1b[H\x1b[2J"); // home and clear
+    Render(current, have_previous ? &previous : nullptr);
+    fflush(stdout);
+    if (once)
+      return 0;
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+}
@@ -0,0 +1,136 @@
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bcp.hpp"
+
+using namespace lora_chat;
+
+static IpTunnel kTunnel{};
+static int kTunFd{-1};
+
+std::optional<SessionPacketPayload> GetNextFragment() {
+  return kTunnel.NextMessage();
+}
+
+void DeliverFragment(SessionPacketPayload &&payload) {
+  static std::array<uint8_t, IpTunnel::kMtu> datagram{};
+  auto length = kTunnel.Receive(payload, datagram);
+  if (length && write(kTunFd, datagram.data(), *length) < 0)
+    perror("bcp-tun: write to tun device failed");
+}
+
+void StartTunnel(WireAddress peer) {
+  auto stats = kTunnel.GetStats();
+  printf("Session established with 0x%08x (so far: %" PRIu64
+         " datagrams sent, %" PRIu64 " received, %" PRIu64 " dropped, %" PRIu64
+         " lost; %" PRId64 " header bytes saved)\n",
+         peer, stats.datagrams_sent, stats.datagrams_received,
+         stats.datagrams_dropped, stats.datagrams_lost,
+         stats.header_bytes_saved);
+  kTunnel.Reset();
+}
+
+// Queues every datagram the kernel routes to the device
+void ReadDatagramsFromTun() {
+  // Room for more than an MTU's worth, so that oversized datagrams get
+  // dropped (and counted) rather than truncated
+  std::array<uint8_t, 2 * IpTunnel::kMtu> datagram{};
+  while (true) {
+    ssize_t n = read(kTunFd, datagram.data(), datagram.size());
+    if (n < 0) {
+      perror("bcp-tun: read from tun device failed");
+      return;
+    }
+    kTunnel.Send({datagram.data(), static_cast<size_t>(n)});
+  }
+}
+
+// Creates (or attaches to) the TUN device `name`, sets its MTU and brings it
+// up. Addresses and routes are left to the caller, e.g. with ip(8).
+int OpenTun(const char *name) {
+  int fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    perror("bcp-tun: couldn't open /dev/net/tun");
+    return -1;
+  }
+  ifreq ifr{};
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+    perror("bcp-tun: TUNSETIFF failed");
+    close(fd);
+    return -1;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  ifr.ifr_mtu = IpTunnel::kMtu;
+  if (sock < 0 || ioctl(sock, SIOCSIFMTU, &ifr) < 0)
+    perror("bcp-tun: couldn't set the MTU");
+  if (sock >= 0 && ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) {
+    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+    if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0)
+      perror("bcp-tun: couldn't bring the device up");
+  }
+  if (sock >= 0)
+    close(sock);
+  return fd;
+}
+
+void PrintUsage(const char *argv0) {
+  printf("usage: %s <ID> <ACTION> [--dev NAME]; ACTION 0 to seek, 1 to "
+         "advertise\n"
+         "    carries IP datagrams routed to the TUN device NAME (default "
+         "bcp0)\n"
+         "    over the session, UDP headers compressed; give the device an "
+         "address\n"
+         "    once it's up, e.g. ip addr add 10.0.0.1/30 dev bcp0\n",
+         argv0);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3 || (argc % 2) == 0) {
+    PrintUsage(argv[0]);
+    return -1;
+  }
+
+  const WireSessionId id = std::stoi(argv[1]);
+  const bool advertise = std::stoi(argv[2]);
+  const char *dev = "bcp0";
+  for (int i = 3; i < argc; i += 2) {
+    if (!strcmp(argv[i], "--dev")) {
+      dev = argv[i + 1];
+    } else {
+      PrintUsage(argv[0]);
+      return -1;
+    }
+  }
+
+  kTunFd = OpenTun(dev);
+  if (kTunFd < 0)
+    return -1;
+  printf("Tunnelling through %s (MTU %zu)\n", dev, IpTunnel::kMtu);
+  std::thread(ReadDatagramsFromTun).detach();
+
+  MessagePipe mpipe{GetNextFragment, DeliverFragment, StartTunnel};
+  ProtocolAgent agent{id, LoraInterface::instance(), mpipe};
+  if (advertise)
+    agent.SetGoal(ProtocolAgent::ConnectionGoal::kAdvertiseConnection);
+  else
+    agent.SetGoal(ProtocolAgent::ConnectionGoal::kSeekConnection);
+
+  while (true)
+    agent.ExecuteAgentAction();
+
+  return 0;
+}
@@ -1,38 +1,235 @@
 #include "config.hpp"
 
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <string_view>
 
 namespace {
 
-constexpr sx1276::Frequency kDefaultFrequency{0xe4c000};
-constexpr sx1276::Bandwidth kDefaultBandwidth{sx1276::Bandwidth::k125kHz};
-constexpr sx1276::CodingRate kDefaultCodingRate{sx1276::CodingRate::k4_7};
-constexpr sx1276::SpreadingFactor kDefaultSpreadingFactor{sx1276::SpreadingFactor::kSF9};
+// Representative frame size for the airtime column
+constexpr int kReferenceFrameBytes{32};
+constexpr float kDefaultTxPowerDbm{17};
+constexpr float kDefaultMarginDb{10};
+constexpr float kDefaultPathLossExponent{2.7};
 
-}; // namespace
+Config config_from_preset(sx1276::Preset const &preset) {
+  return {.channel = preset.channel, .packet = preset.packet,
+          .spi_speed_hz = kSpiSpeed};
+}
+
+void print_presets() {
+  printf("%-16s %4s %8s %4s %9s %10s %12s\n", "preset", "sf", "bw (kHz)",
+         "cr", "bit/s", "airtime", "sensitivity");
+  for (auto const &preset : sx1276::all_presets()) {
+    auto c = sx1276::characterize(preset, kReferenceFrameBytes);
+    printf("%-16s %4d %8.1f  4/%d %9.0f %8.0fms %9.1fdBm\n", preset.name,
+           preset.channel.sf, sx1276::bandwidth_in_hz(preset.channel.bw) / 1e3,
+           preset.channel.cr + 4, c.bitrate_bps, c.airtime_ms,
+           c.sensitivity_dbm);
+  }
+  printf("(airtime is for a %d-byte frame)\n", kReferenceFrameBytes);
+}
+
+std::optional<sx1276::Bandwidth> parse_bandwidth(float khz) {
+  for (uint8_t bw = sx1276::Bandwidth::k7_8kHz;
+       bw <= sx1276::Bandwidth::k500kHz; bw++) {
+    auto hz = sx1276::bandwidth_in_hz(static_cast<sx1276::Bandwidth>(bw));
+    if (fabsf(hz - khz * 1e3f) < 100)
+      return static_cast<sx1276::Bandwidth>(bw);
+  }
+  return {};
+}
+
+bool parse_bool(const char *value) {
+  return !strcmp(value, "1") || !strcmp(value, "true") || !strcmp(value, "yes");
+}
+
+bool apply_setting(Config &cfg, const char *key, const char *value) {
+  if (!strcmp(key, "preset")) {
+    auto *preset = sx1276::find_preset(value);
+    if (!preset) return false;
+    cfg.channel = preset->channel;
+    cfg.packet = preset->packet;
+  } else if (!strcmp(key, "spi-speed")) {
+    if (!strcmp(value, "auto")) {
+      cfg.spi_speed_hz = 0;
+    } else {
+      int speed_hz = atoi(value);
+      if (speed_hz <= 0 || speed_hz > static_cast<int>(kSpiMaxSpeed)) return false;
+      cfg.spi_speed_hz = speed_hz;
+    }
+  } else if (!strcmp(key, "frequency")) {
+    cfg.channel.freq = sx1276::frequency_from_hz(atof(value));
+  } else if (!strcmp(key, "bandwidth")) {
+    auto bw = parse_bandwidth(atof(value));
+    if (!bw) return false;
+    cfg.channel.bw = *bw;
+  } else if (!strcmp(key, "coding-rate")) {
+    int denominator = atoi(value);
+    if (denominator < 5 || denominator > 8) return false;
+    cfg.channel.cr = static_cast<sx1276::CodingRate>(denominator - 4);
+  } else if (!strcmp(key, "spreading-factor")) {
+    int sf = atoi(value);
+    // SF6 isn't supported by the driver yet
+    if (sf < 7 || sf > 12) return false;
+    cfg.channel.sf = static_cast<sx1276::SpreadingFactor>(sf);
+  } else if (!strcmp(key, "preamble")) {
+    int preamble = atoi(value);
+    if (preamble < 6 || preamble > 0xffff) return false;
+    cfg.packet.preamble_symbols = preamble;
+  } else if (!strcmp(key, "crc")) {
+    cfg.packet.payload_crc = parse_bool(value);
+  } else if (!strcmp(key, "implicit-header")) {
+    cfg.packet.implicit_header = parse_bool(value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Lines are "key = value"; blank lines and anything after a '#' are ignored
+bool read_config_file(Config &cfg, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+
+  std::array<char, 256> line{};
+  int line_number = 0;
+  bool ok = true;
+  while (ok && fgets(line.data(), line.size(), file)) {
+    line_number++;
+    line[strcspn(line.data(), "#\n")] = '\0';
+    char key[64], value[64];
+    int fields = sscanf(line.data(), " %63[^= \t] = %63s", key, value);
+    if (fields <= 0) continue;
+    if (fields != 2 || !apply_setting(cfg, key, value)) {
+      printf("%s:%d: bad setting \"%s\"\n", path, line_number, line.data());
+      ok = false;
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+} // namespace
+
+std::optional<Config> get_config(int argc, char **argv) {
+  if (argc <= 1) return prompt_user_for_config();
+
+  Config cfg{config_from_preset(sx1276::default_preset())};
+  std::optional<float> range_m{};
+  float margin_db{kDefaultMarginDb};
+  float tx_power_dbm{kDefaultTxPowerDbm};
+  float path_loss_exponent{kDefaultPathLossExponent};
+
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    if (arg == "--list-presets") {
+      print_presets();
+      return {};
+    }
+    if (i + 1 >= argc) {
+      printf("missing value for %s\n", argv[i]);
+      return {};
+    }
+    const char *value = argv[++i];
+    if (arg == "--preset") {
+      if (!apply_setting(cfg, "preset", value)) {
+        printf("unknown preset \"%s\"; try --list-presets\n", value);
+        return {};
+      }
+    } else if (arg == "--spi-speed") {
+      if (!apply_setting(cfg, "spi-speed", value)) {
+        printf("bad SPI speed \"%s\"\n", value);
+        return {};
+      }
+    } else if (arg == "--config") {
+      if (!read_config_file(cfg, value)) return {};
+    } else if (arg == "--range") {
+      range_m = atof(value);
+    } else if (arg == "--margin") {
+      margin_db = atof(value);
+    } else if (arg == "--tx-power") {
+      tx_power_dbm = atof(value);
+    } else if (arg == "--path-loss-exponent") {
+      path_loss_exponent = atof(value);
+    } else {
+      printf("unknown argument %s\n", argv[i - 1]);
+      return {};
+    }
+  }
+
+  if (range_m) {
+    float freq_hz = sx1276::frequency_in_hz(cfg.channel.freq);
+    float loss_db = sx1276::path_loss_db(*range_m, freq_hz, path_loss_exponent);
+    auto *preset = sx1276::select_preset(tx_power_dbm, loss_db, margin_db);
+    if (!preset) {
+      printf("no preset reaches %.0fm with %.1fdB of margin (%.1fdB path loss)\n",
+             *range_m, margin_db, loss_db);
+      return {};
+    }
+    printf("Selected preset %s for %.0fm (%.1fdB margin)\n", preset->name,
+           *range_m, sx1276::link_margin_db(*preset, tx_power_dbm, loss_db));
+    // Keep any frequency we were given
+    auto freq = cfg.channel.freq;
+    cfg.channel = preset->channel;
+    cfg.packet = preset->packet;
+    cfg.channel.freq = freq;
+  }
+
+  print_config(cfg);
+  return cfg;
+}
 
 Config prompt_user_for_config() {
-  Config conf{
-    .channel = sx1276::ChannelConfig {
-      .freq = kDefaultFrequency,
-      .bw = kDefaultBandwidth,
-      .cr = kDefaultCodingRate,
-      .sf = kDefaultSpreadingFactor,
-    },
-  };
+  print_presets();
+
+  auto const &fallback = sx1276::default_preset();
+  while (true) {
+    printf("preset [%s]: ", fallback.name);
+    std::array<char, 64> input{};
+    if (!fgets(input.data(), input.size(), stdin)) break;
+    input[strcspn(input.data(), "\n")] = '\0';
+    if (!input[0]) break;
 
+    if (auto *preset = sx1276::find_preset(input.data())) {
+      Config conf{config_from_preset(*preset)};
+      print_config(conf);
+      return conf;
+    }
+    printf("unknown preset \"%s\"\n", input.data());
+  }
+
+  Config conf{config_from_preset(fallback)};
+  print_config(conf);
+  return conf;
+}
+
+void print_config(Config const &cfg) {
   // TODO use libfmt and make formatters for the struct types
-  printf("Using hardcoded configuration:\n"
-         "\tfrequency         0x%x\n"
+  printf("Using configuration:\n"
+         "\tfrequency         0x%x (%.3f MHz)\n"
          "\tbandwidth         %d\n"
          "\tcoding-rate       %d\n"
-         "\tspreading-factor  %d\n",
-         conf.channel.freq, conf.channel.bw,
-         conf.channel.cr, conf.channel.sf);
-
-  return conf;
+         "\tspreading-factor  %d\n"
+         "\tpreamble          %d\n"
+         "\tcrc               %s\n"
+         "\theader            %s\n"
+         "\tspi-speed         %s\n"
+         "\tbitrate           %.0f bit/s\n"
+         "\tsensitivity       %.1f dBm\n",
+         cfg.channel.freq, sx1276::frequency_in_hz(cfg.channel.freq) / 1e6,
+         cfg.channel.bw, cfg.channel.cr, cfg.channel.sf,
+         cfg.packet.preamble_symbols, cfg.packet.payload_crc ? "on" : "off",
+         cfg.packet.implicit_header ? "implicit" : "explicit",
+         cfg.spi_speed_hz ? std::to_string(cfg.spi_speed_hz).c_str() : "auto",
+         sx1276::bitrate_bps(cfg.channel), sx1276::sensitivity_dbm(cfg.channel));
 }
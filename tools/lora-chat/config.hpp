@@ -1,13 +1,30 @@
 #pragma once
 
+#include <optional>
+
 #include "sx1276/sx1276.hpp"
 
 struct Config {
   sx1276::ChannelConfig channel;
+  sx1276::PacketConfig packet;
+  // 0 to calibrate for the fastest stable speed at startup
+  uint32_t spi_speed_hz;
 };
 
 // TODO use libfmt and specify print formats for the struct members
 
-// TODO actually prompt the user rather than returning a hardcoded config
+/// Builds the radio configuration from the command line:
+///   --preset NAME       start from a named preset (see --list-presets)
+///   --config FILE       read "key = value" settings from FILE
+///   --spi-speed HZ      SPI clock, or "auto" to calibrate at startup
+///   --range METERS      pick the fastest preset that reaches METERS, with
+///     [--margin DB] [--tx-power DBM] [--path-loss-exponent N]
+///   --list-presets      print the presets and exit
+/// With no arguments, prompts the user for a preset instead.
+/// Returns nullopt if the program should exit.
 // TODO does this really belong here, or should it be in lora_interface?
+std::optional<Config> get_config(int argc, char **argv);
+
 Config prompt_user_for_config();
+
+void print_config(Config const &cfg);
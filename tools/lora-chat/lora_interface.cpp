@@ -1,5 +1,6 @@
 #include "lora_interface.hpp"
 
+#include <algorithm>
 #include <optional>
 
 #include "sx1276/sx1276.hpp"
@@ -18,9 +19,16 @@ bool init_lora(Config const &cfg) {
   if (lora_state)
     return false;
 
-  int fd = spi_init();
+  int fd = spi_init(kSpiDefaultDevice, cfg.spi_speed_hz ? cfg.spi_speed_hz : kSpiSpeed);
+  if (!cfg.spi_speed_hz) {
+    auto calibration = sx1276::calibrate_spi_speed(fd);
+    printf("Calibrated SPI clock to %u Hz\n", spi_get_speed(fd));
+    for (auto const &r : calibration.results)
+      printf("\t%8u Hz: %u errors, %.1f us/register, %.1f us/burst\n",
+             r.speed_hz, r.errors, r.single_register_us, r.fifo_burst_us);
+  }
   lora_state = {fd, cfg};
-  sx1276::init_lora(fd, cfg.channel);
+  sx1276::init_lora(fd, cfg.channel, cfg.packet);
 
   return true;
 }
@@ -49,3 +57,41 @@ std::pair<ReceiveStatus, std::optional<std::string>> lora_receive() {
     return {ReceiveStatus::kNoMessage, {}};
   }
 }
+
+lora_chat::RadioInterface::Status
+LoraChatRadio::Transmit(std::span<uint8_t const> buffer) {
+  switch (lora_transmit(reinterpret_cast<const char *>(buffer.data()),
+                        buffer.size())) {
+  case TransmitStatus::kSuccess:
+    return Status::kSuccess;
+  case TransmitStatus::kBadInput:
+    return Status::kBadBufferSize;
+  case TransmitStatus::kUnspecifiedError:
+    return Status::kUnspecifiedError;
+  }
+  return Status::kUnspecifiedError;
+}
+
+lora_chat::RadioInterface::Status
+LoraChatRadio::Receive(std::span<uint8_t> buffer_out) {
+  if (buffer_out.size() < SX127x_FIFO_CAPACITY)
+    return Status::kBadBufferSize;
+
+  auto [status, msg] = lora_receive();
+  switch (status) {
+  case ReceiveStatus::kSuccess:
+    std::copy(msg->begin(), msg->end(), buffer_out.begin());
+    return Status::kSuccess;
+  case ReceiveStatus::kNoMessage:
+    return Status::kTimeout;
+  case ReceiveStatus::kBadInput:
+    return Status::kBadBufferSize;
+  case ReceiveStatus::kUnspecifiedError:
+    return Status::kUnspecifiedError;
+  }
+  return Status::kUnspecifiedError;
+}
+
+size_t LoraChatRadio::MaximumMessageLength() const {
+  return SX127x_FIFO_CAPACITY;
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <utility>
 
+#include "bcp.hpp"
 #include "config.hpp"
 
 bool init_lora(Config const& cfg);
@@ -22,3 +23,12 @@ enum class ReceiveStatus {
   kNoMessage,
 };
 std::pair<ReceiveStatus, std::optional<std::string>> lora_receive();
+
+// Lets the libbcp tooling (e.g. the load-test generator) drive our radio
+class LoraChatRadio : public lora_chat::RadioInterface {
+public:
+  virtual Status Transmit(std::span<uint8_t const> buffer);
+  virtual Status Receive(std::span<uint8_t> buffer_out);
+
+  virtual size_t MaximumMessageLength() const;
+};
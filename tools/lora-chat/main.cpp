@@ -1,7 +1,9 @@
 #include <iostream>
 
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <random>
 
 #include "config.hpp"
 #include "lora_interface.hpp"
@@ -47,6 +49,62 @@ int handle_receive_message(ReceiveMessagePayload payload) {
   return 0;
 }
 
+namespace {
+
+double as_ms(lora_chat::Duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void print_latency(const char *label,
+                   std::optional<lora_chat::Duration> const &d) {
+  if (d)
+    printf("\t%-18s %.1f ms\n", label, as_ms(*d));
+  else
+    printf("\t%-18s n/a\n", label);
+}
+
+} // namespace
+
+int handle_transmit_iota(TransmitIotaPayload payload) {
+  LoraChatRadio radio{};
+  lora_chat::TrafficGenerator generator{
+      radio, {
+                 .count = static_cast<uint32_t>(payload.count),
+                 .rate_hz = payload.rate_hz,
+                 .frame_bytes = static_cast<size_t>(payload.frame_bytes),
+                 .run_id = std::random_device{}(),
+             }};
+
+  printf("Transmitting %d load-test frames... \n", payload.count);
+  auto report = generator.Run();
+  printf("... complete: %u sent, %u failed, %u late in %.1f ms\n", report.sent,
+         report.failed, report.late, as_ms(report.elapsed));
+  return 0;
+}
+
+int handle_receive_iota(ReceiveIotaPayload payload) {
+  LoraChatRadio radio{};
+  lora_chat::TrafficReceiver receiver{
+      radio, {.expected = static_cast<uint32_t>(payload)}};
+
+  printf("Waiting for load-test frames... \n");
+  auto report = receiver.Run();
+  printf("... complete:\n"
+         "\treceived           %u / %u\n"
+         "\tlost               %u\n"
+         "\tduplicates         %u\n"
+         "\treordered          %u\n"
+         "\tignored            %u\n"
+         "\tthroughput         %.2f frames/s, %.1f bit/s\n",
+         report.received, report.expected, report.lost, report.duplicates,
+         report.reordered, report.ignored, report.frames_per_second,
+         report.bits_per_second);
+  print_latency("latency p50", report.latency_p50);
+  print_latency("latency p90", report.latency_p90);
+  print_latency("latency p99", report.latency_p99);
+  print_latency("latency max", report.latency_max);
+  return 0;
+}
 
 int handle_user_command(UserCommand const &cmd) {
   switch (cmd.tag) {
@@ -58,16 +116,19 @@ int handle_user_command(UserCommand const &cmd) {
   case UserCommandTag::kReceiveMessage:
     return handle_receive_message(cmd.as_receive_message);
   case UserCommandTag::kTransmitIota:
-    printf("command not implemented :)\n");
-    return 0;
+    return handle_transmit_iota(cmd.as_transmit_iota);
+  case UserCommandTag::kReceiveIota:
+    return handle_receive_iota(cmd.as_receive_iota);
   }
   return -1;
 }
 
 int main(int argc, char **args) {
-  Config cfg{prompt_user_for_config()};
+  auto cfg = get_config(argc, args);
+  if (!cfg)
+    return 0;
 
-  assert(init_lora(cfg) && "Failed to initialize SPI or SP1276 radio");
+  assert(init_lora(*cfg) && "Failed to initialize SPI or SP1276 radio");
 
   int return_value = 0;
   while (return_value == 0) {
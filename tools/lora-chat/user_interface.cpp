@@ -19,7 +19,28 @@ UserCommand get_and_parse_user_input() {
   input_buffer[strcspn(input_buffer.data(), "\n")] = '\0';
 
   // TODO handle special commands
-  if (input_buffer[0] == '$') {
+  if (!strncmp(input_buffer.data(), "%iota", 5)) {
+    // load-test: %iota COUNT [RATE-HZ] [FRAME-BYTES]
+    TransmitIotaPayload iota{0, 0, 0};
+    if (sscanf(input_buffer.data() + 5, "%d %lf %d", &iota.count,
+               &iota.rate_hz, &iota.frame_bytes) < 1 ||
+        iota.count <= 0) {
+      printf("usage: %%iota COUNT [RATE-HZ] [FRAME-BYTES]\n");
+      return {.tag = UserCommandTag::kBadCommand};
+    }
+    return UserCommand{
+        .as_transmit_iota = iota,
+        .tag = UserCommandTag::kTransmitIota,
+    };
+  } else if (!strncmp(input_buffer.data(), "%sink", 5)) {
+    // load-test receiver: %sink [COUNT]
+    int expected{0};
+    sscanf(input_buffer.data() + 5, "%d", &expected);
+    return UserCommand{
+        .as_receive_iota = expected,
+        .tag = UserCommandTag::kReceiveIota,
+    };
+  } else if (input_buffer[0] == '$') {
     // receive
     int num_messages{0};
     sscanf(input_buffer.data() + 1, "%d", &num_messages);
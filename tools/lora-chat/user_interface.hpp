@@ -13,12 +13,18 @@ enum class UserCommandTag {
   kTransmitMessage,
   kTransmitIota,
   kReceiveMessage,
+  kReceiveIota,
 };
 
 using TransmitMessagePayload = std::array<char, kMaxUserInputSize>;  // Message to send
-using TransmitIotaPayload = int;  // number of messages to send
+struct TransmitIotaPayload {
+  int count;       // number of messages to send
+  double rate_hz;  // 0 to send back-to-back
+  int frame_bytes; // 0 for the smallest possible frame
+};
 // TODO use radio-facing gpio to detect reception and ditch the manual ToA spec
 using ReceiveMessagePayload = int;  // number of messages to recv
+using ReceiveIotaPayload = int;  // number of messages to expect, 0 if unknown
 
 // I could use std::variant but I really don't feel like
 // dealing with that today
@@ -26,6 +32,8 @@ struct UserCommand {
   union {
     TransmitMessagePayload as_transmit_message;
     ReceiveMessagePayload as_receive_message;
+    TransmitIotaPayload as_transmit_iota;
+    ReceiveIotaPayload as_receive_iota;
   };
   UserCommandTag tag;
 };
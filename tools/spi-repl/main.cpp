@@ -1,4 +1,6 @@
 #include <array>
+#include <chrono>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -15,19 +17,9 @@
 #include <linux/spi/spidev.h>
 
 #include "sx1276/sx1276.hpp"
+#include "watch.hpp"
 
 constexpr size_t kFifoMaxCapacity = 66;
-constexpr size_t kMaxSpiAddress = 0x70;
-
-const std::unordered_set<uint8_t> kSpiAddressGaps {
-  0x43, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4c,
-  0x4e, 0x4f, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55,
-  0x56, 0x57, 0x58, 0x59, 0x5a, 0x5c, 0x5e, 0x5f,
-  0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c,
-  0x6d, 0x6e, 0x6f
-};
-
-
 void read_from_spi_cmd(int fd, uint8_t addr) {
   printf("Reading from register 0x%02x: ", addr);
   auto [status, response] = spi_read_byte(fd, addr);
@@ -50,19 +42,13 @@ void write_to_spi_cmd(int fd, uint8_t addr, uint8_t val) {
 
 void burst_read_from_spi_cmd(int fd, uint8_t addr, int len) {
   printf("Burst-reading %d bytes starting from 0x%02x: ", len, addr);
-  auto [status, response] = spi_read_burst(fd, addr, len);
+  std::vector<uint8_t> response(len);
+  int status = spi_read_burst(fd, addr, response.data(), len);
   if (status < 0) {
     perror("SPI_IOC_MESSAGE failed: ");
   } else {
     printf("success (%d): ", status);
-    bool skip_first = true;
-    for (auto& b : response) {
-      if (skip_first) {
-        skip_first = false;
-        continue;
-      }
-      printf("0x%02x ", b);
-    }
+    for (auto& b : response) printf("0x%02x ", b);
     printf("\n");
   }
 }
@@ -100,6 +86,194 @@ void diff_cmd(int fd) {
   printf("Diff complete: %d deltas\n", delta_count);
 }
 
+void speed_cmd(int fd, unsigned speed_hz) {
+  if (speed_hz > 0) {
+    if (speed_hz > kSpiMaxSpeed)
+      printf("warning: %u Hz is above the SX1276's %u Hz limit\n", speed_hz,
+             kSpiMaxSpeed);
+    if (spi_set_speed(fd, speed_hz) < 0) {
+      perror("SPI_IOC_WR_MAX_SPEED_HZ failed: ");
+      return;
+    }
+  }
+  printf("SPI clock is %u Hz\n", spi_get_speed(fd));
+}
+
+void calibrate_cmd(int fd) {
+  printf("Calibrating SPI clock (FIFO contents will be clobbered)...\n");
+  auto calibration = sx1276::calibrate_spi_speed(fd);
+  printf("%10s %8s %10s %12s %12s\n", "speed (Hz)", "errors", "xfers",
+         "single (us)", "burst (us)");
+  for (auto const& r : calibration.results) {
+    printf("%10u %8u %10u %12.1f %12.1f%s\n", r.speed_hz, r.errors,
+           r.transactions, r.single_register_us, r.fifo_burst_us,
+           r.stable() ? "" : "  UNSTABLE");
+  }
+  if (calibration.selected_hz)
+    printf("Selected %u Hz\n", calibration.selected_hz);
+  else
+    printf("error: no speed verified, leaving the clock at %u Hz\n",
+           spi_get_speed(fd));
+}
+
+// Parses "%watch ..." arguments: RATE-HZ [MS] [REG...]
+// Returns false if they don't parse.
+bool parse_watch_args(const char* args, bool want_duration, float& rate_hz,
+                      unsigned& duration_ms, RegisterWatch::RegisterSet& regs) {
+  int consumed = 0;
+  if (sscanf(args, " %f%n", &rate_hz, &consumed) != 1 || rate_hz < 0)
+    return false;
+  args += consumed;
+  if (want_duration) {
+    if (sscanf(args, " %u%n", &duration_ms, &consumed) != 1) return false;
+    args += consumed;
+  }
+
+  RegisterWatch::RegisterSet requested{};
+  unsigned addr = 0;
+  while (sscanf(args, " %x%n", &addr, &consumed) == 1) {
+    if (addr > kMaxSpiAddress) return false;
+    requested.set(addr);
+    args += consumed;
+  }
+  regs = requested.any() ? requested : RegisterWatch::DefaultRegisters();
+  return true;
+}
+
+void watch_cmd(RegisterWatch& watch, const char* args) {
+  float rate_hz = 0;
+  unsigned duration_ms = 0;
+  RegisterWatch::RegisterSet regs{};
+
+  while (*args == ' ') args++;
+  if (strncmp(args, "stop", 4) == 0) {
+    if (!watch.Running()) {
+      printf("error: no watch running\n");
+      return;
+    }
+    watch.Stop();
+    watch.PrintTimeline();
+    return;
+  }
+
+  const bool background = (strncmp(args, "start", 5) == 0);
+  if (!parse_watch_args(background ? args + 5 : args, !background, rate_hz,
+                        duration_ms, regs)) {
+    printf("usage: %%watch RATE-HZ MS [REG...] | %%watch start RATE-HZ [REG...]"
+           " | %%watch stop\n"
+           "    (RATE-HZ of 0 samples as fast as the bus allows)\n");
+    return;
+  }
+  if (!watch.Start(rate_hz, regs)) {
+    printf("error: watch already running, or the initial snapshot failed\n");
+    return;
+  }
+  if (background) {
+    printf("Watching %zu registers in the background\n", regs.count());
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+  watch.Stop();
+  watch.PrintTimeline();
+}
+
+bool execute_command(int fd, RegisterWatch& watch, char* input_buffer,
+                     int script_depth);
+
+void script_cmd(int fd, RegisterWatch& watch, const char* path,
+                int script_depth) {
+  constexpr int kMaxScriptDepth = 8;
+  if (script_depth >= kMaxScriptDepth) {
+    printf("error: scripts nested too deeply\n");
+    return;
+  }
+  FILE* script = fopen(path, "r");
+  if (!script) {
+    perror(path);
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), script)) {
+    line[strcspn(line, "#\n")] = '\0';
+    if (!line[0]) continue;
+    printf("%s> %s\n", path, line);
+    if (!execute_command(fd, watch, line, script_depth + 1)) break;
+  }
+  fclose(script);
+}
+
+// Returns false if this was an error which should abort a running script
+bool execute_command(int fd, RegisterWatch& watch, char* input_buffer,
+                     int script_depth) {
+  constexpr size_t kBuffSize = 256;
+  unsigned addr = 0;
+  unsigned val = 0;
+
+  if (input_buffer[0] == '%') {
+    // execute special command
+    auto match_n = [&](const char* candidate, size_t n) -> bool {
+      assert(n <= kBuffSize);
+      // skip the leading %
+      return (strncmp(input_buffer + 1, candidate, n) == 0);
+    };
+    auto match = [&](const char* candidate) -> bool {
+      return match_n(candidate, kBuffSize);
+    };
+
+    if (match("diff")) {
+      diff_cmd(fd);
+    } else if (match("calibrate")) {
+      calibrate_cmd(fd);
+    } else if (match_n("speed", 5)) {
+      sscanf(input_buffer + 6, "%u", &val);
+      speed_cmd(fd, val);
+    } else if (match_n("watch", 5)) {
+      watch_cmd(watch, input_buffer + 6);
+    } else if (match("timeline")) {
+      watch.PrintTimeline();
+    } else if (match_n("sleep ", 6)) {
+      sscanf(input_buffer + 7, "%u", &val);
+      std::this_thread::sleep_for(std::chrono::milliseconds(val));
+    } else if (match_n("script ", 7)) {
+      script_cmd(fd, watch, input_buffer + 8, script_depth);
+    } else if (match_n("burst ", 6)) {
+      sscanf(input_buffer + 7, "%x %d", &addr, &val);
+      if (addr > kMaxSpiAddress || addr < 0) {
+        printf("Address 0x%02x is greater than the maximum (0x%02zx), please select "
+            "a new register\n", addr, kMaxSpiAddress);
+        return false;
+      }
+      if (val < 1) {
+        printf("Burst length %d must be at least 1\n", val);
+        return false;
+      }
+      burst_read_from_spi_cmd(fd, addr, val);
+    } else {
+      printf("error: unknown command '%s'\n", input_buffer+1);
+      return false;
+    }
+    return true;
+  }
+
+  int match_count = sscanf(input_buffer, "%x=%x", &addr, &val);
+  if (addr > kMaxSpiAddress || addr < 0) {
+    printf("Address 0x%02x is greater than the maximum (0x%02zx), please select "
+        "a new register\n", addr, kMaxSpiAddress);
+    return false;
+  }
+  if (val > 0xffff || val < 0) {
+    printf("Invalid value 0x%x, please try again\n", val);
+    return false;
+  }
+  if (match_count == 2) write_to_spi_cmd(fd, addr, val);
+  else if (match_count == 1) read_from_spi_cmd(fd, addr);
+  else {
+    printf("error while processing input \"%s\"\n", input_buffer);
+    return false;
+  }
+  return true;
+}
+
 int main() {
 
   // Configuration and data transfer code goes here
@@ -109,11 +283,9 @@ int main() {
 
   constexpr size_t kBuffSize = 256;
   char input_buffer[kBuffSize];
-  std::array<uint8_t, kMaxSpiAddress + 1> last_diff_state {0};
+  // Holds a sizeable ring buffer, so keep it off the stack
+  static RegisterWatch watch{fd};
   while (!feof(stdin)) {
-    unsigned addr = 0;
-    unsigned val = 0;
-
     printf("Enter command: ");
 
     memset(&input_buffer, 0, sizeof(input_buffer));
@@ -122,53 +294,10 @@ int main() {
       continue;
     }
     input_buffer[strcspn(input_buffer, "\n")] = '\0';
-
-    if (input_buffer[0] == '%') {
-      // execute special command
-      auto match_n = [&](const char* candidate, size_t n) -> bool {
-        assert(n <= kBuffSize);
-        // skip the leading %
-        return (strncmp(input_buffer + 1, candidate, n) == 0);
-      };
-      auto match = [&](const char* candidate) -> bool {
-        return match_n(candidate, kBuffSize);
-      };
-
-      if (match("diff")) {
-        diff_cmd(fd);
-      } else if (match_n("burst ", 6)) {
-        sscanf(input_buffer + 7, "%x %d", &addr, &val);
-        if (addr > kMaxSpiAddress || addr < 0) {
-          printf("Address 0x%02x is greater than the maximum (0x%02x), please select "
-              "a new register\n", addr, kMaxSpiAddress);
-          continue;
-        }
-        if (val < 1) {
-          printf("Burst length %d must be at least 1\n", val);
-          continue;
-        }
-        burst_read_from_spi_cmd(fd, addr, val);
-      } else {
-        printf("error: unknown command '%s'\n", input_buffer+1);
-      }
-      continue;
-    }
-
-    int match_count = sscanf(input_buffer, "%x=%x", &addr, &val);
-    if (addr > kMaxSpiAddress || addr < 0) {
-      printf("Address 0x%02x is greater than the maximum (0x%02x), please select "
-          "a new register\n", addr, kMaxSpiAddress);
-      continue;
-    }
-    if (val > 0xffff || val < 0) {
-      printf("Invalid value 0x%x, please try again\n", val);
-      continue;
-    }
-    if (match_count == 2) write_to_spi_cmd(fd, addr, val);
-    else if (match_count == 1) read_from_spi_cmd(fd, addr);
-    else printf("error while processing input \"%s\"\n", &input_buffer);
+    execute_command(fd, watch, input_buffer, 0);
   }
 
+  watch.Stop();
   close(fd);
   return 0;
 }
@@ -0,0 +1,179 @@
+#include "watch.hpp"
+
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+
+#include "sx1276/sx1276.hpp"
+
+namespace {
+
+// Reading 0x00 would pop the FIFO, so snapshots start at the op-mode register
+constexpr uint8_t kFirstWatchedAddress = sx1276::RegAddr::kOpMode;
+
+const std::unordered_set<uint8_t> kNoisyRegisters {
+  sx1276::RegAddr::kRssiValue,
+  sx1276::RegAddr::kRssiWideband,
+  sx1276::RegAddr::kFeiMsb,
+  sx1276::RegAddr::kFeiMid,
+  sx1276::RegAddr::kFeiLsb,
+};
+
+const char* register_name(uint8_t addr) {
+  using RegAddr = sx1276::RegAddr;
+  switch (addr) {
+  case RegAddr::kOpMode: return "OpMode";
+  case RegAddr::kFifoAddrPtr: return "FifoAddrPtr";
+  case RegAddr::kFifoRxCurrentAddr: return "FifoRxCurrentAddr";
+  case RegAddr::kIrqFlagsMask: return "IrqFlagsMask";
+  case RegAddr::kIrqFlags: return "IrqFlags";
+  case RegAddr::kRxNumBytes: return "RxNumBytes";
+  case RegAddr::kRxHeaderCountValueLsb: return "RxHeaderCount";
+  case RegAddr::kRxPacketCountValueLsb: return "RxPacketCount";
+  case RegAddr::kModemStat: return "ModemStat";
+  case RegAddr::kPktSnrValue: return "PktSnr";
+  case RegAddr::kPktRssiValue: return "PktRssi";
+  case RegAddr::kHopChannel: return "HopChannel";
+  case RegAddr::kFifoRxByteAddr: return "FifoRxByteAddr";
+  default: return "";
+  }
+}
+
+const char* op_mode_name(uint8_t op_mode) {
+  switch (op_mode & 0x07) {
+  case sx1276::OpMode::kSleep: return "sleep";
+  case sx1276::OpMode::kStandby: return "standby";
+  case sx1276::OpMode::kFrequencySynthesisTransmit: return "fstx";
+  case sx1276::OpMode::kTransmit: return "tx";
+  case sx1276::OpMode::kFrequencySynthesisReceive: return "fsrx";
+  case sx1276::OpMode::kReceiveContinuous: return "rxcont";
+  case sx1276::OpMode::kReceiveSingle: return "rxsingle";
+  case sx1276::OpMode::kChannelActivityDetection: return "cad";
+  }
+  return "?";
+}
+
+double ms_between(RegisterWatch::Clock::time_point a,
+                  RegisterWatch::Clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+} // namespace
+
+RegisterWatch::RegisterSet RegisterWatch::DefaultRegisters() {
+  RegisterSet set{};
+  for (size_t addr = kFirstWatchedAddress; addr <= kMaxSpiAddress; addr++)
+    if (!kSpiAddressGaps.count(addr) && !kNoisyRegisters.count(addr))
+      set.set(addr);
+  return set;
+}
+
+bool RegisterWatch::Start(float rate_hz, RegisterSet registers) {
+  if (Running()) return false;
+
+  registers_ = registers;
+  head_ = size_ = dropped_ = snapshots_ = failed_snapshots_ = 0;
+  if (!Snapshot(initial_)) return false;
+  start_ = end_ = Clock::now();
+
+  stop_ = false;
+  thread_ = std::thread(&RegisterWatch::Run, this, rate_hz);
+  return true;
+}
+
+void RegisterWatch::Stop() {
+  if (!Running()) return;
+  stop_ = true;
+  thread_.join();
+}
+
+bool RegisterWatch::Snapshot(std::array<uint8_t, kMaxSpiAddress + 1>& regs) {
+  constexpr int kBurstLength = kMaxSpiAddress - kFirstWatchedAddress + 1;
+  return spi_read_burst(fd_, kFirstWatchedAddress,
+                        regs.data() + kFirstWatchedAddress, kBurstLength) >= 0;
+}
+
+void RegisterWatch::Record(Delta const& delta) {
+  ring_[head_] = delta;
+  head_ = (head_ + 1) % kCapacity;
+  if (size_ < kCapacity) size_++;
+  else dropped_++;
+}
+
+void RegisterWatch::Run(float rate_hz) {
+  const auto period = (rate_hz > 0)
+      ? std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / rate_hz))
+      : Clock::duration::zero();
+
+  auto previous = initial_;
+  std::array<uint8_t, kMaxSpiAddress + 1> current{};
+  auto next = Clock::now();
+  while (!stop_) {
+    // Stamp from the middle of the transfer, which is as close as we can get
+    // to when the registers were actually sampled
+    auto before = Clock::now();
+    bool ok = Snapshot(current);
+    auto when = before + (Clock::now() - before) / 2;
+
+    snapshots_++;
+    if (!ok) {
+      failed_snapshots_++;
+    } else {
+      for (size_t addr = 0; addr <= kMaxSpiAddress; addr++) {
+        if (!registers_.test(addr) || current[addr] == previous[addr]) continue;
+        Record({when, static_cast<uint8_t>(addr), previous[addr], current[addr]});
+      }
+      previous = current;
+    }
+
+    if (period > Clock::duration::zero()) {
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  }
+  end_ = Clock::now();
+}
+
+void RegisterWatch::PrintTimeline() const {
+  if (Running()) {
+    printf("error: stop the watch before printing its timeline\n");
+    return;
+  }
+  double duration_ms = ms_between(start_, end_);
+  printf("%zu snapshots in %.1f ms (%.0f/s, %zu failed), %zu deltas",
+         snapshots_, duration_ms,
+         duration_ms > 0 ? snapshots_ * 1000 / duration_ms : 0.0,
+         failed_snapshots_, size_);
+  if (dropped_) printf(" (%zu oldest dropped)", dropped_);
+  printf("\n");
+
+  // Dwell time in each op-mode, from each OpMode delta to the next. Once the
+  // oldest deltas have been dropped the initial snapshot no longer tells us
+  // which mode the retained ones started in, so that comes from the first
+  // retained OpMode delta instead, counted from the first retained delta.
+  std::vector<std::pair<uint8_t, Clock::time_point>> modes{};
+  if (!dropped_) modes.emplace_back(initial_[sx1276::RegAddr::kOpMode], start_);
+
+  const size_t first = (head_ + kCapacity - size_) % kCapacity;
+  for (size_t i = 0; i < size_; i++) {
+    auto const& d = ring_[(first + i) % kCapacity];
+    printf("  %10.3f ms  0x%02x %-18s 0x%02x -> 0x%02x", ms_between(start_, d.when),
+           d.addr, register_name(d.addr), d.before, d.after);
+    if (d.addr == sx1276::RegAddr::kOpMode) {
+      printf("  (%s -> %s)", op_mode_name(d.before), op_mode_name(d.after));
+      if (modes.empty()) modes.emplace_back(d.before, ring_[first].when);
+      modes.emplace_back(d.after, d.when);
+    }
+    printf("\n");
+  }
+
+  if (modes.size() < 2) return;
+  printf("op-mode dwell times:\n");
+  for (size_t i = 0; i < modes.size(); i++) {
+    auto until = (i + 1 < modes.size()) ? modes[i + 1].second : end_;
+    printf("  %-9s %10.3f ms%s\n", op_mode_name(modes[i].first),
+           ms_between(modes[i].second, until),
+           (i + 1 < modes.size()) ? "" : " (still there at stop)");
+  }
+}
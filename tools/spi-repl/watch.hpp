@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <unordered_set>
+
+constexpr size_t kMaxSpiAddress = 0x70;
+
+inline const std::unordered_set<uint8_t> kSpiAddressGaps {
+  0x43, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4c,
+  0x4e, 0x4f, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55,
+  0x56, 0x57, 0x58, 0x59, 0x5a, 0x5c, 0x5e, 0x5f,
+  0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c,
+  0x6d, 0x6e, 0x6f
+};
+
+/// Samples the whole register map with one burst transfer per snapshot and
+/// records every change into a fixed-size ring buffer, so that transitions
+/// lasting well under a millisecond (e.g. op-mode changes around a TX) can be
+/// seen and timed.
+class RegisterWatch {
+public:
+  using Clock = std::chrono::steady_clock;
+  using RegisterSet = std::bitset<kMaxSpiAddress + 1>;
+
+  struct Delta {
+    Clock::time_point when;
+    uint8_t addr;
+    uint8_t before;
+    uint8_t after;
+  };
+
+  static constexpr size_t kCapacity = 8192;
+
+  /// Everything except the address gaps and registers that change on their
+  /// own nearly every sample (RSSI, frequency error)
+  static RegisterSet DefaultRegisters();
+
+  RegisterWatch(int fd) : fd_(fd) {}
+  ~RegisterWatch() { Stop(); }
+
+  /// Begins sampling on a background thread. `rate_hz` of 0 samples
+  /// back-to-back.
+  bool Start(float rate_hz, RegisterSet registers);
+  void Stop();
+  bool Running() const { return thread_.joinable(); }
+
+  /// Prints every recorded delta relative to the first snapshot, followed by
+  /// how long the radio dwelt in each op-mode.
+  void PrintTimeline() const;
+
+private:
+  void Run(float rate_hz);
+  bool Snapshot(std::array<uint8_t, kMaxSpiAddress + 1> &regs);
+  void Record(Delta const &delta);
+
+  int fd_;
+  RegisterSet registers_{};
+  std::thread thread_{};
+  std::atomic<bool> stop_{false};
+
+  // Only touched by the sampling thread until it's joined
+  std::array<Delta, kCapacity> ring_{};
+  size_t head_{0};
+  size_t size_{0};
+  size_t dropped_{0};
+  size_t snapshots_{0};
+  size_t failed_snapshots_{0};
+  Clock::time_point start_{};
+  Clock::time_point end_{};
+  std::array<uint8_t, kMaxSpiAddress + 1> initial_{};
+};